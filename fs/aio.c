@@ -0,0 +1,390 @@
+#include <fs/aio.h>
+
+#include <kernel/assert.h>
+#include <kernel/util.h>
+#include <lib/stdio.h>
+#include <lib/string.h>
+#include <mm/heap.h>
+#include <mm/page-cache.h>
+#include <mm/paging.h>
+
+#define ring_index(i) ((i) & (AIO_RING_SIZE - 1))
+
+/* Stop the compiler from moving ring accesses across an index update. x86
+ * does not reorder stores with other stores, so this is all we need for the
+ * other side to see a slot's contents before it sees the new index. */
+#define barrier() __asm volatile("" : : : "memory")
+
+struct aio_ring *aio_create()
+{
+	struct aio_ring *ring = kcreate(struct aio_ring, 1);
+
+	memset((uint8_t *)ring, 0, sizeof(*ring));
+
+	return ring;
+}
+
+void aio_destroy(struct aio_ring *ring)
+{
+	assert(!ring->in_flight);
+	kfree(ring);
+}
+
+struct aio_request *aio_get_request(struct aio_ring *ring)
+{
+	struct aio_request *request;
+
+	if (ring->sq_pending - ring->sq_head >= AIO_RING_SIZE) {
+		return 0;
+	}
+
+	request = &ring->sq[ring_index(ring->sq_pending++)];
+	memset((uint8_t *)request, 0, sizeof(*request));
+
+	return request;
+}
+
+/* Whether 'request' is a read or write of whole sectors of a block device,
+ * which can go straight to the driver. */
+static int _aio_direct(struct aio_request *request)
+{
+	struct fs_node *node = request->node;
+
+	if ((request->opcode != AIO_READ && request->opcode != AIO_WRITE) ||
+	    !node || !(node->flags & FS_BLOCKDEVICE)) {
+		return 0;
+	}
+
+	return (request->size &&
+		!(request->offset % BLOCK_SECTOR_SIZE) &&
+		!(request->size % BLOCK_SECTOR_SIZE) &&
+		request->size / BLOCK_SECTOR_SIZE <=
+		((struct block_device *)node)->max_sectors &&
+		request->offset <= node->size &&
+		request->size <= node->size - request->offset &&
+		!((uint32_t)request->buffer & 0x3));
+}
+
+/* Post a completion. Completions come from both the worker and interrupt
+ * handlers, so the tail is updated with interrupts disabled. */
+static void _aio_post(struct aio_ring *ring, uint32_t user_data,
+		      sint32_t result)
+{
+	struct aio_completion *completion;
+	uint32_t flags;
+
+	irq_save(flags);
+
+	completion = &ring->cq[ring_index(ring->cq_tail)];
+	completion->user_data = user_data;
+	completion->result = result;
+
+	barrier();
+	ring->cq_tail++;
+
+	irq_restore(flags);
+}
+
+static void _aio_complete(struct aio_ring *ring, struct aio_request *request,
+			  sint32_t result)
+{
+	_aio_post(ring, request->user_data, result);
+}
+
+static uint32_t _aio_start(struct aio_ring *ring);
+
+/* Called by block_complete(), usually from the driver's interrupt. */
+static void _aio_block_done(struct block_request *request)
+{
+	struct aio_block *block = (struct aio_block *)request;
+	struct aio_ring *ring = block->ring;
+
+	_aio_post(ring, block->user_data,
+		  request->status == BLOCK_DONE ? (sint32_t)block->size : -1);
+	ring->in_flight--;
+
+	wake_up(&ring->wait);
+
+	/* The completion made room for another request in flight. */
+	_aio_start(ring);
+}
+
+/* Start the direct requests at the head of the submission queue, stopping at
+ * the first other request so that requests are started in order. Called from
+ * the worker and from interrupt handlers. Returns the number started. */
+static uint32_t _aio_start(struct aio_ring *ring)
+{
+	uint32_t flags, started = 0;
+
+	irq_save(flags);
+
+	while (ring->sq_head != ring->sq_tail &&
+	       ring->cq_tail - ring->cq_head + ring->in_flight <
+	       AIO_RING_SIZE) {
+		struct aio_request *request;
+		struct aio_block *block;
+
+		barrier();
+		request = &ring->sq[ring_index(ring->sq_head)];
+		if (!_aio_direct(request)) {
+			break;
+		}
+
+		block = &ring->blocks[ring_index(ring->sq_head)];
+		block->ring = ring;
+		block->user_data = request->user_data;
+		block->size = request->size;
+		block->request.sector = request->offset / BLOCK_SECTOR_SIZE;
+		block->request.count = request->size / BLOCK_SECTOR_SIZE;
+		block->request.buffer = request->buffer;
+		block->request.write = (request->opcode == AIO_WRITE);
+		block->request.done = &_aio_block_done;
+
+		ring->in_flight++;
+		ring->sq_head++;
+		started++;
+
+		/* This may complete the request, and start the next, before
+		 * returning, so the ring must be up to date first. */
+		block_submit((struct block_device *)request->node,
+			     &block->request);
+	}
+
+	irq_restore(flags);
+
+	if (started) {
+		aio_debug("%d direct requests\n", started);
+	}
+
+	return started;
+}
+
+uint32_t aio_submit(struct aio_ring *ring)
+{
+	struct fs_node *synced = 0;
+	uint32_t count = ring->sq_pending - ring->sq_tail;
+	uint32_t i;
+
+	/* Direct requests may be started from an interrupt handler, where the
+	 * page cache cannot be used, so make it consistent with the disk now. */
+	for (i = ring->sq_tail; i != ring->sq_pending; i++) {
+		struct aio_request *request = &ring->sq[ring_index(i)];
+
+		if (!_aio_direct(request) ||
+		    !(request->node->flags & FS_PAGECACHE)) {
+			continue;
+		}
+
+		if (request->node != synced) {
+			page_cache_sync(request->node);
+			synced = request->node;
+		}
+
+		if (request->opcode == AIO_WRITE) {
+			page_cache_invalidate(request->node, request->offset &
+					      ~(PAGE_SIZE - 1));
+		}
+	}
+
+	barrier();
+	ring->sq_tail = ring->sq_pending;
+
+	aio_debug("%d requests\n", count);
+
+	_aio_start(ring);
+
+	return count;
+}
+
+/* Return whether 'next' continues the transfer made by 'request'. */
+static int _aio_mergeable(struct aio_request *request,
+			  struct aio_request *next)
+{
+	return (next->opcode == request->opcode &&
+		next->node == request->node &&
+		next->offset == request->offset + request->size);
+}
+
+/* Perform the read or write at the head of the submission queue, merged with
+ * as many of the following requests as continue it, up to 'limit'. Returns
+ * the number of requests completed. */
+static uint32_t _aio_transfer(struct aio_ring *ring, uint32_t limit)
+{
+	struct iovec iov[AIO_BATCH_MAX];
+	struct aio_request *first, *request;
+	uint32_t count, total, i;
+
+	first = &ring->sq[ring_index(ring->sq_head)];
+	request = first;
+
+	iov[0].iov_base = first->buffer;
+	iov[0].iov_len = first->size;
+
+	for (count = 1; count < limit && count < AIO_BATCH_MAX; count++) {
+		struct aio_request *next;
+
+		next = &ring->sq[ring_index(ring->sq_head + count)];
+		if (!_aio_mergeable(request, next)) {
+			break;
+		}
+
+		iov[count].iov_base = next->buffer;
+		iov[count].iov_len = next->size;
+		request = next;
+	}
+
+	if (first->opcode == AIO_READ) {
+		total = fs_readv(first->node, first->offset, iov, count);
+	} else {
+		total = fs_writev(first->node, first->offset, iov, count);
+	}
+
+	aio_debug("%d requests, %d bytes\n", count, total);
+
+	/* Share the bytes transferred out between the requests in order, so
+	 * that a short transfer is seen by the requests at the end. */
+	for (i = 0; i < count; i++) {
+		uint32_t length = min(iov[i].iov_len, total);
+
+		_aio_complete(ring, &ring->sq[ring_index(ring->sq_head + i)],
+			      length);
+		total -= length;
+	}
+
+	return count;
+}
+
+/* Interrupt handlers only move the submission queue head past direct
+ * requests, so once the worker has found another request at the head, the head
+ * stays put until the worker moves it. */
+uint32_t aio_run(struct aio_ring *ring)
+{
+	uint32_t done = 0;
+
+	while (ring->sq_head != ring->sq_tail) {
+		struct aio_request *request;
+		uint32_t room, count = 1;
+
+		room = AIO_RING_SIZE - (ring->cq_tail - ring->cq_head) -
+			ring->in_flight;
+		if (!room) {
+			break;
+		}
+
+		barrier();
+		request = &ring->sq[ring_index(ring->sq_head)];
+
+		if (_aio_direct(request)) {
+			if (!_aio_start(ring)) {
+				break;
+			}
+			continue;
+		}
+
+		if (!request->node && request->opcode != AIO_NOP) {
+			_aio_complete(ring, request, -1);
+		} else {
+			switch (request->opcode) {
+			case AIO_NOP:
+				_aio_complete(ring, request, 0);
+				break;
+			case AIO_READ:
+			case AIO_WRITE:
+				count = _aio_transfer(ring,
+						      min(room, ring->sq_tail -
+							  ring->sq_head));
+
+				/* Direct requests behind this one must not
+				 * miss the data it left in the cache. */
+				if (request->opcode == AIO_WRITE &&
+				    (request->node->flags & FS_BLOCKDEVICE)) {
+					page_cache_sync(request->node);
+				}
+				break;
+			case AIO_READV:
+				_aio_complete(ring, request,
+					      fs_readv(request->node,
+						       request->offset,
+						       request->iov,
+						       request->iov_count));
+				break;
+			case AIO_WRITEV:
+				_aio_complete(ring, request,
+					      fs_writev(request->node,
+							request->offset,
+							request->iov,
+							request->iov_count));
+				break;
+			case AIO_SYNC:
+				if (request->node->flags & FS_PAGECACHE) {
+					page_cache_sync(request->node);
+				}
+				_aio_complete(ring, request, 0);
+				break;
+			default:
+				_aio_complete(ring, request, -1);
+				break;
+			}
+		}
+
+		ring->sq_head += count;
+		done += count;
+	}
+
+	/* Notify once per batch, rather than once per request. */
+	if (done) {
+		wake_up(&ring->wait);
+	}
+
+	return done;
+}
+
+uint32_t aio_wait(struct aio_ring *ring, uint32_t count)
+{
+	uint32_t available, flags;
+	int sleeping;
+
+	while ((available = ring->cq_tail - ring->cq_head) < count) {
+		/* There is no kernel thread to run the worker on yet, so the
+		 * waiting task runs it on its own stack. */
+		if (aio_run(ring)) {
+			continue;
+		}
+
+		/* Only direct requests in flight can complete now. Test with
+		 * interrupts disabled, so that a completion cannot happen
+		 * between the test and going to sleep. */
+		irq_save(flags);
+		available = ring->cq_tail - ring->cq_head;
+		sleeping = (available < count &&
+			    available + ring->in_flight >= count);
+		if (sleeping) {
+			sleep_on(&ring->wait);
+		}
+		irq_restore(flags);
+
+		/* Don't sleep on completions which can never arrive. */
+		if (!sleeping) {
+			available = ring->cq_tail - ring->cq_head;
+			break;
+		}
+	}
+
+	return available;
+}
+
+struct aio_completion *aio_get_completion(struct aio_ring *ring)
+{
+	if (ring->cq_head == ring->cq_tail) {
+		return 0;
+	}
+
+	barrier();
+	return &ring->cq[ring_index(ring->cq_head)];
+}
+
+void aio_completion_seen(struct aio_ring *ring)
+{
+	barrier();
+	ring->cq_head++;
+}
@@ -0,0 +1,422 @@
+#include <fs/block.h>
+
+#include <fs/devfs.h>
+#include <kernel/assert.h>
+#include <kernel/util.h>
+#include <lib/stdio.h>
+#include <lib/string.h>
+#include <mm/paging.h>
+
+#define block_device(node) ((struct block_device *)(node))
+
+/* Whether 'next' continues the transfer ending with 'request'. */
+#define is_contiguous(request, next)					\
+	((next)->write == (request)->write &&				\
+	 (next)->sector == (request)->sector + (request)->count)
+
+/* Insert 'request' into the queue, which is kept sorted by sector. */
+static void _block_insert(struct block_device *device,
+			  struct block_request *request)
+{
+	struct block_request **link = &device->queue;
+
+	while (*link && (*link)->sector <= request->sector) {
+		link = &(*link)->next;
+	}
+
+	request->next = *link;
+	*link = request;
+}
+
+/* Take the next transfer from the queue and pass it to the driver. Requests
+ * are taken in ascending sector order from the head position, wrapping around
+ * to the lowest sector at the end of the disk, so that the heads sweep across
+ * the disk in one direction. Returns -1 if the driver is busy. */
+static int _block_start(struct block_device *device)
+{
+	struct block_request **link = &device->queue;
+	struct block_transfer *transfer = device->transfers;
+	struct block_request *request;
+	uint32_t i;
+
+	while (transfer->busy) {
+		transfer++;
+	}
+
+	while (*link && (*link)->sector < device->head) {
+		link = &(*link)->next;
+	}
+
+	if (!*link) {
+		link = &device->queue;
+	}
+
+	/* Take the request and any which continue it. Since the queue is
+	 * sorted, these follow it directly. */
+	transfer->sector = (*link)->sector;
+	transfer->count = 0;
+	transfer->write = (*link)->write;
+	transfer->iov_count = 0;
+	do {
+		request = *link;
+		*link = request->next;
+
+		i = transfer->iov_count++;
+		transfer->iov[i].iov_base = request->buffer;
+		transfer->iov[i].iov_len = request->count * BLOCK_SECTOR_SIZE;
+		transfer->requests[i] = request;
+		transfer->count += request->count;
+	} while (*link && transfer->iov_count < BLOCK_MAX_SEGMENTS &&
+		 is_contiguous(request, *link) &&
+		 transfer->count + (*link)->count <= device->max_sectors);
+
+	block_debug("%s: %d requests, sectors %d-%d\n", device->node.name,
+		    transfer->iov_count, transfer->sector,
+		    transfer->sector + transfer->count - 1);
+
+	transfer->busy = 1;
+	device->in_flight++;
+
+	if (device->transfer(device, transfer)) {
+		/* Busy, so return the requests to the queue. */
+		for (i = 0; i < transfer->iov_count; i++) {
+			_block_insert(device, transfer->requests[i]);
+		}
+
+		transfer->busy = 0;
+		device->in_flight--;
+		return -1;
+	}
+
+	/* The transfer may already have completed, but the head has still
+	 * moved past it. */
+	device->head = transfer->sector + transfer->count;
+
+	return 0;
+}
+
+void block_dispatch(struct block_device *device)
+{
+	uint32_t flags;
+
+	irq_save(flags);
+
+	/* A driver which finishes synchronously calls block_complete() from
+	 * inside the transfer, which would dispatch again. Loop instead of
+	 * recursing. */
+	if (!device->dispatching) {
+		device->dispatching = 1;
+
+		while (device->in_flight < device->depth && !device->plugged &&
+		       device->queue) {
+			if (_block_start(device)) {
+				break;
+			}
+		}
+
+		device->dispatching = 0;
+	}
+
+	irq_restore(flags);
+}
+
+void block_complete(struct block_device *device,
+		    struct block_transfer *transfer, int status)
+{
+	uint32_t flags;
+	uint32_t i;
+
+	irq_save(flags);
+
+	for (i = 0; i < transfer->iov_count; i++) {
+		struct block_request *request = transfer->requests[i];
+
+		request->status = status ? BLOCK_ERROR : BLOCK_DONE;
+		wake_up(&request->wait);
+
+		if (request->done) {
+			request->done(request);
+		}
+	}
+
+	transfer->busy = 0;
+	device->in_flight--;
+	block_dispatch(device);
+
+	irq_restore(flags);
+}
+
+void block_submit(struct block_device *device, struct block_request *request)
+{
+	uint32_t flags;
+
+	assert(request->count);
+	assert(request->sector + request->count <= device->sector_count);
+
+	request->status = BLOCK_PENDING;
+	request->wait.head = 0;
+
+	irq_save(flags);
+	_block_insert(device, request);
+	irq_restore(flags);
+
+	block_dispatch(device);
+}
+
+int block_wait(struct block_request *request)
+{
+	uint32_t flags;
+
+	/* Test the status with interrupts disabled, so the completion cannot
+	 * happen between the test and going to sleep. */
+	irq_save(flags);
+	while (request->status == BLOCK_PENDING) {
+		sleep_on(&request->wait);
+		__asm volatile("cli");
+	}
+	irq_restore(flags);
+
+	return request->status == BLOCK_DONE ? 0 : -1;
+}
+
+void block_plug(struct block_device *device)
+{
+	uint32_t flags;
+
+	irq_save(flags);
+	device->plugged++;
+	irq_restore(flags);
+}
+
+void block_unplug(struct block_device *device)
+{
+	uint32_t flags;
+
+	irq_save(flags);
+	assert(device->plugged);
+	device->plugged--;
+	irq_restore(flags);
+
+	block_dispatch(device);
+}
+
+static int _block_sync(struct block_device *device, uint32_t sector,
+		       uint32_t count, uint8_t *buffer, int write)
+{
+	struct block_request request;
+
+	request.sector = sector;
+	request.count = count;
+	request.buffer = buffer;
+	request.write = write;
+	request.done = 0;
+
+	block_submit(device, &request);
+	return block_wait(&request);
+}
+
+int block_read(struct block_device *device, uint32_t sector, uint32_t count,
+	       uint8_t *buffer)
+{
+	return _block_sync(device, sector, count, buffer, 0);
+}
+
+int block_write(struct block_device *device, uint32_t sector, uint32_t count,
+		uint8_t *buffer)
+{
+	return _block_sync(device, sector, count, buffer, 1);
+}
+
+/* Unplug the device and wait for the 'count' requests submitted while it was
+ * plugged. Returns the index of the first request which failed, or 'count' if
+ * all succeeded. */
+static uint32_t _block_flush(struct block_device *device,
+			     struct block_request *requests, uint32_t count)
+{
+	uint32_t failed = count;
+	uint32_t i;
+
+	block_unplug(device);
+
+	for (i = 0; i < count; i++) {
+		if (block_wait(&requests[i]) && failed == count) {
+			failed = i;
+		}
+	}
+
+	return failed;
+}
+
+/* Transfer a byte range of the disk to or from 'iov'. Whole, aligned sectors
+ * are submitted as requests with the device plugged, so they are sorted and
+ * merged into as few transfers as possible. Partial sectors go through the
+ * bounce buffer, and writes to them read the sector first. Returns the number
+ * of bytes transferred before the first error. */
+static uint32_t _block_rw(struct block_device *device, uint32_t offset,
+			  struct iovec *iov, uint32_t iov_count, int write)
+{
+	struct block_request requests[BLOCK_MAX_SEGMENTS];
+	uint32_t starts[BLOCK_MAX_SEGMENTS];
+	uint32_t count = 0, done = 0, i;
+
+	block_plug(device);
+
+	for (i = 0; i < iov_count && offset + done < device->node.size; i++) {
+		uint8_t *buffer = iov[i].iov_base;
+		uint32_t remaining = min(iov[i].iov_len,
+					 device->node.size - (offset + done));
+
+		while (remaining) {
+			uint32_t position = offset + done;
+			uint32_t sector = position / BLOCK_SECTOR_SIZE;
+			uint32_t within = position % BLOCK_SECTOR_SIZE;
+			uint32_t length, failed;
+
+			if (within || remaining < BLOCK_SECTOR_SIZE ||
+			    ((uint32_t)buffer & 0x3)) {
+				failed = _block_flush(device, requests, count);
+				if (failed < count) {
+					return starts[failed] - offset;
+				}
+				count = 0;
+
+				length = min(BLOCK_SECTOR_SIZE - within,
+					     remaining);
+
+				if (block_read(device, sector, 1,
+					       device->bounce)) {
+					return done;
+				}
+
+				if (write) {
+					memcpy(device->bounce + within, buffer,
+					       length);
+					if (block_write(device, sector, 1,
+							device->bounce)) {
+						return done;
+					}
+				} else {
+					memcpy(buffer, device->bounce + within,
+					       length);
+				}
+
+				block_plug(device);
+			} else {
+				struct block_request *request;
+
+				if (count == BLOCK_MAX_SEGMENTS) {
+					failed = _block_flush(device, requests,
+							      count);
+					if (failed < count) {
+						return starts[failed] - offset;
+					}
+					count = 0;
+					block_plug(device);
+				}
+
+				length = min(remaining / BLOCK_SECTOR_SIZE,
+					     device->max_sectors) *
+					BLOCK_SECTOR_SIZE;
+
+				request = &requests[count];
+				request->sector = sector;
+				request->count = length / BLOCK_SECTOR_SIZE;
+				request->buffer = buffer;
+				request->write = write;
+				request->done = 0;
+				starts[count++] = position;
+
+				block_submit(device, request);
+			}
+
+			buffer += length;
+			remaining -= length;
+			done += length;
+		}
+	}
+
+	i = _block_flush(device, requests, count);
+	if (i < count) {
+		return starts[i] - offset;
+	}
+
+	return done;
+}
+
+static uint32_t _block_readv(struct fs_node *node, uint32_t offset,
+			     struct iovec *iov, uint32_t count)
+{
+	return _block_rw(block_device(node), offset, iov, count, 0);
+}
+
+static uint32_t _block_writev(struct fs_node *node, uint32_t offset,
+			      struct iovec *iov, uint32_t count)
+{
+	return _block_rw(block_device(node), offset, iov, count, 1);
+}
+
+static uint32_t _block_read(struct fs_node *node, uint32_t offset,
+			    uint32_t size, uint8_t *buffer)
+{
+	struct iovec iov;
+
+	iov.iov_base = buffer;
+	iov.iov_len = size;
+
+	return _block_rw(block_device(node), offset, &iov, 1, 0);
+}
+
+static uint32_t _block_write(struct fs_node *node, uint32_t offset,
+			     uint32_t size, uint8_t *buffer)
+{
+	struct iovec iov;
+
+	iov.iov_base = buffer;
+	iov.iov_len = size;
+
+	return _block_rw(block_device(node), offset, &iov, 1, 1);
+}
+
+void block_register(struct block_device *device, const char *name)
+{
+	struct fs_node *node = &device->node;
+	size_t length = strlen(name);
+
+	assert(length < sizeof(node->name));
+	assert(device->max_sectors);
+	assert(device->depth <= BLOCK_MAX_IN_FLIGHT);
+
+	memset((uint8_t *)node, 0, sizeof(*node));
+	memcpy((uint8_t *)node->name, (const uint8_t *)name, length + 1);
+	node->flags = FS_BLOCKDEVICE | FS_PAGECACHE;
+
+	/* Byte offsets are 32 bits, so only the first 4 GB can be reached. */
+	node->size = min(device->sector_count,
+			 0xFFFFFFFF / BLOCK_SECTOR_SIZE) * BLOCK_SECTOR_SIZE;
+
+	node->read = &_block_read;
+	node->write = &_block_write;
+	node->readv = &_block_readv;
+	node->writev = &_block_writev;
+
+	if (!device->depth) {
+		device->depth = 1;
+	}
+
+	memset((uint8_t *)device->transfers, 0, sizeof(device->transfers));
+	device->queue = 0;
+	device->in_flight = 0;
+	device->head = 0;
+	device->plugged = 0;
+	device->dispatching = 0;
+
+	/* A page of its own, so that it is aligned and physically contiguous
+	 * for drivers which use DMA. */
+	device->bounce = (uint8_t *)kpage_alloc(1);
+	assert(device->bounce);
+
+	printf("%s: %d sectors (%d MB)\n", name, device->sector_count,
+	       device->sector_count / 2048);
+
+	devfs_register(node);
+}
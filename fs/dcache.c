@@ -0,0 +1,178 @@
+#include <fs/dcache.h>
+
+#include <lib/string.h>
+
+/* Multiplier used to mix the parent node address into the name hash. */
+#define DCACHE_PARENT_MIX 0x9E3779B1
+
+#define dcache_hash(parent, name)					\
+	(strhash(name) ^ ((uint32_t)(parent) * DCACHE_PARENT_MIX))
+#define dcache_bucket(hash) (buckets[(hash) % DCACHE_BUCKETS])
+
+static struct dentry entries[DCACHE_SIZE];
+static struct dentry *buckets[DCACHE_BUCKETS];
+
+/* The LRU list runs from the most recently used entry (lru_head) to the least
+ * recently used (lru_tail). Every entry is always on the list; unused entries
+ * have a null parent and are kept at the tail so they are reused first. */
+static struct dentry *lru_head;
+static struct dentry *lru_tail;
+
+static void _lru_unlink(struct dentry *entry)
+{
+	if (entry->lru_prev) {
+		entry->lru_prev->lru_next = entry->lru_next;
+	} else {
+		lru_head = entry->lru_next;
+	}
+
+	if (entry->lru_next) {
+		entry->lru_next->lru_prev = entry->lru_prev;
+	} else {
+		lru_tail = entry->lru_prev;
+	}
+}
+
+static void _lru_push_head(struct dentry *entry)
+{
+	entry->lru_prev = 0;
+	entry->lru_next = lru_head;
+
+	if (lru_head) {
+		lru_head->lru_prev = entry;
+	} else {
+		lru_tail = entry;
+	}
+
+	lru_head = entry;
+}
+
+static void _lru_push_tail(struct dentry *entry)
+{
+	entry->lru_next = 0;
+	entry->lru_prev = lru_tail;
+
+	if (lru_tail) {
+		lru_tail->lru_next = entry;
+	} else {
+		lru_head = entry;
+	}
+
+	lru_tail = entry;
+}
+
+/* Remove an entry from its hash bucket and mark it unused. */
+static void _dcache_remove(struct dentry *entry)
+{
+	struct dentry **link = &dcache_bucket(entry->hash);
+
+	while (*link && *link != entry) {
+		link = &(*link)->hash_next;
+	}
+
+	if (*link) {
+		*link = entry->hash_next;
+	}
+
+	entry->parent = 0;
+	entry->node = 0;
+	entry->hash_next = 0;
+}
+
+static struct dentry *_dcache_find(struct fs_node *parent, const char *name,
+				   uint32_t hash)
+{
+	struct dentry *entry;
+
+	for (entry = dcache_bucket(hash); entry; entry = entry->hash_next) {
+		if (entry->hash == hash && entry->parent == parent
+		    && !strcmp(entry->name, name)) {
+			return entry;
+		}
+	}
+
+	return 0;
+}
+
+void init_dcache()
+{
+	int i;
+
+	memset((uint8_t *)buckets, 0x0, sizeof(buckets));
+	memset((uint8_t *)entries, 0x0, sizeof(entries));
+	lru_head = 0;
+	lru_tail = 0;
+
+	for (i = 0; i < DCACHE_SIZE; i++) {
+		_lru_push_tail(&entries[i]);
+	}
+}
+
+struct dentry *dcache_lookup(struct fs_node *parent, const char *name)
+{
+	struct dentry *entry;
+
+	if (strlen(name) >= DCACHE_NAME_LEN) {
+		return 0;
+	}
+
+	entry = _dcache_find(parent, name, dcache_hash(parent, name));
+
+	if (entry && entry != lru_head) {
+		_lru_unlink(entry);
+		_lru_push_head(entry);
+	}
+
+	return entry;
+}
+
+void dcache_insert(struct fs_node *parent, const char *name,
+		   struct fs_node *node)
+{
+	uint32_t hash;
+	size_t length = strlen(name);
+	struct dentry *entry;
+
+	if (length >= DCACHE_NAME_LEN) {
+		return;
+	}
+
+	hash = dcache_hash(parent, name);
+
+	/* Replace an existing entry, otherwise recycle the least recently used
+	 * one. */
+	entry = _dcache_find(parent, name, hash);
+	if (!entry) {
+		entry = lru_tail;
+		if (entry->parent) {
+			_dcache_remove(entry);
+		}
+
+		entry->parent = parent;
+		entry->hash = hash;
+		memcpy((uint8_t *)entry->name, (const uint8_t *)name, length + 1);
+		entry->hash_next = dcache_bucket(hash);
+		dcache_bucket(hash) = entry;
+	}
+
+	entry->node = node;
+
+	_lru_unlink(entry);
+	_lru_push_head(entry);
+}
+
+void dcache_invalidate(struct fs_node *parent, const char *name)
+{
+	struct dentry *entry;
+
+	if (strlen(name) >= DCACHE_NAME_LEN) {
+		return;
+	}
+
+	entry = _dcache_find(parent, name, dcache_hash(parent, name));
+	if (entry) {
+		_dcache_remove(entry);
+		_lru_unlink(entry);
+		_lru_push_tail(entry);
+	}
+}
@@ -0,0 +1,66 @@
+#include <fs/devfs.h>
+
+#include <fs/dcache.h>
+#include <lib/string.h>
+
+static struct fs_node root;
+static struct fs_node *devices[DEVFS_MAX_DEVICES];
+static struct dirent dirents[DEVFS_MAX_DEVICES];
+static uint32_t device_count;
+
+/* Both callbacks ignore the directory, as devfs only has the one. */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+static struct dirent *_devfs_readdir(struct fs_node *node, uint32_t index)
+{
+	return index < device_count ? &dirents[index] : 0;
+}
+
+static struct fs_node *_devfs_finddir(struct fs_node *node, char *name)
+{
+	uint32_t i;
+
+	for (i = 0; i < device_count; i++) {
+		if (!strcmp(devices[i]->name, name)) {
+			return devices[i];
+		}
+	}
+
+	return 0;
+}
+
+#pragma GCC diagnostic pop /* ignored "-Wunused-parameter" */
+
+struct fs_node *init_devfs()
+{
+	memset((uint8_t *)&root, 0, sizeof(root));
+	memcpy((uint8_t *)root.name, (const uint8_t *)"dev", 4);
+	root.flags = FS_DIRECTORY;
+	root.readdir = &_devfs_readdir;
+	root.finddir = &_devfs_finddir;
+
+	return &root;
+}
+
+int devfs_register(struct fs_node *node)
+{
+	size_t length = strlen(node->name);
+
+	if (device_count == DEVFS_MAX_DEVICES
+	    || length >= sizeof(dirents[0].name)
+	    || _devfs_finddir(&root, node->name)) {
+		return -1;
+	}
+
+	memcpy((uint8_t *)dirents[device_count].name,
+	       (const uint8_t *)node->name, length + 1);
+	dirents[device_count].inode = device_count;
+	node->inode = device_count;
+	devices[device_count++] = node;
+
+	/* A lookup may have cached the name as missing. */
+	dcache_invalidate(&root, node->name);
+
+	return 0;
+}
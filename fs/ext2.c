@@ -0,0 +1,1297 @@
+#include <fs/ext2.h>
+
+#include <kernel/assert.h>
+#include <kernel/util.h>
+#include <lib/stdio.h>
+#include <lib/string.h>
+#include <mm/heap.h>
+#include <mm/page-cache.h>
+
+#define ext2_node(node) ((struct ext2_node *)(node))
+#define is_ext2_dir(inode) (((inode)->mode & EXT2_S_IFMT) == EXT2_S_IFDIR)
+
+/* Bits of the per-group bitmaps_dirty flags. */
+#define EXT2_BLOCK_BITMAP 0x1
+#define EXT2_INODE_BITMAP 0x2
+
+static struct dirent *_ext2_readdir(struct fs_node *node, uint32_t index);
+static struct fs_node *_ext2_finddir(struct fs_node *node, char *name);
+static struct fs_node *_ext2_create(struct fs_node *node, char *name,
+				    uint32_t flags);
+static int _ext2_unlink(struct fs_node *node, char *name);
+static void _ext2_close(struct fs_node *node);
+
+/* Transfer to or from the device. Its readv and writev are called directly
+ * rather than through the page cache, since file data is cached against the
+ * file's own node. */
+static uint32_t _ext2_device_rw(struct fs_node *device, uint32_t offset,
+				struct iovec *iov, uint32_t count, int write)
+{
+	if (write) {
+		return device->writev ?
+			device->writev(device, offset, iov, count) :
+			fs_writev(device, offset, iov, count);
+	}
+
+	return device->readv ? device->readv(device, offset, iov, count) :
+		fs_readv(device, offset, iov, count);
+}
+
+/* Transfer 'size' bytes at byte 'offset' of the device. Returns 0 on success,
+ * or -1 on a short transfer. */
+static int _ext2_io(struct ext2_fs *fs, uint32_t offset, void *buffer,
+		    uint32_t size, int write)
+{
+	struct iovec iov;
+
+	iov.iov_base = buffer;
+	iov.iov_len = size;
+
+	return _ext2_device_rw(fs->device, offset, &iov, 1, write) == size
+		? 0 : -1;
+}
+
+static int _ext2_block_io(struct ext2_fs *fs, uint32_t block, void *buffer,
+			  int write)
+{
+	return _ext2_io(fs, block * fs->block_size, buffer, fs->block_size,
+			write);
+}
+
+/* Return the block or inode bitmap of 'group', reading it on first use. */
+static uint8_t *_ext2_bitmap(struct ext2_fs *fs, uint32_t group, int inode)
+{
+	uint8_t **bitmap = inode ? &fs->inode_bitmaps[group]
+		: &fs->block_bitmaps[group];
+
+	if (!*bitmap) {
+		*bitmap = kcreate(uint8_t, fs->block_size);
+		_ext2_block_io(fs, inode ? fs->groups[group].inode_bitmap
+			       : fs->groups[group].block_bitmap, *bitmap, 0);
+	}
+
+	return *bitmap;
+}
+
+/* Write back the bitmaps, group descriptors and superblock changed since the
+ * last call. Only the primary superblock and descriptor table are updated;
+ * the backups hold nothing which changes in normal use. */
+static void _ext2_sync(struct ext2_fs *fs)
+{
+	uint32_t group;
+
+	for (group = 0; group < fs->group_count; group++) {
+		if (fs->bitmaps_dirty[group] & EXT2_BLOCK_BITMAP) {
+			_ext2_block_io(fs, fs->groups[group].block_bitmap,
+				       fs->block_bitmaps[group], 1);
+		}
+
+		if (fs->bitmaps_dirty[group] & EXT2_INODE_BITMAP) {
+			_ext2_block_io(fs, fs->groups[group].inode_bitmap,
+				       fs->inode_bitmaps[group], 1);
+		}
+
+		fs->bitmaps_dirty[group] = 0;
+	}
+
+	if (fs->dirty) {
+		_ext2_io(fs, fs->groups_offset, fs->groups,
+			 fs->group_count * sizeof(struct ext2_group_desc), 1);
+		_ext2_io(fs, EXT2_SUPERBLOCK_OFFSET, &fs->super,
+			 sizeof(fs->super), 1);
+		fs->dirty = 0;
+	}
+}
+
+/* Find a clear bit in the first 'limit' bits of 'bitmap', searching from
+ * 'start' to the end and then from the beginning. Whole bytes of set bits are
+ * skipped. Returns 'limit' if every bit is set. */
+static uint32_t _ext2_find_clear(uint8_t *bitmap, uint32_t start,
+				 uint32_t limit)
+{
+	uint32_t i, bit;
+
+	for (i = 0; i < limit; i++) {
+		bit = (start + i) % limit;
+
+		if (!(bit & 0x7) && bitmap[bit / 8] == 0xFF &&
+		    i + 8 <= limit && bit + 8 <= limit) {
+			i += 7;
+			continue;
+		}
+
+		if (!(bitmap[bit / 8] & (1 << (bit % 8)))) {
+			return bit;
+		}
+	}
+
+	return limit;
+}
+
+/* Allocate a block, preferring 'goal', then the rest of its group, then the
+ * following groups in turn. Returns 0 if the disk is full. */
+static uint32_t _ext2_alloc_block(struct ext2_fs *fs, uint32_t goal)
+{
+	struct ext2_superblock *super = &fs->super;
+	uint32_t first = super->first_data_block;
+	uint32_t group, i, start, limit, bit;
+	uint8_t *bitmap;
+
+	if (!super->free_blocks_count) {
+		return 0;
+	}
+
+	if (goal < first || goal >= super->blocks_count) {
+		goal = first;
+	}
+
+	group = (goal - first) / super->blocks_per_group;
+	start = (goal - first) % super->blocks_per_group;
+
+	for (i = 0; i < fs->group_count; i++) {
+		if (fs->groups[group].free_blocks_count) {
+			limit = min(super->blocks_per_group,
+				    super->blocks_count - first -
+				    group * super->blocks_per_group);
+			bitmap = _ext2_bitmap(fs, group, 0);
+			bit = _ext2_find_clear(bitmap, start, limit);
+
+			if (bit < limit) {
+				bitmap[bit / 8] |= 1 << (bit % 8);
+				fs->bitmaps_dirty[group] |= EXT2_BLOCK_BITMAP;
+				fs->groups[group].free_blocks_count--;
+				super->free_blocks_count--;
+				fs->dirty = 1;
+
+				return first + group * super->blocks_per_group +
+					bit;
+			}
+		}
+
+		group = (group + 1) % fs->group_count;
+		start = 0;
+	}
+
+	return 0;
+}
+
+static void _ext2_free_block(struct ext2_fs *fs, uint32_t block)
+{
+	struct ext2_superblock *super = &fs->super;
+	uint32_t group = (block - super->first_data_block) /
+		super->blocks_per_group;
+	uint32_t bit = (block - super->first_data_block) %
+		super->blocks_per_group;
+	uint8_t *bitmap = _ext2_bitmap(fs, group, 0);
+
+	assert(bitmap[bit / 8] & (1 << (bit % 8)));
+
+	bitmap[bit / 8] &= ~(1 << (bit % 8));
+	fs->bitmaps_dirty[group] |= EXT2_BLOCK_BITMAP;
+	fs->groups[group].free_blocks_count++;
+	super->free_blocks_count++;
+	fs->dirty = 1;
+}
+
+/* Allocate an inode, preferring 'group'. Returns its number, or 0 if there
+ * are no free inodes. */
+static uint32_t _ext2_alloc_inode(struct ext2_fs *fs, uint32_t group,
+				  int directory)
+{
+	struct ext2_superblock *super = &fs->super;
+	uint32_t first_inode = super->revision ? super->first_inode : 11;
+	uint32_t i, bit, reserved;
+	uint8_t *bitmap;
+
+	if (!super->free_inodes_count) {
+		return 0;
+	}
+
+	for (i = 0; i < fs->group_count; i++) {
+		if (fs->groups[group].free_inodes_count) {
+			/* The first inodes are reserved, and are usually
+			 * marked in use, but do not rely on it. Searching from
+			 * the first unreserved bit only wraps round to a
+			 * reserved one if the rest of the group is full. */
+			reserved = 0;
+			if (first_inode - 1 > group * super->inodes_per_group) {
+				reserved = min(first_inode - 1 - group *
+					       super->inodes_per_group,
+					       super->inodes_per_group);
+			}
+
+			bitmap = _ext2_bitmap(fs, group, 1);
+			bit = _ext2_find_clear(bitmap, reserved,
+					       super->inodes_per_group);
+			if (bit < reserved) {
+				bit = super->inodes_per_group;
+			}
+
+			if (bit < super->inodes_per_group) {
+				bitmap[bit / 8] |= 1 << (bit % 8);
+				fs->bitmaps_dirty[group] |= EXT2_INODE_BITMAP;
+				fs->groups[group].free_inodes_count--;
+				if (directory) {
+					fs->groups[group].used_dirs_count++;
+				}
+				super->free_inodes_count--;
+				fs->dirty = 1;
+
+				return group * super->inodes_per_group +
+					bit + 1;
+			}
+		}
+
+		group = (group + 1) % fs->group_count;
+	}
+
+	return 0;
+}
+
+static void _ext2_free_inode(struct ext2_fs *fs, uint32_t number,
+			     int directory)
+{
+	struct ext2_superblock *super = &fs->super;
+	uint32_t group = (number - 1) / super->inodes_per_group;
+	uint32_t bit = (number - 1) % super->inodes_per_group;
+	uint8_t *bitmap = _ext2_bitmap(fs, group, 1);
+
+	bitmap[bit / 8] &= ~(1 << (bit % 8));
+	fs->bitmaps_dirty[group] |= EXT2_INODE_BITMAP;
+	fs->groups[group].free_inodes_count++;
+	if (directory) {
+		fs->groups[group].used_dirs_count--;
+	}
+	super->free_inodes_count++;
+	fs->dirty = 1;
+}
+
+static uint32_t _ext2_inode_offset(struct ext2_fs *fs, uint32_t number)
+{
+	uint32_t group = (number - 1) / fs->super.inodes_per_group;
+	uint32_t index = (number - 1) % fs->super.inodes_per_group;
+
+	return fs->groups[group].inode_table * fs->block_size +
+		index * fs->inode_size;
+}
+
+/* Write the cached inode back. Fields beyond the revision 0 inode are left
+ * as they are on disk. */
+static void _ext2_write_inode(struct ext2_node *node)
+{
+	_ext2_io(node->fs, _ext2_inode_offset(node->fs, node->node.inode),
+		 &node->inode, sizeof(node->inode), 1);
+}
+
+/* Allocate a block of pointers or directory entries, write it out full of
+ * zeros, and count it against 'node'. */
+static uint32_t _ext2_alloc_zeroed(struct ext2_node *node, uint32_t goal)
+{
+	struct ext2_fs *fs = node->fs;
+	uint32_t block = _ext2_alloc_block(fs, goal);
+
+	if (block) {
+		_ext2_block_io(fs, block, fs->zero, 1);
+		node->inode.sectors += fs->block_size / 512;
+	}
+
+	return block;
+}
+
+/* Return the disk block holding block 'index' of the file, or 0 if it is a
+ * hole. If 'create' is set, missing blocks are allocated near 'goal', and
+ * '*created' is set if the data block itself is new. The indirect blocks on
+ * the path are kept in the node, so that a lookup of the next block usually
+ * reads nothing from the disk. */
+static uint32_t _ext2_bmap(struct ext2_node *node, uint32_t index, int create,
+			   uint32_t goal, int *created)
+{
+	struct ext2_fs *fs = node->fs;
+	uint32_t span = 1, depth = 0, level, block, slot;
+
+	*created = 0;
+
+	/* Find which tree of the inode holds the block, and its index within
+	 * that tree. */
+	if (index < EXT2_DIRECT_BLOCKS) {
+		slot = index;
+	} else {
+		index -= EXT2_DIRECT_BLOCKS;
+		span = fs->pointers;
+
+		for (depth = 1; index >= span; depth++) {
+			if (depth == EXT2_INDIRECT_LEVELS) {
+				return 0;
+			}
+			index -= span;
+			span *= fs->pointers;
+		}
+
+		slot = EXT2_DIRECT_BLOCKS + depth - 1;
+	}
+
+	if (!goal) {
+		/* Start of the inode's group. */
+		goal = fs->super.first_data_block +
+			((node->node.inode - 1) / fs->super.inodes_per_group) *
+			fs->super.blocks_per_group;
+	}
+
+	if (!node->inode.block[slot]) {
+		if (!create) {
+			return 0;
+		}
+
+		block = depth ? _ext2_alloc_zeroed(node, goal)
+			: _ext2_alloc_block(fs, goal);
+		if (!block) {
+			return 0;
+		}
+
+		if (!depth) {
+			node->inode.sectors += fs->block_size / 512;
+			*created = 1;
+		}
+
+		node->inode.block[slot] = block;
+	}
+
+	block = node->inode.block[slot];
+
+	for (level = 0; level < depth; level++) {
+		struct ext2_indirect *indirect = &node->indirect[level];
+		uint32_t i;
+
+		span /= fs->pointers;
+		i = index / span;
+		index %= span;
+
+		if (indirect->block != block) {
+			if (!indirect->pointers) {
+				indirect->pointers =
+					kcreate(uint32_t, fs->pointers);
+			}
+
+			indirect->block = 0;
+			if (_ext2_block_io(fs, block, indirect->pointers, 0)) {
+				return 0;
+			}
+			indirect->block = block;
+		}
+
+		if (!indirect->pointers[i]) {
+			if (!create) {
+				return 0;
+			}
+
+			if (level + 1 < depth) {
+				indirect->pointers[i] =
+					_ext2_alloc_zeroed(node, goal);
+			} else if ((indirect->pointers[i] =
+				    _ext2_alloc_block(fs, goal))) {
+				node->inode.sectors += fs->block_size / 512;
+				*created = 1;
+			}
+
+			if (!indirect->pointers[i]) {
+				return 0;
+			}
+
+			_ext2_block_io(fs, block, indirect->pointers, 1);
+		}
+
+		block = indirect->pointers[i];
+	}
+
+	return block;
+}
+
+/* Transfer up to 'size' bytes at 'offset' in the file to or from 'iov'. Pieces
+ * which are contiguous on the disk are gathered into one device call, so a
+ * file laid out in order is moved in large requests. Holes read as zeros, and
+ * are filled when written. Returns the number of bytes transferred. */
+static uint32_t _ext2_transfer(struct ext2_node *node, uint32_t offset,
+			       uint32_t size, struct iovec *iov,
+			       uint32_t count, int write)
+{
+	struct ext2_fs *fs = node->fs;
+	struct iovec pieces[EXT2_MAX_SEGMENTS];
+	uint32_t piece_count = 0, pending = 0, done = 0;
+	uint32_t start = 0, end = 0; /* Device offsets of the gathered run. */
+	uint32_t i = 0, within = 0, previous = 0;
+
+	while (done + pending < size && i < count) {
+		uint32_t position = offset + done + pending;
+		uint32_t in_block = position % fs->block_size;
+		uint32_t block, length, address;
+		int created;
+
+		if (within == iov[i].iov_len) {
+			i++;
+			within = 0;
+			continue;
+		}
+
+		length = min(min(fs->block_size - in_block,
+				 iov[i].iov_len - within),
+			     size - done - pending);
+
+		block = _ext2_bmap(node, position / fs->block_size, write,
+				   previous ? previous + 1 : 0, &created);
+		address = block * fs->block_size + in_block;
+
+		/* Send the run so far if this piece does not continue it. */
+		if (piece_count && (!block || address != end ||
+				    piece_count == EXT2_MAX_SEGMENTS)) {
+			uint32_t moved = _ext2_device_rw(fs->device, start,
+							 pieces, piece_count,
+							 write);
+
+			done += moved;
+			if (moved < pending) {
+				return done;
+			}
+
+			piece_count = 0;
+			pending = 0;
+		}
+
+		if (!block) {
+			if (write) {
+				/* The disk is full. */
+				break;
+			}
+
+			memset(iov[i].iov_base + within, 0x0, length);
+			done += length;
+			within += length;
+			continue;
+		}
+
+		/* A new block which is only partly written must not expose
+		 * whatever it held before. */
+		if (created && length < fs->block_size) {
+			_ext2_block_io(fs, block, fs->zero, 1);
+		}
+
+		if (!piece_count) {
+			start = address;
+		}
+
+		pieces[piece_count].iov_base = iov[i].iov_base + within;
+		pieces[piece_count].iov_len = length;
+		piece_count++;
+
+		pending += length;
+		within += length;
+		end = address + length;
+		previous = block;
+	}
+
+	if (piece_count) {
+		done += _ext2_device_rw(fs->device, start, pieces, piece_count,
+					write);
+	}
+
+	return done;
+}
+
+static uint32_t _ext2_readv(struct fs_node *node, uint32_t offset,
+			    struct iovec *iov, uint32_t count)
+{
+	if (offset >= node->size) {
+		return 0;
+	}
+
+	return _ext2_transfer(ext2_node(node), offset, node->size - offset,
+			      iov, count, 0);
+}
+
+static uint32_t _ext2_read(struct fs_node *node, uint32_t offset,
+			   uint32_t size, uint8_t *buffer)
+{
+	struct iovec iov;
+
+	iov.iov_base = buffer;
+	iov.iov_len = size;
+
+	return _ext2_readv(node, offset, &iov, 1);
+}
+
+static uint32_t _ext2_writev(struct fs_node *node, uint32_t offset,
+			     struct iovec *iov, uint32_t count)
+{
+	struct ext2_node *file = ext2_node(node);
+	uint32_t size = 0, done, i;
+
+	for (i = 0; i < count; i++) {
+		size += iov[i].iov_len;
+	}
+
+	done = _ext2_transfer(file, offset, size, iov, count, 1);
+
+	/* The page cache keeps node->size up to date; the inode only records
+	 * data which has reached the disk. */
+	file->inode.size = max(file->inode.size, offset + done);
+	node->size = max(node->size, file->inode.size);
+
+	_ext2_write_inode(file);
+	_ext2_sync(file->fs);
+
+	return done;
+}
+
+static uint32_t _ext2_write(struct fs_node *node, uint32_t offset,
+			    uint32_t size, uint8_t *buffer)
+{
+	struct iovec iov;
+
+	iov.iov_base = buffer;
+	iov.iov_len = size;
+
+	return _ext2_writev(node, offset, &iov, 1);
+}
+
+/* Free the blocks of the tree rooted at 'block', which is 'depth' levels of
+ * indirect blocks above the data and starts at block 'base' of the file, that
+ * hold file blocks at or after 'keep'. Returns 1 if the whole tree was freed,
+ * so that the pointer to it should be cleared. */
+static int _ext2_truncate_tree(struct ext2_node *node, uint32_t block,
+			       uint32_t depth, uint32_t base, uint32_t keep)
+{
+	struct ext2_fs *fs = node->fs;
+	uint32_t span = 1, i, *pointers;
+	int changed = 0, empty = 1;
+
+	if (!depth) {
+		if (base < keep) {
+			return 0;
+		}
+
+		_ext2_free_block(fs, block);
+		node->inode.sectors -= fs->block_size / 512;
+		return 1;
+	}
+
+	for (i = 1; i < depth; i++) {
+		span *= fs->pointers;
+	}
+
+	pointers = kcreate(uint32_t, fs->pointers);
+	if (_ext2_block_io(fs, block, pointers, 0)) {
+		kfree(pointers);
+		return 0;
+	}
+
+	for (i = 0; i < fs->pointers; i++) {
+		uint32_t child = base + i * span;
+
+		if (!pointers[i]) {
+			continue;
+		}
+
+		if (child + span > keep &&
+		    _ext2_truncate_tree(node, pointers[i], depth - 1, child,
+					keep)) {
+			pointers[i] = 0;
+			changed = 1;
+		} else {
+			empty = 0;
+		}
+	}
+
+	if (empty) {
+		_ext2_free_block(fs, block);
+		node->inode.sectors -= fs->block_size / 512;
+	} else if (changed) {
+		_ext2_block_io(fs, block, pointers, 1);
+	}
+
+	kfree(pointers);
+
+	return empty;
+}
+
+static int _ext2_truncate(struct fs_node *node, uint32_t size)
+{
+	struct ext2_node *file = ext2_node(node);
+	struct ext2_fs *fs = file->fs;
+	uint32_t keep = (size + fs->block_size - 1) / fs->block_size;
+	uint32_t base = 0, span = 1, i;
+	int created;
+
+	for (i = 0; i < EXT2_BLOCK_POINTERS; i++) {
+		uint32_t depth = i < EXT2_DIRECT_BLOCKS ? 0
+			: i - EXT2_DIRECT_BLOCKS + 1;
+
+		if (i >= EXT2_DIRECT_BLOCKS) {
+			span = span * fs->pointers;
+		}
+
+		if (file->inode.block[i] && base + span > keep &&
+		    _ext2_truncate_tree(file, file->inode.block[i], depth,
+					base, keep)) {
+			file->inode.block[i] = 0;
+		}
+
+		base += span;
+	}
+
+	/* Blocks may have been freed under the kept pointer blocks. */
+	for (i = 0; i < EXT2_INDIRECT_LEVELS; i++) {
+		file->indirect[i].block = 0;
+	}
+
+	/* Zero the rest of the last block, so that growing the file again
+	 * exposes zeros rather than old data. */
+	if (size % fs->block_size && size < file->inode.size) {
+		uint32_t block = _ext2_bmap(file, size / fs->block_size, 0, 0,
+					    &created);
+
+		if (block) {
+			_ext2_io(fs, block * fs->block_size +
+				 size % fs->block_size, fs->zero,
+				 fs->block_size - size % fs->block_size, 1);
+		}
+	}
+
+	file->inode.size = size;
+	node->size = size;
+
+	_ext2_write_inode(file);
+	_ext2_sync(fs);
+
+	return 0;
+}
+
+static void _ext2_set_callbacks(struct ext2_node *node)
+{
+	struct fs_node *fs_node = &node->node;
+	int writable = !node->fs->read_only;
+
+	if (is_ext2_dir(&node->inode)) {
+		fs_node->flags = FS_DIRECTORY;
+		fs_node->readdir = &_ext2_readdir;
+		fs_node->finddir = &_ext2_finddir;
+		fs_node->create = writable ? &_ext2_create : 0;
+		fs_node->unlink = writable ? &_ext2_unlink : 0;
+	} else if ((node->inode.mode & EXT2_S_IFMT) == EXT2_S_IFREG) {
+		fs_node->flags = FS_FILE | FS_PAGECACHE;
+		fs_node->read = &_ext2_read;
+		fs_node->readv = &_ext2_readv;
+		fs_node->write = writable ? &_ext2_write : 0;
+		fs_node->writev = writable ? &_ext2_writev : 0;
+		fs_node->truncate = writable ? &_ext2_truncate : 0;
+		fs_node->close = writable ? &_ext2_close : 0;
+	} else {
+		/* Symbolic links and special files are shown, but cannot be
+		 * opened. */
+		fs_node->flags = FS_FILE;
+	}
+}
+
+/* Return the node for inode 'number', reading the inode if it is not already
+ * in use. */
+static struct ext2_node *_ext2_get(struct ext2_fs *fs, uint32_t number)
+{
+	struct ext2_node **bucket = &fs->nodes[number % EXT2_NODE_BUCKETS];
+	struct ext2_node *node;
+
+	for (node = *bucket; node; node = node->next) {
+		if (node->node.inode == number) {
+			return node;
+		}
+	}
+
+	if (!number || number > fs->super.inodes_count) {
+		return 0;
+	}
+
+	node = kcreate(struct ext2_node, 1);
+	memset((uint8_t *)node, 0x0, sizeof(*node));
+
+	if (_ext2_io(fs, _ext2_inode_offset(fs, number), &node->inode,
+		     sizeof(node->inode), 0)) {
+		kfree(node);
+		return 0;
+	}
+
+	node->fs = fs;
+	node->node.inode = number;
+	node->node.size = node->inode.size;
+	node->node.uid = node->inode.uid;
+	node->node.gid = node->inode.gid;
+	node->node.permissions = node->inode.mode & 0xFFF;
+	_ext2_set_callbacks(node);
+
+	node->next = *bucket;
+	*bucket = node;
+
+	return node;
+}
+
+/* Drop a node whose inode has been freed. */
+static void _ext2_put(struct ext2_node *node)
+{
+	struct ext2_node **link =
+		&node->fs->nodes[node->node.inode % EXT2_NODE_BUCKETS];
+	uint32_t i;
+
+	while (*link != node) {
+		link = &(*link)->next;
+	}
+	*link = node->next;
+
+	for (i = 0; i < EXT2_INDIRECT_LEVELS; i++) {
+		if (node->indirect[i].pointers) {
+			kfree(node->indirect[i].pointers);
+		}
+	}
+
+	kfree(node);
+}
+
+/* A position in a directory, as found by _ext2_dir_find(). */
+struct ext2_slot {
+	uint8_t *block;              /* The directory block, read in.       */
+	uint32_t index;              /* Its index in the directory.         */
+	uint32_t offset;             /* Offset of the entry in the block.   */
+	uint32_t previous;           /* Offset of the entry before, or -1.  */
+};
+
+#define dirent_at(block, offset) ((struct ext2_dirent *)((block) + (offset)))
+
+static int _ext2_name_equal(struct ext2_dirent *entry, const char *name,
+			    size_t length)
+{
+	size_t i;
+
+	if (entry->name_length != length) {
+		return 0;
+	}
+
+	for (i = 0; i < length; i++) {
+		if (entry->name[i] != name[i]) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Find the 'index'th used entry of 'directory' if 'name' is 0, or the entry
+ * called 'name' otherwise. "." and ".." are not counted or matched. Returns 0
+ * and fills in 'slot' if found, whose block the caller must free. */
+static int _ext2_dir_find(struct ext2_node *directory, const char *name,
+			  uint32_t index, struct ext2_slot *slot)
+{
+	struct ext2_fs *fs = directory->fs;
+	uint32_t blocks = directory->inode.size / fs->block_size;
+	size_t length = name ? strlen(name) : 0;
+	uint8_t *block = kcreate(uint8_t, fs->block_size);
+	struct iovec iov;
+	uint32_t i;
+
+	iov.iov_base = block;
+	iov.iov_len = fs->block_size;
+
+	for (i = 0; i < blocks; i++) {
+		uint32_t offset = 0, previous = (uint32_t)-1;
+
+		if (_ext2_transfer(directory, i * fs->block_size,
+				   fs->block_size, &iov, 1, 0) !=
+		    fs->block_size) {
+			break;
+		}
+
+		while (offset + 8 <= fs->block_size) {
+			struct ext2_dirent *entry = dirent_at(block, offset);
+
+			if (entry->record_length < 8 ||
+			    offset + entry->record_length > fs->block_size) {
+				ext2_debug("bad entry in directory %d\n",
+					   directory->node.inode);
+				break;
+			}
+
+			if (entry->inode &&
+			    !(entry->name_length == 1 &&
+			      entry->name[0] == '.') &&
+			    !(entry->name_length == 2 &&
+			      entry->name[0] == '.' && entry->name[1] == '.')) {
+				int found = name ?
+					_ext2_name_equal(entry, name, length)
+					: !index--;
+
+				if (found) {
+					slot->block = block;
+					slot->index = i;
+					slot->offset = offset;
+					slot->previous = previous;
+					return 0;
+				}
+			}
+
+			previous = offset;
+			offset += entry->record_length;
+		}
+	}
+
+	kfree(block);
+
+	return -1;
+}
+
+static struct dirent *_ext2_readdir(struct fs_node *node, uint32_t index)
+{
+	struct ext2_node *directory = ext2_node(node);
+	struct ext2_dirent *entry;
+	struct ext2_slot slot;
+
+	if (_ext2_dir_find(directory, 0, index, &slot)) {
+		return 0;
+	}
+
+	entry = dirent_at(slot.block, slot.offset);
+	memcpy((uint8_t *)directory->dirent.name, (uint8_t *)entry->name,
+	       entry->name_length);
+	directory->dirent.name[entry->name_length] = '\0';
+	directory->dirent.inode = entry->inode;
+
+	kfree(slot.block);
+
+	return &directory->dirent;
+}
+
+static struct fs_node *_ext2_finddir(struct fs_node *node, char *name)
+{
+	struct ext2_node *directory = ext2_node(node);
+	struct ext2_node *child;
+	struct ext2_slot slot;
+
+	if (_ext2_dir_find(directory, name, 0, &slot)) {
+		return 0;
+	}
+
+	child = _ext2_get(directory->fs,
+			  dirent_at(slot.block, slot.offset)->inode);
+	if (child) {
+		memcpy((uint8_t *)child->node.name, (const uint8_t *)name,
+		       strlen(name) + 1);
+	}
+
+	kfree(slot.block);
+
+	return child ? &child->node : 0;
+}
+
+/* Write a directory entry at 'entry', whose record length is set by the
+ * caller. */
+static void _ext2_dirent_fill(struct ext2_fs *fs, struct ext2_dirent *entry,
+			      const char *name, uint32_t number, int directory)
+{
+	entry->inode = number;
+	entry->name_length = strlen(name);
+	entry->file_type = 0;
+	if (fs->super.features_incompat & EXT2_INCOMPAT_FILETYPE) {
+		entry->file_type = directory ? EXT2_FT_DIR : EXT2_FT_REG_FILE;
+	}
+	memcpy((uint8_t *)entry->name, (const uint8_t *)name,
+	       entry->name_length);
+}
+
+/* Add an entry for inode 'number' to 'directory', in the first gap large
+ * enough to hold it, or in a new block at the end. Returns 0 on success, or
+ * -1 if the disk is full. */
+static int _ext2_dir_add(struct ext2_node *directory, const char *name,
+			 uint32_t number, int is_directory)
+{
+	struct ext2_fs *fs = directory->fs;
+	uint32_t blocks = directory->inode.size / fs->block_size;
+	uint32_t needed = ext2_dirent_size(strlen(name));
+	uint8_t *block = kcreate(uint8_t, fs->block_size);
+	struct iovec iov;
+	uint32_t i;
+
+	iov.iov_base = block;
+	iov.iov_len = fs->block_size;
+
+	/* Adding entries invalidates any htree index. */
+	directory->inode.flags &= ~EXT2_INDEX_FL;
+
+	for (i = 0; i <= blocks; i++) {
+		struct ext2_dirent *entry = 0;
+		uint32_t offset = 0;
+
+		if (i == blocks) {
+			/* Grow the directory by a block holding only the
+			 * new entry. */
+			entry = dirent_at(block, 0);
+			memset(block, 0x0, fs->block_size);
+			entry->record_length = fs->block_size;
+			directory->inode.size += fs->block_size;
+		} else if (_ext2_transfer(directory, i * fs->block_size,
+					  fs->block_size, &iov, 1, 0) !=
+			   fs->block_size) {
+			continue;
+		}
+
+		while (!entry && offset + 8 <= fs->block_size) {
+			struct ext2_dirent *current = dirent_at(block, offset);
+			uint32_t used = ext2_dirent_size(current->name_length);
+
+			if (current->record_length < 8) {
+				break;
+			}
+
+			if (!current->inode &&
+			    current->record_length >= needed) {
+				entry = current;
+			} else if (current->inode &&
+				   current->record_length >= used + needed) {
+				/* Split the slack off the end of the
+				 * entry. */
+				entry = dirent_at(block, offset + used);
+				entry->record_length =
+					current->record_length - used;
+				current->record_length = used;
+			}
+
+			offset += current->record_length;
+		}
+
+		if (!entry) {
+			continue;
+		}
+
+		_ext2_dirent_fill(fs, entry, name, number, is_directory);
+
+		if (_ext2_transfer(directory, i * fs->block_size,
+				   fs->block_size, &iov, 1, 1) !=
+		    fs->block_size) {
+			if (i == blocks) {
+				directory->inode.size -= fs->block_size;
+			}
+			break;
+		}
+
+		directory->node.size = directory->inode.size;
+		_ext2_write_inode(directory);
+		kfree(block);
+		return 0;
+	}
+
+	kfree(block);
+	return -1;
+}
+
+static struct fs_node *_ext2_create(struct fs_node *node, char *name,
+				    uint32_t flags)
+{
+	struct ext2_node *directory = ext2_node(node);
+	struct ext2_fs *fs = directory->fs;
+	int is_directory = flags == FS_DIRECTORY;
+	size_t length = strlen(name);
+	struct ext2_node *child;
+	struct ext2_slot slot;
+	uint32_t number;
+
+	if (!length || length > 255 || length >= sizeof(node->name) ||
+	    (flags != FS_FILE && flags != FS_DIRECTORY)) {
+		return 0;
+	}
+
+	if (!_ext2_dir_find(directory, name, 0, &slot)) {
+		kfree(slot.block);
+		return 0;
+	}
+
+	/* New inodes go in the group of their directory, so that a directory
+	 * and its files are close together on the disk. */
+	number = _ext2_alloc_inode(fs, (node->inode - 1) /
+				   fs->super.inodes_per_group, is_directory);
+	if (!number) {
+		return 0;
+	}
+
+	child = kcreate(struct ext2_node, 1);
+	memset((uint8_t *)child, 0x0, sizeof(*child));
+	child->fs = fs;
+	child->node.inode = number;
+	child->inode.mode = is_directory ? EXT2_DIRECTORY_MODE
+		: EXT2_FILE_MODE;
+	child->inode.links_count = is_directory ? 2 : 1;
+	child->node.permissions = child->inode.mode & 0xFFF;
+	memcpy((uint8_t *)child->node.name, (const uint8_t *)name, length + 1);
+	_ext2_set_callbacks(child);
+
+	child->next = fs->nodes[number % EXT2_NODE_BUCKETS];
+	fs->nodes[number % EXT2_NODE_BUCKETS] = child;
+
+	if (is_directory) {
+		uint8_t *block = kcreate(uint8_t, fs->block_size);
+		struct ext2_dirent *entry;
+		struct iovec iov;
+
+		memset(block, 0x0, fs->block_size);
+		entry = dirent_at(block, 0);
+		_ext2_dirent_fill(fs, entry, ".", number, 1);
+		entry->record_length = ext2_dirent_size(1);
+		entry = dirent_at(block, ext2_dirent_size(1));
+		_ext2_dirent_fill(fs, entry, "..", node->inode, 1);
+		entry->record_length = fs->block_size - ext2_dirent_size(1);
+
+		iov.iov_base = block;
+		iov.iov_len = fs->block_size;
+		child->inode.size = fs->block_size;
+		child->node.size = fs->block_size;
+
+		if (_ext2_transfer(child, 0, fs->block_size, &iov, 1, 1) !=
+		    fs->block_size) {
+			kfree(block);
+			_ext2_truncate(&child->node, 0);
+			goto fail;
+		}
+		kfree(block);
+
+		/* The new directory's ".." links to the parent. */
+		directory->inode.links_count++;
+	}
+
+	_ext2_write_inode(child);
+
+	if (_ext2_dir_add(directory, name, number, is_directory)) {
+		if (is_directory) {
+			directory->inode.links_count--;
+		}
+		_ext2_truncate(&child->node, 0);
+		goto fail;
+	}
+
+	_ext2_sync(fs);
+
+	return &child->node;
+
+fail:
+	child->inode.links_count = 0;
+	child->inode.delete_time = 1;
+	_ext2_write_inode(child);
+	_ext2_free_inode(fs, number, is_directory);
+	_ext2_put(child);
+	_ext2_sync(fs);
+
+	return 0;
+}
+
+/* Returns 1 if 'directory' holds nothing but "." and "..". */
+static int _ext2_dir_empty(struct ext2_node *directory)
+{
+	struct ext2_slot slot;
+
+	if (_ext2_dir_find(directory, 0, 0, &slot)) {
+		return 1;
+	}
+
+	kfree(slot.block);
+	return 0;
+}
+
+/* Free the blocks and inode of a node whose last link has gone, and the
+ * node itself. */
+static void _ext2_release(struct ext2_node *node)
+{
+	struct ext2_fs *fs = node->fs;
+
+	_ext2_truncate(&node->node, 0);
+	_ext2_free_inode(fs, node->node.inode, is_ext2_dir(&node->inode));
+
+	/* fsck takes a deleted inode to have a nonzero deletion time. There is
+	 * no clock to give it a real one. */
+	node->inode.delete_time = 1;
+	_ext2_write_inode(node);
+	_ext2_put(node);
+}
+
+/* An unlinked file which was open is released when its last open file is
+ * closed. Its cached pages were written back by then, so drop them first. */
+static void _ext2_close(struct fs_node *node)
+{
+	struct ext2_node *file = ext2_node(node);
+	struct ext2_fs *fs = file->fs;
+
+	if (!file->inode.links_count && !node->open_count) {
+		page_cache_invalidate(node, 0);
+		_ext2_release(file);
+		_ext2_sync(fs);
+	}
+}
+
+static int _ext2_unlink(struct fs_node *node, char *name)
+{
+	struct ext2_node *directory = ext2_node(node);
+	struct ext2_fs *fs = directory->fs;
+	struct ext2_dirent *entry;
+	struct ext2_node *child;
+	struct ext2_slot slot;
+	struct iovec iov;
+	int is_directory;
+
+	if (_ext2_dir_find(directory, name, 0, &slot)) {
+		return -1;
+	}
+
+	entry = dirent_at(slot.block, slot.offset);
+	child = _ext2_get(fs, entry->inode);
+	is_directory = child && is_ext2_dir(&child->inode);
+
+	if (!child || (is_directory && !_ext2_dir_empty(child))) {
+		kfree(slot.block);
+		return -1;
+	}
+
+	/* Fold the entry into the one before it, or mark it unused if it is
+	 * the first in its block. */
+	if (slot.previous != (uint32_t)-1) {
+		dirent_at(slot.block, slot.previous)->record_length +=
+			entry->record_length;
+	} else {
+		entry->inode = 0;
+	}
+
+	iov.iov_base = slot.block;
+	iov.iov_len = fs->block_size;
+	_ext2_transfer(directory, slot.index * fs->block_size, fs->block_size,
+		       &iov, 1, 1);
+	kfree(slot.block);
+
+	if (is_directory) {
+		/* Its own "." and the parent's entry, and the parent loses the
+		 * link from "..". */
+		child->inode.links_count = 0;
+		directory->inode.links_count--;
+		_ext2_write_inode(directory);
+	} else {
+		child->inode.links_count--;
+	}
+
+	/* An open file keeps its blocks and inode until its last close. */
+	if (!child->inode.links_count && !child->node.open_count) {
+		_ext2_release(child);
+	} else {
+		_ext2_write_inode(child);
+	}
+
+	_ext2_sync(fs);
+
+	return 0;
+}
+
+/* Free a filesystem which failed to mount, with the nodes it has read. */
+static void _ext2_destroy(struct ext2_fs *fs)
+{
+	uint32_t i;
+
+	for (i = 0; i < EXT2_NODE_BUCKETS; i++) {
+		while (fs->nodes[i]) {
+			_ext2_put(fs->nodes[i]);
+		}
+	}
+
+	for (i = 0; i < fs->group_count; i++) {
+		if (fs->block_bitmaps[i]) {
+			kfree(fs->block_bitmaps[i]);
+		}
+		if (fs->inode_bitmaps[i]) {
+			kfree(fs->inode_bitmaps[i]);
+		}
+	}
+
+	kfree(fs->groups);
+	kfree(fs->block_bitmaps);
+	kfree(fs->inode_bitmaps);
+	kfree(fs->bitmaps_dirty);
+	kfree(fs->zero);
+	kfree(fs);
+}
+
+struct fs_node *init_ext2(struct fs_node *device)
+{
+	struct ext2_superblock super;
+	struct ext2_node *root;
+	struct ext2_fs *fs;
+	uint32_t group_count, size;
+	struct iovec iov;
+
+	iov.iov_base = (uint8_t *)&super;
+	iov.iov_len = sizeof(super);
+	if (device->size < EXT2_SUPERBLOCK_OFFSET + EXT2_SUPERBLOCK_SIZE ||
+	    _ext2_device_rw(device, EXT2_SUPERBLOCK_OFFSET, &iov, 1, 0) !=
+	    sizeof(super) || super.magic != EXT2_MAGIC) {
+		return 0;
+	}
+
+	/* Blocks larger than a page would not fit the page cache. */
+	if (super.log_block_size > 2 || !super.blocks_per_group ||
+	    !super.inodes_per_group ||
+	    (super.revision && super.inode_size < sizeof(struct ext2_inode))) {
+		return 0;
+	}
+
+	if (super.revision &&
+	    (super.features_incompat & ~EXT2_INCOMPAT_SUPPORTED)) {
+		printf("%s: unsupported ext2 features %h\n", device->name,
+		       super.features_incompat);
+		return 0;
+	}
+
+	if ((uint64_t)super.blocks_count << (10 + super.log_block_size) >
+	    device->size) {
+		return 0;
+	}
+
+	group_count = (super.blocks_count - super.first_data_block +
+		       super.blocks_per_group - 1) / super.blocks_per_group;
+
+	fs = kcreate(struct ext2_fs, 1);
+	memset((uint8_t *)fs, 0x0, sizeof(*fs));
+	fs->device = device;
+	fs->super = super;
+	fs->block_size = 1024 << super.log_block_size;
+	fs->pointers = fs->block_size / sizeof(uint32_t);
+	fs->inode_size = super.revision ? super.inode_size
+		: sizeof(struct ext2_inode);
+	fs->group_count = group_count;
+	fs->groups_offset = (super.first_data_block + 1) * fs->block_size;
+	fs->read_only = super.revision &&
+		(super.features_ro_compat & ~EXT2_RO_COMPAT_SUPPORTED);
+
+	size = group_count * sizeof(struct ext2_group_desc);
+	fs->groups = (struct ext2_group_desc *)kcreate(uint8_t, size);
+	fs->block_bitmaps = kcreate(uint8_t *, group_count);
+	fs->inode_bitmaps = kcreate(uint8_t *, group_count);
+	fs->bitmaps_dirty = kcreate(uint8_t, group_count);
+	memset((uint8_t *)fs->block_bitmaps, 0x0,
+	       group_count * sizeof(uint8_t *));
+	memset((uint8_t *)fs->inode_bitmaps, 0x0,
+	       group_count * sizeof(uint8_t *));
+	memset(fs->bitmaps_dirty, 0x0, group_count);
+
+	fs->zero = kcreate(uint8_t, fs->block_size);
+	memset(fs->zero, 0x0, fs->block_size);
+
+	if (_ext2_io(fs, fs->groups_offset, fs->groups, size, 0) ||
+	    !(root = _ext2_get(fs, EXT2_ROOT_INODE)) ||
+	    !is_ext2_dir(&root->inode)) {
+		printf("%s: cannot read ext2 root directory\n", device->name);
+		_ext2_destroy(fs);
+		return 0;
+	}
+
+	memcpy((uint8_t *)root->node.name, (const uint8_t *)"ext2", 5);
+
+	printf("%s: ext2, %d blocks of %d bytes in %d groups%s\n",
+	       device->name, super.blocks_count, fs->block_size, group_count,
+	       fs->read_only ? ", read-only" : "");
+
+	return &root->node;
+}
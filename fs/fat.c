@@ -0,0 +1,593 @@
+#include <fs/fat.h>
+
+#include <kernel/assert.h>
+#include <lib/stdio.h>
+#include <lib/string.h>
+#include <mm/heap.h>
+
+#define fat_inode(node) ((struct fat_inode *)(node))
+
+/* The size of the boot sector holding the BIOS parameter block. */
+#define FAT_BOOT_SIZE 512
+
+/* A volume with fewer clusters than this is FAT12, and otherwise FAT16 if it
+ * has fewer than FAT16_MAX_CLUSTERS. Anything larger is FAT32. */
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
+#define is_power_of_two(x) ((x) && !((x) & ((x) - 1)))
+#define to_lower(c) (((c) >= 'A' && (c) <= 'Z') ? (c) + ('a' - 'A') : (c))
+
+static struct dirent *_fat_readdir(struct fs_node *node, uint32_t index);
+static struct fs_node *_fat_finddir(struct fs_node *node, char *name);
+static uint32_t _fat_read(struct fs_node *node, uint32_t offset,
+			  uint32_t size, uint8_t *buffer);
+static uint32_t _fat_readv(struct fs_node *node, uint32_t offset,
+			   struct iovec *iov, uint32_t count);
+
+/* Read from the device. Its readv is called directly rather than through the
+ * page cache, since file data is cached against the file's own node, and the
+ * FAT and directories are only read once. */
+static uint32_t _fat_device_readv(struct fs_node *device, uint32_t offset,
+				  struct iovec *iov, uint32_t count)
+{
+	if (device->readv) {
+		return device->readv(device, offset, iov, count);
+	}
+
+	return fs_readv(device, offset, iov, count);
+}
+
+/* Return the cluster after 'cluster' in its chain, or 0 at the end of the
+ * chain. End of chain markers and bad clusters are all above the last cluster
+ * of the volume, so any out of range entry ends the chain. */
+static uint32_t _fat_next(struct fat_fs *fs, uint32_t cluster)
+{
+	uint32_t next;
+
+	if (fs->type == 12) {
+		/* Entries are 12 bits, so two share three bytes. */
+		uint8_t *entry = fs->fat + cluster + cluster / 2;
+
+		next = entry[0] | ((uint32_t)entry[1] << 8);
+		next = (cluster & 0x1) ? next >> 4 : next & 0xFFF;
+	} else {
+		next = fs->fat[cluster * 2] |
+			((uint32_t)fs->fat[cluster * 2 + 1] << 8);
+	}
+
+	if (next < 2 || next >= fs->cluster_count + 2) {
+		return 0;
+	}
+
+	return next;
+}
+
+/* Turn the cluster chain of 'inode' into extents, if it has not been already.
+ * The chain is walked twice, first to count the extents so that the array is
+ * allocated once. Returns -1 if the chain has a loop. */
+static int _fat_map(struct fat_inode *inode)
+{
+	struct fat_fs *fs = inode->fs;
+	struct fat_extent *extent;
+	uint32_t cluster, next, index, count = 1;
+
+	if (inode->extents || !inode->cluster) {
+		return 0;
+	}
+
+	for (cluster = inode->cluster, index = 1;
+	     (next = _fat_next(fs, cluster)); cluster = next, index++) {
+		if (index > fs->cluster_count) {
+			fat_debug("cluster chain at %d loops\n",
+				  inode->cluster);
+			return -1;
+		}
+
+		if (next != cluster + 1) {
+			count++;
+		}
+	}
+
+	extent = inode->extents = kcreate(struct fat_extent, count);
+	inode->extent_count = count;
+
+	extent->index = 0;
+	extent->cluster = inode->cluster;
+	extent->count = 1;
+
+	for (cluster = inode->cluster, index = 1;
+	     (next = _fat_next(fs, cluster)); cluster = next, index++) {
+		if (next == cluster + 1) {
+			extent->count++;
+		} else {
+			extent++;
+			extent->index = index;
+			extent->cluster = next;
+			extent->count = 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Return the byte offset on the device of byte 'position' of 'inode', and set
+ * 'length' to the number of bytes which follow it contiguously on the device.
+ * Returns 0 past the end of the cluster chain. */
+static uint32_t _fat_locate(struct fat_inode *inode, uint32_t position,
+			    uint32_t *length)
+{
+	struct fat_fs *fs = inode->fs;
+	uint32_t index = position / fs->cluster_size;
+	uint32_t low = 0, high = inode->extent_count;
+	struct fat_extent *extent;
+	uint32_t within;
+
+	/* The FAT12 and FAT16 root directory has a fixed region of its own. */
+	if (inode == fs->root) {
+		if (position >= fs->root_size) {
+			return 0;
+		}
+
+		*length = fs->root_size - position;
+		return fs->root_offset + position;
+	}
+
+	if (!high) {
+		return 0;
+	}
+
+	/* Find the last extent starting at or before 'index'. */
+	while (low + 1 < high) {
+		uint32_t middle = (low + high) / 2;
+
+		if (inode->extents[middle].index <= index) {
+			low = middle;
+		} else {
+			high = middle;
+		}
+	}
+
+	extent = &inode->extents[low];
+	if (index >= extent->index + extent->count) {
+		return 0;
+	}
+
+	within = position - extent->index * fs->cluster_size;
+	*length = extent->count * fs->cluster_size - within;
+
+	return fs->data_offset + (extent->cluster - 2) * fs->cluster_size +
+		within;
+}
+
+/* Read up to 'size' bytes from 'offset' in 'inode' into 'iov'. Pieces which
+ * are contiguous on the device are gathered into one device readv, so a file
+ * stored in a single run of clusters is read with a single request. Returns
+ * the number of bytes read. */
+static uint32_t _fat_transfer(struct fat_inode *inode, uint32_t offset,
+			      uint32_t size, struct iovec *iov, uint32_t count)
+{
+	struct iovec pieces[FAT_MAX_SEGMENTS];
+	uint32_t piece_count = 0, pending = 0, done = 0;
+	uint32_t start = 0, end = 0; /* Device offsets of the gathered run. */
+	uint32_t i = 0, within = 0;
+
+	if (_fat_map(inode)) {
+		return 0;
+	}
+
+	while (done + pending < size && i < count) {
+		uint32_t position, available, length;
+
+		if (within == iov[i].iov_len) {
+			i++;
+			within = 0;
+			continue;
+		}
+
+		position = _fat_locate(inode, offset + done + pending,
+				       &available);
+		if (!position) {
+			break;
+		}
+
+		/* Send the run so far if this piece does not continue it. */
+		if (piece_count && (position != end ||
+				    piece_count == FAT_MAX_SEGMENTS)) {
+			length = _fat_device_readv(inode->fs->device, start,
+						   pieces, piece_count);
+			done += length;
+			if (length < pending) {
+				return done;
+			}
+
+			piece_count = 0;
+			pending = 0;
+		}
+
+		if (!piece_count) {
+			start = position;
+		}
+
+		length = min(min(available, iov[i].iov_len - within),
+			     size - done - pending);
+
+		pieces[piece_count].iov_base = iov[i].iov_base + within;
+		pieces[piece_count].iov_len = length;
+		piece_count++;
+
+		pending += length;
+		within += length;
+		end = position + length;
+	}
+
+	if (piece_count) {
+		done += _fat_device_readv(inode->fs->device, start, pieces,
+					  piece_count);
+	}
+
+	return done;
+}
+
+static uint32_t _fat_readv(struct fs_node *node, uint32_t offset,
+			   struct iovec *iov, uint32_t count)
+{
+	if (offset >= node->size) {
+		return 0;
+	}
+
+	return _fat_transfer(fat_inode(node), offset, node->size - offset,
+			     iov, count);
+}
+
+static uint32_t _fat_read(struct fs_node *node, uint32_t offset,
+			  uint32_t size, uint8_t *buffer)
+{
+	struct iovec iov;
+
+	iov.iov_base = buffer;
+	iov.iov_len = size;
+
+	return _fat_readv(node, offset, &iov, 1);
+}
+
+/* The checksum of an 8.3 name, stored in each of its long name entries. */
+static uint8_t _fat_checksum(const uint8_t *name)
+{
+	uint8_t sum = 0;
+	uint32_t i;
+
+	for (i = 0; i < 11; i++) {
+		sum = ((sum & 0x1) << 7) + (sum >> 1) + name[i];
+	}
+
+	return sum;
+}
+
+/* Copy the characters of a long name entry into 'name'. Long name entries are
+ * stored last part first, numbered down to 1, and 'previous' is the number of
+ * the entry before this one. Returns the number of this entry, or 0 if it does
+ * not continue the sequence. Characters outside ASCII become '?'. */
+static uint32_t _fat_lfn(char *name, struct fat_lfn *entry, uint32_t previous,
+			 uint8_t *checksum)
+{
+	uint32_t order = entry->order & 0x1F;
+	uint16_t characters[FAT_LFN_CHARS];
+	uint32_t i;
+
+	if (!order || order * FAT_LFN_CHARS >= sizeof(((struct fs_node *)0)->name)) {
+		return 0;
+	}
+
+	if (entry->order & FAT_LFN_LAST) {
+		previous = order + 1;
+		*checksum = entry->checksum;
+		name[order * FAT_LFN_CHARS] = '\0';
+	}
+
+	if (order + 1 != previous || entry->checksum != *checksum) {
+		return 0;
+	}
+
+	for (i = 0; i < 5; i++) {
+		characters[i] = entry->name1[i];
+	}
+	for (i = 0; i < 6; i++) {
+		characters[5 + i] = entry->name2[i];
+	}
+	for (i = 0; i < 2; i++) {
+		characters[11 + i] = entry->name3[i];
+	}
+
+	name += (order - 1) * FAT_LFN_CHARS;
+	for (i = 0; i < FAT_LFN_CHARS; i++) {
+		/* The name is terminated, then padded with 0xFFFF. */
+		if (!characters[i]) {
+			name[i] = '\0';
+			break;
+		}
+
+		name[i] = characters[i] < 0x80 ? characters[i] : '?';
+	}
+
+	return order;
+}
+
+/* Format an 8.3 name as "base.ext", lower casing either part if the entry's
+ * case flags say so. */
+static void _fat_short_name(char *name, struct fat_dirent *entry)
+{
+	uint32_t length = 0;
+	uint32_t i;
+
+	for (i = 0; i < 8 && entry->name[i] != ' '; i++) {
+		name[length++] = (entry->case_flags & FAT_CASE_BASE) ?
+			to_lower(entry->name[i]) : entry->name[i];
+	}
+
+	if (entry->name[0] == FAT_KANJI) {
+		name[0] = (char)FAT_DELETED;
+	}
+
+	if (entry->name[8] != ' ') {
+		name[length++] = '.';
+
+		for (i = 8; i < 11 && entry->name[i] != ' '; i++) {
+			name[length++] =
+				(entry->case_flags & FAT_CASE_EXTENSION) ?
+				to_lower(entry->name[i]) : entry->name[i];
+		}
+	}
+
+	name[length] = '\0';
+}
+
+/* Names are compared without regard to case, as FAT does. */
+static int _fat_compare(const char *a, const char *b)
+{
+	while (*a && to_lower(*a) == to_lower(*b)) {
+		a++;
+		b++;
+	}
+
+	return to_lower(*a) - to_lower(*b);
+}
+
+/* Allocate an inode for a file or directory. It is not linked into a parent,
+ * and a directory's entries are only read when first used. */
+static struct fat_inode *_fat_new(struct fat_fs *fs, const char *name,
+				   uint32_t flags, uint32_t cluster,
+				   uint32_t size)
+{
+	struct fat_inode *inode = kcreate(struct fat_inode, 1);
+	struct fs_node *node = &inode->node;
+	size_t length = strlen(name);
+
+	memset((uint8_t *)inode, 0x0, sizeof(*inode));
+	memcpy((uint8_t *)node->name, (const uint8_t *)name, length + 1);
+	node->flags = flags;
+	node->inode = fs->next_inode++;
+	node->size = size;
+
+	if ((flags & 0x7) == FS_DIRECTORY) {
+		node->readdir = &_fat_readdir;
+		node->finddir = &_fat_finddir;
+	} else {
+		node->read = &_fat_read;
+		node->readv = &_fat_readv;
+	}
+
+	memcpy((uint8_t *)inode->dirent.name, (const uint8_t *)name,
+	       length + 1);
+	inode->dirent.inode = node->inode;
+	inode->fs = fs;
+	inode->cluster = cluster;
+
+	return inode;
+}
+
+/* Read the entries of 'directory' and keep an inode for each, in the order
+ * they are stored. */
+static void _fat_load(struct fat_inode *directory)
+{
+	struct fat_fs *fs = directory->fs;
+	struct fat_inode **link = &directory->children;
+	struct fat_dirent *entry, *end;
+	char name[256];
+	uint8_t checksum = 0;
+	uint32_t lfn = 0, size, i;
+	struct iovec iov;
+	uint8_t *buffer;
+
+	directory->loaded = 1;
+
+	if (directory == fs->root) {
+		size = fs->root_size;
+	} else {
+		if (_fat_map(directory) || !directory->extent_count) {
+			return;
+		}
+
+		size = 0;
+		for (i = 0; i < directory->extent_count; i++) {
+			size += directory->extents[i].count * fs->cluster_size;
+		}
+	}
+
+	buffer = kcreate(uint8_t, size);
+	iov.iov_base = buffer;
+	iov.iov_len = size;
+	size = _fat_transfer(directory, 0, size, &iov, 1);
+
+	entry = (struct fat_dirent *)buffer;
+	end = entry + size / sizeof(struct fat_dirent);
+
+	for (; entry < end && entry->name[0]; entry++) {
+		uint32_t cluster = entry->cluster;
+		uint32_t flags;
+
+		if (entry->name[0] == FAT_DELETED) {
+			lfn = 0;
+			continue;
+		}
+
+		if (entry->attributes == FAT_ATTR_LFN) {
+			lfn = _fat_lfn(name, (struct fat_lfn *)entry, lfn,
+				       &checksum);
+			continue;
+		}
+
+		if (entry->attributes & FAT_ATTR_VOLUME_ID) {
+			lfn = 0;
+			continue;
+		}
+
+		/* Use the long name only if it was complete and belongs to
+		 * this entry. */
+		if (lfn != 1 || checksum != _fat_checksum(entry->name)) {
+			_fat_short_name(name, entry);
+		}
+		lfn = 0;
+
+		if (!strcmp(name, ".") || !strcmp(name, "..")) {
+			continue;
+		}
+
+		if (cluster < 2 || cluster >= fs->cluster_count + 2) {
+			cluster = 0;
+		}
+
+		if (entry->attributes & FAT_ATTR_DIRECTORY) {
+			flags = FS_DIRECTORY;
+			size = 0;
+		} else {
+			flags = FS_FILE | FS_PAGECACHE;
+			size = cluster ? entry->size : 0;
+		}
+
+		*link = _fat_new(fs, name, flags, cluster, size);
+		link = &(*link)->next;
+	}
+
+	kfree(buffer);
+}
+
+static struct dirent *_fat_readdir(struct fs_node *node, uint32_t index)
+{
+	struct fat_inode *child;
+
+	if (!fat_inode(node)->loaded) {
+		_fat_load(fat_inode(node));
+	}
+
+	child = fat_inode(node)->children;
+	while (child && index--) {
+		child = child->next;
+	}
+
+	return child ? &child->dirent : 0;
+}
+
+static struct fs_node *_fat_finddir(struct fs_node *node, char *name)
+{
+	struct fat_inode *child;
+
+	if (!fat_inode(node)->loaded) {
+		_fat_load(fat_inode(node));
+	}
+
+	for (child = fat_inode(node)->children; child; child = child->next) {
+		if (!_fat_compare(child->node.name, name)) {
+			return &child->node;
+		}
+	}
+
+	return 0;
+}
+
+struct fs_node *init_fat(struct fs_node *device)
+{
+	struct fat_boot_sector *boot;
+	uint8_t sector[FAT_BOOT_SIZE];
+	uint32_t bytes_per_sector, total, root_sectors, first_data;
+	uint32_t cluster_count, fat_size, type;
+	struct iovec iov;
+	struct fat_fs *fs;
+
+	iov.iov_base = sector;
+	iov.iov_len = FAT_BOOT_SIZE;
+	if (device->size < FAT_BOOT_SIZE ||
+	    _fat_device_readv(device, 0, &iov, 1) != FAT_BOOT_SIZE ||
+	    sector[510] != 0x55 || sector[511] != 0xAA) {
+		return 0;
+	}
+
+	boot = (struct fat_boot_sector *)sector;
+	bytes_per_sector = boot->bytes_per_sector;
+
+	/* FAT32 has no fixed root directory, and no sectors_per_fat here. */
+	if (bytes_per_sector < 512 || bytes_per_sector > 4096 ||
+	    !is_power_of_two(bytes_per_sector) ||
+	    !is_power_of_two(boot->sectors_per_cluster) ||
+	    !boot->reserved_sectors || !boot->fat_count ||
+	    !boot->root_entries || !boot->sectors_per_fat) {
+		return 0;
+	}
+
+	total = boot->total_sectors_16 ? boot->total_sectors_16
+		: boot->total_sectors_32;
+	root_sectors = (boot->root_entries * sizeof(struct fat_dirent) +
+			bytes_per_sector - 1) / bytes_per_sector;
+	first_data = boot->reserved_sectors +
+		boot->fat_count * boot->sectors_per_fat + root_sectors;
+
+	if (total <= first_data || total > device->size / bytes_per_sector) {
+		return 0;
+	}
+
+	cluster_count = (total - first_data) / boot->sectors_per_cluster;
+	if (cluster_count < FAT12_MAX_CLUSTERS) {
+		type = 12;
+	} else if (cluster_count < FAT16_MAX_CLUSTERS) {
+		type = 16;
+	} else {
+		fat_debug("%s: FAT32 is not supported\n", device->name);
+		return 0;
+	}
+
+	/* The FAT must have an entry for every cluster. */
+	fat_size = boot->sectors_per_fat * bytes_per_sector;
+	if (fat_size < (type == 12 ? (cluster_count + 2) * 3 / 2 + 1
+			: (cluster_count + 2) * 2)) {
+		return 0;
+	}
+
+	fs = kcreate(struct fat_fs, 1);
+	fs->device = device;
+	fs->type = type;
+	fs->cluster_size = boot->sectors_per_cluster * bytes_per_sector;
+	fs->cluster_count = cluster_count;
+	fs->root_offset = (boot->reserved_sectors +
+			   boot->fat_count * boot->sectors_per_fat) *
+		bytes_per_sector;
+	fs->root_size = boot->root_entries * sizeof(struct fat_dirent);
+	fs->data_offset = first_data * bytes_per_sector;
+	fs->next_inode = 1;
+
+	fs->fat = kcreate(uint8_t, fat_size);
+	iov.iov_base = fs->fat;
+	iov.iov_len = fat_size;
+	if (_fat_device_readv(device, boot->reserved_sectors * bytes_per_sector,
+			      &iov, 1) != fat_size) {
+		kfree(fs->fat);
+		kfree(fs);
+		return 0;
+	}
+
+	fs->root = _fat_new(fs, "fat", FS_DIRECTORY, 0, 0);
+
+	printf("%s: FAT%d, %d clusters of %d bytes\n", device->name, type,
+	       cluster_count, fs->cluster_size);
+
+	return &fs->root->node;
+}
@@ -0,0 +1,259 @@
+#include <fs/file.h>
+
+#include <kernel/assert.h>
+#include <lib/string.h>
+#include <mm/heap.h>
+#include <mm/page-cache.h>
+#include <sched/task.h>
+
+/* Defined in ../sched/task.c. */
+extern volatile struct task *current_task;
+
+#define is_readable(file) (((file)->flags & O_ACCMODE) != O_WRONLY)
+#define is_writeable(file) (((file)->flags & O_ACCMODE) != O_RDONLY)
+
+/* Return the open file for 'fd' in the current task, or 0. */
+static struct file *_file_get(int fd)
+{
+	if (fd < 0 || fd >= TASK_MAX_FILES) {
+		return 0;
+	}
+
+	return current_task->files[fd];
+}
+
+/* Install 'file' on the lowest free descriptor. Returns -1 if the table is
+ * full. */
+static int _fd_install(struct file *file)
+{
+	int fd;
+
+	for (fd = 0; fd < TASK_MAX_FILES; fd++) {
+		if (!current_task->files[fd]) {
+			current_task->files[fd] = file;
+			return fd;
+		}
+	}
+
+	return -1;
+}
+
+/* Look up 'path', creating it if it does not exist and O_CREAT is set. */
+static struct fs_node *_file_lookup(const char *path, uint32_t flags)
+{
+	struct fs_node *node = vfs_lookup(path);
+	struct fs_node *parent;
+	char directory[sizeof(((struct fs_node *)0)->name)];
+	const char *name;
+	uint32_t length;
+
+	if (node || !(flags & O_CREAT)) {
+		return node;
+	}
+
+	/* Split the path into its directory and final component. */
+	name = path + strlen(path);
+	while (name > path && *(name - 1) != '/') {
+		name--;
+	}
+
+	length = name - path;
+	if (!*name || length >= sizeof(directory)) {
+		return 0;
+	}
+
+	memcpy((uint8_t *)directory, (const uint8_t *)path, length);
+	directory[length] = '\0';
+
+	parent = vfs_lookup(directory);
+	if (!parent) {
+		return 0;
+	}
+
+	return fs_create(parent, (char *)name, FS_FILE);
+}
+
+void file_get(struct file *file)
+{
+	file->references++;
+}
+
+void file_put(struct file *file)
+{
+	assert(file->references);
+
+	if (!--file->references) {
+		struct fs_node *node = file->node;
+
+		/* Data written through the cache reaches the disk by the time
+		 * the last descriptor is closed. */
+		if (node->flags & FS_PAGECACHE) {
+			page_cache_sync(node);
+		}
+
+		/* An unlinked node may be freed by the driver from here. */
+		assert(node->open_count);
+		node->open_count--;
+		fs_close(node);
+		kfree(file);
+	}
+}
+
+int open(const char *path, uint32_t flags)
+{
+	struct fs_node *node = _file_lookup(path, flags);
+	struct file *file;
+	int fd;
+
+	if (!node || is_dir(node)) {
+		return -1;
+	}
+
+	file = kcreate(struct file, 1);
+	file->node = node;
+	file->position = 0;
+	file->flags = flags;
+	file->references = 1;
+
+	if ((fd = _fd_install(file)) < 0) {
+		kfree(file);
+		return -1;
+	}
+
+	node->open_count++;
+	fs_open(node, is_readable(file), is_writeable(file));
+
+	if ((flags & O_TRUNC) && is_writeable(file)) {
+		fs_truncate(node, 0);
+	}
+
+	return fd;
+}
+
+int close(int fd)
+{
+	struct file *file = _file_get(fd);
+
+	if (!file) {
+		return -1;
+	}
+
+	current_task->files[fd] = 0;
+	file_put(file);
+
+	return 0;
+}
+
+sint32_t read(int fd, uint8_t *buffer, uint32_t size)
+{
+	struct file *file = _file_get(fd);
+	uint32_t length;
+
+	if (!file || !is_readable(file)) {
+		return -1;
+	}
+
+	length = fs_read(file->node, file->position, size, buffer);
+	file->position += length;
+
+	return length;
+}
+
+sint32_t write(int fd, uint8_t *buffer, uint32_t size)
+{
+	struct file *file = _file_get(fd);
+	uint32_t length;
+
+	if (!file || !is_writeable(file)) {
+		return -1;
+	}
+
+	if (file->flags & O_APPEND) {
+		file->position = file->node->size;
+	}
+
+	length = fd_write(file->node, file->position, size, buffer);
+	file->position += length;
+
+	return length;
+}
+
+sint32_t readv(int fd, struct iovec *iov, uint32_t count)
+{
+	struct file *file = _file_get(fd);
+	uint32_t length;
+
+	if (!file || !is_readable(file)) {
+		return -1;
+	}
+
+	length = fs_readv(file->node, file->position, iov, count);
+	file->position += length;
+
+	return length;
+}
+
+sint32_t writev(int fd, struct iovec *iov, uint32_t count)
+{
+	struct file *file = _file_get(fd);
+	uint32_t length;
+
+	if (!file || !is_writeable(file)) {
+		return -1;
+	}
+
+	if (file->flags & O_APPEND) {
+		file->position = file->node->size;
+	}
+
+	length = fs_writev(file->node, file->position, iov, count);
+	file->position += length;
+
+	return length;
+}
+
+sint32_t lseek(int fd, sint32_t offset, int whence)
+{
+	struct file *file = _file_get(fd);
+	sint32_t base;
+
+	if (!file) {
+		return -1;
+	}
+
+	switch (whence) {
+	case SEEK_SET:
+		base = 0;
+		break;
+	case SEEK_CUR:
+		base = file->position;
+		break;
+	case SEEK_END:
+		base = file->node->size;
+		break;
+	default:
+		return -1;
+	}
+
+	if (base + offset < 0) {
+		return -1;
+	}
+
+	file->position = base + offset;
+
+	return file->position;
+}
+
+int dup(int fd)
+{
+	struct file *file = _file_get(fd);
+	int new_fd;
+
+	if (!file || (new_fd = _fd_install(file)) < 0) {
+		return -1;
+	}
+
+	file_get(file);
+
+	return new_fd;
+}
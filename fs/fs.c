@@ -1,5 +1,9 @@
 #include <fs/fs.h>
 
+#include <fs/dcache.h>
+#include <lib/string.h>
+#include <mm/page-cache.h>
+
 /* Filesystem root. */
 struct fs_node *fs_root = 0;
 
@@ -25,7 +29,9 @@ void fs_close(struct fs_node *node)
 
 uint32_t fs_read(struct fs_node *node, uint32_t offset, uint32_t size, uint8_t *buffer)
 {
-	if (node->read) {
+	if (node->flags & FS_PAGECACHE) {
+		return page_cache_read(node, offset, size, buffer);
+	} else if (node->read) {
 		return node->read(node, offset, size, buffer);
 	} else {
 		return 0;
@@ -34,13 +40,72 @@ uint32_t fs_read(struct fs_node *node, uint32_t offset, uint32_t size, uint8_t *
 
 uint32_t fd_write(struct fs_node *node, uint32_t offset, uint32_t size, uint8_t *buffer)
 {
-	if (node->write) {
+	/* A cached node without a write callback is read-only. */
+	if ((node->flags & FS_PAGECACHE) && node->write) {
+		return page_cache_write(node, offset, size, buffer);
+	} else if (node->write) {
 		return node->write(node, offset, size, buffer);
 	} else {
 		return 0;
 	}
 }
 
+uint32_t fs_readv(struct fs_node *node, uint32_t offset,
+		  struct iovec *iov, uint32_t count)
+{
+	uint32_t done = 0;
+	uint32_t i;
+
+	if (node->readv && !(node->flags & FS_PAGECACHE)) {
+		return node->readv(node, offset, iov, count);
+	}
+
+	for (i = 0; i < count; i++) {
+		uint32_t length = fs_read(node, offset + done, iov[i].iov_len,
+					  iov[i].iov_base);
+
+		done += length;
+		if (length < iov[i].iov_len) {
+			break;
+		}
+	}
+
+	return done;
+}
+
+uint32_t fs_writev(struct fs_node *node, uint32_t offset,
+		   struct iovec *iov, uint32_t count)
+{
+	uint32_t done = 0;
+	uint32_t i;
+
+	if (node->writev && !(node->flags & FS_PAGECACHE)) {
+		return node->writev(node, offset, iov, count);
+	}
+
+	for (i = 0; i < count; i++) {
+		uint32_t length = fd_write(node, offset + done, iov[i].iov_len,
+					   iov[i].iov_base);
+
+		done += length;
+		if (length < iov[i].iov_len) {
+			break;
+		}
+	}
+
+	return done;
+}
+
+uint32_t fs_mmap(struct fs_node *node, uint32_t offset, uint32_t size,
+		 struct page_directory *directory, uint32_t address)
+{
+	if (node->mmap) {
+		return node->mmap(node, offset, size, directory, address);
+	} else {
+		return 0;
+	}
+}
+
 struct dirent *fs_readdir(struct fs_node *node, uint32_t index)
 {
 	if (node->readdir && is_dir(node)) {
@@ -58,3 +123,167 @@ struct fs_node *fs_finddir(struct fs_node *node, char *name)
 		return 0;
 	}
 }
+
+struct fs_node *fs_create(struct fs_node *node, char *name, uint32_t flags)
+{
+	struct fs_node *child;
+
+	if (!node->create || !is_dir(node)) {
+		return 0;
+	}
+
+	child = node->create(node, name, flags);
+
+	/* Replace any negative dentry for the name. */
+	if (child) {
+		dcache_insert(node, name, child);
+	}
+
+	return child;
+}
+
+int fs_unlink(struct fs_node *node, char *name)
+{
+	struct fs_node *child;
+	uint32_t cached, open;
+
+	if (!node->unlink || !is_dir(node)) {
+		return -1;
+	}
+
+	child = fs_finddir(node, name);
+	if (!child) {
+		return -1;
+	}
+
+	/* The driver may free the child node, so check this first. */
+	cached = child->flags & FS_PAGECACHE;
+	open = child->open_count;
+
+	if (node->unlink(node, name)) {
+		return -1;
+	}
+
+	dcache_invalidate(node, name);
+
+	/* An open file keeps its data until the driver frees it on the last
+	 * close. */
+	if (cached && !open) {
+		page_cache_invalidate(child, 0);
+	}
+
+	return 0;
+}
+
+int fs_truncate(struct fs_node *node, uint32_t size)
+{
+	if (!node->truncate) {
+		return -1;
+	}
+
+	if (node->flags & FS_PAGECACHE) {
+		page_cache_invalidate(node, size);
+	}
+
+	return node->truncate(node, size);
+}
+
+void fs_mount(struct fs_node *node, struct fs_node *root)
+{
+	node->flags |= FS_MOUNTPOINT;
+	node->pointer = root;
+}
+
+void fs_unmount(struct fs_node *node)
+{
+	/* The page cache does not know which filesystem a node belongs to, so
+	 * write back every dirty page. */
+	page_cache_sync(0);
+
+	node->flags &= ~FS_MOUNTPOINT;
+	node->pointer = 0;
+}
+
+/* Follow a mountpoint to the root of the mounted filesystem. */
+#define follow_mount(node)						\
+	((((node)->flags & FS_MOUNTPOINT) && (node)->pointer)		\
+	 ? (node)->pointer : (node))
+
+/* Resolve a single path component, consulting the dentry cache first. */
+static struct fs_node *_vfs_lookup_component(struct fs_node *dir, char *name)
+{
+	struct dentry *dentry;
+	struct fs_node *node;
+
+	dentry = dcache_lookup(dir, name);
+	if (dentry) {
+		return dentry->node;
+	}
+
+	node = fs_finddir(dir, name);
+	dcache_insert(dir, name, node);
+
+	return node;
+}
+
+struct fs_node *vfs_lookup(const char *path)
+{
+	struct fs_node *parents[VFS_MAX_DEPTH];
+	struct fs_node *node;
+	char name[sizeof(((struct fs_node *)0)->name)];
+	int depth = 0;
+
+	if (!fs_root || !path || *path != '/') {
+		return 0;
+	}
+
+	node = follow_mount(fs_root);
+
+	while (*path != '\0') {
+		uint32_t length = 0;
+
+		/* Skip any separators. */
+		while (*path == '/') {
+			path++;
+		}
+
+		/* Copy out the next component. */
+		while (path[length] != '\0' && path[length] != '/') {
+			length++;
+		}
+
+		if (!length) {
+			break;
+		} else if (length >= sizeof(name)) {
+			return 0;
+		}
+
+		memcpy((uint8_t *)name, (const uint8_t *)path, length);
+		name[length] = '\0';
+		path += length;
+
+		if (!strcmp(name, ".")) {
+			continue;
+		} else if (!strcmp(name, "..")) {
+			if (depth) {
+				node = parents[--depth];
+			}
+			continue;
+		}
+
+		if (!is_dir(node) || depth == VFS_MAX_DEPTH) {
+			return 0;
+		}
+
+		parents[depth++] = node;
+		node = _vfs_lookup_component(node, name);
+
+		if (!node) {
+			return 0;
+		}
+
+		node = follow_mount(node);
+	}
+
+	return node;
+}
@@ -1,163 +1,389 @@
 #include <fs/initrd.h>
 
 #include <fs/fs.h>
+#include <fs/lz4.h>
 #include <kernel/assert.h>
+#include <kernel/panic.h>
 #include <lib/stdio.h>
 #include <kernel/types.h>
+#include <kernel/util.h>
 #include <lib/string.h>
 #include <mm/heap.h>
+#include <mm/paging.h>
 
-#define HEADER_ID 0xCC
-#define is_header(h) ((((struct initrd_file_header *)h)->id == HEADER_ID) \
-		      ? 1 : 0)
+/* Defined in ../mm/paging.c. */
+extern struct page_directory *kernel_directory;
+extern struct page_directory *current_directory;
 
+/* struct fs_node->implementation values. Set once a file's checksum has been
+ * verified, so that it is only computed on first access. */
+#define INITRD_NODE_VERIFIED 0x01
+
+/* The modulus used by the Adler-32 checksum. */
+#define ADLER32_MODULUS 65521
+
+/* The name index is a chained hash table with a power-of-two number of
+ * buckets, so that a bucket can be selected by masking the hash. We allocate
+ * at least twice as many buckets as there are entries to keep chains short.
+ * Entries are keyed on both their name and their parent directory. */
+#define INITRD_HASH_MIN_BUCKETS 16
+#define INITRD_PARENT_MIX       0x9E3779B1
+#define initrd_key(name_hash, parent)				\
+	((name_hash) ^ ((uint32_t)(parent) * INITRD_PARENT_MIX))
+#define initrd_bucket(key) (hash_buckets[(key) & hash_mask])
+
+/* The root directory is always the first entry. */
+#define INITRD_ROOT 0
+
+/* Return a pointer to the data of a file entry within the image. */
+#define initrd_data(entry) ((uint8_t *)(location + (uint32_t)(entry)->offset))
+
+/* An entry in the name index. The name hash is precomputed by initrd-gen and
+ * stored in the image, so a lookup only calls strcmp() on a full hash
+ * match. */
+struct initrd_hash_entry {
+	uint32_t key;                     /* initrd_key() of the entry.   */
+	struct fs_node *node;             /* The indexed node.            */
+	struct initrd_hash_entry *next;   /* Next entry in the bucket.    */
+};
+
+static uint32_t location;
 static struct initrd_header *header;
-static struct initrd_file_header *file_headers;
-static struct fs_node *root;
-static struct fs_node *dev;
-static struct dirent dirent;
+static struct initrd_entry *entries;
+static const char *strings;
+static struct dirent *dirents;
 static struct fs_node *nodes;
-static int nodes_count;
+static uint32_t nodes_count;
+
+/* The resident, uncompressed data of each file. For uncompressed files this
+ * points into the image, for compressed files it is 0 until first access. */
+static uint8_t **file_data;
+
+static struct initrd_hash_entry **hash_buckets;
+static struct initrd_hash_entry *hash_entries;
+static uint32_t hash_mask;
+
+static uint32_t _adler32(const uint8_t *data, uint32_t length)
+{
+	uint32_t a = 1;
+	uint32_t b = 0;
+
+	while (length) {
+		/* 5552 is the largest number of bytes which can be summed before
+		 * b overflows 32 bits. */
+		uint32_t block = min(length, 5552);
+
+		length -= block;
+		while (block--) {
+			a += *data++;
+			b += a;
+		}
+
+		a %= ADLER32_MODULUS;
+		b %= ADLER32_MODULUS;
+	}
+
+	return (b << 16) | a;
+}
+
+/* Return the uncompressed data of a file, decompressing it on first access and
+ * verifying its checksum. Returns 0 if the file data is corrupt. */
+static uint8_t *_initrd_load(struct fs_node *node, struct initrd_entry *entry)
+{
+	uint8_t *data;
+
+	if (node->implementation & INITRD_NODE_VERIFIED) {
+		return file_data[node->inode];
+	}
+
+	if (entry->flags & INITRD_LZ4) {
+		/* Decompress into page-aligned memory so that the file can
+		 * still be mapped. */
+		data = kcreate_a(uint8_t, (uint32_t)entry->size);
+
+		if (lz4_decompress(initrd_data(entry), entry->stored_size, data,
+				   (uint32_t)entry->size)
+		    != (sint32_t)entry->size) {
+			initrd_log(LOG_ERR,
+				   "initrd: corrupt LZ4 data for '%s'\n",
+				   node->name);
+			kfree(data);
+			return 0;
+		}
+	} else {
+		data = file_data[node->inode];
+	}
+
+	if (_adler32(data, (uint32_t)entry->size) != entry->checksum) {
+		initrd_log(LOG_ERR, "initrd: checksum mismatch for '%s'\n",
+			   node->name);
+		if (entry->flags & INITRD_LZ4) {
+			kfree(data);
+		}
+		return 0;
+	}
+
+	file_data[node->inode] = data;
+	node->implementation |= INITRD_NODE_VERIFIED;
+
+	return data;
+}
 
 static uint32_t _initrd_read(struct fs_node *node, uint32_t offset,
                              uint32_t size, uint8_t *buffer)
 {
-	struct initrd_file_header header = file_headers[node->inode];
+	struct initrd_entry *entry = &entries[node->inode];
 	uint32_t read_length = size;
+	uint8_t *data;
 
-	assert(is_header(&header));
+	assert(initrd_type(entry) == INITRD_FILE);
 
-	if (offset > header.size) {
+	if (offset > entry->size) {
 		/* Invalid read (out of bounds) */
-		initrd_debug("initrd: invalid offset of %h in node size %h\n",
-			     offset, size);
+		initrd_log(LOG_WARNING,
+			   "initrd: invalid offset of %h in node size %h\n",
+			   offset, size);
 		return 0;
 	}
 
-	if (offset + size > header.size) {
+	if (offset + size > entry->size) {
 		/* Reduce read size as necessary to prevent overshoot. */
-		read_length = header.size - offset;
+		read_length = entry->size - offset;
+	}
+
+	if (!(data = _initrd_load(node, entry))) {
+		return 0;
 	}
 
-	memcpy(buffer, (uint8_t *)(header.offset + offset), read_length);
+	memcpy(buffer, data + offset, read_length);
 
 	return read_length;
 }
 
-static struct dirent *_initrd_readdir(struct fs_node *node, uint32_t index)
+/* Scatter a read across several buffers, with a single load of the file. */
+static uint32_t _initrd_readv(struct fs_node *node, uint32_t offset,
+			      struct iovec *iov, uint32_t count)
 {
-	if (node == root && !index) {
-		strcpy(dirent.name, "dev");
-		dirent.name[3] = 0;
-		dirent.inode = 0;
+	struct initrd_entry *entry = &entries[node->inode];
+	uint32_t done = 0;
+	uint32_t i;
+	uint8_t *data;
+
+	assert(initrd_type(entry) == INITRD_FILE);
 
-		return &dirent;
+	if (offset >= entry->size || !(data = _initrd_load(node, entry))) {
+		return 0;
 	}
 
-	if ((int)(index - 1) >= nodes_count) {
-		/* Return nothing on out of bounds request. */
+	for (i = 0; i < count && offset + done < entry->size; i++) {
+		uint32_t length = min(iov[i].iov_len,
+				      (uint32_t)entry->size - (offset + done));
+
+		memcpy(iov[i].iov_base, data + offset + done, length);
+		done += length;
+	}
+
+	return done;
+}
+
+/* The initrd is resident in memory, so a file's pages can be mapped by pointing
+ * page table entries straight at the frames holding its data, found through the
+ * kernel directory. Uncompressed file data is page-aligned within the image and
+ * the image is loaded on a page boundary, while decompressed data is allocated
+ * page-aligned, so the mapping exposes only the file and its padding. */
+static uint32_t _initrd_mmap(struct fs_node *node, uint32_t offset,
+			     uint32_t size, struct page_directory *directory,
+			     uint32_t address)
+{
+	struct initrd_entry *entry = &entries[node->inode];
+	uint8_t *data;
+	uint32_t start;
+	uint32_t end;
+	uint32_t page;
+
+	assert(initrd_type(entry) == INITRD_FILE);
+
+	if ((address & PAGE_OFFSET_MASK) || offset >= entry->size) {
+		initrd_log(LOG_WARNING, "initrd: invalid mmap of %h at %h\n",
+			   offset, address);
+		return 0;
+	}
+
+	if (!(data = _initrd_load(node, entry))) {
 		return 0;
 	}
 
-	strcpy(dirent.name, nodes[index - 1].name);
-	dirent.name[strlen(nodes[index - 1].name)] = 0;
-	dirent.inode = nodes[index - 1].inode;
+	size = min(size, (uint32_t)entry->size - offset);
+	start = (uint32_t)data + offset;
+	end = start + size;
+
+	for (page = start & ALIGNMENT_MASK; page < end; page += PAGE_SIZE) {
+		struct page *source = get_page(page, NO_CREATE,
+					       kernel_directory);
+
+		assert(source && source->present);
+		map_frame(get_page(address + (page - (start & ALIGNMENT_MASK)),
+				   CREATE_PAGE, directory),
+			  source->frame * PAGE_SIZE, 0, 0);
+	}
+
+	if (directory == current_directory) {
+		flush_tlb();
+	}
 
-	return &dirent;
+	return address + (start & PAGE_OFFSET_MASK);
 }
 
-static struct fs_node *_initrd_finddir(struct fs_node *node, char *name)
+static struct dirent *_initrd_readdir(struct fs_node *node, uint32_t index)
 {
-	int i;
+	struct initrd_entry *entry = &entries[node->inode];
 
-	if (node == root && !strcmp(name, "dev")) {
-		return dev;
+	if (index >= entry->child_count) {
+		/* Return nothing on out of bounds request. */
+		return 0;
 	}
 
-	for (i = 0; i < nodes_count; i++) {
-		if (!strcmp(name, nodes[i].name)) {
-			return &nodes[i];
+	/* The directory entries are built once in init_initrd(), so we can
+	 * hand them out directly without copying names. */
+	return &dirents[entry->first_child + index];
+}
+
+static struct fs_node *_initrd_finddir(struct fs_node *node, char *name)
+{
+	struct initrd_hash_entry *hash_entry;
+	uint32_t name_hash = strhash(name);
+	uint32_t key = initrd_key(name_hash, node->inode);
+
+	for (hash_entry = initrd_bucket(key); hash_entry;
+	     hash_entry = hash_entry->next) {
+		struct initrd_entry *entry;
+
+		if (hash_entry->key != key) {
+			continue;
+		}
+
+		entry = &entries[hash_entry->node->inode];
+		if (entry->parent == node->inode && entry->name_hash == name_hash
+		    && !strcmp(name, &strings[entry->name])) {
+			return hash_entry->node;
 		}
 	}
 
 	return 0;
 }
 
-struct fs_node *init_initrd(uint32_t location)
+/* Build the name index and directory entries for all nodes. */
+static void _initrd_build_index(void)
+{
+	uint32_t buckets_count = INITRD_HASH_MIN_BUCKETS;
+	uint32_t i;
+
+	while (buckets_count < 2 * nodes_count) {
+		buckets_count <<= 1;
+	}
+
+	hash_mask = buckets_count - 1;
+	hash_buckets = kcreate(struct initrd_hash_entry *, buckets_count);
+	memset((uint8_t *)hash_buckets, 0x0,
+	       sizeof(struct initrd_hash_entry *) * buckets_count);
+	hash_entries = kcreate(struct initrd_hash_entry, nodes_count);
+	dirents = kcreate(struct dirent, nodes_count);
+
+	/* The root has no name, and is not a child of any directory. */
+	for (i = INITRD_ROOT + 1; i < nodes_count; i++) {
+		struct initrd_hash_entry *hash_entry = &hash_entries[i];
+		struct initrd_entry *entry = &entries[i];
+
+		hash_entry->key = initrd_key(entry->name_hash, entry->parent);
+		hash_entry->node = &nodes[i];
+		hash_entry->next = initrd_bucket(hash_entry->key);
+		initrd_bucket(hash_entry->key) = hash_entry;
+
+		memcpy((uint8_t *)dirents[i].name, (uint8_t *)nodes[i].name,
+		       strlen(nodes[i].name) + 1);
+		dirents[i].inode = i;
+	}
+
+	initrd_debug("initrd: indexed %d entries in %d buckets\n",
+		     nodes_count, buckets_count);
+}
+
+struct fs_node *init_initrd(uint32_t initrd_location)
 {
-	int i;
+	uint32_t i;
 
-	/* Initialise the main and file header pointers and populate the root
-	 * directory. */
+	location = initrd_location;
 	header = (struct initrd_header *)location;
-	file_headers = (struct initrd_file_header *)(location		\
-						     + sizeof(struct initrd_header));
-
-	/* Initialise the root (/) directory. */
-	root = kcreate(struct fs_node, 1);
-	strcpy(root->name, "initrd");
-	root->permissions = 0;
-	root->uid = 0;
-	root->gid = 0;
-	root->inode = 0;
-	root->size = 0;
-	root->flags = FS_DIRECTORY;
-	root->read = 0;
-	root->write = 0;
-	root->open = 0;
-	root->close = 0;
-	root->readdir = &_initrd_readdir;
-	root->finddir = &_initrd_finddir;
-	root->pointer = 0;
-	root->implementation = 0;
-
-	/* Initialise the devices (/dev) directory. */
-	dev = kcreate(struct fs_node, 1);
-	strcpy(dev->name, "dev");
-	dev->permissions = 0;
-	dev->uid = 0;
-	dev->gid = 0;
-	dev->inode = 0;
-	dev->size = 0;
-	dev->flags = FS_DIRECTORY;
-	dev->read = 0;
-	dev->write = 0;
-	dev->open = 0;
-	dev->close = 0;
-	dev->readdir = &_initrd_readdir;
-	dev->finddir = &_initrd_finddir;
-	dev->pointer = 0;
-	dev->implementation = 0;
-
-	nodes = kcreate(struct fs_node, header->file_count);
-	nodes_count = header->file_count;
-
-	/* Iterate over all files. */
+
+	if (header->magic != INITRD_MAGIC
+	    || header->version != INITRD_VERSION) {
+		initrd_log(LOG_ERR,
+			   "initrd: unsupported image at %h, version %d\n",
+			   location, header->version);
+		panic("Invalid initrd image");
+	}
+
+	/* Initialise the table pointers. */
+	entries = (struct initrd_entry *)(location + header->entries_offset);
+	strings = (const char *)(location + header->strings_offset);
+
+	nodes = kcreate(struct fs_node, header->entry_count);
+	nodes_count = header->entry_count;
+	file_data = kcreate(uint8_t *, nodes_count);
+
+	/* Iterate over all entries. */
 	for (i = 0; i < nodes_count; i++) {
 		struct fs_node *node = &nodes[i];
-		struct initrd_file_header *header = &file_headers[i];
+		struct initrd_entry *entry = &entries[i];
+		const char *name = &strings[entry->name];
 
-		/* We need to change the file's header so that it holds the file
-		 * offset relative to the start of memory, instead of the offset
-		 * relative to the start of the ramdisk. */
-		header->offset += location;
+		/* We can only address images which lie in the first 4 GiB. */
+		assert(!((entry->offset + entry->size) >> 32));
 
-		/* Create a file node. */
-		strcpy(node->name, &header->name[0]);
+		/* Create a node. */
+		memcpy((uint8_t *)node->name, (const uint8_t *)name,
+		       strlen(name) + 1);
 		node->permissions = 0;
 		node->uid = 0;
 		node->gid = 0;
-		node->size = header->size;
 		node->inode = i;
-		node->flags = FS_FILE;
-		node->read = &_initrd_read;
-		node->write = 0;
-		node->readdir = 0;
-		node->finddir = 0;
+		node->pointer = 0;
+		node->implementation = 0;
 		node->open = 0;
 		node->close = 0;
-		node->implementation = 0;
+		node->open_count = 0;
+		node->write = 0;
+		node->create = 0;
+		node->unlink = 0;
+		node->truncate = 0;
+		node->writev = 0;
+
+		if (initrd_type(entry) == INITRD_DIRECTORY) {
+			node->size = 0;
+			node->flags = FS_DIRECTORY;
+			node->read = 0;
+			node->mmap = 0;
+			node->readv = 0;
+			node->readdir = &_initrd_readdir;
+			node->finddir = &_initrd_finddir;
+			file_data[i] = 0;
+		} else {
+			node->size = (uint32_t)entry->size;
+			node->flags = FS_FILE;
+			node->read = &_initrd_read;
+			node->mmap = &_initrd_mmap;
+			node->readv = &_initrd_readv;
+			node->readdir = 0;
+			node->finddir = 0;
+			file_data[i] = (entry->flags & INITRD_LZ4)
+				? 0 : initrd_data(entry);
+		}
 	}
 
-	return root;
+	strcpy(nodes[INITRD_ROOT].name, "initrd");
+	nodes[INITRD_ROOT].name[6] = 0;
+
+	_initrd_build_index();
+
+	return &nodes[INITRD_ROOT];
 }
@@ -0,0 +1,100 @@
+#include <fs/lz4.h>
+
+/* Every match is at least this many bytes long, and the match length stored
+ * in a sequence token is relative to it. */
+#define LZ4_MIN_MATCH 4
+
+/* A length nibble of this value is followed by extra length bytes. */
+#define LZ4_RUN_MASK 0xF
+
+/* An LZ4 block is a series of sequences. Each sequence starts with a token
+ * byte, whose high nibble is the literal length and whose low nibble is the
+ * match length. Lengths of 15 are continued in subsequent bytes, each of which
+ * is added to the length until a byte other than 255 is read. The literals
+ * follow, then a two byte little-endian match offset. The final sequence of a
+ * block contains only literals. */
+
+/* Read a continued length. Returns 0 if the input is exhausted. */
+static int _lz4_read_length(const uint8_t **ip, const uint8_t *end,
+			    uint32_t *length)
+{
+	uint8_t byte;
+
+	do {
+		if (*ip >= end) {
+			return 0;
+		}
+
+		byte = *(*ip)++;
+		*length += byte;
+	} while (byte == 0xFF);
+
+	return 1;
+}
+
+sint32_t lz4_decompress(const uint8_t *source, uint32_t source_size,
+			uint8_t *destination, uint32_t destination_size)
+{
+	const uint8_t *ip = source;
+	const uint8_t *ip_end = source + source_size;
+	uint8_t *op = destination;
+	uint8_t *op_end = destination + destination_size;
+
+	while (ip < ip_end) {
+		uint8_t token = *ip++;
+		uint32_t length = token >> 4;
+		uint32_t offset;
+		const uint8_t *match;
+
+		/* Copy the literals. */
+		if (length == LZ4_RUN_MASK
+		    && !_lz4_read_length(&ip, ip_end, &length)) {
+			return -1;
+		}
+
+		if (length > (uint32_t)(ip_end - ip)
+		    || length > (uint32_t)(op_end - op)) {
+			return -1;
+		}
+
+		while (length--) {
+			*op++ = *ip++;
+		}
+
+		/* The last sequence has no match. */
+		if (ip == ip_end) {
+			break;
+		}
+
+		/* Copy the match. */
+		if (ip_end - ip < 2) {
+			return -1;
+		}
+
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		if (!offset || offset > (uint32_t)(op - destination)) {
+			return -1;
+		}
+
+		length = token & LZ4_RUN_MASK;
+		if (length == LZ4_RUN_MASK
+		    && !_lz4_read_length(&ip, ip_end, &length)) {
+			return -1;
+		}
+
+		length += LZ4_MIN_MATCH;
+		if (length > (uint32_t)(op_end - op)) {
+			return -1;
+		}
+
+		/* Matches may overlap the output, so copy byte by byte. */
+		match = op - offset;
+		while (length--) {
+			*op++ = *match++;
+		}
+	}
+
+	return (sint32_t)(op - destination);
+}
@@ -0,0 +1,492 @@
+#include <fs/tmpfs.h>
+
+#include <kernel/assert.h>
+#include <kernel/util.h>
+#include <lib/stdio.h>
+#include <lib/string.h>
+#include <mm/heap.h>
+#include <mm/paging.h>
+
+/* Defined in ../mm/paging.c. */
+extern struct page_directory *kernel_directory;
+extern struct page_directory *current_directory;
+
+/* The initial capacity of a file's extent array. */
+#define TMPFS_MIN_EXTENTS 4
+
+#define tmpfs_inode(node) ((struct tmpfs_inode *)(node))
+#define extent_end(extent) ((extent)->page + (extent)->count)
+#define pages_in(size) (((size) + PAGE_SIZE - 1) / PAGE_SIZE)
+
+static uint32_t next_inode = 1;
+
+static struct tmpfs_inode *_tmpfs_new(struct tmpfs_inode *parent,
+				      const char *name, uint32_t flags);
+
+/* Return the index of the extent containing 'page', or of the first extent
+ * after it if 'page' is in a hole. */
+static uint32_t _tmpfs_extent_search(struct tmpfs_inode *inode, uint32_t page)
+{
+	uint32_t low = 0;
+	uint32_t high = inode->extent_count;
+
+	while (low < high) {
+		uint32_t middle = (low + high) / 2;
+
+		if (extent_end(&inode->extents[middle]) <= page) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	return low;
+}
+
+/* Return the address of a file page, or 0 if it is a hole. */
+static uint8_t *_tmpfs_page(struct tmpfs_inode *inode, uint32_t page)
+{
+	uint32_t i = _tmpfs_extent_search(inode, page);
+	struct tmpfs_extent *extent = &inode->extents[i];
+
+	if (i == inode->extent_count || extent->page > page) {
+		return 0;
+	}
+
+	return (uint8_t *)(extent->address + (page - extent->page) * PAGE_SIZE);
+}
+
+/* Insert a single page extent at index 'i' of the extent array. */
+static void _tmpfs_extent_insert(struct tmpfs_inode *inode, uint32_t i,
+				 uint32_t page, uint32_t address)
+{
+	uint32_t j;
+
+	if (inode->extent_count == inode->extent_capacity) {
+		uint32_t capacity = max(inode->extent_capacity * 2,
+					TMPFS_MIN_EXTENTS);
+		struct tmpfs_extent *extents;
+
+		extents = kcreate(struct tmpfs_extent, capacity);
+		if (inode->extents) {
+			memcpy((uint8_t *)extents, (uint8_t *)inode->extents,
+			       sizeof(struct tmpfs_extent) * inode->extent_count);
+			kfree(inode->extents);
+		}
+
+		inode->extents = extents;
+		inode->extent_capacity = capacity;
+	}
+
+	for (j = inode->extent_count; j > i; j--) {
+		inode->extents[j] = inode->extents[j - 1];
+	}
+
+	inode->extents[i].page = page;
+	inode->extents[i].count = 1;
+	inode->extents[i].address = address;
+	inode->extent_count++;
+}
+
+static void _tmpfs_extent_remove(struct tmpfs_inode *inode, uint32_t i)
+{
+	for (i++; i < inode->extent_count; i++) {
+		inode->extents[i - 1] = inode->extents[i];
+	}
+
+	inode->extent_count--;
+}
+
+/* Allocate a zeroed page to fill the hole at 'page'. If the preceding extent
+ * ends at 'page' we try to grow it in place, so that sequentially written
+ * files end up in a few large extents. Returns 0 when out of memory. */
+static uint8_t *_tmpfs_page_alloc(struct tmpfs_inode *inode, uint32_t page)
+{
+	uint32_t i = _tmpfs_extent_search(inode, page);
+	uint32_t address;
+
+	if (i) {
+		struct tmpfs_extent *previous = &inode->extents[i - 1];
+		uint32_t next = previous->address + previous->count * PAGE_SIZE;
+
+		if (extent_end(previous) == page && kpage_alloc_at(next, 1)) {
+			previous->count++;
+			return (uint8_t *)next;
+		}
+	}
+
+	address = kpage_alloc(1);
+	if (!address) {
+		tmpfs_debug("tmpfs: out of pages\n");
+		return 0;
+	}
+
+	_tmpfs_extent_insert(inode, i, page, address);
+
+	return (uint8_t *)address;
+}
+
+/* Copy between the file at 'offset' and the buffers of 'iov'. The extents are
+ * walked once, alongside the buffers, rather than searched for each page.
+ * Reads stop at the end of the file, and holes read as zeros. Writes allocate
+ * pages for holes, and stop early when out of memory. Returns the number of
+ * bytes transferred. */
+static uint32_t _tmpfs_transfer(struct tmpfs_inode *inode, uint32_t offset,
+				struct iovec *iov, uint32_t count, int write)
+{
+	struct fs_node *node = &inode->node;
+	uint32_t total = (uint32_t)-1;
+	uint32_t done = 0;
+	uint32_t i, e;
+
+	if (!write) {
+		if (offset >= node->size) {
+			return 0;
+		}
+		total = node->size - offset;
+	}
+
+	e = _tmpfs_extent_search(inode, offset / PAGE_SIZE);
+
+	for (i = 0; i < count && done < total; i++) {
+		uint8_t *buffer = iov[i].iov_base;
+		uint32_t remaining = min(iov[i].iov_len, total - done);
+
+		while (remaining) {
+			uint32_t index = (offset + done) / PAGE_SIZE;
+			uint32_t page_offset = (offset + done) % PAGE_SIZE;
+			uint32_t length = min(PAGE_SIZE - page_offset,
+					      remaining);
+			struct tmpfs_extent *extent;
+			uint8_t *page = 0;
+
+			while (e < inode->extent_count &&
+			       extent_end(&inode->extents[e]) <= index) {
+				e++;
+			}
+
+			extent = &inode->extents[e];
+			if (e < inode->extent_count && extent->page <= index) {
+				page = (uint8_t *)(extent->address +
+						   (index - extent->page) *
+						   PAGE_SIZE);
+			}
+
+			if (write) {
+				if (!page) {
+					page = _tmpfs_page_alloc(inode, index);
+					if (!page) {
+						total = done;
+						break;
+					}
+
+					/* The page may have gone into a new
+					 * extent, moving those after it. */
+					e = _tmpfs_extent_search(inode, index);
+				}
+
+				memcpy(page + page_offset, buffer, length);
+			} else if (page) {
+				memcpy(buffer, page + page_offset, length);
+			} else {
+				memset(buffer, 0x0, length);
+			}
+
+			buffer += length;
+			remaining -= length;
+			done += length;
+		}
+	}
+
+	if (write) {
+		node->size = max(node->size, offset + done);
+	}
+
+	return done;
+}
+
+static uint32_t _tmpfs_read(struct fs_node *node, uint32_t offset,
+			    uint32_t size, uint8_t *buffer)
+{
+	struct iovec iov;
+
+	iov.iov_base = buffer;
+	iov.iov_len = size;
+
+	return _tmpfs_transfer(tmpfs_inode(node), offset, &iov, 1, 0);
+}
+
+static uint32_t _tmpfs_write(struct fs_node *node, uint32_t offset,
+			     uint32_t size, uint8_t *buffer)
+{
+	struct iovec iov;
+
+	iov.iov_base = buffer;
+	iov.iov_len = size;
+
+	return _tmpfs_transfer(tmpfs_inode(node), offset, &iov, 1, 1);
+}
+
+static uint32_t _tmpfs_readv(struct fs_node *node, uint32_t offset,
+			     struct iovec *iov, uint32_t count)
+{
+	return _tmpfs_transfer(tmpfs_inode(node), offset, iov, count, 0);
+}
+
+static uint32_t _tmpfs_writev(struct fs_node *node, uint32_t offset,
+			      struct iovec *iov, uint32_t count)
+{
+	return _tmpfs_transfer(tmpfs_inode(node), offset, iov, count, 1);
+}
+
+static int _tmpfs_truncate(struct fs_node *node, uint32_t size)
+{
+	struct tmpfs_inode *inode = tmpfs_inode(node);
+	uint32_t keep = pages_in(size);
+	uint8_t *page;
+
+	/* Mappings would be left pointing at freed frames. */
+	if (keep < inode->mapped_end) {
+		tmpfs_debug("tmpfs: '%s' is mapped up to page %d\n",
+			    node->name, inode->mapped_end);
+		return -1;
+	}
+
+	/* Free every page from 'keep' onwards, working back from the end. */
+	while (inode->extent_count) {
+		struct tmpfs_extent *extent =
+			&inode->extents[inode->extent_count - 1];
+
+		if (extent_end(extent) <= keep) {
+			break;
+		}
+
+		if (extent->page >= keep) {
+			kpage_free(extent->address, extent->count);
+			_tmpfs_extent_remove(inode, inode->extent_count - 1);
+		} else {
+			uint32_t count = keep - extent->page;
+
+			kpage_free(extent->address + count * PAGE_SIZE,
+				   extent->count - count);
+			extent->count = count;
+		}
+	}
+
+	/* Zero the tail of the last page, so that extending the file again
+	 * exposes zeros rather than old data. */
+	if ((size % PAGE_SIZE) && (page = _tmpfs_page(inode, size / PAGE_SIZE))) {
+		memset(page + (size % PAGE_SIZE), 0x0,
+		       PAGE_SIZE - (size % PAGE_SIZE));
+	}
+
+	node->size = size;
+
+	return 0;
+}
+
+/* Map file pages by pointing page table entries at the frames backing the
+ * kpage window. Holes in the range are allocated first, so that every page has
+ * a frame. */
+static uint32_t _tmpfs_mmap(struct fs_node *node, uint32_t offset,
+			    uint32_t size, struct page_directory *directory,
+			    uint32_t address)
+{
+	struct tmpfs_inode *inode = tmpfs_inode(node);
+	uint32_t first = offset / PAGE_SIZE;
+	uint32_t index;
+
+	if ((address & PAGE_OFFSET_MASK) || offset >= node->size) {
+		tmpfs_debug("tmpfs: invalid mmap of %h at %h\n",
+			    offset, address);
+		return 0;
+	}
+
+	size = min(size, node->size - offset);
+
+	for (index = first; index < pages_in(offset + size); index++) {
+		uint8_t *page = _tmpfs_page(inode, index);
+		struct page *source;
+
+		if (!page && !(page = _tmpfs_page_alloc(inode, index))) {
+			return 0;
+		}
+
+		source = get_page((uint32_t)page, NO_CREATE, kernel_directory);
+		map_frame(get_page(address + (index - first) * PAGE_SIZE,
+				   CREATE_PAGE, directory),
+			  source->frame * PAGE_SIZE, 0, 0);
+	}
+
+	inode->mapped_end = max(inode->mapped_end, pages_in(offset + size));
+
+	if (directory == current_directory) {
+		flush_tlb();
+	}
+
+	return address + (offset % PAGE_SIZE);
+}
+
+static struct dirent *_tmpfs_readdir(struct fs_node *node, uint32_t index)
+{
+	struct tmpfs_inode *child = tmpfs_inode(node)->children;
+
+	while (child && index--) {
+		child = child->next;
+	}
+
+	return child ? &child->dirent : 0;
+}
+
+static struct fs_node *_tmpfs_finddir(struct fs_node *node, char *name)
+{
+	struct tmpfs_inode *child;
+
+	for (child = tmpfs_inode(node)->children; child; child = child->next) {
+		if (!strcmp(child->node.name, name)) {
+			return &child->node;
+		}
+	}
+
+	return 0;
+}
+
+static struct fs_node *_tmpfs_create(struct fs_node *node, char *name,
+				     uint32_t flags)
+{
+	size_t length = strlen(name);
+
+	if (!length || length >= sizeof(node->name)
+	    || (flags != FS_FILE && flags != FS_DIRECTORY)
+	    || _tmpfs_finddir(node, name)) {
+		return 0;
+	}
+
+	return &_tmpfs_new(tmpfs_inode(node), name, flags)->node;
+}
+
+/* Free an unlinked file and its pages. */
+static void _tmpfs_free(struct tmpfs_inode *inode)
+{
+	_tmpfs_truncate(&inode->node, 0);
+	if (inode->extents) {
+		kfree(inode->extents);
+	}
+	kfree(inode);
+}
+
+/* Called when a file is closed, which frees it if this was the last thing
+ * keeping it after it was unlinked. */
+static void _tmpfs_close(struct fs_node *node)
+{
+	struct tmpfs_inode *inode = tmpfs_inode(node);
+
+	if (inode->unlinked && !node->open_count && !inode->mapped_end) {
+		_tmpfs_free(inode);
+	}
+}
+
+static int _tmpfs_unlink(struct fs_node *node, char *name)
+{
+	struct tmpfs_inode **link = &tmpfs_inode(node)->children;
+	struct tmpfs_inode *child;
+
+	while (*link && strcmp((*link)->node.name, name)) {
+		link = &(*link)->next;
+	}
+
+	if (!(child = *link) || child->children) {
+		/* Missing, or a non-empty directory. */
+		return -1;
+	}
+
+	*link = child->next;
+	child->unlinked = 1;
+
+	/* An open or mapped file loses its name, but is kept for the open
+	 * files until the last is closed, and for the mappings for good. */
+	if (child->node.open_count || child->mapped_end) {
+		return 0;
+	}
+
+	_tmpfs_free(child);
+
+	return 0;
+}
+
+/* Allocate an inode, and link it into 'parent' if there is one. */
+static struct tmpfs_inode *_tmpfs_new(struct tmpfs_inode *parent,
+				      const char *name, uint32_t flags)
+{
+	struct tmpfs_inode *inode = kcreate(struct tmpfs_inode, 1);
+	struct fs_node *node = &inode->node;
+	size_t length = strlen(name);
+
+	memcpy((uint8_t *)node->name, (const uint8_t *)name, length + 1);
+	node->permissions = 0;
+	node->uid = 0;
+	node->gid = 0;
+	node->flags = flags;
+	node->inode = next_inode++;
+	node->size = 0;
+	node->implementation = 0;
+	node->open = 0;
+	node->close = 0;
+	node->pointer = 0;
+	node->open_count = 0;
+
+	if (flags == FS_DIRECTORY) {
+		node->read = 0;
+		node->write = 0;
+		node->mmap = 0;
+		node->truncate = 0;
+		node->readv = 0;
+		node->writev = 0;
+		node->readdir = &_tmpfs_readdir;
+		node->finddir = &_tmpfs_finddir;
+		node->create = &_tmpfs_create;
+		node->unlink = &_tmpfs_unlink;
+	} else {
+		node->read = &_tmpfs_read;
+		node->write = &_tmpfs_write;
+		node->mmap = &_tmpfs_mmap;
+		node->truncate = &_tmpfs_truncate;
+		node->readv = &_tmpfs_readv;
+		node->writev = &_tmpfs_writev;
+		node->close = &_tmpfs_close;
+		node->readdir = 0;
+		node->finddir = 0;
+		node->create = 0;
+		node->unlink = 0;
+	}
+
+	memcpy((uint8_t *)inode->dirent.name, (const uint8_t *)name,
+	       length + 1);
+	inode->dirent.inode = node->inode;
+	inode->children = 0;
+	inode->extents = 0;
+	inode->extent_count = 0;
+	inode->extent_capacity = 0;
+	inode->mapped_end = 0;
+	inode->unlinked = 0;
+	inode->parent = parent;
+	inode->next = 0;
+
+	/* Append, so that readdir returns entries in creation order. */
+	if (parent) {
+		struct tmpfs_inode **link = &parent->children;
+
+		while (*link) {
+			link = &(*link)->next;
+		}
+
+		*link = inode;
+	}
+
+	return inode;
+}
+
+struct fs_node *init_tmpfs()
+{
+	return &_tmpfs_new(0, "tmpfs", FS_DIRECTORY)->node;
+}
@@ -0,0 +1,123 @@
+#ifndef _AIO_H
+#define _AIO_H
+
+#include <fs/block.h>
+#include <fs/fs.h>
+#include <kernel/debug.h>
+#include <kernel/types.h>
+#include <sched/task.h>
+
+/* Asynchronous I/O is submitted through a pair of rings shared between the
+ * submitter and the kernel worker. The submitter fills in requests in the
+ * submission queue and publishes them with aio_submit(). The worker consumes
+ * requests from the submission queue and posts one completion for each on the
+ * completion queue, waking any task sleeping in aio_wait(). The head and tail
+ * indices run freely and are masked when used.
+ *
+ * Reads and writes of whole sectors of a block device are direct: they skip
+ * the page cache and go straight to the driver, like O_DIRECT. They are
+ * started by aio_submit(), which returns without waiting for them, and each
+ * completion is posted from the driver's interrupt, which then starts any
+ * direct requests queued behind it. Requests are started in order, but direct
+ * ones may complete out of order, so wait for a request before submitting one
+ * that depends on it. Every other request is run by aio_run(), on the stack of
+ * the task calling it or aio_wait(). */
+
+/* The most verbose asynchronous I/O messages compiled in. Set it to LOG_DEBUG
+ * to trace it. */
+#define AIO_LOG_LEVEL LOG_INFO
+
+#define aio_debug(...) debug_log(AIO, LOG_DEBUG, __VA_ARGS__)
+
+/* The number of entries in each ring. Must be a power of two. */
+#define AIO_RING_SIZE 64
+
+/* The most requests the worker will merge into a single vectored transfer. */
+#define AIO_BATCH_MAX 16
+
+/* Request opcodes. */
+#define AIO_NOP    0x0
+#define AIO_READ   0x1
+#define AIO_WRITE  0x2
+#define AIO_READV  0x3
+#define AIO_WRITEV 0x4
+#define AIO_SYNC   0x5
+
+struct aio_request {
+	uint32_t opcode;           /* One of the AIO_* opcodes.               */
+	struct fs_node *node;      /* The file to transfer to or from.        */
+	uint32_t offset;           /* Byte offset into the file.              */
+	uint8_t *buffer;           /* Buffer for AIO_READ and AIO_WRITE.      */
+	uint32_t size;             /* Buffer size in bytes.                   */
+	struct iovec *iov;         /* Buffers for AIO_READV and AIO_WRITEV.   */
+	uint32_t iov_count;        /* Number of buffers in 'iov'.             */
+	uint32_t user_data;        /* Passed through to the completion.       */
+};
+
+/* A direct request in flight. The block request must be the first member, so
+ * that its completion callback can find the rest. */
+struct aio_block {
+	struct block_request request;
+	struct aio_ring *ring;
+	uint32_t user_data;        /* From the aio_request.                   */
+	uint32_t size;             /* Bytes transferred on success.           */
+};
+
+struct aio_completion {
+	uint32_t user_data;        /* From the request.                       */
+	sint32_t result;           /* Bytes transferred, or -1 on error.      */
+};
+
+struct aio_ring {
+	struct aio_request sq[AIO_RING_SIZE];     /* Submission queue.        */
+	struct aio_completion cq[AIO_RING_SIZE];  /* Completion queue.        */
+	volatile uint32_t sq_head;   /* Next request the worker will take.    */
+	volatile uint32_t sq_tail;   /* End of the published requests.        */
+	uint32_t sq_pending;         /* End of the requests being prepared.   */
+	volatile uint32_t cq_head;   /* Next completion the submitter reads.  */
+	volatile uint32_t cq_tail;   /* End of the posted completions.        */
+	struct wait_queue wait;      /* Tasks waiting for completions.        */
+	volatile uint32_t in_flight; /* Direct requests started, not posted.  */
+
+	/* The direct requests started from each submission queue slot. A slot
+	 * is only reused once the ring has gone round, by when the request
+	 * in it has completed, as there is room on the completion queue for
+	 * every request in flight. */
+	struct aio_block blocks[AIO_RING_SIZE];
+};
+
+/* Create and destroy a ring. */
+struct aio_ring *aio_create(void);
+void aio_destroy(struct aio_ring *ring);
+
+/* Return the next free slot in the submission queue for the caller to fill
+ * in, or 0 if the queue is full. The request is not seen by the worker until
+ * aio_submit() is called, so several requests can be prepared and submitted as
+ * a batch. */
+struct aio_request *aio_get_request(struct aio_ring *ring);
+
+/* Publish every request prepared since the last call, and start the direct
+ * requests at the head of the submission queue. Dirty cached pages of a block
+ * device are written back before it is read or written directly, and cached
+ * pages are dropped from the start of a direct write on. Returns the number of
+ * requests submitted. */
+uint32_t aio_submit(struct aio_ring *ring);
+
+/* Run the worker over 'ring', processing every submitted request for which
+ * there is room in the completion queue. Adjacent reads or writes of
+ * contiguous ranges of the same file are merged into a single vectored
+ * transfer, and direct requests are started. Returns the number of requests
+ * completed, which does not count the direct ones. */
+uint32_t aio_run(struct aio_ring *ring);
+
+/* Run the worker and sleep until at least 'count' completions are available,
+ * or until no more can arrive without some being consumed. Returns the number
+ * available. */
+uint32_t aio_wait(struct aio_ring *ring, uint32_t count);
+
+/* Return the oldest unconsumed completion, or 0 if there is none. The entry
+ * stays valid until aio_completion_seen() is called. */
+struct aio_completion *aio_get_completion(struct aio_ring *ring);
+void aio_completion_seen(struct aio_ring *ring);
+
+#endif /* _AIO_H */
@@ -0,0 +1,124 @@
+#ifndef _BLOCK_H
+#define _BLOCK_H
+
+#include <fs/fs.h>
+#include <kernel/debug.h>
+#include <kernel/types.h>
+#include <sched/task.h>
+
+/* The block layer sits between the VFS and disk drivers. Each disk is a block
+ * device, whose fs_node reads and writes byte ranges of the disk. Byte ranges
+ * are split into sector requests, which wait in a per-device queue sorted by
+ * sector. The queue is serviced in one direction across the disk (C-LOOK), and
+ * requests for adjacent sectors in the same direction are merged into a single
+ * scatter-gather transfer when dispatched to the driver. */
+
+/* The most verbose block layer messages compiled in. Set it to LOG_DEBUG
+ * to trace it. */
+#define BLOCK_LOG_LEVEL LOG_INFO
+
+#define block_debug(...) debug_log(BLOCK, LOG_DEBUG, __VA_ARGS__)
+
+#define BLOCK_SECTOR_SIZE 512
+
+/* The most requests which may be merged into one transfer. */
+#define BLOCK_MAX_SEGMENTS 32
+
+/* The most transfers a driver may have in progress at once. */
+#define BLOCK_MAX_IN_FLIGHT 16
+
+/* Request status values. */
+#define BLOCK_PENDING 0
+#define BLOCK_DONE    1
+#define BLOCK_ERROR   2
+
+struct block_request {
+	uint32_t sector;             /* First sector to transfer.             */
+	uint32_t count;              /* Number of sectors.                    */
+	uint8_t *buffer;             /* count * BLOCK_SECTOR_SIZE bytes.      */
+	int write;                   /* Nonzero to write to the disk.         */
+	volatile int status;         /* One of the BLOCK_* status values.     */
+	struct wait_queue wait;      /* Tasks waiting for the request.        */
+	struct block_request *next;  /* Next request in the queue.            */
+
+	/* Called by block_complete() once the status is set, possibly from an
+	 * interrupt handler, or 0. The request may be reused from here. */
+	void (*done)(struct block_request *request);
+};
+
+/* One or more merged requests, handed to the driver as a single transfer of
+ * 'count' sectors starting at 'sector'. Buffer 'i' of 'iov' belongs to
+ * requests[i], and is a whole number of sectors. */
+struct block_transfer {
+	uint32_t sector;
+	uint32_t count;
+	int write;
+	struct iovec iov[BLOCK_MAX_SEGMENTS];
+	struct block_request *requests[BLOCK_MAX_SEGMENTS];
+	uint32_t iov_count;
+	int busy;                    /* Slot in use.                          */
+};
+
+struct block_device;
+
+/* Start 'transfer'. The driver must call block_complete() when it finishes,
+ * which may be before this returns. Returns 0 if the transfer was started, or
+ * -1 if the device is busy and the transfer should be retried from the next
+ * block_dispatch(). */
+typedef int (*block_transfer_t)(struct block_device *,
+				struct block_transfer *);
+
+/* A block device. The node must be the first member, so that the fs_node
+ * pointers handed to the VFS can be cast back to the device. */
+struct block_device {
+	struct fs_node node;
+	uint32_t sector_count;           /* Size of the disk, in sectors.     */
+	uint32_t max_sectors;            /* Most sectors in one transfer.     */
+	uint32_t depth;                  /* Most transfers in flight.         */
+	block_transfer_t transfer;       /* Driver entry point.               */
+	void *driver;                    /* Private to the driver.            */
+	struct block_request *queue;     /* Waiting requests, by sector.      */
+	struct block_transfer transfers[BLOCK_MAX_IN_FLIGHT];
+	uint32_t in_flight;              /* Transfers in progress.            */
+	uint32_t head;                   /* Sector after the last transfer.   */
+	uint32_t plugged;                /* Hold dispatch while nonzero.      */
+	int dispatching;                 /* Set inside block_dispatch().      */
+	uint8_t *bounce;                 /* For partial sector transfers.     */
+};
+
+/* Initialise 'device' and register it in /dev under 'name'. The caller must
+ * have set sector_count, max_sectors, transfer and driver, and may set depth
+ * to allow more than one transfer in flight. Reads and writes of the device
+ * node go through the page cache. */
+void block_register(struct block_device *device, const char *name);
+
+/* Queue 'request' on 'device'. The request is started by the next
+ * block_dispatch(), which happens immediately unless the device is plugged. */
+void block_submit(struct block_device *device, struct block_request *request);
+
+/* Sleep until 'request' has finished. Returns 0 on success, or -1 on error. */
+int block_wait(struct block_request *request);
+
+/* While a device is plugged, submitted requests are queued but not started, so
+ * that a batch of requests can be sorted and merged before any is sent to the
+ * driver. Unplugging dispatches the queue. Plugs nest. */
+void block_plug(struct block_device *device);
+void block_unplug(struct block_device *device);
+
+/* Start transfers from the queue until it is empty, the device is plugged,
+ * 'depth' transfers are in flight, or the driver reports that it is busy. */
+void block_dispatch(struct block_device *device);
+
+/* Called by the driver, possibly from an interrupt handler, when 'transfer'
+ * has finished. 'status' is 0 on success, or -1 on error. */
+void block_complete(struct block_device *device,
+		    struct block_transfer *transfer, int status);
+
+/* Read or write whole sectors, waiting for the transfer to finish. Returns 0
+ * on success, or -1 on error. */
+int block_read(struct block_device *device, uint32_t sector, uint32_t count,
+	       uint8_t *buffer);
+int block_write(struct block_device *device, uint32_t sector, uint32_t count,
+		uint8_t *buffer);
+
+#endif /* _BLOCK_H */
@@ -0,0 +1,46 @@
+#ifndef _DCACHE_H
+#define _DCACHE_H
+
+#include <fs/fs.h>
+#include <kernel/types.h>
+
+/* The dentry cache remembers the result of a fs_finddir() call on a
+ * (directory, name) pair, so that repeated path walks do not need to call into
+ * the filesystem driver. Lookups which failed are cached as negative entries,
+ * which have a null node. The cache has a fixed number of entries and evicts
+ * the least recently used entry when full. */
+
+/* The number of entries and hash buckets in the cache. */
+#define DCACHE_SIZE    256
+#define DCACHE_BUCKETS 128
+
+/* Names longer than this are never cached, and always go to the driver. */
+#define DCACHE_NAME_LEN 32
+
+struct dentry {
+	struct fs_node *parent;      /* The directory containing the entry.   */
+	struct fs_node *node;        /* The resolved node, or 0 if negative.  */
+	uint32_t hash;               /* Hash of the parent and name.          */
+	char name[DCACHE_NAME_LEN];  /* Null-terminated component name.       */
+	struct dentry *hash_next;    /* Next entry in the hash bucket.        */
+	struct dentry *lru_prev;     /* More recently used neighbour.         */
+	struct dentry *lru_next;     /* Less recently used neighbour.         */
+};
+
+void init_dcache(void);
+
+/* Return the cached entry for 'name' in 'parent', or 0 on a cache miss. A
+ * returned entry with a null node is a negative entry, meaning that the name is
+ * known not to exist. */
+struct dentry *dcache_lookup(struct fs_node *parent, const char *name);
+
+/* Cache the result of looking up 'name' in 'parent'. A null 'node' records a
+ * negative entry. */
+void dcache_insert(struct fs_node *parent, const char *name,
+		   struct fs_node *node);
+
+/* Drop any cached entry for 'name' in 'parent'. Drivers must call this when a
+ * name is created or removed, so that stale entries are not returned. */
+void dcache_invalidate(struct fs_node *parent, const char *name);
+
+#endif /* _DCACHE_H */
@@ -0,0 +1,19 @@
+#ifndef _DEVFS_H
+#define _DEVFS_H
+
+#include <fs/fs.h>
+#include <kernel/types.h>
+
+/* The maximum number of device nodes. */
+#define DEVFS_MAX_DEVICES 32
+
+/* Create the device filesystem and return its root directory, to be mounted on
+ * /dev with fs_mount(). Drivers add their nodes to it with devfs_register(). */
+struct fs_node *init_devfs(void);
+
+/* Add 'node' to the device filesystem under its own name. The node is owned by
+ * the driver and must stay valid for as long as the kernel runs. Returns 0 on
+ * success, or -1 if the name is taken or there is no room left. */
+int devfs_register(struct fs_node *node);
+
+#endif /* _DEVFS_H */
@@ -0,0 +1,189 @@
+#ifndef _EXT2_H
+#define _EXT2_H
+
+#include <fs/fs.h>
+#include <kernel/debug.h>
+#include <kernel/types.h>
+
+/* The most verbose ext2 messages compiled in. */
+#define EXT2_LOG_LEVEL LOG_DEBUG
+
+#define ext2_debug(...) debug_log(EXT2, LOG_DEBUG, __VA_ARGS__)
+
+/* The superblock is always 1024 bytes from the start of the volume. */
+#define EXT2_SUPERBLOCK_OFFSET 1024
+#define EXT2_SUPERBLOCK_SIZE   1024
+#define EXT2_MAGIC             0xEF53
+
+#define EXT2_ROOT_INODE 2
+
+/* Block pointers in an inode: 12 direct, then single, double and triple
+ * indirect. */
+#define EXT2_DIRECT_BLOCKS 12
+#define EXT2_BLOCK_POINTERS 15
+#define EXT2_INDIRECT_LEVELS 3
+
+/* Features. Volumes with an unknown incompatible feature are not mounted, and
+ * those with an unknown read-only compatible feature are mounted read-only. */
+#define EXT2_INCOMPAT_FILETYPE       0x0002
+#define EXT2_RO_COMPAT_SPARSE_SUPER  0x0001
+#define EXT2_RO_COMPAT_LARGE_FILE    0x0002
+#define EXT2_INCOMPAT_SUPPORTED      EXT2_INCOMPAT_FILETYPE
+#define EXT2_RO_COMPAT_SUPPORTED     (EXT2_RO_COMPAT_SPARSE_SUPER |	\
+				      EXT2_RO_COMPAT_LARGE_FILE)
+
+/* Inode mode types and default permissions. */
+#define EXT2_S_IFMT  0xF000
+#define EXT2_S_IFREG 0x8000
+#define EXT2_S_IFDIR 0x4000
+#define EXT2_FILE_MODE      (EXT2_S_IFREG | 0644)
+#define EXT2_DIRECTORY_MODE (EXT2_S_IFDIR | 0755)
+
+/* Inode flags. A directory with an htree index is still a valid linear
+ * directory, but the flag must be cleared when the directory is changed. */
+#define EXT2_INDEX_FL 0x1000
+
+/* File types stored in directory entries. */
+#define EXT2_FT_REG_FILE 1
+#define EXT2_FT_DIR      2
+
+/* The most discontiguous pieces of disk sent to the device in one call. */
+#define EXT2_MAX_SEGMENTS 32
+
+/* Buckets in the table of inodes in use. */
+#define EXT2_NODE_BUCKETS 64
+
+/* The fields of the superblock this driver uses. */
+struct ext2_superblock {
+	uint32_t inodes_count;
+	uint32_t blocks_count;
+	uint32_t reserved_blocks_count;
+	uint32_t free_blocks_count;
+	uint32_t free_inodes_count;
+	uint32_t first_data_block;
+	uint32_t log_block_size;        /* Block size is 1024 << this.      */
+	uint32_t log_fragment_size;
+	uint32_t blocks_per_group;
+	uint32_t fragments_per_group;
+	uint32_t inodes_per_group;
+	uint32_t mount_time;
+	uint32_t write_time;
+	uint16_t mount_count;
+	uint16_t max_mount_count;
+	uint16_t magic;
+	uint16_t state;
+	uint16_t errors;
+	uint16_t minor_revision;
+	uint32_t last_check;
+	uint32_t check_interval;
+	uint32_t creator_os;
+	uint32_t revision;
+	uint16_t reserved_uid;
+	uint16_t reserved_gid;
+	/* Revision 1 and later. */
+	uint32_t first_inode;
+	uint16_t inode_size;
+	uint16_t block_group;
+	uint32_t features_compat;
+	uint32_t features_incompat;
+	uint32_t features_ro_compat;
+} __attribute__((packed));
+
+struct ext2_group_desc {
+	uint32_t block_bitmap;
+	uint32_t inode_bitmap;
+	uint32_t inode_table;
+	uint16_t free_blocks_count;
+	uint16_t free_inodes_count;
+	uint16_t used_dirs_count;
+	uint16_t pad;
+	uint8_t reserved[12];
+} __attribute__((packed));
+
+/* The revision 0 inode. Later revisions may have larger inodes, whose extra
+ * fields are left alone. */
+struct ext2_inode {
+	uint16_t mode;
+	uint16_t uid;
+	uint32_t size;
+	uint32_t access_time;
+	uint32_t change_time;
+	uint32_t modify_time;
+	uint32_t delete_time;
+	uint16_t gid;
+	uint16_t links_count;
+	uint32_t sectors;               /* 512 byte units, with metadata.   */
+	uint32_t flags;
+	uint32_t os1;
+	uint32_t block[EXT2_BLOCK_POINTERS];
+	uint32_t generation;
+	uint32_t file_acl;
+	uint32_t size_high;             /* Or the directory ACL.            */
+	uint32_t fragment_address;
+	uint8_t os2[12];
+} __attribute__((packed));
+
+struct ext2_dirent {
+	uint32_t inode;                 /* 0 if the entry is unused.        */
+	uint16_t record_length;         /* To the next entry.               */
+	uint8_t name_length;
+	uint8_t file_type;              /* If EXT2_INCOMPAT_FILETYPE.       */
+	char name[];
+} __attribute__((packed));
+
+/* The size of a directory entry with a name of 'length' characters. */
+#define ext2_dirent_size(length) ((8 + (length) + 3) & ~3)
+
+/* A block of block pointers, kept from the last lookup through it. */
+struct ext2_indirect {
+	uint32_t block;                 /* Block number, or 0 if empty.     */
+	uint32_t *pointers;
+};
+
+struct ext2_node;
+
+struct ext2_fs {
+	struct fs_node *device;
+	struct ext2_superblock super;
+	int read_only;
+	uint32_t block_size;
+	uint32_t pointers;              /* Block pointers per block.        */
+	uint32_t inode_size;
+	uint32_t group_count;
+	struct ext2_group_desc *groups; /* Cached group descriptor table.   */
+	uint32_t groups_offset;         /* Byte offset of the table.        */
+	uint8_t **block_bitmaps;        /* Cached when first used.          */
+	uint8_t **inode_bitmaps;
+	uint8_t *bitmaps_dirty;         /* Per group: 1 block, 2 inode.     */
+	int dirty;                      /* Superblock and descriptors.      */
+	uint8_t *zero;                  /* A block of zeros.                */
+	struct ext2_node *nodes[EXT2_NODE_BUCKETS];
+};
+
+/* An ext2 file or directory. The node must be the first member, so that the
+ * fs_node pointers handed to the VFS can be cast back to it. There is at most
+ * one for each inode, kept until the inode is removed, or if it is open then,
+ * until its last open file is closed. */
+struct ext2_node {
+	struct fs_node node;
+	struct dirent dirent;           /* Returned by readdir.             */
+	struct ext2_fs *fs;
+	struct ext2_inode inode;        /* Cached on-disk inode.            */
+	struct ext2_indirect indirect[EXT2_INDIRECT_LEVELS];
+	struct ext2_node *next;         /* Next in the hash bucket.         */
+};
+
+/* Mount the ext2 filesystem on 'device', usually a block device node, and
+ * return its root directory, which may be mounted with fs_mount(). Returns 0
+ * if the device does not hold a supported ext2 filesystem.
+ *
+ * Group descriptors are read at mount time, and block and inode bitmaps when a
+ * group is first allocated from. They are written back at the end of each
+ * operation which changes them. Each node keeps the indirect blocks of its
+ * last block lookup, so sequential access reads each indirect block once. New
+ * blocks are placed after the previous block of the file where possible, and
+ * new inodes in the group of their directory. File data goes through the page
+ * cache. */
+struct fs_node *init_ext2(struct fs_node *device);
+
+#endif /* _EXT2_H */
@@ -0,0 +1,135 @@
+#ifndef _FAT_H
+#define _FAT_H
+
+#include <fs/fs.h>
+#include <kernel/debug.h>
+#include <kernel/types.h>
+
+/* The most verbose FAT messages compiled in. */
+#define FAT_LOG_LEVEL LOG_DEBUG
+
+#define fat_debug(...) debug_log(FAT, LOG_DEBUG, __VA_ARGS__)
+
+/* Directory entry attributes. */
+#define FAT_ATTR_READ_ONLY 0x01
+#define FAT_ATTR_HIDDEN    0x02
+#define FAT_ATTR_SYSTEM    0x04
+#define FAT_ATTR_VOLUME_ID 0x08
+#define FAT_ATTR_DIRECTORY 0x10
+#define FAT_ATTR_ARCHIVE   0x20
+#define FAT_ATTR_LFN       0x0F /* A long file name entry. */
+
+/* Bits in the reserved byte of a directory entry, set by Windows NT and Linux
+ * when the base name or extension of an 8.3 name is all lower case. */
+#define FAT_CASE_BASE      0x08
+#define FAT_CASE_EXTENSION 0x10
+
+/* The first byte of the name of a deleted entry, and of an entry whose name
+ * really begins with 0xE5. */
+#define FAT_DELETED 0xE5
+#define FAT_KANJI   0x05
+
+/* Set in the order byte of the last long file name entry of a name. */
+#define FAT_LFN_LAST 0x40
+
+/* Characters held by each long file name entry. */
+#define FAT_LFN_CHARS 13
+
+/* The most discontiguous pieces of disk read by one readv of the device. */
+#define FAT_MAX_SEGMENTS 32
+
+/* The BIOS parameter block at the start of the boot sector. */
+struct fat_boot_sector {
+	uint8_t jump[3];
+	char oem[8];
+	uint16_t bytes_per_sector;
+	uint8_t sectors_per_cluster;
+	uint16_t reserved_sectors;
+	uint8_t fat_count;
+	uint16_t root_entries;
+	uint16_t total_sectors_16;
+	uint8_t media;
+	uint16_t sectors_per_fat;
+	uint16_t sectors_per_track;
+	uint16_t heads;
+	uint32_t hidden_sectors;
+	uint32_t total_sectors_32;
+} __attribute__((packed));
+
+struct fat_dirent {
+	uint8_t name[11];           /* 8.3 name, padded with spaces.        */
+	uint8_t attributes;
+	uint8_t case_flags;         /* FAT_CASE_* bits.                     */
+	uint8_t create_tenths;
+	uint16_t create_time;
+	uint16_t create_date;
+	uint16_t access_date;
+	uint16_t cluster_high;      /* FAT32 only.                          */
+	uint16_t modify_time;
+	uint16_t modify_date;
+	uint16_t cluster;           /* First cluster, or 0 if empty.        */
+	uint32_t size;
+} __attribute__((packed));
+
+/* A VFAT long file name entry. These precede the 8.3 entry they name, last
+ * part first, each holding FAT_LFN_CHARS UCS-2 characters. */
+struct fat_lfn {
+	uint8_t order;
+	uint16_t name1[5];
+	uint8_t attributes;         /* Always FAT_ATTR_LFN.                 */
+	uint8_t type;
+	uint8_t checksum;           /* Of the 8.3 name.                     */
+	uint16_t name2[6];
+	uint16_t cluster;           /* Always 0.                            */
+	uint16_t name3[2];
+} __attribute__((packed));
+
+/* A run of physically contiguous clusters of a file, starting at cluster
+ * 'cluster' of the disk, and at cluster 'index' of the file. */
+struct fat_extent {
+	uint32_t index;
+	uint32_t cluster;
+	uint32_t count;
+};
+
+struct fat_inode;
+
+struct fat_fs {
+	struct fs_node *device;     /* The disk holding the filesystem.     */
+	struct fat_inode *root;
+	uint32_t type;              /* 12 or 16.                            */
+	uint32_t cluster_size;      /* In bytes.                            */
+	uint32_t cluster_count;     /* Clusters 2 to cluster_count + 1.     */
+	uint32_t root_offset;       /* Byte offset of the root directory.   */
+	uint32_t root_size;
+	uint32_t data_offset;       /* Byte offset of cluster 2.            */
+	uint8_t *fat;               /* The first FAT, read at mount.        */
+	uint32_t next_inode;
+};
+
+/* A FAT file or directory. The node must be the first member, so that the
+ * fs_node pointers handed to the VFS can be cast back to the inode. */
+struct fat_inode {
+	struct fs_node node;
+	struct dirent dirent;           /* Returned by readdir.             */
+	struct fat_fs *fs;
+	uint32_t cluster;               /* First cluster; 0 for the root.   */
+	struct fat_extent *extents;     /* Cluster chain, or 0 until used.  */
+	uint32_t extent_count;
+	struct fat_inode *children;     /* Directories: cached entries.     */
+	struct fat_inode *next;         /* Next entry in the parent.        */
+	int loaded;                     /* Directories: children are read.  */
+};
+
+/* Mount the FAT12 or FAT16 filesystem on 'device', usually a block device
+ * node, and return its root directory, which may be mounted with fs_mount().
+ * Returns 0 if the device does not hold a FAT12 or FAT16 filesystem.
+ *
+ * The filesystem is read-only. The FAT is read into memory when mounted, and
+ * a file's cluster chain is turned into extents the first time it is read, so
+ * reads need no further FAT lookups. A directory is read once and its entries
+ * kept. File data goes through the page cache, and each contiguous run of
+ * clusters is read from the device in a single request. */
+struct fs_node *init_fat(struct fs_node *device);
+
+#endif /* _FAT_H */
@@ -0,0 +1,70 @@
+#ifndef _FILE_H
+#define _FILE_H
+
+#include <fs/fs.h>
+#include <kernel/types.h>
+
+/* open() flags. The low two bits are the access mode. */
+#define O_RDONLY   0x0000
+#define O_WRONLY   0x0001
+#define O_RDWR     0x0002
+#define O_ACCMODE  0x0003
+#define O_CREAT    0x0040
+#define O_TRUNC    0x0200
+#define O_APPEND   0x0400
+
+/* lseek() whence values. */
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+
+/* The number of file descriptors in each task's table. */
+#define TASK_MAX_FILES 16
+
+/* An open file. File descriptors refer to one of these, and descriptors which
+ * are duplicated with dup() or inherited through fork() share the same open
+ * file, and so the same position. */
+struct file {
+	struct fs_node *node;  /* The opened node.                          */
+	uint32_t position;     /* Offset of the next read or write.         */
+	uint32_t flags;        /* Flags passed to open().                   */
+	uint32_t references;   /* Number of descriptors referring to this.  */
+};
+
+/* Take another reference to an open file, and drop one, closing the node when
+ * the last reference goes, after writing back its dirty cached pages. Each open
+ * file holds the node's open_count, so that the node outlives an unlink. Used
+ * by fork() to share the descriptor table. */
+void file_get(struct file *file);
+void file_put(struct file *file);
+
+/* Open the file at the absolute 'path' in the current task, creating it if
+ * O_CREAT is given and it does not exist. Returns the lowest free file
+ * descriptor, or -1 on failure. */
+int open(const char *path, uint32_t flags);
+
+/* Release a file descriptor. Returns 0 on success, or -1 if 'fd' is not
+ * open. */
+int close(int fd);
+
+/* Read or write up to 'size' bytes at the current position of 'fd', and
+ * advance the position by the number of bytes transferred. Writes to a file
+ * opened with O_APPEND always go to the end of the file. Return the number of
+ * bytes transferred, or -1 if 'fd' is not open for reading or writing. */
+sint32_t read(int fd, uint8_t *buffer, uint32_t size);
+sint32_t write(int fd, uint8_t *buffer, uint32_t size);
+
+/* As read() and write(), but transfer to or from 'count' buffers in turn with a
+ * single call into the filesystem. */
+sint32_t readv(int fd, struct iovec *iov, uint32_t count);
+sint32_t writev(int fd, struct iovec *iov, uint32_t count);
+
+/* Set the position of 'fd' relative to the start of the file, the current
+ * position or the end of the file. Returns the new position, or -1. */
+sint32_t lseek(int fd, sint32_t offset, int whence);
+
+/* Duplicate 'fd' onto the lowest free file descriptor, sharing its open
+ * file. Returns the new descriptor, or -1. */
+int dup(int fd);
+
+#endif /* _FILE_H */
@@ -11,12 +11,15 @@
 #define FS_PIPE        0x05
 #define FS_SYMLINK     0x06
 #define FS_MOUNTPOINT  0x08
+#define FS_PAGECACHE   0x10 /* Reads and writes go through the page cache. */
 
 #define is_dir(node) ((node->flags & 0x7) == FS_DIRECTORY)
 
 /* Internal prototypes. */
 struct fs_node;
 struct dirent;
+struct iovec;
+struct page_directory;
 
 typedef uint32_t inode_t;
 
@@ -28,6 +31,16 @@ typedef void (*open_func_t)(struct fs_node *);
 typedef void (*close_func_t)(struct fs_node *);
 typedef struct dirent  *(*readdir_func_t)(struct fs_node *,uint32_t);
 typedef struct fs_node *(*finddir_func_t)(struct fs_node *,char *name);
+typedef uint32_t (*mmap_func_t)(struct fs_node *, uint32_t, uint32_t,
+				struct page_directory *, uint32_t);
+typedef struct fs_node *(*create_func_t)(struct fs_node *, char *name,
+					 uint32_t flags);
+typedef int (*unlink_func_t)(struct fs_node *, char *name);
+typedef int (*truncate_func_t)(struct fs_node *, uint32_t);
+typedef uint32_t (*readv_func_t)(struct fs_node *, uint32_t,
+				 struct iovec *, uint32_t);
+typedef uint32_t (*writev_func_t)(struct fs_node *, uint32_t,
+				  struct iovec *, uint32_t);
 
 struct fs_node {
 	char     name[255];        /* Filename.                               */
@@ -45,7 +58,17 @@ struct fs_node {
 	write_func_t write;        /* Write function.                         */
 	readdir_func_t readdir;    /* Returns the nth child of a directory.   */
 	finddir_func_t finddir;    /* Find a child in a directory by name.    */
+	mmap_func_t mmap;          /* Map file pages into an address space.   */
+	create_func_t create;      /* Create a child in a directory.          */
+	unlink_func_t unlink;      /* Remove a child from a directory.        */
+	truncate_func_t truncate;  /* Change the size of a file.              */
+	readv_func_t readv;        /* Scatter read, optional.                 */
+	writev_func_t writev;      /* Gather write, optional.                 */
 	struct fs_node *pointer;   /* Used by mountpoints and symlinks.       */
+
+	/* Open files referring to the node. Drivers keep an unlinked node
+	 * until its last file is closed, which calls 'close'. */
+	uint32_t open_count;
 };
 
 /* One of these is returned by the readdir call, according to POSIX. */
@@ -54,6 +77,12 @@ struct dirent {
 	inode_t inode;             /* Device specific.                        */
 };
 
+/* One buffer of a scatter-gather transfer. */
+struct iovec {
+	uint8_t *iov_base;         /* Start of the buffer.                    */
+	uint32_t iov_len;          /* Size of the buffer, in bytes.           */
+};
+
 /* Filesystem root. */
 extern struct fs_node *fs_root;
 
@@ -70,8 +99,59 @@ uint32_t fd_write(struct fs_node *node,
 		  uint32_t offset, uint32_t size,
 		  uint8_t *buffer);
 
+/* Read into, or write from, 'count' buffers in turn, starting at 'offset' in
+ * the file. Nodes without a native readv or writev callback fall back to one
+ * fs_read() or fd_write() per buffer. Return the total number of bytes
+ * transferred, which is short if the end of the file is reached. */
+uint32_t fs_readv(struct fs_node *node, uint32_t offset,
+		  struct iovec *iov, uint32_t count);
+
+uint32_t fs_writev(struct fs_node *node, uint32_t offset,
+		   struct iovec *iov, uint32_t count);
+
+/* Map 'size' bytes of a file starting at 'offset' read-only into the page
+ * directory 'directory', at the page-aligned virtual address 'address'. No data
+ * is copied; the pages refer directly to the memory backing the file. Returns
+ * the virtual address of the byte at 'offset', or 0 if the node cannot be
+ * mapped. */
+uint32_t fs_mmap(struct fs_node *node,
+		 uint32_t offset, uint32_t size,
+		 struct page_directory *directory, uint32_t address);
+
 struct dirent *fs_readdir(struct fs_node *node, uint32_t index);
 
 struct fs_node *fs_finddir(struct fs_node *node, char *name);
 
+/* Create a file or directory called 'name' in the directory 'node'. 'flags'
+ * is FS_FILE or FS_DIRECTORY. Returns the new node, or 0 if the name exists or
+ * the filesystem is read-only. */
+struct fs_node *fs_create(struct fs_node *node, char *name, uint32_t flags);
+
+/* Remove 'name' from the directory 'node'. Directories must be empty. A node
+ * with open files stays usable through them until the last is closed. Returns
+ * 0 on success, or -1 on failure. */
+int fs_unlink(struct fs_node *node, char *name);
+
+/* Set the size of a file, discarding data beyond 'size' or extending the file
+ * with a hole. Returns 0 on success, or -1 on failure. */
+int fs_truncate(struct fs_node *node, uint32_t size);
+
+/* Mount the filesystem whose root is 'root' over the directory 'node'. Path
+ * lookups through 'node' then continue in 'root'. */
+void fs_mount(struct fs_node *node, struct fs_node *root);
+
+/* Remove the filesystem mounted over 'node', first writing back its dirty
+ * pages from the page cache. */
+void fs_unmount(struct fs_node *node);
+
+/* The maximum number of directories that a path may descend through. */
+#define VFS_MAX_DEPTH 32
+
+/* Resolve an absolute path, starting at fs_root. Each component is looked up
+ * through the dentry cache, and only calls into the filesystem driver on a
+ * cache miss. Empty and "." components are ignored, ".." returns to the
+ * parent directory, and mountpoints are followed. Returns 0 if any component
+ * does not exist. */
+struct fs_node *vfs_lookup(const char *path);
+
 #endif /* _FS_H */
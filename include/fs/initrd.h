@@ -1,34 +1,78 @@
 #ifndef _INITRD_H
 #define _INITRD_H
 
+#include <kernel/debug.h>
 #include <kernel/types.h>
 
-/* Define this for initrd debugging. */
-#define INITRD_DEBUG 1
+/* The most verbose initrd messages compiled in. */
+#define INITRD_LOG_LEVEL LOG_DEBUG
 
-#ifdef INITRD_DEBUG
-# define initrd_debug(...) {					\
-		kdebug("%s:%d, %s() ",				\
-		       __FILE__, __LINE__, __func__);		\
-		kdebug(__VA_ARGS__);				\
-	}
-#else
-# define initrd_debug(f, ...) /**/
-#endif
+#define initrd_log(level, ...) debug_log(INITRD, level, __VA_ARGS__)
+#define initrd_debug(...) initrd_log(LOG_DEBUG, __VA_ARGS__)
+
+/* The initrd image begins with a struct initrd_header, which gives the image
+ * offsets of the remaining tables:
+ *
+ *   +----------------------+  0
+ *   | struct initrd_header |
+ *   +----------------------+  entries_offset
+ *   | struct initrd_entry  |  entry_count entries, where entry 0 is the root
+ *   | ...                  |  directory. The children of each directory are
+ *   +----------------------+  contiguous and sorted by name.
+ *   | string table         |  strings_offset, strings_size bytes of
+ *   +----------------------+  null-terminated names.
+ *   | file data            |  Each file begins on a page boundary, so that it
+ *   | ...                  |  can be mapped without copying.
+ *   +----------------------+
+ *
+ * A file with the INITRD_LZ4 flag is stored as a single raw LZ4 block of
+ * stored_size bytes, and is decompressed on first access. Files which do not
+ * shrink when compressed are stored uncompressed, with stored_size equal to
+ * size.
+ *
+ * All offsets are relative to the start of the image. Offsets and sizes of file
+ * data are 64 bits wide, although this kernel can only address images which
+ * lie below 4 GiB. */
+#define INITRD_MAGIC   0x44524E49 /* "INRD" */
+#define INITRD_VERSION 2
+
+/* The alignment of file data within the image. */
+#define INITRD_DATA_ALIGN 0x1000
+
+/* struct initrd_entry->flags values. The low nibble is the entry type. */
+#define INITRD_FILE      0x01
+#define INITRD_DIRECTORY 0x02
+#define INITRD_TYPE_MASK 0x0F
+#define INITRD_LZ4       0x10
+
+#define initrd_type(entry) ((entry)->flags & INITRD_TYPE_MASK)
 
 struct initrd_header {
-	uint32_t file_count; /* The number of files in the ramdisk image. */
-};
+	uint32_t magic;          /* Always INITRD_MAGIC.                       */
+	uint32_t version;        /* Image format version, INITRD_VERSION.      */
+	uint32_t entry_count;    /* The number of entries, including the root. */
+	uint32_t entries_offset; /* Image offset of the entry table.           */
+	uint32_t strings_offset; /* Image offset of the string table.          */
+	uint32_t strings_size;   /* Size of the string table, in bytes.        */
+	uint32_t data_offset;    /* Image offset of the first file's data.     */
+	uint32_t reserved;
+} __attribute__((packed));
 
-struct initrd_file_header {
-	char name[128];  /* Filename. */
-	uint8_t id;      /* Identification value, used for consitency checking. */
-	uint32_t offset; /* Initrd offset of the beginning of the file. */
-	uint32_t size;   /* Size of the file. */
-};
+struct initrd_entry {
+	uint64_t offset;      /* Image offset of the file data.                 */
+	uint64_t size;        /* Size of the file data, in bytes.               */
+	uint32_t name;        /* String table offset of the entry name.         */
+	uint32_t name_hash;   /* strhash() of the entry name.                   */
+	uint32_t parent;      /* Index of the parent directory.                 */
+	uint32_t first_child; /* Directories: index of the first child.         */
+	uint32_t child_count; /* Directories: number of children.               */
+	uint32_t flags;       /* Entry type, and INITRD_LZ4 if compressed.      */
+	uint32_t checksum;    /* Files: Adler-32 checksum of the file data.     */
+	uint32_t stored_size; /* Files: size of the data in the image.          */
+} __attribute__((packed));
 
 /* Initialise the ramdisk. It accepts as a parameter the address of the
  * multiboot module, and returns a filesystem node. */
-struct fs_node *init_initrd(uint32_t location);
+struct fs_node *init_initrd(uint32_t initrd_location);
 
 #endif /* _INITRD_H */
@@ -0,0 +1,13 @@
+#ifndef _LZ4_H
+#define _LZ4_H
+
+#include <kernel/types.h>
+
+/* Decompress a raw LZ4 block (no frame header) of 'source_size' bytes from
+ * 'source' into 'destination', which has room for 'destination_size' bytes.
+ * Returns the number of bytes written, or -1 if the block is malformed or
+ * would overflow either buffer. */
+sint32_t lz4_decompress(const uint8_t *source, uint32_t source_size,
+			uint8_t *destination, uint32_t destination_size);
+
+#endif /* _LZ4_H */
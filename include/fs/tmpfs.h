@@ -0,0 +1,46 @@
+#ifndef _TMPFS_H
+#define _TMPFS_H
+
+#include <fs/fs.h>
+#include <kernel/debug.h>
+#include <kernel/types.h>
+
+/* The most verbose tmpfs messages compiled in. */
+#define TMPFS_LOG_LEVEL LOG_DEBUG
+
+#define tmpfs_debug(...) debug_log(TMPFS, LOG_DEBUG, __VA_ARGS__)
+
+/* A run of file pages, stored in contiguous pages of the kpage window. */
+struct tmpfs_extent {
+	uint32_t page;    /* Index of the first file page in the extent. */
+	uint32_t count;   /* Number of pages in the extent.              */
+	uint32_t address; /* Virtual address of the first page.          */
+};
+
+/* A tmpfs file or directory. The node must be the first member, so that the
+ * fs_node pointers handed to the VFS can be cast back to the inode. */
+struct tmpfs_inode {
+	struct fs_node node;
+	struct dirent dirent;              /* Returned by readdir.            */
+	struct tmpfs_inode *parent;        /* Containing directory.           */
+	struct tmpfs_inode *next;          /* Next entry in the parent.       */
+	struct tmpfs_inode *children;      /* Directories: first entry.       */
+	struct tmpfs_extent *extents;      /* Files: extents, sorted by page. */
+	uint32_t extent_count;
+	uint32_t extent_capacity;
+	uint32_t mapped_end;               /* Files: pages below were mapped. */
+	int unlinked;                      /* Removed from its directory.     */
+};
+
+/* Create an empty, writable RAM filesystem and return its root directory,
+ * which may be mounted with fs_mount(). File contents are stored in pages
+ * allocated with kpage_alloc(), never on the kernel heap. Pages are only
+ * allocated when written, so files may be sparse.
+ *
+ * Unlinking a file which is open removes its name, and its pages are freed
+ * when the last open file is closed. mmap maps the file's own frames, and there
+ * is no munmap, so pages which have been mapped are kept for good: a file
+ * cannot be truncated below them, and unlinking it keeps its pages. */
+struct fs_node *init_tmpfs(void);
+
+#endif /* _TMPFS_H */
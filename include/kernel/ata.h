@@ -0,0 +1,61 @@
+#ifndef _ATA_H
+#define _ATA_H
+
+#include <fs/block.h>
+#include <kernel/debug.h>
+#include <kernel/port.h>
+#include <kernel/types.h>
+
+/* The most verbose ATA messages compiled in. */
+#define ATA_LOG_LEVEL LOG_DEBUG
+
+#define ata_debug(...) debug_log(ATA, LOG_DEBUG, __VA_ARGS__)
+
+/* The most sectors in one transfer. A single command can move up to 256
+ * sectors with 28 bit addressing. */
+#define ATA_MAX_SECTORS 128
+
+/* The number of entries in a channel's physical region descriptor table,
+ * which fills one page. */
+#define ATA_PRDT_SIZE 512
+
+/* Set in the flags of the last entry in the PRDT. */
+#define ATA_PRD_EOT 0x8000
+
+/* A physical region descriptor, describing one physically contiguous buffer of
+ * a DMA transfer. A region must not cross a 64 KB boundary, and a size of 0
+ * means 64 KB. */
+struct ata_prd {
+	uint32_t address;
+	uint16_t size;
+	uint16_t flags;
+} __attribute__((packed));
+
+struct ata_drive;
+
+struct ata_channel {
+	port_t io;                    /* Task file registers.                 */
+	port_t control;               /* Device control register.             */
+	port_t busmaster;             /* Bus master registers, or 0 if none.  */
+	uint8_t irq;
+	struct ata_prd *prdt;         /* DMA descriptor table.                */
+	uint32_t prdt_physical;
+	struct ata_drive *drives[2];  /* Master and slave, if present.        */
+	struct ata_drive *active;     /* Drive with a transfer in progress.   */
+	struct block_transfer *transfer; /* The transfer in progress.         */
+	int dma;                      /* Whether the transfer uses DMA.       */
+	int flushing;                 /* FLUSH CACHE after a DMA write.       */
+};
+
+struct ata_drive {
+	struct block_device device;
+	struct ata_channel *channel;
+	uint8_t slave;
+};
+
+/* Probe the legacy IDE channels for ATA disks and register each as a block
+ * device, named hda to hdd. Transfers use bus master DMA if a PCI IDE
+ * controller supports it, and PIO otherwise. */
+void init_ata(void);
+
+#endif /* _ATA_H */
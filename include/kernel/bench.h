@@ -0,0 +1,21 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <kernel/types.h>
+
+/* In-kernel benchmarks, for scripts/bench.sh. When the kernel command line has
+ * the word "bench", kmain() runs them once it has booted, prints the results on
+ * the console as a JSON object between "bench: begin" and "bench: end" lines,
+ * and asks QEMU to exit through the isa-debug-exit device.
+ *
+ * Times are measured with the time stamp counter, whose rate is found against
+ * the timer before the first benchmark. */
+
+/* Whether 'command_line' asks for the benchmarks. */
+int bench_requested(const char *command_line);
+
+/* Run every benchmark and report, then exit QEMU with DEBUG_EXIT_SUCCESS, or
+ * halt if it cannot. Does not return. */
+void bench_run(void);
+
+#endif /* _BENCH_H */
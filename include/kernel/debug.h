@@ -0,0 +1,84 @@
+#ifndef _DEBUG_H
+#define _DEBUG_H
+
+#include <kernel/log.h>
+#include <kernel/types.h>
+
+/* Subsystem logging. Each subsystem's header sets <NAME>_LOG_LEVEL, the most
+ * verbose of its messages to compile in, and wraps debug_log(), as in:
+ *
+ *     #define HEAP_LOG_LEVEL LOG_DEBUG
+ *     #define heap_debug(...) debug_log(HEAP, LOG_DEBUG, __VA_ARGS__)
+ *
+ * A message is compiled in if its level is no more verbose than both its
+ * subsystem's level and LOG_LEVEL_MAX, and otherwise leaves no code, not even
+ * its arguments. One that is compiled in is written, prefixed with where it
+ * came from. Warnings and errors are always written; more verbose messages
+ * only if their subsystem's bit is set in debug_mask. */
+
+/* The most verbose level compiled in anywhere. Builds without DEBUG drop all
+ * debugging messages. */
+#ifndef LOG_LEVEL_MAX
+# ifdef DEBUG
+#  define LOG_LEVEL_MAX LOG_DEBUG
+# else
+#  define LOG_LEVEL_MAX LOG_INFO
+# endif
+#endif
+
+/* Subsystem bits in debug_mask. */
+#define DEBUG_AIO           0x00000001
+#define DEBUG_ATA           0x00000002
+#define DEBUG_BLOCK         0x00000004
+#define DEBUG_EXT2          0x00000008
+#define DEBUG_FAT           0x00000010
+#define DEBUG_GDT           0x00000020
+#define DEBUG_HEAP          0x00000040
+#define DEBUG_IDT           0x00000080
+#define DEBUG_INITRD        0x00000100
+#define DEBUG_ISR           0x00000200
+#define DEBUG_ORDERED_ARRAY 0x00000400
+#define DEBUG_PAGE_CACHE    0x00000800
+#define DEBUG_PAGING        0x00001000
+#define DEBUG_PCI           0x00002000
+#define DEBUG_SCHED         0x00004000
+#define DEBUG_SERIAL        0x00008000
+#define DEBUG_STDIO         0x00010000
+#define DEBUG_TIMER         0x00020000
+#define DEBUG_TMPFS         0x00040000
+#define DEBUG_VIRTIO        0x00080000
+#define DEBUG_ALL           0x000FFFFF
+
+/* Subsystems logged until told otherwise. Paging logs every switch of page
+ * directory, so it is left out. */
+#define DEBUG_DEFAULT       (DEBUG_ALL & ~DEBUG_PAGING)
+
+extern uint32_t debug_mask;
+
+#define debug_compiled(subsystem, level)				\
+	((level) <= LOG_LEVEL_MAX && (level) <= subsystem##_LOG_LEVEL)
+
+#define debug_enabled(subsystem, level)					\
+	((level) <= LOG_WARNING || (debug_mask & DEBUG_##subsystem))
+
+#define debug_log(subsystem, level, ...)				\
+	do {								\
+		if (debug_compiled(subsystem, level) &&			\
+		    debug_enabled(subsystem, level)) {			\
+			debug_printf((level), __FILE__, __LINE__,	\
+				     __func__, __VA_ARGS__);		\
+		}							\
+	} while (0)
+
+/* Set debug_mask from the "debug=" option of the kernel command line, if
+ * there is one: a comma separated list of subsystem names, such as
+ * "debug=heap,paging", or "all" or "none". Warnings and errors are logged
+ * whatever it is set to. */
+void init_debug(const char *command_line);
+
+/* Log a message at 'level' with its file, line and function. Use debug_log()
+ * rather than calling this directly. */
+void debug_printf(int level, const char *file, int line, const char *function,
+		  const char *format, ...);
+
+#endif /* _DEBUG_H */
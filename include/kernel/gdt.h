@@ -1,20 +1,13 @@
 #ifndef _GDT_H
 #define _GDT_H
 
+#include <kernel/debug.h>
 #include <kernel/types.h>
 
-/* Define this for GDT debugging. */
-#define GDT_DEBUG 1
-
-#ifdef GDT_DEBUG
-# define gdt_debug(...) {				\
-		kdebug("%s:%d, %s() ",			\
-		       __FILE__, __LINE__, __func__);	\
-		kdebug(__VA_ARGS__);			\
-	}
-#else
-# define gdt_debug(f, ...) /**/
-#endif
+/* The most verbose GDT messages compiled in. */
+#define GDT_LOG_LEVEL LOG_DEBUG
+
+#define gdt_debug(...) debug_log(GDT, LOG_DEBUG, __VA_ARGS__)
 
 struct gdt_entry {
 	uint16_t limit_low;     /* The lower 16 bits of the limit. */
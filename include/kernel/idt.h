@@ -1,20 +1,13 @@
 #ifndef _IDT_H
 #define _IDT_H
 
+#include <kernel/debug.h>
 #include <kernel/types.h>
 
-/* Define this for IDT debugging. */
-#define IDT_DEBUG 1
+/* The most verbose IDT messages compiled in. */
+#define IDT_LOG_LEVEL LOG_DEBUG
 
-#ifdef IDT_DEBUG
-# define idt_debug(...) {				\
-		kdebug("%s:%d, %s() ",			\
-		       __FILE__, __LINE__, __func__);	\
-		kdebug(__VA_ARGS__);			\
-	}
-#else
-# define idt_debug(f, ...) /**/
-#endif
+#define idt_debug(...) debug_log(IDT, LOG_DEBUG, __VA_ARGS__)
 
 struct idt_entry {
 	uint16_t base_low;  /* The lower 16 bits of the interrupt address. */
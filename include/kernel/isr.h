@@ -1,20 +1,13 @@
 #ifndef _ISR_H
 #define _ISR_H
 
+#include <kernel/debug.h>
 #include <kernel/types.h>
 
-/* Define this for ISR debugging. */
-#define ISR_DEBUG 1
+/* The most verbose ISR messages compiled in. */
+#define ISR_LOG_LEVEL LOG_DEBUG
 
-#ifdef ISR_DEBUG
-# define isr_debug(...) {						\
-			 kdebug("%s:%d, %s() ",				\
-					__FILE__, __LINE__, __func__);	\
-			 kdebug(__VA_ARGS__);				\
-			 }
-#else
-# define isr_debug(f, ...) /**/
-#endif
+#define isr_debug(...) debug_log(ISR, LOG_DEBUG, __VA_ARGS__)
 
 /* IRQ mappings. */
 #define IRQ0  32
@@ -64,6 +57,9 @@ struct registers {
 /* ISR handler function. */
 typedef void (*isr_t)(struct registers);
 
-void register_interrupt_handler(uint8_t interrupt_number, isr_t handler);
+/* Install 'handler' for 'interrupt_number', replacing any handler already
+ * there, and return the one replaced, or 0. Drivers on an interrupt line which
+ * may be shared call the returned handler from their own. */
+isr_t register_interrupt_handler(uint8_t interrupt_number, isr_t handler);
 
 #endif /* _ISR_H */
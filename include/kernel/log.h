@@ -0,0 +1,75 @@
+#ifndef _LOG_H
+#define _LOG_H
+
+#include <kernel/types.h>
+
+/* Message levels, most severe first, as used by syslog. */
+#define LOG_EMERG   0
+#define LOG_ALERT   1
+#define LOG_CRIT    2
+#define LOG_ERR     3
+#define LOG_WARNING 4
+#define LOG_NOTICE  5
+#define LOG_INFO    6
+#define LOG_DEBUG   7
+
+/* Records kept in the ring. Must be a power of two. */
+#define LOG_RECORDS 256
+
+/* The most text held by a record. Longer messages take several records. */
+#define LOG_TEXT_MAX 116
+
+/* Record flags. A record without a newline at the end is continued by the next
+ * one written, which has LOG_CONTINUED set. */
+#define LOG_CONTINUED 0x01
+
+/* A message, or part of one, in the ring. */
+struct log_record {
+	uint32_t sequence;          /* Its sequence number once written.    */
+	uint32_t timestamp;         /* Milliseconds since boot.             */
+	uint8_t level;
+	uint8_t length;             /* Of the text.                         */
+	uint8_t flags;
+	uint8_t reserved;
+	char text[LOG_TEXT_MAX];    /* Not null-terminated.                 */
+};
+
+/* A consumer of the log, which is handed the text of each record in order.
+ * Consoles are written to by log_drain(), which is called on each timer tick,
+ * so that writing a message does not wait for the console. A console with
+ * room() is not given more than it can take, and catches up on a later drain. */
+struct log_console {
+	const char *name;
+	void (*write)(const char *text, uint32_t length);
+	void (*flush)(void);        /* Optional, after each drain.          */
+	uint32_t (*room)(void);     /* Optional, bytes it can take now.     */
+	void (*sync)(void);         /* Optional, wait for output to finish. */
+	uint32_t sequence;          /* The next record to write.            */
+	struct log_console *next;
+};
+
+/* Register the kernel log with devfs as /dev/kmsg, which reads as the retained
+ * messages, one line each, with level and timestamp. The log itself works from
+ * the start of boot. */
+void init_log(void);
+
+/* Append 'length' bytes of 'text' at 'level', starting a new record after each
+ * newline. Safe to call from interrupt handlers: writers only disable
+ * interrupts to take a sequence number, and never wait for each other or for a
+ * console. When the ring is full, the oldest records are overwritten. */
+void log_write(int level, const char *text, uint32_t length);
+
+/* Add a console, which will be sent the records from the oldest still in the
+ * ring onwards. */
+void log_register_console(struct log_console *console);
+
+/* Write any new records to the consoles. Does nothing if a drain is already
+ * in progress. */
+void log_drain(void);
+
+/* Write all records to the consoles now, skipping those whose writer will not
+ * finish, for use when nothing else will run again, as in a panic. Consoles
+ * with sync() are waited for. */
+void log_flush(void);
+
+#endif /* _LOG_H */
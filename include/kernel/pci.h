@@ -0,0 +1,128 @@
+#ifndef _PCI_H
+#define _PCI_H
+
+#include <kernel/debug.h>
+#include <kernel/types.h>
+
+/* The most verbose PCI messages compiled in. */
+#define PCI_LOG_LEVEL LOG_DEBUG
+
+#define pci_debug(...) debug_log(PCI, LOG_DEBUG, __VA_ARGS__)
+
+/* Configuration space registers. */
+#define PCI_VENDOR_ID      0x00
+#define PCI_DEVICE_ID      0x02
+#define PCI_COMMAND        0x04
+#define PCI_CLASS          0x08 /* Class, subclass, interface, revision. */
+#define PCI_HEADER_TYPE    0x0C /* Byte 2 of the dword.                  */
+#define PCI_BAR0           0x10
+#define PCI_BUS_NUMBERS    0x18 /* Bridges: primary, secondary bus.      */
+#define PCI_INTERRUPT_LINE 0x3C
+
+/* Command register bits. */
+#define PCI_COMMAND_IO        0x01
+#define PCI_COMMAND_MEMORY    0x02
+#define PCI_COMMAND_BUSMASTER 0x04
+
+/* Header types, and the bit set in the header type of a multi-function
+ * device. */
+#define PCI_HEADER_DEVICE        0x00
+#define PCI_HEADER_BRIDGE        0x01
+#define PCI_HEADER_MULTIFUNCTION 0x80
+
+/* The most devices kept in the device table. */
+#define PCI_MAX_DEVICES 32
+
+/* Base address registers in a device header. */
+#define PCI_BARS 6
+
+/* Matches any vendor, device or class in a struct pci_id. */
+#define PCI_ANY_ID 0xFFFF
+
+/* Interrupt line of a device which does not use an interrupt. */
+#define PCI_NO_IRQ 0xFF
+
+/* BAR flags. */
+#define PCI_BAR_IO       0x1  /* I/O space, otherwise memory space.      */
+#define PCI_BAR_PREFETCH 0x2
+#define PCI_BAR_64       0x4  /* Occupies this BAR and the next.         */
+
+/* The location of a device function on the bus. */
+struct pci_function {
+	uint8_t bus;
+	uint8_t slot;
+	uint8_t function;
+};
+
+/* A decoded base address register. A size of 0 means the BAR is unused, or
+ * lies above 4 GB where it cannot be reached. */
+struct pci_bar {
+	uint32_t address;           /* Port or physical address.            */
+	uint32_t size;              /* In bytes.                            */
+	uint8_t flags;              /* PCI_BAR_* flags.                     */
+	uint32_t virtual;           /* Mapping from pci_map_bar(), or 0.    */
+};
+
+struct pci_driver;
+
+/* A function found on the bus when it was enumerated. */
+struct pci_device {
+	struct pci_function function;
+	uint16_t vendor;
+	uint16_t device;
+	uint8_t class;
+	uint8_t subclass;
+	uint8_t interface;
+	uint8_t revision;
+	uint8_t irq;                /* Interrupt line, or PCI_NO_IRQ.       */
+	struct pci_bar bars[PCI_BARS];
+	struct pci_driver *driver;  /* Driver bound to the device, or 0.    */
+	void *data;                 /* Private to the driver.               */
+};
+
+/* An ID a driver handles. Fields set to PCI_ANY_ID match anything, and 'class'
+ * is the class and subclass as class << 8 | subclass. A driver's table is
+ * ended by an entry with every field 0. */
+struct pci_id {
+	uint16_t vendor;
+	uint16_t device;
+	uint16_t class;
+};
+
+/* Called for each unbound device matching one of the driver's IDs. Returns 0
+ * to bind the driver to the device, or -1 to leave it for other drivers. */
+typedef int (*pci_probe_t)(struct pci_device *);
+
+struct pci_driver {
+	const char *name;
+	const struct pci_id *ids;
+	pci_probe_t probe;
+	struct pci_driver *next;
+};
+
+/* Enumerate every bus with configuration mechanism #1, following PCI to PCI
+ * bridges, and fill in the device table. Must be called after init_paging(),
+ * so that drivers can map their BARs. */
+void init_pci(void);
+
+/* Read and write a dword of a function's configuration space. 'offset' is
+ * rounded down to a multiple of four. */
+uint32_t pci_read(struct pci_function *function, uint8_t offset);
+void pci_write(struct pci_function *function, uint8_t offset, uint32_t value);
+
+/* Add 'driver' to the driver list, and probe it against every device found by
+ * init_pci() which has no driver yet. */
+void pci_register_driver(struct pci_driver *driver);
+
+/* Return the 'index'th device in the table, or 0 past the end. */
+struct pci_device *pci_get_device(uint32_t index);
+
+/* Set the given PCI_COMMAND_* bits in the device's command register. */
+void pci_enable(struct pci_device *device, uint16_t command);
+
+/* Return the port of an I/O space BAR, or the virtual address of a memory
+ * space BAR, which is mapped uncached into the kpage window on first use.
+ * Returns 0 if the BAR is unused or cannot be mapped. */
+uint32_t pci_map_bar(struct pci_device *device, uint32_t index);
+
+#endif /* _PCI_H */
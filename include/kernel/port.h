@@ -1,9 +1,14 @@
 #ifndef _PORT_H
 #define _PORT_H
 
+#include <ports/ata.h>
+#include <ports/debug-exit.h>
+#include <ports/pci.h>
 #include <ports/pic.h>
 #include <ports/pit.h>
+#include <ports/serial.h>
 #include <ports/tty.h>
+#include <ports/virtio.h>
 
 #include <kernel/types.h>
 
@@ -11,6 +16,13 @@ typedef unsigned short port_t;
 
 void out_byte(port_t port, uint8_t value);
 uint8_t in_byte(port_t port);
+void out_word(port_t port, uint16_t value);
 uint16_t in_word(port_t port);
+void out_long(port_t port, uint32_t value);
+uint32_t in_long(port_t port);
+
+/* Transfer 'count' words between 'port' and 'buffer' with rep insw/outsw. */
+void in_words(port_t port, uint16_t *buffer, uint32_t count);
+void out_words(port_t port, uint16_t *buffer, uint32_t count);
 
 #endif /* _PORT_H */
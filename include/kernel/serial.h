@@ -0,0 +1,44 @@
+#ifndef _SERIAL_H
+#define _SERIAL_H
+
+#include <fs/fs.h>
+#include <kernel/debug.h>
+#include <kernel/log.h>
+#include <kernel/port.h>
+#include <kernel/types.h>
+
+/* The most verbose serial port messages compiled in. */
+#define SERIAL_LOG_LEVEL LOG_DEBUG
+
+#define serial_debug(...) debug_log(SERIAL, LOG_DEBUG, __VA_ARGS__)
+
+/* Line speed. */
+#define SERIAL_BAUD 115200
+
+/* Sizes of the transmit and receive rings. Must be powers of two. */
+#define SERIAL_TX_BUFFER 4096
+#define SERIAL_RX_BUFFER 256
+
+struct serial_port {
+	port_t io;
+	uint8_t irq;
+	uint8_t interrupts;             /* Copy of the enable register.     */
+	int transmitting;               /* TX interrupt enabled.            */
+	uint8_t tx[SERIAL_TX_BUFFER];
+	uint32_t tx_head, tx_tail;      /* Free running; head is written.   */
+	uint8_t rx[SERIAL_RX_BUFFER];
+	uint32_t rx_head, rx_tail;
+	uint32_t rx_dropped;
+	struct fs_node node;
+	struct log_console console;
+};
+
+/* Find COM1 and, if it is there, make it a console for the kernel log and the
+ * character device /dev/ttyS0. Output is queued in a ring buffer and fed to
+ * the UART's FIFO sixteen bytes at a time from the transmit interrupt, so
+ * writers do not wait for the line unless the ring is full. Received bytes are queued
+ * by the receive interrupt, and reads of the device return what has arrived
+ * without waiting. */
+void init_serial(void);
+
+#endif /* _SERIAL_H */
@@ -1,21 +1,18 @@
 #ifndef _TIMER_H
 #define _TIMER_H
 
+#include <kernel/debug.h>
 #include <kernel/types.h>
 
-/* Define this for TIMER debugging. */
-#define TIMER_DEBUG 1
+/* The most verbose TIMER messages compiled in. */
+#define TIMER_LOG_LEVEL LOG_DEBUG
 
-#ifdef TIMER_DEBUG
-# define timer_debug(...) {				\
-		kdebug("%s:%d, %s() ",			\
-		       __FILE__, __LINE__, __func__);	\
-		kdebug(__VA_ARGS__);			\
-	}
-#else
-# define timer_debug(f, ...) /**/
-#endif
+#define timer_debug(...) debug_log(TIMER, LOG_DEBUG, __VA_ARGS__)
 
 void init_timer(uint32_t frequency);
 
+/* Time since the timer was started, in milliseconds, to the resolution of
+ * a tick. Returns 0 before init_timer(). */
+uint32_t timer_milliseconds(void);
+
 #endif /* _TIMER_H */
@@ -11,7 +11,9 @@ void tty_clear(void);
 void tty_scroll_line(void);
 void tty_move_cursor(uint8_t x, uint8_t y);
 
-/* Output text. */
+/* Output text. Characters written with tty_putc() and the number printing
+ * functions are shown at the next tty_flush(), which tty_write(), tty_nwrite()
+ * and printf() do when they finish, and the timer does regularly. */
 void tty_putc(char c);
 void tty_puth(uint32_t h);
 void tty_putb(uint32_t b);
@@ -20,6 +22,7 @@ void tty_puti(int i);
 
 void tty_write(const char *c);
 void tty_nwrite(const char *c, int n);
+void tty_flush(void);
 
 void tty_set_foreground_colour(enum tty_colour_e colour);
 void tty_set_background_colour(enum tty_colour_e colour);
@@ -1,12 +1,12 @@
 #ifndef _TYPES_H
 #define _TYPES_H
 
-typedef          long  sint64_t;
+typedef     long long  sint64_t;
 typedef          int   sint32_t;
 typedef          short sint16_t;
 typedef          char  sint8_t;
 
-typedef unsigned long  uint64_t;
+typedef unsigned long long uint64_t;
 typedef unsigned int   uint32_t;
 typedef unsigned short uint16_t;
 typedef unsigned char  uint8_t;
@@ -14,6 +14,20 @@
 #define high_byte(n) ((n) << 8)
 #define low_byte(n) ((n) & 0x00FF)
 
+/* Disable interrupts, saving the previous state in 'flags', and restore it.
+ * Unlike a cli/sti pair, these nest and are safe in interrupt handlers. The
+ * host tests run in user mode, where cli faults and there are no interrupts
+ * to disable. */
+#ifdef HOST_TEST
+#define irq_save(flags) ((flags) = 0)
+#define irq_restore(flags) ((void)(flags))
+#else
+#define irq_save(flags)							\
+	__asm volatile("pushf; pop %0; cli" : "=r" (flags) : : "memory")
+#define irq_restore(flags)						\
+	__asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc")
+#endif
+
 #define min(x, y) (((x) < (y)) ? (x) : (y))
 #define max(x, y) (((x) > (y)) ? (x) : (y))
 
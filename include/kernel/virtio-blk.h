@@ -0,0 +1,103 @@
+#ifndef _VIRTIO_BLK_H
+#define _VIRTIO_BLK_H
+
+#include <fs/block.h>
+#include <kernel/debug.h>
+#include <kernel/pci.h>
+#include <kernel/port.h>
+#include <kernel/types.h>
+
+/* The most verbose virtio-blk messages compiled in. */
+#define VIRTIO_LOG_LEVEL LOG_DEBUG
+
+#define virtio_debug(...) debug_log(VIRTIO, LOG_DEBUG, __VA_ARGS__)
+
+/* PCI IDs of a transitional virtio block device. */
+#define VIRTIO_VENDOR     0x1AF4
+#define VIRTIO_BLK_DEVICE 0x1001
+
+/* The most virtio-blk devices supported. */
+#define VIRTIO_BLK_MAX 4
+
+/* The most sectors in one transfer. */
+#define VIRTIO_BLK_MAX_SECTORS 256
+
+/* Feature bits. */
+#define VIRTIO_BLK_F_SEG_MAX   (1 << 2)
+#define VIRTIO_RING_F_EVENT_IDX (1 << 29)
+
+/* Request types. */
+#define VIRTIO_BLK_T_IN  0
+#define VIRTIO_BLK_T_OUT 1
+
+/* Descriptor flags. */
+#define VIRTQ_DESC_F_NEXT  0x1
+#define VIRTQ_DESC_F_WRITE 0x2 /* Written by the device. */
+
+/* Set by the device in the used ring's flags when it does not need to be
+ * notified of new buffers. */
+#define VIRTQ_USED_F_NO_NOTIFY 0x1
+
+/* The legacy interface aligns the used ring to a page. */
+#define VIRTQ_ALIGN 0x1000
+
+struct virtq_desc {
+	uint64_t address;   /* Physical address of the buffer.          */
+	uint32_t length;
+	uint16_t flags;
+	uint16_t next;      /* Next descriptor if VIRTQ_DESC_F_NEXT.    */
+} __attribute__((packed));
+
+/* The available ring is followed by a 16 bit used_event, and the used ring by
+ * a 16 bit avail_event, if VIRTIO_RING_F_EVENT_IDX is negotiated. */
+struct virtq_avail {
+	uint16_t flags;
+	uint16_t index;
+	uint16_t ring[];
+} __attribute__((packed));
+
+struct virtq_used_elem {
+	uint32_t id;        /* Head of the completed descriptor chain.  */
+	uint32_t length;    /* Bytes written by the device.             */
+} __attribute__((packed));
+
+struct virtq_used {
+	uint16_t flags;
+	uint16_t index;
+	struct virtq_used_elem ring[];
+} __attribute__((packed));
+
+/* The header and status byte which surround the data of a request. One is
+ * kept for each transfer slot of the block device. */
+struct virtio_blk_header {
+	uint32_t type;
+	uint32_t reserved;
+	uint64_t sector;
+	uint8_t status;     /* Written by the device; 0 on success.     */
+} __attribute__((packed));
+
+struct virtio_blk {
+	struct block_device device;
+	struct pci_device *pci;
+	port_t io;                      /* Legacy register BAR.               */
+	uint8_t irq;
+	uint32_t features;              /* Negotiated features.               */
+	uint16_t size;                  /* Entries in the virtqueue.          */
+	uint32_t seg_max;               /* Most data descriptors per request. */
+	struct virtq_desc *desc;
+	struct virtq_avail *avail;
+	struct virtq_used *used;
+	uint16_t free_head;             /* First unused descriptor.           */
+	uint16_t free_count;
+	uint16_t last_used;             /* Used ring entries consumed.        */
+	uint16_t in_flight;             /* Requests owned by the device.      */
+	struct virtio_blk_header *headers;  /* One per transfer slot.         */
+	uint32_t headers_physical;
+	struct block_transfer **chains; /* Transfer of each chain head.       */
+};
+
+/* Register the virtio-blk PCI driver. Each device it binds is registered as a
+ * block device, named vda to vdd. Each keeps up to BLOCK_MAX_IN_FLIGHT requests in flight. */
+void init_virtio_blk(void);
+
+#endif /* _VIRTIO_BLK_H */
@@ -1,20 +1,15 @@
 #ifndef _ORDERED_ARRAY_H
 #define _ORDERED_ARRAY_H
 
+#include <kernel/debug.h>
 #include <kernel/types.h>
 
-/* Define this for ordered array debugging. */
-#define ORDERED_ARRAY_DEBUG 1
-
-#ifdef ORDERED_ARRAY_DEBUG
-# define ordered_array_debug(...) {			\
-		kdebug("%s:%d, %s() ",			\
-		       __FILE__, __LINE__, __func__);	\
-		kdebug(__VA_ARGS__);			\
-	}
-#else
-# define ordered_array_debug(f, ...) /**/
-#endif
+/* The most verbose ordered array messages compiled in. */
+#define ORDERED_ARRAY_LOG_LEVEL LOG_DEBUG
+
+#define ordered_array_log(level, ...)			\
+	debug_log(ORDERED_ARRAY, level, __VA_ARGS__)
+#define ordered_array_debug(...) ordered_array_log(LOG_DEBUG, __VA_ARGS__)
 
 /* Predicates must return non-zero if the first argument is greater than the
  * second. If the second argument is less than the first, return zero. */
@@ -1,13 +1,17 @@
 #ifndef _KSTREAM_H
 #define _KSTREAM_H
 
+#include <kernel/debug.h>
+#include <kernel/log.h>
 #include <kernel/stdarg.h>
 #include <kernel/util.h>
 
 void init_kstream(void);
 
-/* kprintf() and kvprintf produce output according to a format as described
- * below by writing output to kstream.
+/* printf() and vprintf() produce output according to a format as described
+ * below by writing output to the kernel log. nprintf() and nvprintf() read
+ * no more than 'size' characters of the format. snprintf() and vsnprintf()
+ * write to the character string 'string'.
  *
  * RETURN VALUE
  *
@@ -30,22 +34,69 @@ void init_kstream(void);
  * directives: ordinary characters (not %), which are copied unchanged to the
  * output stream; and conversion specifications, each of which results in
  * fetching zero or more subsequent arguments.  Each conversion specification
- * consists of the character %, followed by a conversion character.
+ * is introduced by the character %, and ends with a conversion specifier.  In
+ * between there may be (in this order) zero or more flags, an optional minimum
+ * field width, an optional precision and an optional length modifier.
  *
  * The arguments must correspond properly (after type promotion) with the
  * conversion specifier. By default, the arguments are used in the order given,
  * where each '*' and each conversion specifier asks for the next argument (and
  * it is an error if insufficiently many arguments are given).
  *
- * THE CONVERSION CHARACTER
+ * THE FLAG CHARACTERS
  *
- * A character that specifies the type of conversion to be applied.  The
- * conversion specifiers and their meanings are:
+ * #     For o, the first character of the output is a zero.  For x and X, a
+ *       nonzero result has 0x or 0X prepended.
+ *
+ * 0     Numbers are padded on the left with zeros rather than blanks.  If a
+ *       precision is given, or the - flag, the 0 flag is ignored.
+ *
+ * -     The converted value is padded on the right with blanks.
+ *
+ * ' '   A blank is left before a positive number produced by a signed
+ *       conversion.
+ *
+ * +     A sign is always placed before a number produced by a signed
+ *       conversion.  A + overrides a space if both are used.
+ *
+ * THE FIELD WIDTH
+ *
+ * An optional decimal digit string specifying a minimum field width, or '*'
+ * to take it from the next int argument.  A negative width is taken as a -
+ * flag followed by a positive width.
+ *
+ * THE PRECISION
+ *
+ * An optional period followed by a decimal digit string, or by '*' to take it
+ * from the next int argument.  It gives the minimum number of digits for
+ * integer conversions, and the maximum number of characters to be printed
+ * from a string for s.
+ *
+ * THE LENGTH MODIFIER
+ *
+ * hh    An integer conversion is of a signed char or unsigned char argument.
+ *
+ * h     An integer conversion is of a short or unsigned short argument.  The
+ *       h is only a length modifier when an integer conversion follows it,
+ *       since on its own it is the h conversion below.
+ *
+ * l, z, t
+ *       An integer conversion is of a 32 bit argument, as with no modifier.
+ *
+ * ll, j An integer conversion is of a long long or unsigned long long argument.
+ *
+ * THE CONVERSION SPECIFIER
  *
  * d, i  The int argument is converted to signed decimal notation.
  *
- * f, F  The double argument is rounded and converted to decimal notation in the
- *       style [-]ddd.ddd.
+ * o, u, x, X
+ *       The unsigned int argument is converted to unsigned octal (o), unsigned
+ *       decimal (u), or unsigned hexadecimal (x and X) notation.  The letters
+ *       abcdef are used for x conversions; the letters ABCDEF are used for X
+ *       conversions.
+ *
+ * h, p  The unsigned int or pointer argument is converted to upper case
+ *       hexadecimal, prefixed with 0x.
  *
  * c     The int argument is converted to an unsigned char, and the resulting
  *       character is written.
@@ -56,29 +107,31 @@ void init_kstream(void);
  *
  * %     A '%' is written. No argument is converted. The complete conversion
  *       specification is '%%'.
+ *
+ * Any other conversion specification is written as it is.
  */
 int printf(const char *format, ...);
 int vprintf(const char *format, va_list ap);
 int nprintf(size_t size, const char *format, ...);
 int nvprintf(size_t size, const char *format, va_list ap);
+int snprintf(char *string, size_t size, const char *format, ...);
+int vsnprintf(char *string, size_t size, const char *format, va_list ap);
 
-#ifdef DEBUG
-# define kdebug(...)   printf(__VA_ARGS__)
+/* Output is not written to the screen directly, but appended to the kernel
+ * log, from which the consoles are written asynchronously. printf() logs at
+ * LOG_INFO, and klog() and vklog() at 'level'. */
+int klog(int level, const char *format, ...);
+int vklog(int level, const char *format, va_list ap);
+
+#if LOG_LEVEL_MAX >= LOG_DEBUG
+# define kdebug(...)   klog(LOG_DEBUG, __VA_ARGS__)
 #else
 # define kdebug(...)
-#endif /* DEBUG */
+#endif /* LOG_LEVEL_MAX >= LOG_DEBUG */
 
-/* Define this for stdio debugging. */
-#define STDIO_DEBUG 1
+/* The most verbose stdio messages compiled in. */
+#define STDIO_LOG_LEVEL LOG_DEBUG
 
-#ifdef STDIO_DEBUG
-# define stdio_debug(...) {				\
-		kdebug("%s:%d, %s() ",		\
-		       __FILE__, __LINE__, __func__);	\
-		kdebug(__VA_ARGS__);			\
-	}
-#else
-# define stdio_debug(f, ...) /**/
-#endif
+#define stdio_debug(...) debug_log(STDIO, LOG_DEBUG, __VA_ARGS__)
 
 #endif /* _KSTREAM_H */
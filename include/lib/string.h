@@ -18,7 +18,17 @@ char *strcpy(char *dest, const char *src);
  * respectively, to be less than, to match, or be greater than s2. */
 int strcmp(const char *s1, const char *s2);
 
+/* The strhash() function returns a 32-bit FNV-1a hash of the string s. The
+ * hash is stable across calls, so it may be precomputed and stored alongside
+ * the string for fast lookups. */
+uint32_t strhash(const char *s);
+
+/* memcpy() copies 'length' bytes from src to destination, which must not
+ * overlap; memmove() allows them to. memset() fills 'length' bytes of
+ * destination with 'value'. All three return destination, and move whole
+ * words once the destination is aligned. */
 uint8_t *memcpy(uint8_t *destination, const uint8_t *src, uint32_t length);
+uint8_t *memmove(uint8_t *destination, const uint8_t *src, uint32_t length);
 uint8_t *memset(uint8_t *destination, uint8_t value, uint32_t length);
 
 #endif /* _STRING_H */
@@ -1,21 +1,14 @@
 #ifndef _HEAP_H
 #define _HEAP_H
 
+#include <kernel/debug.h>
 #include <kernel/types.h>
 #include <lib/ordered-array.h>
 
-/* Define this for heap debugging. */
-#define HEAP_DEBUG 1
+/* The most verbose heap messages compiled in. */
+#define HEAP_LOG_LEVEL LOG_DEBUG
 
-#ifdef HEAP_DEBUG
-# define heap_debug(...) {				\
-		kdebug("%s:%d, %s() ",			\
-		       __FILE__, __LINE__, __func__);	\
-		kdebug(__VA_ARGS__);			\
-	}
-#else
-# define heap_debug(f, ...) /**/
-#endif
+#define heap_debug(...) debug_log(HEAP, LOG_DEBUG, __VA_ARGS__)
 
 /* Limits and characteristics of the heap. These are arbritary and
  * customiseable values. */
@@ -25,6 +18,14 @@
 #define HEAP_INDEX_SIZE     0x20000
 #define HEAP_MIN_SIZE       0x70000
 
+/* An invalid memory access in a heap algorithm can go totally undetected, so in
+ * order to provde some level of validation that a piece of memory is in fact a
+ * header or footer, we will define a symbolic constant that will be embedded
+ * inside of each header and footer. Note that their value is purely
+ * arbritary. */
+#define HEADER_ID 0xCEC004B3
+#define FOOTER_ID 0xCEC6F0FA
+
 struct header {
 	uint32_t id;     /* Symbolic constant, used for identification.   */
 	uint8_t is_hole; /* 1=hole, 0=block.                              */
@@ -0,0 +1,83 @@
+#ifndef _PAGE_CACHE_H
+#define _PAGE_CACHE_H
+
+#include <fs/fs.h>
+#include <kernel/debug.h>
+#include <kernel/types.h>
+
+/* The page cache holds file data in page-sized slots, keyed by the file node
+ * and the index of the page within the file. Reads and writes of nodes with
+ * the FS_PAGECACHE flag are served from the cache by fs_read() and fd_write(),
+ * and only call the driver to fill a missing page or to write back a dirty
+ * one.
+ *
+ * Each slot is backed by a frame from the physical frame allocator, mapped into
+ * a fixed window of kernel address space. Frames are allocated the first time a
+ * slot is used. When every slot is in use, a victim is chosen with the clock
+ * algorithm, and written back first if it is dirty. */
+
+/* The kernel virtual address window used by the cache. The page table for this
+ * window is created by init_paging(), so that it is shared by every page
+ * directory cloned from the kernel directory. */
+#define PAGE_CACHE_START 0xD0000000
+#define PAGE_CACHE_PAGES 256
+
+/* The number of hash buckets used to find a page. */
+#define PAGE_CACHE_BUCKETS 128
+
+/* When a read misses on a page whose predecessor is cached, the access is
+ * assumed to be sequential and this many following pages are read ahead. */
+#define PAGE_CACHE_READAHEAD 4
+
+/* The most frames taken back by page_cache_shrink() when the frame allocator
+ * runs out. */
+#define PAGE_CACHE_SHRINK_BATCH 16
+
+/* How often page_cache_writeback() writes dirty pages back, in milliseconds. */
+#define PAGE_CACHE_WRITEBACK_MS 5000
+
+/* The most verbose page cache messages compiled in. */
+#define PAGE_CACHE_LOG_LEVEL LOG_DEBUG
+
+#define page_cache_log(level, ...) debug_log(PAGE_CACHE, level, __VA_ARGS__)
+#define page_cache_debug(...) page_cache_log(LOG_DEBUG, __VA_ARGS__)
+
+struct cached_page {
+	struct fs_node *node;           /* Owning node, or 0 if unused.     */
+	uint32_t index;                 /* Page index within the file.      */
+	uint32_t length;                /* Number of valid bytes.           */
+	uint8_t referenced;             /* Clock reference bit.             */
+	uint8_t dirty;                  /* Must be written back.            */
+	uint8_t mapped;                 /* Slot has a frame.                */
+	uint8_t busy;                   /* Being filled, keep the frame.    */
+	struct cached_page *hash_next;  /* Next page in the hash bucket.    */
+};
+
+void init_page_cache(void);
+
+/* Read and write file data through the cache. These have the semantics of the
+ * driver read and write callbacks. */
+uint32_t page_cache_read(struct fs_node *node, uint32_t offset,
+			 uint32_t size, uint8_t *buffer);
+uint32_t page_cache_write(struct fs_node *node, uint32_t offset,
+			  uint32_t size, uint8_t *buffer);
+
+/* Write back all dirty pages of 'node', or of every node if 'node' is 0. */
+void page_cache_sync(struct fs_node *node);
+
+/* Drop all cached pages of 'node' at or beyond byte 'offset', without writing
+ * them back. Used when a file is truncated or removed. */
+void page_cache_invalidate(struct fs_node *node, uint32_t offset);
+
+/* Write back dirty pages if PAGE_CACHE_WRITEBACK_MS have passed since the last
+ * time, so that data written to a file reaches the disk even if it is never
+ * evicted or synced. The filesystems are not reentrant, so this is called from
+ * the kernel's idle loop rather than from the timer interrupt. */
+void page_cache_writeback(void);
+
+/* Release up to 'count' unused or clean pages back to the frame allocator.
+ * Pages being filled by a driver are kept. Called by alloc_frame() when it
+ * runs out of frames. Returns the number of frames released. */
+uint32_t page_cache_shrink(uint32_t count);
+
+#endif /* _PAGE_CACHE_H */
@@ -1,12 +1,15 @@
 #ifndef _PAGING_H
 #define _PAGING_H
 
+#include <kernel/debug.h>
 #include <kernel/isr.h>
 #include <kernel/types.h>
 #include <lib/stdio.h>
 
-/* Define this for paging debugging. */
-#define PAGING_DEBUG 1
+/* The most verbose paging messages compiled in. */
+#define PAGING_LOG_LEVEL LOG_DEBUG
+
+#define paging_debug(...) debug_log(PAGING, LOG_DEBUG, __VA_ARGS__)
 
 /* The size of a page. */
 #define PAGE_SIZE 0x1000
@@ -22,36 +25,33 @@
 #define PAGE_OFFSET_MASK 0xFFF
 
 /* Determines whether an address is page aligned or not. To do so, it ANDs the
- * value with an alignment ask. If the address is page aligned, then the
- * alignment mask will mask off all nonzero digits. If the address does not fall
- * on a page boundary, then the index into the page will remain. */
-#define is_page_aligned(a) ((((a) & ALIGNMENT_MASK) == 0) ? 1 : 0)
+ * value with the page offset mask. If the address is page aligned, then the
+ * mask will leave nothing. If the address does not fall on a page boundary,
+ * then the index into the page will remain. */
+#define is_page_aligned(a) ((((a) & PAGE_OFFSET_MASK) == 0) ? 1 : 0)
 
 /* Here we set some limits and sizes to our memory. */
 #define PAGES_IN_TABLE 1024
 #define TABLES_IN_DIRECTORY 1024
 #define MEMORY_END_PAGE 0x01000000
 
+/* A window of kernel address space whose pages are individually backed by
+ * frames on demand, see kpage_alloc(). */
+#define KPAGE_START 0xD0400000
+#define KPAGE_PAGES 1024
+
 /* If we reach here, we're out of memory! */
 #define MEMORY_END_FRAME 0xFFFFFFFF
 
-#ifdef PAGING_DEBUG
-# define paging_debug(...) {				\
-		kdebug("%s:%d, %s() ",			\
-		       __FILE__, __LINE__, __func__);	\
-		kdebug(__VA_ARGS__);			\
-	}
-#else
-# define paging_debug(f, ...) /**/
-#endif
-
 struct page {
 	uint32_t present  :  1; /* Page present in memory. */
 	uint32_t rw       :  1; /* Read-only if clear, readwrite if set. */
 	uint32_t user     :  1; /* Supervisor level only if clear. */
+	uint32_t pwt      :  1; /* Write-through rather than write-back. */
+	uint32_t pcd      :  1; /* Not cached, as for device registers. */
 	uint32_t accessed :  1; /* Has the page been accessed since last refresh? */
 	uint32_t dirty    :  1; /* Has the page been written to since last refresh? */
-	uint32_t unused   :  7; /* Amalgamation of unused and reserved bits. */
+	uint32_t unused   :  5; /* Amalgamation of unused and reserved bits. */
 	uint32_t frame    : 20; /* Frame address (shifted right 12 bits). */
 };
 
@@ -86,6 +86,51 @@ void page_fault(struct registers registers);
 void alloc_frame(struct page *page, int is_kernel, int is_writeable);
 void free_frame(struct page *page);
 
+/* Point a page at an existing frame, such as one already holding file data,
+ * without allocating it from the frame bitset. Pages mapped this way do not own
+ * their frame and must not be passed to free_frame(). */
+void map_frame(struct page *page, uint32_t frame_address,
+	       int is_kernel, int is_writeable);
+
+/* Allocate 'count' contiguous pages in the kpage window, each backed by a
+ * newly allocated, zeroed frame. Returns the virtual address of the first
+ * page, or 0 if the window has no run of 'count' free pages. */
+uint32_t kpage_alloc(uint32_t count);
+
+/* As kpage_alloc(), but only succeeds if the pages starting at 'address' are
+ * free. Used to grow an existing allocation in place. */
+uint32_t kpage_alloc_at(uint32_t address, uint32_t count);
+
+/* As kpage_alloc(), but the frames are also physically contiguous, for devices
+ * which access memory directly. Pages allocated this way are released with
+ * kpage_free() as usual. */
+uint32_t kpage_alloc_contiguous(uint32_t count);
+
+/* Release 'count' pages starting at 'address' and their frames. */
+void kpage_free(uint32_t address, uint32_t count);
+
+/* kpage_map() flags. Device registers must be mapped KPAGE_UNCACHED, so that
+ * every access reaches the device, in order. */
+#define KPAGE_UNCACHED 0x1
+
+/* Map 'count' pages of physical memory starting at 'physical', such as device
+ * registers, into the kpage window. The frames are not taken from the frame
+ * bitset, and are released with kpage_unmap() rather than kpage_free().
+ * Returns the virtual address of the first page, or 0 if the window is full. */
+uint32_t kpage_map(uint32_t physical, uint32_t count, uint32_t flags);
+
+/* Remove a mapping made by kpage_map(). */
+void kpage_unmap(uint32_t address, uint32_t count);
+
+/* Return the physical address that 'address' is mapped to in the current page
+ * directory, or 0 if it is not mapped. Used to program devices which access
+ * memory directly. */
+uint32_t virtual_to_physical(uint32_t address);
+
+/* Flush the TLB by reloading CR3. Required after changing a mapping in the
+ * current page directory. */
+void flush_tlb(void);
+
 struct page_directory *clone_directory(struct page_directory *src);
 
 
@@ -0,0 +1,61 @@
+#ifndef _PORTS_ATA_H
+#define _PORTS_ATA_H
+
+#include <kernel/port.h>
+
+/* Port addresses of the legacy (compatibility mode) IDE channels. */
+#define ATA_PRIMARY_IO        0x1F0
+#define ATA_PRIMARY_CONTROL   0x3F6
+#define ATA_SECONDARY_IO      0x170
+#define ATA_SECONDARY_CONTROL 0x376
+
+/* Task file registers, as offsets from the channel's I/O port. */
+#define ATA_DATA          0x0
+#define ATA_ERROR         0x1
+#define ATA_SECTOR_COUNT  0x2
+#define ATA_LBA_LOW       0x3
+#define ATA_LBA_MID       0x4
+#define ATA_LBA_HIGH      0x5
+#define ATA_DRIVE         0x6
+#define ATA_STATUS        0x7
+#define ATA_COMMAND       0x7
+
+/* Status register bits. */
+#define ATA_STATUS_ERR    0x01
+#define ATA_STATUS_DRQ    0x08
+#define ATA_STATUS_DF     0x20
+#define ATA_STATUS_DRDY   0x40
+#define ATA_STATUS_BSY    0x80
+
+/* Drive register values. */
+#define ATA_DRIVE_LBA     0xE0
+#define ATA_DRIVE_SLAVE   0x10
+
+/* Device control register bits. */
+#define ATA_CONTROL_NIEN  0x02
+
+/* Commands. */
+#define ATA_CMD_READ_PIO  0x20
+#define ATA_CMD_WRITE_PIO 0x30
+#define ATA_CMD_READ_DMA  0xC8
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_FLUSH     0xE7
+#define ATA_CMD_IDENTIFY  0xEC
+
+/* Bus master IDE registers, as offsets from the channel's bus master port. The
+ * secondary channel's registers follow the primary's. */
+#define ATA_BM_COMMAND    0x0
+#define ATA_BM_STATUS     0x2
+#define ATA_BM_PRDT       0x4
+#define ATA_BM_SECONDARY  0x8
+
+/* Bus master command register bits. */
+#define ATA_BM_START      0x01
+#define ATA_BM_READ       0x08 /* Transfer from the disk to memory. */
+
+/* Bus master status register bits. */
+#define ATA_BM_ACTIVE     0x01
+#define ATA_BM_ERROR      0x02
+#define ATA_BM_IRQ        0x04
+
+#endif /* _PORTS_ATA_H */
@@ -0,0 +1,19 @@
+#ifndef _PORTS_DEBUG_EXIT_H
+#define _PORTS_DEBUG_EXIT_H
+
+#include <kernel/port.h>
+
+/* Port address of QEMU's isa-debug-exit device, when it is added with
+ * "-device isa-debug-exit,iobase=0xf4,iosize=0x04". Writing a byte to it
+ * makes QEMU exit with the status (byte << 1) | 1. Without the device, the
+ * write does nothing. */
+#define DEBUG_EXIT_PORT 0xF4
+
+/* Bytes written to the port, giving QEMU exit statuses that it cannot return
+ * for any other reason. */
+#define DEBUG_EXIT_SUCCESS 0x10 /* Exit status 33. */
+#define DEBUG_EXIT_FAILURE 0x11 /* Exit status 35. */
+
+#define DEBUG_EXIT_OUT(b) out_byte(DEBUG_EXIT_PORT, (b))
+
+#endif /* _PORTS_DEBUG_EXIT_H */
@@ -0,0 +1,15 @@
+#ifndef _PORTS_PCI_H
+#define _PORTS_PCI_H
+
+#include <kernel/port.h>
+
+/* Port addresses for configuration space access mechanism #1. A dword written
+ * to the address port selects a register, which is then read or written
+ * through the data port. */
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+/* Set in the address to enable the configuration cycle. */
+#define PCI_CONFIG_ENABLE  0x80000000
+
+#endif /* _PORTS_PCI_H */
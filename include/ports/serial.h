@@ -0,0 +1,60 @@
+#ifndef _PORTS_SERIAL_H
+#define _PORTS_SERIAL_H
+
+#include <kernel/port.h>
+
+/* Port address of the first serial port. */
+#define SERIAL_COM1 0x3F8
+
+/* 16550 UART registers, as offsets from the port address. */
+#define SERIAL_DATA           0x0 /* Receive and transmit holding.     */
+#define SERIAL_INTERRUPT      0x1 /* Interrupt enable.                 */
+#define SERIAL_DIVISOR_LOW    0x0 /* With SERIAL_LINE_DLAB set.        */
+#define SERIAL_DIVISOR_HIGH   0x1
+#define SERIAL_IDENTIFY       0x2 /* Interrupt identification, read.   */
+#define SERIAL_FIFO           0x2 /* FIFO control, write.              */
+#define SERIAL_LINE           0x3 /* Line control.                     */
+#define SERIAL_MODEM          0x4 /* Modem control.                    */
+#define SERIAL_STATUS         0x5 /* Line status.                      */
+#define SERIAL_MODEM_STATUS   0x6
+#define SERIAL_SCRATCH        0x7
+
+/* Interrupt enable register bits. */
+#define SERIAL_INTERRUPT_RX   0x01 /* Data received.                   */
+#define SERIAL_INTERRUPT_TX   0x02 /* Transmit holding register empty. */
+
+/* Interrupt identification register. Bit 0 is clear while an interrupt is
+ * pending, and bits 1-3 give its cause. */
+#define SERIAL_IDENTIFY_NONE    0x01
+#define SERIAL_IDENTIFY_MASK    0x0E
+#define SERIAL_IDENTIFY_MODEM   0x00
+#define SERIAL_IDENTIFY_TX      0x02
+#define SERIAL_IDENTIFY_RX      0x04
+#define SERIAL_IDENTIFY_STATUS  0x06
+#define SERIAL_IDENTIFY_TIMEOUT 0x0C
+
+/* FIFO control register bits. */
+#define SERIAL_FIFO_ENABLE    0x01
+#define SERIAL_FIFO_CLEAR_RX  0x02
+#define SERIAL_FIFO_CLEAR_TX  0x04
+#define SERIAL_FIFO_RX_14     0xC0 /* Receive interrupt at 14 bytes.   */
+
+/* Line control register bits. */
+#define SERIAL_LINE_8N1       0x03
+#define SERIAL_LINE_DLAB      0x80 /* Divisor latch access.            */
+
+/* Modem control register bits. OUT2 gates the UART's interrupt line. */
+#define SERIAL_MODEM_DTR      0x01
+#define SERIAL_MODEM_RTS      0x02
+#define SERIAL_MODEM_OUT2     0x08
+#define SERIAL_MODEM_LOOPBACK 0x10
+
+/* Line status register bits. */
+#define SERIAL_STATUS_DATA    0x01 /* Received data ready.             */
+#define SERIAL_STATUS_THRE    0x20 /* Transmit FIFO empty.             */
+
+/* The UART clock divided by 16, and the depth of its transmit FIFO. */
+#define SERIAL_BASE_BAUD      115200
+#define SERIAL_FIFO_SIZE      16
+
+#endif /* _PORTS_SERIAL_H */
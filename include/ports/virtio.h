@@ -0,0 +1,30 @@
+#ifndef _PORTS_VIRTIO_H
+#define _PORTS_VIRTIO_H
+
+#include <kernel/port.h>
+
+/* Registers of a legacy virtio PCI device, as offsets from its I/O BAR. */
+#define VIRTIO_HOST_FEATURES  0x00 /* 32 bits, read only.           */
+#define VIRTIO_GUEST_FEATURES 0x04 /* 32 bits.                      */
+#define VIRTIO_QUEUE_PFN      0x08 /* 32 bits, page frame of queue. */
+#define VIRTIO_QUEUE_SIZE     0x0C /* 16 bits, read only.           */
+#define VIRTIO_QUEUE_SELECT   0x0E /* 16 bits.                      */
+#define VIRTIO_QUEUE_NOTIFY   0x10 /* 16 bits.                      */
+#define VIRTIO_STATUS         0x12 /* 8 bits.                       */
+#define VIRTIO_ISR            0x13 /* 8 bits, cleared on read.      */
+#define VIRTIO_CONFIG         0x14 /* Start of device configuration. */
+
+/* Device status bits. */
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER      0x02
+#define VIRTIO_STATUS_DRIVER_OK   0x04
+#define VIRTIO_STATUS_FAILED      0x80
+
+/* ISR status bits. */
+#define VIRTIO_ISR_QUEUE 0x01
+
+/* virtio-blk configuration, as offsets from VIRTIO_CONFIG. */
+#define VIRTIO_BLK_CAPACITY 0x00 /* 64 bits, in 512 byte sectors. */
+#define VIRTIO_BLK_SEG_MAX  0x0C /* 32 bits.                      */
+
+#endif /* _PORTS_VIRTIO_H */
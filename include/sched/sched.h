@@ -1,19 +1,13 @@
 #ifndef _SCHED_H
 #define _SCHED_H
 
+#include <kernel/debug.h>
 #include <lib/stdio.h>
 
-/* Define this for scheduler debugging. */
-#undef SCHED_DEBUG
+/* The most verbose scheduler messages compiled in. Set it to LOG_DEBUG
+ * to trace it. */
+#define SCHED_LOG_LEVEL LOG_INFO
 
-#ifdef SCHED_DEBUG
-# define sched_debug(...) {                                \
-		kdebug("%s:%d, %s ",			   \
-		       __FILE__, __LINE__, __func__);	   \
-		kstream_printf(__VA_ARGS__);		   \
-	}
-#else
-# define sched_debug(f, ...) /**/
-#endif
+#define sched_debug(...) debug_log(SCHED, LOG_DEBUG, __VA_ARGS__)
 
 #endif
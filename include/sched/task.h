@@ -1,16 +1,20 @@
 #ifndef _SCHED_TASK_H
 #define _SCHED_TASK_H
 
+#include <fs/file.h>
 #include <kernel/types.h>
 
 /* The structure of a task.
  *
- *   pid  - Process ID
- *   esp  - Stack pointer.
- *   ebp  - Base pointer.
- *   eip  - Instruction pointer.
- *   pde  - Page directory.
- *   next - A pointer to the next task.
+ *   pid   - Process ID
+ *   esp   - Stack pointer.
+ *   ebp   - Base pointer.
+ *   eip   - Instruction pointer.
+ *   pde   - Page directory.
+ *   files - File descriptor table.
+ *   state - Whether the task is runnable or asleep on a wait queue.
+ *   wait  - The next task sleeping on the same wait queue.
+ *   next  - A pointer to the next task.
  */
 struct task {
 	int pid;
@@ -18,13 +22,33 @@ struct task {
 	uint32_t ebp;
 	uint32_t eip;
 	struct page_directory *pde;
+	struct file *files[TASK_MAX_FILES];
+	volatile int state;
+	struct task *wait;
 	struct task *next;
 };
 
+/* Task states. */
+#define TASK_RUNNING 0
+#define TASK_WAITING 1
+
+/* A list of tasks sleeping until some event occurs. */
+struct wait_queue {
+	struct task *head;
+};
+
 void init_tasking(void);
 void context_switch(void);
 int fork(void);
 void stack_mv(void *dst, size_t size);
 int getpid(void);
 
+/* Put the current task to sleep on 'queue' until another task or an interrupt
+ * handler calls wake_up() on it. Interrupts are enabled on return. */
+void sleep_on(struct wait_queue *queue);
+
+/* Make every task sleeping on 'queue' runnable again. Safe to call from an
+ * interrupt handler. */
+void wake_up(struct wait_queue *queue);
+
 #endif /* _SCHED_TASK_H */
@@ -0,0 +1,460 @@
+#include <kernel/ata.h>
+
+#include <kernel/isr.h>
+#include <kernel/pci.h>
+#include <kernel/util.h>
+#include <lib/stdio.h>
+#include <lib/string.h>
+#include <mm/paging.h>
+
+/* PCI class and subclass of an IDE controller, and the programming interface
+ * bit which says that it can act as a bus master. */
+#define PCI_CLASS_IDE      0x0101
+#define PCI_IDE_BUSMASTER  0x80
+
+/* The BAR holding the bus master registers. */
+#define PCI_BUSMASTER_BAR  4
+
+/* Poll this many times for a drive to respond before giving up. */
+#define ATA_TIMEOUT 100000
+
+static struct ata_channel channels[2];
+static struct ata_drive drives[4];
+
+/* Handlers already on each channel's IRQ when we took it, called after ours. */
+static isr_t chained[2];
+
+/* Bus master I/O port of the IDE controller, or 0 if there is none. */
+static port_t busmaster;
+
+/* Take the first IDE controller which can act as a bus master, and enable bus
+ * mastering. The legacy channels belong to only one controller. */
+static int _ata_probe(struct pci_device *device)
+{
+	if (busmaster || !(device->interface & PCI_IDE_BUSMASTER) ||
+	    !(device->bars[PCI_BUSMASTER_BAR].flags & PCI_BAR_IO)) {
+		return -1;
+	}
+
+	if (!(busmaster = pci_map_bar(device, PCI_BUSMASTER_BAR))) {
+		return -1;
+	}
+
+	pci_enable(device, PCI_COMMAND_IO | PCI_COMMAND_BUSMASTER);
+
+	ata_debug("IDE bus master at %h\n", busmaster);
+
+	return 0;
+}
+
+static const struct pci_id ata_ids[] = {
+	{ PCI_ANY_ID, PCI_ANY_ID, PCI_CLASS_IDE },
+	{ 0, 0, 0 }
+};
+
+static struct pci_driver ata_driver = {
+	"ata", ata_ids, &_ata_probe, 0
+};
+
+/* Wait for the drive to clear BSY, and return the final status. */
+static uint8_t _ata_wait(struct ata_channel *channel)
+{
+	uint32_t i;
+	uint8_t status = 0;
+
+	/* Reading the alternate status register four times gives the drive
+	 * the 400ns it needs to update its status after a command. */
+	for (i = 0; i < 4; i++) {
+		in_byte(channel->control);
+	}
+
+	for (i = 0; i < ATA_TIMEOUT; i++) {
+		status = in_byte(channel->io + ATA_STATUS);
+		if (!(status & ATA_STATUS_BSY)) {
+			break;
+		}
+	}
+
+	return status;
+}
+
+/* Wait for the drive to be ready to transfer a sector of data. Returns 0, or
+ * -1 if the drive reports an error. */
+static int _ata_wait_drq(struct ata_channel *channel)
+{
+	uint8_t status;
+	uint32_t i;
+
+	for (i = 0; i < ATA_TIMEOUT; i++) {
+		status = _ata_wait(channel);
+
+		if (status & (ATA_STATUS_ERR | ATA_STATUS_DF)) {
+			return -1;
+		}
+
+		if (status & ATA_STATUS_DRQ) {
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* Select the drive and load the address and sector count of a transfer. */
+static void _ata_setup(struct ata_drive *drive, uint32_t sector,
+		       uint32_t count)
+{
+	port_t io = drive->channel->io;
+
+	out_byte(io + ATA_DRIVE, ATA_DRIVE_LBA |
+		 (drive->slave ? ATA_DRIVE_SLAVE : 0) |
+		 ((sector >> 24) & 0x0F));
+	_ata_wait(drive->channel);
+
+	/* A count of 0 means 256 sectors. */
+	out_byte(io + ATA_SECTOR_COUNT, (uint8_t)count);
+	out_byte(io + ATA_LBA_LOW, (uint8_t)sector);
+	out_byte(io + ATA_LBA_MID, (uint8_t)(sector >> 8));
+	out_byte(io + ATA_LBA_HIGH, (uint8_t)(sector >> 16));
+}
+
+static int _ata_pio(struct ata_drive *drive, uint32_t sector, uint32_t count,
+		    int write, struct iovec *iov, uint32_t iov_count)
+{
+	struct ata_channel *channel = drive->channel;
+	uint32_t i;
+
+	_ata_setup(drive, sector, count);
+	out_byte(channel->io + ATA_COMMAND,
+		 write ? ATA_CMD_WRITE_PIO : ATA_CMD_READ_PIO);
+
+	for (i = 0; i < iov_count; i++) {
+		uint8_t *buffer = iov[i].iov_base;
+		uint8_t *end = buffer + iov[i].iov_len;
+
+		for (; buffer < end; buffer += BLOCK_SECTOR_SIZE) {
+			if (_ata_wait_drq(channel)) {
+				return -1;
+			}
+
+			if (write) {
+				out_words(channel->io + ATA_DATA,
+					  (uint16_t *)buffer,
+					  BLOCK_SECTOR_SIZE / 2);
+			} else {
+				in_words(channel->io + ATA_DATA,
+					 (uint16_t *)buffer,
+					 BLOCK_SECTOR_SIZE / 2);
+			}
+		}
+	}
+
+	/* The drive is busy writing the last sector, and would ignore a
+	 * command given now. */
+	if (_ata_wait(channel) & (ATA_STATUS_ERR | ATA_STATUS_DF)) {
+		return -1;
+	}
+
+	if (write) {
+		/* The data may still be in the drive's write cache. */
+		out_byte(channel->io + ATA_COMMAND, ATA_CMD_FLUSH);
+		if (_ata_wait(channel) & (ATA_STATUS_ERR | ATA_STATUS_DF)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Describe the buffers of a transfer in the channel's PRDT. Returns -1 if they
+ * cannot be used for DMA, in which case the transfer falls back to PIO. */
+static int _ata_build_prdt(struct ata_channel *channel,
+			   struct iovec *iov, uint32_t iov_count)
+{
+	struct ata_prd *prd = 0;
+	uint32_t entries = 0;
+	uint32_t i;
+
+	for (i = 0; i < iov_count; i++) {
+		uint32_t address = (uint32_t)iov[i].iov_base;
+		uint32_t remaining = iov[i].iov_len;
+
+		/* The controller transfers whole words. */
+		if (address & 0x1) {
+			return -1;
+		}
+
+		while (remaining) {
+			uint32_t physical = virtual_to_physical(address);
+			uint32_t length = min(remaining, PAGE_SIZE -
+					      (address & PAGE_OFFSET_MASK));
+			uint32_t size = prd ? (prd->size ? prd->size : 0x10000)
+				: 0;
+
+			if (!physical) {
+				return -1;
+			}
+
+			/* Extend the previous region if this page follows it
+			 * in physical memory, without crossing 64 KB. */
+			if (prd && prd->address + size == physical &&
+			    (prd->address >> 16) ==
+			    ((physical + length - 1) >> 16)) {
+				prd->size = (uint16_t)(size + length);
+			} else {
+				if (entries == ATA_PRDT_SIZE) {
+					return -1;
+				}
+
+				prd = &channel->prdt[entries++];
+				prd->address = physical;
+				prd->size = (uint16_t)length;
+				prd->flags = 0;
+			}
+
+			address += length;
+			remaining -= length;
+		}
+	}
+
+	if (!prd) {
+		return -1;
+	}
+
+	prd->flags = ATA_PRD_EOT;
+	return 0;
+}
+
+static void _ata_dma(struct ata_drive *drive, uint32_t sector, uint32_t count,
+		     int write)
+{
+	struct ata_channel *channel = drive->channel;
+	uint8_t direction = write ? 0 : ATA_BM_READ;
+
+	out_byte(channel->busmaster + ATA_BM_COMMAND, 0);
+	out_long(channel->busmaster + ATA_BM_PRDT, channel->prdt_physical);
+
+	/* The error and interrupt bits are cleared by writing ones. */
+	out_byte(channel->busmaster + ATA_BM_STATUS,
+		 in_byte(channel->busmaster + ATA_BM_STATUS) |
+		 ATA_BM_ERROR | ATA_BM_IRQ);
+	out_byte(channel->busmaster + ATA_BM_COMMAND, direction);
+
+	_ata_setup(drive, sector, count);
+	out_byte(channel->io + ATA_COMMAND,
+		 write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+	out_byte(channel->busmaster + ATA_BM_COMMAND,
+		 direction | ATA_BM_START);
+}
+
+/* Give the other drive on a channel a chance to start a transfer it was
+ * refused while the channel was busy. */
+static void _ata_kick(struct ata_channel *channel, struct ata_drive *drive)
+{
+	struct ata_drive *other = channel->drives[!drive->slave];
+
+	if (other && !channel->active) {
+		block_dispatch(&other->device);
+	}
+}
+
+static int _ata_transfer(struct block_device *device,
+			 struct block_transfer *transfer)
+{
+	struct ata_drive *drive = device->driver;
+	struct ata_channel *channel = drive->channel;
+	int status;
+
+	/* Both drives on a channel share its registers. */
+	if (channel->active) {
+		return -1;
+	}
+
+	channel->active = drive;
+	channel->transfer = transfer;
+
+	if (channel->busmaster &&
+	    !_ata_build_prdt(channel, transfer->iov, transfer->iov_count)) {
+		/* Finishes in _ata_interrupt(). */
+		channel->dma = 1;
+		_ata_dma(drive, transfer->sector, transfer->count,
+			 transfer->write);
+		return 0;
+	}
+
+	status = _ata_pio(drive, transfer->sector, transfer->count,
+			  transfer->write, transfer->iov, transfer->iov_count);
+
+	channel->active = 0;
+	block_complete(device, transfer, status);
+	_ata_kick(channel, drive);
+
+	return 0;
+}
+
+static void _ata_interrupt(struct registers registers)
+{
+	struct ata_channel *channel;
+	struct ata_drive *drive;
+	uint8_t status, dma_status;
+	int error;
+
+	channel = &channels[registers.interrupt_number == IRQ15];
+	drive = channel->active;
+
+	/* Another driver may share the line, so give it the interrupt too. */
+	if (chained[channel - channels]) {
+		chained[channel - channels](registers);
+	}
+
+	/* Reading the status register acknowledges the interrupt. */
+	status = in_byte(channel->io + ATA_STATUS);
+
+	if (!drive || !channel->dma) {
+		/* PIO transfers are polled. */
+		return;
+	}
+
+	if (channel->flushing) {
+		/* FLUSH CACHE interrupts again once the data is on the
+		 * disk. */
+		if (status & ATA_STATUS_BSY) {
+			return;
+		}
+
+		channel->flushing = 0;
+		error = status & (ATA_STATUS_ERR | ATA_STATUS_DF);
+	} else {
+		dma_status = in_byte(channel->busmaster + ATA_BM_STATUS);
+		if (!(dma_status & ATA_BM_IRQ)) {
+			return;
+		}
+
+		out_byte(channel->busmaster + ATA_BM_COMMAND, 0);
+		out_byte(channel->busmaster + ATA_BM_STATUS,
+			 ATA_BM_ERROR | ATA_BM_IRQ);
+
+		/* A command given while the drive is busy is ignored. */
+		status = _ata_wait(channel);
+		error = (status & (ATA_STATUS_ERR | ATA_STATUS_DF)) ||
+			(dma_status & ATA_BM_ERROR);
+
+		/* A write is only complete once it has left the drive's
+		 * write cache. */
+		if (!error && channel->transfer->write) {
+			channel->flushing = 1;
+			out_byte(channel->io + ATA_COMMAND, ATA_CMD_FLUSH);
+			return;
+		}
+	}
+
+	channel->active = 0;
+	channel->dma = 0;
+
+	block_complete(&drive->device, channel->transfer, error ? -1 : 0);
+	_ata_kick(channel, drive);
+}
+
+/* Issue IDENTIFY DEVICE, and return the number of sectors addressable with 28
+ * bit LBA, or 0 if there is no ATA disk present. */
+static uint32_t _ata_identify(struct ata_channel *channel, uint8_t slave)
+{
+	uint16_t identity[256];
+	uint8_t status;
+
+	out_byte(channel->io + ATA_DRIVE,
+		 ATA_DRIVE_LBA | (slave ? ATA_DRIVE_SLAVE : 0));
+	_ata_wait(channel);
+
+	out_byte(channel->io + ATA_SECTOR_COUNT, 0);
+	out_byte(channel->io + ATA_LBA_LOW, 0);
+	out_byte(channel->io + ATA_LBA_MID, 0);
+	out_byte(channel->io + ATA_LBA_HIGH, 0);
+	out_byte(channel->io + ATA_COMMAND, ATA_CMD_IDENTIFY);
+
+	/* A status of zero, or a floating bus, means no drive. */
+	status = in_byte(channel->io + ATA_STATUS);
+	if (!status || status == 0xFF) {
+		return 0;
+	}
+
+	status = _ata_wait(channel);
+	if (status & ATA_STATUS_BSY) {
+		return 0;
+	}
+
+	/* ATAPI and SATA devices identify themselves through the LBA
+	 * registers, and abort the command. */
+	if (in_byte(channel->io + ATA_LBA_MID) ||
+	    in_byte(channel->io + ATA_LBA_HIGH)) {
+		return 0;
+	}
+
+	if (_ata_wait_drq(channel)) {
+		return 0;
+	}
+
+	in_words(channel->io + ATA_DATA, identity, 256);
+
+	/* Words 60 and 61 hold the number of LBA28 sectors. */
+	return identity[60] | ((uint32_t)identity[61] << 16);
+}
+
+void init_ata()
+{
+	char name[] = "hda";
+	uint32_t i;
+
+	pci_register_driver(&ata_driver);
+
+	channels[0].io = ATA_PRIMARY_IO;
+	channels[0].control = ATA_PRIMARY_CONTROL;
+	channels[0].irq = IRQ14;
+	channels[1].io = ATA_SECONDARY_IO;
+	channels[1].control = ATA_SECONDARY_CONTROL;
+	channels[1].irq = IRQ15;
+
+	for (i = 0; i < 4; i++) {
+		struct ata_channel *channel = &channels[i / 2];
+		struct ata_drive *drive = &drives[i];
+		uint32_t sectors;
+
+		if (!(i % 2)) {
+			/* Enable interrupts from the channel. */
+			out_byte(channel->control, 0);
+
+			if (busmaster) {
+				channel->busmaster = busmaster +
+					(i ? ATA_BM_SECONDARY : 0);
+				/* A page of its own, so that the table
+				 * is physically contiguous. */
+				channel->prdt = (struct ata_prd *)
+					kpage_alloc(1);
+				channel->prdt_physical = virtual_to_physical(
+					(uint32_t)channel->prdt);
+			}
+
+			chained[i / 2] = register_interrupt_handler(
+				channel->irq, (isr_t)&_ata_interrupt);
+		}
+
+		name[2] = 'a' + i;
+
+		if (!(sectors = _ata_identify(channel, i % 2))) {
+			continue;
+		}
+
+		drive->channel = channel;
+		drive->slave = i % 2;
+		drive->device.sector_count = sectors;
+		drive->device.max_sectors = ATA_MAX_SECTORS;
+		drive->device.transfer = &_ata_transfer;
+		drive->device.driver = drive;
+		channel->drives[i % 2] = drive;
+
+		ata_debug("%s: %s, %d sectors\n", name,
+			  channel->busmaster ? "DMA" : "PIO", sectors);
+
+		block_register(&drive->device, name);
+	}
+}
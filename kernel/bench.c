@@ -0,0 +1,588 @@
+#include <kernel/bench.h>
+
+#include <fs/aio.h>
+#include <fs/block.h>
+#include <fs/fs.h>
+#include <kernel/assert.h>
+#include <kernel/isr.h>
+#include <kernel/log.h>
+#include <kernel/port.h>
+#include <kernel/timer.h>
+#include <kernel/util.h>
+#include <lib/stdio.h>
+#include <lib/string.h>
+#include <mm/heap.h>
+#include <mm/paging.h>
+#include <sched/task.h>
+
+#define BENCH_OPTION "bench"
+
+/* How long to count time stamp counter cycles for against the timer. */
+#define BENCH_CALIBRATE_MS 200
+
+/* kmalloc()/kfree() pairs of BENCH_ALLOC_SIZE bytes. */
+#define BENCH_ALLOC_PAIRS 10000
+#define BENCH_ALLOC_SIZE  64
+
+/* Allocations and frees in random order and sizes, among BENCH_HEAP_SLOTS
+ * blocks of up to BENCH_HEAP_MAX_SIZE bytes. */
+#define BENCH_HEAP_OPS      20000
+#define BENCH_HEAP_SLOTS    256
+#define BENCH_HEAP_MAX_SIZE 1024
+
+#define BENCH_SCHEDULES 100000
+
+/* Faults on each of BENCH_FAULT_PAGES pages, BENCH_FAULT_ROUNDS times. */
+#define BENCH_FAULT_PAGES  64
+#define BENCH_FAULT_ROUNDS 16
+
+/* The tmpfs file is written, then read BENCH_READ_ROUNDS times a buffer at a
+ * time. The initrd file is added by scripts/bench.sh. */
+#define BENCH_TMPFS_DIR    "/tmp"
+#define BENCH_FILE_NAME    "bench.dat"
+#define BENCH_FILE_SIZE    0x40000
+#define BENCH_INITRD_FILE  "/" BENCH_FILE_NAME
+#define BENCH_READ_ROUNDS  16
+#define BENCH_BUFFER_SIZE  PAGE_SIZE
+
+/* Each disk is read once from the start, BENCH_DISK_CHUNK bytes at a time,
+ * straight from the driver rather than through the page cache. The disks are
+ * attached by scripts/bench.sh. */
+#define BENCH_DISK_BYTES 0x800000
+#define BENCH_DISK_CHUNK 0x10000
+
+/* The disks are read the same way through an AIO ring, with this many chunks
+ * in flight at once. */
+#define BENCH_AIO_DEPTH 4
+
+#define BENCH_MAX_RESULTS 16
+
+/* Defined in mm/paging.c. */
+extern struct page_directory *kernel_directory;
+
+struct bench_result {
+	const char *name;
+	uint32_t operations;
+	uint64_t cycles;
+	uint32_t bytes;             /* Read in total, or 0 if not a read. */
+};
+
+static struct bench_result results[BENCH_MAX_RESULTS];
+static uint32_t result_count = 0;
+
+/* Time stamp counter cycles per millisecond. */
+static uint32_t tsc_khz = 0;
+
+/* xorshift32, as in tests/host.c, so that the trace is the same on each run. */
+static uint32_t random_state = 1;
+
+/* The pages whose faults _bench_page_fault() handles. */
+static uint32_t fault_start = 0;
+static uint32_t fault_end = 0;
+
+static uint8_t buffer[BENCH_BUFFER_SIZE];
+
+static uint64_t _bench_cycles(void)
+{
+	uint64_t cycles;
+
+	__asm volatile("rdtsc" : "=A" (cycles));
+	return cycles;
+}
+
+/* Divide without the 64 bit division from libgcc, which we do not link. */
+static uint64_t _bench_divide(uint64_t dividend, uint32_t divisor)
+{
+	uint32_t high = (uint32_t)(dividend >> 32);
+	uint32_t low = (uint32_t)dividend;
+	uint32_t remainder = high % divisor;
+
+	high /= divisor;
+	__asm("divl %4"
+	      : "=a" (low), "=d" (remainder)
+	      : "0" (low), "1" (remainder), "rm" (divisor));
+
+	return ((uint64_t)high << 32) | low;
+}
+
+static uint32_t _bench_random(void)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+
+	return random_state;
+}
+
+/* Count cycles between two timer ticks BENCH_CALIBRATE_MS or more apart. */
+static uint32_t _bench_calibrate(void)
+{
+	uint32_t start_ms, elapsed;
+	uint64_t start;
+
+	start_ms = timer_milliseconds();
+	while (timer_milliseconds() == start_ms) {
+		__asm volatile("hlt");
+	}
+
+	start_ms = timer_milliseconds();
+	start = _bench_cycles();
+	do {
+		__asm volatile("hlt");
+		elapsed = timer_milliseconds() - start_ms;
+	} while (elapsed < BENCH_CALIBRATE_MS);
+
+	return (uint32_t)_bench_divide(_bench_cycles() - start, elapsed);
+}
+
+static struct bench_result *_bench_result(const char *name)
+{
+	struct bench_result *result;
+
+	assert(result_count < BENCH_MAX_RESULTS);
+	result = &results[result_count++];
+	memset((uint8_t *)result, 0, sizeof(*result));
+	result->name = name;
+
+	return result;
+}
+
+static void _bench_kmalloc(void)
+{
+	struct bench_result *result = _bench_result("kmalloc_kfree");
+	uint32_t flags, i;
+	uint64_t start;
+
+	irq_save(flags);
+	start = _bench_cycles();
+	for (i = 0; i < BENCH_ALLOC_PAIRS; i++) {
+		kfree((void *)kmalloc(BENCH_ALLOC_SIZE));
+	}
+	result->cycles = _bench_cycles() - start;
+	irq_restore(flags);
+
+	result->operations = BENCH_ALLOC_PAIRS;
+}
+
+static void _bench_heap(void)
+{
+	struct bench_result *result = _bench_result("heap_random");
+	static void *slots[BENCH_HEAP_SLOTS];
+	uint32_t flags, i, slot;
+	uint64_t start;
+
+	random_state = 1;
+	memset((uint8_t *)slots, 0, sizeof(slots));
+
+	irq_save(flags);
+	start = _bench_cycles();
+	for (i = 0; i < BENCH_HEAP_OPS; i++) {
+		slot = _bench_random() % BENCH_HEAP_SLOTS;
+
+		if (slots[slot]) {
+			kfree(slots[slot]);
+			slots[slot] = 0;
+		} else {
+			slots[slot] = (void *)kmalloc(
+				16 + _bench_random() % BENCH_HEAP_MAX_SIZE);
+		}
+	}
+	result->cycles = _bench_cycles() - start;
+	irq_restore(flags);
+
+	for (slot = 0; slot < BENCH_HEAP_SLOTS; slot++) {
+		if (slots[slot]) {
+			kfree(slots[slot]);
+		}
+	}
+
+	result->operations = BENCH_HEAP_OPS;
+}
+
+/* context_switch() does not switch stacks or address spaces yet, and there is
+ * only the kernel task, so this is the cost of the scheduler's bookkeeping:
+ * saving the task's state and finding the next task, which is itself. */
+static void _bench_schedule(void)
+{
+	struct bench_result *result = _bench_result("schedule_bookkeeping");
+	uint32_t flags, i;
+	uint64_t start;
+
+	irq_save(flags);
+	start = _bench_cycles();
+	for (i = 0; i < BENCH_SCHEDULES; i++) {
+		context_switch();
+	}
+	result->cycles = _bench_cycles() - start;
+	irq_restore(flags);
+
+	result->operations = BENCH_SCHEDULES;
+}
+
+/* Give a page in the benchmark's range a frame, as demand paging would. The
+ * page was not present, so there is no stale TLB entry to flush. Anything else
+ * is a real fault. */
+static void _bench_page_fault(struct registers registers)
+{
+	uint32_t address;
+
+	__asm volatile("mov %%cr2, %0" : "=r" (address));
+
+	if (address >= fault_start && address < fault_end) {
+		alloc_frame(get_page(address & ALIGNMENT_MASK, NO_CREATE,
+				     kernel_directory), 1, 1);
+	} else {
+		page_fault(registers);
+	}
+}
+
+static void _bench_page_faults(void)
+{
+	struct bench_result *result = _bench_result("page_fault");
+	uint32_t flags, round, address, i;
+	uint64_t start;
+
+	register_interrupt_handler(14, &_bench_page_fault);
+
+	for (round = 0; round < BENCH_FAULT_ROUNDS; round++) {
+		address = kpage_alloc(BENCH_FAULT_PAGES);
+		assert(address);
+
+		/* Keep the pages, but take their frames away again. */
+		for (i = 0; i < BENCH_FAULT_PAGES; i++) {
+			free_frame(get_page(address + i * PAGE_SIZE, NO_CREATE,
+					    kernel_directory));
+		}
+		flush_tlb();
+
+		fault_start = address;
+		fault_end = address + BENCH_FAULT_PAGES * PAGE_SIZE;
+
+		irq_save(flags);
+		start = _bench_cycles();
+		for (i = 0; i < BENCH_FAULT_PAGES; i++) {
+			*(volatile uint8_t *)(address + i * PAGE_SIZE) = 1;
+		}
+		result->cycles += _bench_cycles() - start;
+		irq_restore(flags);
+
+		fault_start = fault_end = 0;
+		kpage_free(address, BENCH_FAULT_PAGES);
+	}
+
+	register_interrupt_handler(14, &page_fault);
+	result->operations = BENCH_FAULT_ROUNDS * BENCH_FAULT_PAGES;
+}
+
+/* Read all of 'node' BENCH_READ_ROUNDS times. Returns 0, or -1 if a read came
+ * up short. */
+static int _bench_read(struct bench_result *result, struct fs_node *node)
+{
+	uint32_t flags, round, offset, length;
+	uint64_t start;
+	int ret = 0;
+
+	irq_save(flags);
+	start = _bench_cycles();
+	for (round = 0; round < BENCH_READ_ROUNDS && !ret; round++) {
+		for (offset = 0; offset < node->size; offset += length) {
+			length = min(node->size - offset, BENCH_BUFFER_SIZE);
+			if (fs_read(node, offset, length, buffer) != length) {
+				ret = -1;
+				break;
+			}
+			result->bytes += length;
+			result->operations++;
+		}
+	}
+	result->cycles = _bench_cycles() - start;
+	irq_restore(flags);
+
+	return ret;
+}
+
+static void _bench_fs_tmpfs(void)
+{
+	struct bench_result *result;
+	struct fs_node *dir, *node;
+	uint32_t offset, i;
+
+	dir = vfs_lookup(BENCH_TMPFS_DIR);
+	if (!dir || !(node = fs_create(dir, BENCH_FILE_NAME, FS_FILE))) {
+		printf("bench: cannot create %s/%s\n", BENCH_TMPFS_DIR,
+		       BENCH_FILE_NAME);
+		return;
+	}
+
+	for (i = 0; i < BENCH_BUFFER_SIZE; i++) {
+		buffer[i] = (uint8_t)i;
+	}
+	for (offset = 0; offset < BENCH_FILE_SIZE;
+	     offset += BENCH_BUFFER_SIZE) {
+		if (fd_write(node, offset, BENCH_BUFFER_SIZE, buffer) !=
+		    BENCH_BUFFER_SIZE) {
+			printf("bench: cannot write %s/%s\n", BENCH_TMPFS_DIR,
+			       BENCH_FILE_NAME);
+			fs_unlink(dir, BENCH_FILE_NAME);
+			return;
+		}
+	}
+
+	result = _bench_result("fs_read_tmpfs");
+	if (_bench_read(result, node)) {
+		printf("bench: short read of %s/%s\n", BENCH_TMPFS_DIR,
+		       BENCH_FILE_NAME);
+		result_count--;
+	}
+
+	fs_unlink(dir, BENCH_FILE_NAME);
+}
+
+/* Only run when the initrd has the file, so that a kernel booted with any
+ * initrd can still be benchmarked. */
+static void _bench_fs_initrd(void)
+{
+	struct bench_result *result;
+	struct fs_node *node;
+
+	node = vfs_lookup(BENCH_INITRD_FILE);
+	if (!node || !node->size) {
+		printf("bench: no %s in the initrd, skipping fs_read_initrd\n",
+		       BENCH_INITRD_FILE);
+		return;
+	}
+
+	result = _bench_result("fs_read_initrd");
+	if (_bench_read(result, node)) {
+		printf("bench: short read of %s\n", BENCH_INITRD_FILE);
+		result_count--;
+	}
+}
+
+/* Only run when the disk is attached. The buffer is physically contiguous, so
+ * that either driver can transfer into it directly. */
+static void _bench_block(const char *path, const char *name)
+{
+	struct bench_result *result;
+	struct block_device *device;
+	struct fs_node *node;
+	uint32_t chunk, sectors, sector, address;
+	uint64_t start;
+
+	node = vfs_lookup(path);
+	if (!node || !(node->flags & FS_BLOCKDEVICE) ||
+	    !((struct block_device *)node)->sector_count) {
+		printf("bench: no %s, skipping %s\n", path, name);
+		return;
+	}
+
+	device = (struct block_device *)node;
+	address = kpage_alloc_contiguous(BENCH_DISK_CHUNK / PAGE_SIZE);
+	assert(address);
+
+	chunk = min(BENCH_DISK_CHUNK / BLOCK_SECTOR_SIZE, device->max_sectors);
+	sectors = min(BENCH_DISK_BYTES / BLOCK_SECTOR_SIZE,
+		      device->sector_count);
+
+	/* Interrupts stay enabled, as the drivers may complete from them. */
+	result = _bench_result(name);
+	start = _bench_cycles();
+	for (sector = 0; sector < sectors; sector += chunk) {
+		uint32_t count = min(chunk, sectors - sector);
+
+		if (block_read(device, sector, count, (uint8_t *)address)) {
+			printf("bench: error reading %s at sector %d\n", path,
+			       sector);
+			result_count--;
+			break;
+		}
+
+		result->bytes += count * BLOCK_SECTOR_SIZE;
+		result->operations++;
+	}
+	result->cycles = _bench_cycles() - start;
+
+	kpage_free(address, BENCH_DISK_CHUNK / PAGE_SIZE);
+}
+
+/* Queue a read of the chunk at 'sector' into 'slot' of the buffer at
+ * 'address'. Returns the sector after it. */
+static uint32_t _bench_aio_queue(struct aio_ring *ring, struct fs_node *node,
+				 uint32_t sector, uint32_t count,
+				 uint32_t address, uint32_t slot)
+{
+	struct aio_request *request = aio_get_request(ring);
+
+	assert(request);
+	request->opcode = AIO_READ;
+	request->node = node;
+	request->offset = sector * BLOCK_SECTOR_SIZE;
+	request->buffer = (uint8_t *)(address + slot * BENCH_DISK_CHUNK);
+	request->size = count * BLOCK_SECTOR_SIZE;
+	request->user_data = slot;
+
+	return sector + count;
+}
+
+/* Like _bench_block(), but with BENCH_AIO_DEPTH reads in flight, each started
+ * as soon as one completes, so that the driver always has work queued. */
+static void _bench_aio(const char *path, const char *name)
+{
+	struct aio_completion *completion;
+	struct bench_result *result;
+	struct block_device *device;
+	struct aio_ring *ring;
+	struct fs_node *node;
+	uint32_t chunk, sectors, sector, address, slot;
+	uint64_t start;
+	int failed = 0;
+
+	node = vfs_lookup(path);
+	if (!node || !(node->flags & FS_BLOCKDEVICE) ||
+	    !((struct block_device *)node)->sector_count) {
+		printf("bench: no %s, skipping %s\n", path, name);
+		return;
+	}
+
+	device = (struct block_device *)node;
+	address = kpage_alloc_contiguous(BENCH_AIO_DEPTH * BENCH_DISK_CHUNK /
+					 PAGE_SIZE);
+	assert(address);
+	ring = aio_create();
+
+	chunk = min(BENCH_DISK_CHUNK / BLOCK_SECTOR_SIZE, device->max_sectors);
+	sectors = min(BENCH_DISK_BYTES / BLOCK_SECTOR_SIZE,
+		      device->sector_count);
+
+	result = _bench_result(name);
+	start = _bench_cycles();
+
+	sector = 0;
+	for (slot = 0; slot < BENCH_AIO_DEPTH && sector < sectors; slot++) {
+		sector = _bench_aio_queue(ring, node, sector,
+					  min(chunk, sectors - sector),
+					  address, slot);
+	}
+	aio_submit(ring);
+
+	/* Stops once every read has completed, as nothing more can arrive. */
+	while (aio_wait(ring, 1)) {
+		completion = aio_get_completion(ring);
+		slot = completion->user_data;
+
+		if (completion->result < 0) {
+			/* Let the reads in flight finish, but start no more. */
+			if (!failed) {
+				printf("bench: error reading %s\n", path);
+				result_count--;
+				failed = 1;
+			}
+			sector = sectors;
+		} else {
+			result->bytes += completion->result;
+			result->operations++;
+		}
+		aio_completion_seen(ring);
+
+		if (sector < sectors) {
+			sector = _bench_aio_queue(ring, node, sector,
+						  min(chunk, sectors - sector),
+						  address, slot);
+			aio_submit(ring);
+		}
+	}
+	result->cycles = _bench_cycles() - start;
+
+	aio_destroy(ring);
+	kpage_free(address, BENCH_AIO_DEPTH * BENCH_DISK_CHUNK / PAGE_SIZE);
+}
+
+static void _bench_print(struct bench_result *result, int last)
+{
+	uint64_t nanoseconds;
+	uint32_t microseconds;
+
+	nanoseconds = _bench_divide(result->cycles * 1000000, tsc_khz);
+	microseconds = (uint32_t)_bench_divide(nanoseconds, 1000);
+
+	printf("{\"name\":\"%s\",\"iterations\":%u,\"cycles\":%llu,"
+	       "\"cycles_per_op\":%u,\"ns_per_op\":%u",
+	       result->name, result->operations, result->cycles,
+	       (uint32_t)_bench_divide(result->cycles, result->operations),
+	       (uint32_t)_bench_divide(nanoseconds, result->operations));
+
+	/* bytes * 10^6 / 1024 / microseconds. */
+	if (result->bytes) {
+		printf(",\"bytes\":%u,\"kib_per_s\":%u", result->bytes,
+		       (uint32_t)_bench_divide(
+			       ((uint64_t)result->bytes * 15625) >> 4,
+			       max(microseconds, 1)));
+	}
+
+	printf("}%s\n", last ? "" : ",");
+}
+
+int bench_requested(const char *command_line)
+{
+	const char *option = BENCH_OPTION;
+	uint32_t i;
+
+	while (*command_line) {
+		for (i = 0; option[i] && command_line[i] == option[i]; i++) {
+			/* Compare with the option. */
+		}
+
+		/* The whole word must match. */
+		if (!option[i] &&
+		    (command_line[i] == ' ' || command_line[i] == '\0')) {
+			return 1;
+		}
+
+		/* Skip to the next word. */
+		while (*command_line && *command_line != ' ') {
+			command_line++;
+		}
+		while (*command_line == ' ') {
+			command_line++;
+		}
+	}
+
+	return 0;
+}
+
+void bench_run(void)
+{
+	uint32_t i;
+
+	printf("bench: calibrating the time stamp counter\n");
+	tsc_khz = _bench_calibrate();
+
+	_bench_kmalloc();
+	_bench_heap();
+	_bench_schedule();
+	_bench_page_faults();
+	_bench_fs_tmpfs();
+	_bench_fs_initrd();
+	_bench_block("/dev/hda", "block_read_hda");
+	_bench_block("/dev/vda", "block_read_vda");
+	_bench_aio("/dev/hda", "aio_read_hda");
+	_bench_aio("/dev/vda", "aio_read_vda");
+
+	printf("bench: begin\n");
+	printf("{\"tsc_khz\":%u,\"benchmarks\":[\n", tsc_khz);
+	for (i = 0; i < result_count; i++) {
+		_bench_print(&results[i], i + 1 == result_count);
+	}
+	printf("]}\n");
+	printf("bench: end\n");
+
+	log_flush();
+	DEBUG_EXIT_OUT(DEBUG_EXIT_SUCCESS);
+
+	/* Without the isa-debug-exit device, we are still here. */
+	printf("bench: unable to exit, halting\n");
+	log_flush();
+	for (;;) {
+		__asm volatile("cli; hlt");
+	}
+}
@@ -0,0 +1,129 @@
+#include <kernel/debug.h>
+
+#include <kernel/stdarg.h>
+#include <lib/stdio.h>
+
+#define DEBUG_OPTION "debug="
+
+struct debug_subsystem {
+	const char *name;
+	uint32_t mask;
+};
+
+static const struct debug_subsystem subsystems[] = {
+	{ "aio",           DEBUG_AIO },
+	{ "ata",           DEBUG_ATA },
+	{ "block",         DEBUG_BLOCK },
+	{ "ext2",          DEBUG_EXT2 },
+	{ "fat",           DEBUG_FAT },
+	{ "gdt",           DEBUG_GDT },
+	{ "heap",          DEBUG_HEAP },
+	{ "idt",           DEBUG_IDT },
+	{ "initrd",        DEBUG_INITRD },
+	{ "isr",           DEBUG_ISR },
+	{ "ordered-array", DEBUG_ORDERED_ARRAY },
+	{ "page-cache",    DEBUG_PAGE_CACHE },
+	{ "paging",        DEBUG_PAGING },
+	{ "pci",           DEBUG_PCI },
+	{ "sched",         DEBUG_SCHED },
+	{ "serial",        DEBUG_SERIAL },
+	{ "stdio",         DEBUG_STDIO },
+	{ "timer",         DEBUG_TIMER },
+	{ "tmpfs",         DEBUG_TMPFS },
+	{ "virtio",        DEBUG_VIRTIO },
+	{ "all",           DEBUG_ALL },
+	{ "none",          0 },
+	{ 0,               0 }
+};
+
+uint32_t debug_mask = DEBUG_DEFAULT;
+
+/* Whether the 'length' characters at 'word' are 'name'. */
+static int _debug_match(const char *word, uint32_t length, const char *name)
+{
+	uint32_t i;
+
+	for (i = 0; i < length; i++) {
+		if (word[i] != name[i]) {
+			return 0;
+		}
+	}
+
+	return name[length] == '\0';
+}
+
+/* Find the "debug=" option in 'command_line', returning its value. */
+static const char *_debug_option(const char *command_line)
+{
+	const char *option = DEBUG_OPTION;
+	uint32_t i;
+
+	while (*command_line) {
+		for (i = 0; option[i] && command_line[i] == option[i]; i++) {
+			/* Compare with the option name. */
+		}
+
+		if (!option[i]) {
+			return command_line + i;
+		}
+
+		/* Skip to the next word. */
+		while (*command_line && *command_line != ' ') {
+			command_line++;
+		}
+		while (*command_line == ' ') {
+			command_line++;
+		}
+	}
+
+	return 0;
+}
+
+void init_debug(const char *command_line)
+{
+	const struct debug_subsystem *subsystem;
+	const char *value;
+	uint32_t length, mask = 0;
+
+	if (!command_line || !(value = _debug_option(command_line))) {
+		return;
+	}
+
+	while (*value && *value != ' ') {
+		for (length = 0; value[length] && value[length] != ',' &&
+			     value[length] != ' '; length++) {
+			/* Find the end of the name. */
+		}
+
+		for (subsystem = subsystems; subsystem->name; subsystem++) {
+			if (_debug_match(value, length, subsystem->name)) {
+				mask |= subsystem->mask;
+				break;
+			}
+		}
+
+		if (!subsystem->name) {
+			printf("debug: unknown subsystem '%.*s'\n", length,
+			       value);
+		}
+
+		value += length;
+		if (*value == ',') {
+			value++;
+		}
+	}
+
+	debug_mask = mask;
+}
+
+void debug_printf(int level, const char *file, int line, const char *function,
+		  const char *format, ...)
+{
+	va_list ap;
+
+	klog(level, "%s:%d, %s() ", file, line, function);
+
+	va_start(ap, format);
+	vklog(level, format, ap);
+	va_end(ap);
+}
@@ -100,6 +100,8 @@ isr_common_stub:
     mov fs, ax
     mov gs, ax
 
+    cld           ; C code expects the direction flag clear, but the
+                  ; interrupted code may have set it. iret restores it.
     call isr_handler
 
     pop ebx        ; reload the original data segment descriptor
@@ -128,6 +130,8 @@ irq_common_stub:
     mov fs, ax
     mov gs, ax
 
+    cld           ; C code expects the direction flag clear, but the
+                  ; interrupted code may have set it. iret restores it.
     call irq_handler
 
     pop ebx        ; reload the original data segment descriptor
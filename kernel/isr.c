@@ -36,9 +36,13 @@ void irq_handler(struct registers registers)
 	_execute_handler(registers);
 }
 
-void register_interrupt_handler(uint8_t interrupt_number, isr_t handler) {
+isr_t register_interrupt_handler(uint8_t interrupt_number, isr_t handler) {
+	isr_t previous = interrupt_handlers[interrupt_number];
+
 	isr_debug("Register: [%d, %p]\n",
 		  interrupt_number, (uint32_t) handler);
 
 	interrupt_handlers[interrupt_number] = handler;
+
+	return previous;
 }
@@ -0,0 +1,309 @@
+#include <kernel/log.h>
+
+#include <fs/devfs.h>
+#include <kernel/timer.h>
+#include <kernel/util.h>
+#include <lib/string.h>
+
+/* Sequence numbers start at 1, so that an unused record, whose sequence is 0,
+ * never looks written. A writer sets its record's sequence to 0 while it
+ * fills it in. */
+#define LOG_UNWRITTEN 0
+
+/* The longest prefix added to a line read from /dev/kmsg. */
+#define LOG_PREFIX_MAX 20
+
+/* Keep the compiler from moving stores to a record across the store of its
+ * sequence number. With one processor, nothing stronger is needed. */
+#define log_barrier() __asm volatile("" : : : "memory")
+
+#define log_record(sequence) (&records[(sequence) & (LOG_RECORDS - 1)])
+
+static struct log_record records[LOG_RECORDS];
+static uint32_t next_sequence = 1;
+
+/* Set if the last record written did not end its line. */
+static int line_open = 0;
+
+static struct log_console *consoles = 0;
+static int draining = 0;
+
+static struct fs_node kmsg_node;
+
+/* The oldest record still in the ring. */
+static uint32_t _log_oldest(void)
+{
+	return next_sequence > LOG_RECORDS ? next_sequence - LOG_RECORDS : 1;
+}
+
+/* Copy record 'sequence' to 'copy'. Returns 0 on success, 1 if its writer has
+ * not finished, or -1 if it has been overwritten. */
+static int _log_read(uint32_t sequence, struct log_record *copy)
+{
+	struct log_record *record = log_record(sequence);
+
+	if (sequence < _log_oldest()) {
+		return -1;
+	}
+
+	if (record->sequence != sequence) {
+		return 1;
+	}
+
+	memcpy((uint8_t *)copy, (uint8_t *)record, sizeof(*record));
+	log_barrier();
+
+	/* A writer may have taken the record while it was copied. */
+	return record->sequence == sequence ? 0 : -1;
+}
+
+/* Write 'value' in decimal to 'buffer', at least 'width' digits long with
+ * leading zeros or spaces. Returns the number of characters written. */
+static uint32_t _log_decimal(char *buffer, uint32_t value, uint32_t width,
+			     char pad)
+{
+	char digits[10];
+	uint32_t count = 0, length = 0;
+
+	do {
+		digits[count++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+
+	while (width-- > count) {
+		buffer[length++] = pad;
+	}
+
+	while (count) {
+		buffer[length++] = digits[--count];
+	}
+
+	return length;
+}
+
+void log_write(int level, const char *text, uint32_t length)
+{
+	struct log_record *record;
+	uint32_t sequence, count, lag, flags, interrupts, i;
+	struct log_console *console;
+
+	while (length) {
+		/* A record ends at a newline, so that each line of /dev/kmsg
+		 * starts a record. */
+		count = min(length, LOG_TEXT_MAX);
+		for (i = 0; i < count - 1 && text[i] != '\n'; i++) {
+			/* Find the end of the line. */
+		}
+		count = i + 1;
+
+		/* Take a sequence number. This is the only point at which
+		 * writers are serialised. */
+		irq_save(interrupts);
+		sequence = next_sequence++;
+		flags = line_open ? LOG_CONTINUED : 0;
+		line_open = text[count - 1] != '\n';
+		irq_restore(interrupts);
+
+		record = log_record(sequence);
+		record->sequence = LOG_UNWRITTEN;
+		log_barrier();
+
+		record->timestamp = timer_milliseconds();
+		record->level = level;
+		record->length = count;
+		record->flags = flags;
+		memcpy((uint8_t *)record->text, (const uint8_t *)text, count);
+
+		log_barrier();
+		record->sequence = sequence;
+
+		text += count;
+		length -= count;
+	}
+
+	/* Normally the timer drains the log, but a burst of messages with
+	 * interrupts disabled would otherwise overwrite records before the
+	 * consoles see them. */
+	for (console = consoles, lag = 0; console; console = console->next) {
+		lag = max(lag, next_sequence - console->sequence);
+	}
+
+	if (lag > LOG_RECORDS / 2) {
+		log_drain();
+	}
+}
+
+void log_register_console(struct log_console *console)
+{
+	uint32_t interrupts;
+
+	irq_save(interrupts);
+	console->sequence = _log_oldest();
+	console->next = consoles;
+	consoles = console;
+	irq_restore(interrupts);
+}
+
+/* Tell 'console' how many records it missed, and move it on to the oldest
+ * record left. */
+static void _log_lost(struct log_console *console)
+{
+	static const char message[] = " messages lost]\n";
+	uint32_t oldest = _log_oldest(), length = 2;
+	char notice[40] = "\n[";
+
+	length += _log_decimal(notice + length, oldest - console->sequence, 0,
+			       ' ');
+	memcpy((uint8_t *)notice + length, (const uint8_t *)message,
+	       sizeof(message) - 1);
+	length += sizeof(message) - 1;
+
+	console->write(notice, length);
+	console->sequence = oldest;
+}
+
+static void _log_drain(int force)
+{
+	struct log_console *console;
+	struct log_record record;
+	uint32_t interrupts;
+	int result;
+
+	irq_save(interrupts);
+	if (draining && !force) {
+		irq_restore(interrupts);
+		return;
+	}
+	draining = 1;
+	irq_restore(interrupts);
+
+	for (console = consoles; console; console = console->next) {
+		while (console->sequence != next_sequence) {
+			result = _log_read(console->sequence, &record);
+
+			if (result > 0 && !force) {
+				/* Wait for the writer to finish. */
+				break;
+			} else if (result > 0) {
+				console->sequence++;
+			} else if (result < 0) {
+				_log_lost(console);
+			} else if (!force && console->room &&
+				   console->room() < record.length) {
+				/* Leave the rest until it has caught up. */
+				break;
+			} else {
+				console->write(record.text, record.length);
+				console->sequence++;
+			}
+		}
+
+		if (console->flush) {
+			console->flush();
+		}
+
+		if (force && console->sync) {
+			console->sync();
+		}
+	}
+
+	draining = 0;
+}
+
+void log_drain()
+{
+	_log_drain(0);
+}
+
+void log_flush()
+{
+	_log_drain(1);
+}
+
+/* Write the "<level>[seconds.milliseconds] " prefix of a line of /dev/kmsg to
+ * 'buffer', returning its length. */
+static uint32_t _log_prefix(char *buffer, struct log_record *record)
+{
+	uint32_t length = 0;
+
+	buffer[length++] = '<';
+	buffer[length++] = '0' + (record->level & 0x7);
+	buffer[length++] = '>';
+	buffer[length++] = '[';
+	length += _log_decimal(buffer + length, record->timestamp / 1000, 5,
+			       ' ');
+	buffer[length++] = '.';
+	length += _log_decimal(buffer + length, record->timestamp % 1000, 3,
+			       '0');
+	buffer[length++] = ']';
+	buffer[length++] = ' ';
+
+	return length;
+}
+
+/* We don't want GCC complaining if we don't use the node parameter. */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+/* Read the records in the ring as text, each line starting with its level and
+ * timestamp. Offsets count from the oldest record still in the ring, so they
+ * move as new records push old ones out; a single read of the whole log is
+ * consistent. */
+static uint32_t _log_kmsg_read(struct fs_node *node, uint32_t offset,
+			       uint32_t size, uint8_t *buffer)
+{
+	char line[LOG_PREFIX_MAX + LOG_TEXT_MAX];
+	uint32_t sequence, end, position = 0, done = 0;
+	struct log_record record;
+
+	end = next_sequence;
+
+	for (sequence = _log_oldest(); sequence != end && done < size;
+	     sequence++) {
+		uint32_t length = 0, start, count;
+
+		if (_log_read(sequence, &record)) {
+			continue;
+		}
+
+		if (!(record.flags & LOG_CONTINUED)) {
+			length = _log_prefix(line, &record);
+		}
+		memcpy((uint8_t *)line + length, (uint8_t *)record.text,
+		       record.length);
+		length += record.length;
+
+		if (position + length > offset) {
+			start = offset > position ? offset - position : 0;
+			count = min(length - start, size - done);
+			memcpy(buffer + done, (uint8_t *)line + start, count);
+			done += count;
+		}
+
+		position += length;
+	}
+
+	return done;
+}
+
+/* Writing to /dev/kmsg adds a message. */
+static uint32_t _log_kmsg_write(struct fs_node *node, uint32_t offset,
+				uint32_t size, uint8_t *buffer)
+{
+	log_write(LOG_INFO, (const char *)buffer, size);
+
+	return size;
+}
+
+#pragma GCC diagnostic pop /* ignored "-Wunused-parameter" */
+
+void init_log()
+{
+	memset((uint8_t *)&kmsg_node, 0, sizeof(kmsg_node));
+	memcpy((uint8_t *)kmsg_node.name, (const uint8_t *)"kmsg", 5);
+	kmsg_node.flags = FS_CHARDEVICE;
+	kmsg_node.read = &_log_kmsg_read;
+	kmsg_node.write = &_log_kmsg_write;
+
+	devfs_register(&kmsg_node);
+}
@@ -1,14 +1,26 @@
+#include <fs/dcache.h>
+#include <fs/devfs.h>
+#include <fs/ext2.h>
+#include <fs/fat.h>
 #include <fs/fs.h>
 #include <fs/initrd.h>
+#include <fs/tmpfs.h>
 #include <kernel/assert.h>
+#include <kernel/ata.h>
+#include <kernel/bench.h>
+#include <kernel/debug.h>
 #include <kernel/gdt.h>
 #include <kernel/idt.h>
+#include <kernel/log.h>
 #include <kernel/multiboot.h>
+#include <kernel/pci.h>
+#include <kernel/serial.h>
 #include <kernel/timer.h>
-#include <kernel/tty.h>
+#include <kernel/virtio-blk.h>
 #include <lib/stdio.h>
 #include <lib/string.h>
 #include <mm/heap.h>
+#include <mm/page-cache.h>
 #include <mm/paging.h>
 #include <sched/task.h>
 
@@ -21,15 +33,23 @@ int kmain(struct multiboot *mboot, uint32_t stack)
 	uint32_t initrd_location;
 	uint32_t initrd_end;
 	int i = 0;
-	struct fs_node *fs_root;
 	struct dirent *node = 0;
+	struct fs_node *tmp, *dev, *devices, *mnt, *disks, *disk, *root;
+	struct dirent *entry;
+	uint32_t index;
+	int bench = 0;
 
 	/* Get our stack pointer. */
 	initial_esp = stack;
 
 	init_kstream();
+	if (mboot->flags & MULTIBOOT_FLAG_CMDLINE) {
+		init_debug((const char *)mboot->cmdline);
+		bench = bench_requested((const char *)mboot->cmdline);
+	}
 	init_idt();
 	init_gdt();
+	init_serial();
 
 	/* Initialise the PIT to 100 Hz. */
 	__asm volatile("sti");
@@ -44,9 +64,47 @@ int kmain(struct multiboot *mboot, uint32_t stack)
 
 	/* Start paging. */
 	init_paging();
+	init_page_cache();
 	init_tasking();
 
 	fs_root = init_initrd(initrd_location);
+	init_dcache();
+
+	/* Mount a writable filesystem on /tmp. */
+	tmp = vfs_lookup("/tmp");
+	assert(tmp);
+	fs_mount(tmp, init_tmpfs());
+
+	/* Device nodes live in /dev. */
+	dev = vfs_lookup("/dev");
+	assert(dev);
+	devices = init_devfs();
+	fs_mount(dev, devices);
+	init_log();
+
+	init_pci();
+	init_ata();
+	init_virtio_blk();
+
+	/* Mount each disk holding a filesystem we know on /mnt/<disk>, in a
+	 * tmpfs which holds the mountpoints. Older initrd images have no /mnt,
+	 * in which case nothing is mounted. */
+	if ((mnt = vfs_lookup("/mnt"))) {
+		disks = init_tmpfs();
+		fs_mount(mnt, disks);
+
+		for (index = 0; (entry = fs_readdir(devices, index)); index++) {
+			disk = fs_finddir(devices, entry->name);
+			if (!disk || !(disk->flags & FS_BLOCKDEVICE)) {
+				continue;
+			}
+
+			if ((root = init_fat(disk)) || (root = init_ext2(disk))) {
+				fs_mount(fs_create(disks, entry->name,
+						   FS_DIRECTORY), root);
+			}
+		}
+	}
 
 	/* int ret = fork(); */
 	/* k_message("fork() = %h, getpid() = %h", ret, getpid()); */
@@ -56,19 +114,33 @@ int kmain(struct multiboot *mboot, uint32_t stack)
 	while ((node = fs_readdir(fs_root, i))) {
 		struct fs_node *fsnode = fs_finddir(fs_root, node->name);
 
-		printf("\t%h\t%d\t/%s",
-		       ((struct initrd_file_header *)fsnode)->offset,
-		       fsnode->size, node->name);
+		printf("\t%d\t%d\t/%s",
+		       fsnode->inode, fsnode->size, node->name);
 
 		if (is_dir(fsnode)) {
-			tty_putc('/');
+			printf("/");
 		}
 
-		tty_putc('\n');
+		printf("\n");
 		i++;
 	}
 
 	__asm volatile("sti");
 
+	/* scripts/profiles.sh waits for this message. */
+	printf("Boot complete in %d ms\n", timer_milliseconds());
+
+	/* scripts/bench.sh boots with "bench" on the command line. */
+	if (bench) {
+		bench_run();
+	}
+
+	/* Nothing else runs once the kernel has booted, so wait here for
+	 * interrupts, writing back dirty file data every so often. */
+	for (;;) {
+		__asm volatile("hlt");
+		page_cache_writeback();
+	}
+
 	return 0;
 }
@@ -1,5 +1,6 @@
 #include <kernel/panic.h>
 
+#include <kernel/log.h>
 #include <lib/stdio.h>
 
 #define DISABLE_INTERRUPTS __asm volatile("cli")
@@ -9,6 +10,7 @@ extern void panic_halt(const char *message, const char *file, uint32_t line)
 {
 	DISABLE_INTERRUPTS;
 	printf("\nPANIC(%s) at %s:%d\n", message, file, line);
+	log_flush();
 	CPU_HALT;
 }
 
@@ -16,5 +18,6 @@ extern void panic_assert(const char *file, uint32_t line, const char *assertion)
 {
 	DISABLE_INTERRUPTS;
 	printf("\nASSERTION-FAILED(%s) at %s:%d\n", assertion, file, line);
+	log_flush();
 	CPU_HALT;
 }
@@ -0,0 +1,295 @@
+#include <kernel/pci.h>
+
+#include <kernel/assert.h>
+#include <kernel/port.h>
+#include <lib/stdio.h>
+#include <lib/string.h>
+#include <mm/paging.h>
+
+/* A vendor ID read from an empty slot. */
+#define PCI_NO_VENDOR 0xFFFF
+
+/* PCI class and subclass of a PCI to PCI bridge. */
+#define PCI_CLASS_BRIDGE 0x0604
+
+static struct pci_device devices[PCI_MAX_DEVICES];
+static uint32_t device_count;
+
+static struct pci_driver *drivers;
+
+uint32_t pci_read(struct pci_function *function, uint8_t offset)
+{
+	out_long(PCI_CONFIG_ADDRESS, PCI_CONFIG_ENABLE |
+		 ((uint32_t)function->bus << 16) |
+		 ((uint32_t)function->slot << 11) |
+		 ((uint32_t)function->function << 8) |
+		 (offset & 0xFC));
+
+	return in_long(PCI_CONFIG_DATA);
+}
+
+void pci_write(struct pci_function *function, uint8_t offset, uint32_t value)
+{
+	out_long(PCI_CONFIG_ADDRESS, PCI_CONFIG_ENABLE |
+		 ((uint32_t)function->bus << 16) |
+		 ((uint32_t)function->slot << 11) |
+		 ((uint32_t)function->function << 8) |
+		 (offset & 0xFC));
+
+	out_long(PCI_CONFIG_DATA, value);
+}
+
+/* Decode BAR 'index' of 'device', and return the number of BARs it occupies.
+ * The size is found by writing all ones and reading back which address bits
+ * are writable, with decoding disabled so that the device does not respond at
+ * the temporary address. */
+static uint32_t _pci_decode_bar(struct pci_device *device, uint32_t index)
+{
+	struct pci_function *function = &device->function;
+	struct pci_bar *bar = &device->bars[index];
+	uint8_t offset = PCI_BAR0 + index * 4;
+	uint32_t command, value, mask, high = 0;
+
+	command = pci_read(function, PCI_COMMAND) & 0xFFFF;
+	pci_write(function, PCI_COMMAND,
+		  command & ~(PCI_COMMAND_IO | PCI_COMMAND_MEMORY));
+
+	value = pci_read(function, offset);
+	pci_write(function, offset, 0xFFFFFFFF);
+	mask = pci_read(function, offset);
+	pci_write(function, offset, value);
+
+	bar->virtual = 0;
+
+	if (value & 0x1) {
+		bar->flags = PCI_BAR_IO;
+		bar->address = value & 0xFFFC;
+		mask = (mask & 0xFFFC) | 0xFFFF0000;
+	} else {
+		bar->flags = (value & 0x8) ? PCI_BAR_PREFETCH : 0;
+		bar->address = value & 0xFFFFFFF0;
+		mask &= 0xFFFFFFF0;
+
+		/* Type 2 is a 64 bit BAR, whose upper half is in the next. */
+		if (((value >> 1) & 0x3) == 0x2 && index + 1 < PCI_BARS) {
+			bar->flags |= PCI_BAR_64;
+			high = pci_read(function, offset + 4);
+		}
+	}
+
+	pci_write(function, PCI_COMMAND, command);
+
+	/* An unimplemented BAR reads back as zero, and one which has not been
+	 * assigned an address cannot be used. */
+	bar->size = (mask & 0xFFFFFFF0) && bar->address && !high ?
+		~mask + 1 : 0;
+
+	return (bar->flags & PCI_BAR_64) ? 2 : 1;
+}
+
+static int _pci_matches(struct pci_device *device, const struct pci_id *id)
+{
+	uint16_t class = ((uint16_t)device->class << 8) | device->subclass;
+
+	return (id->vendor == PCI_ANY_ID || id->vendor == device->vendor) &&
+		(id->device == PCI_ANY_ID || id->device == device->device) &&
+		(id->class == PCI_ANY_ID || id->class == class);
+}
+
+/* Offer 'device' to 'driver' if one of its IDs matches. Returns 0 if the
+ * driver took the device. */
+static int _pci_probe(struct pci_driver *driver, struct pci_device *device)
+{
+	const struct pci_id *id;
+
+	for (id = driver->ids; id->vendor || id->device || id->class; id++) {
+		if (!_pci_matches(device, id)) {
+			continue;
+		}
+
+		if (driver->probe(device)) {
+			return -1;
+		}
+
+		pci_debug("%d:%d.%d bound to %s\n", device->function.bus,
+			  device->function.slot, device->function.function,
+			  driver->name);
+
+		device->driver = driver;
+		return 0;
+	}
+
+	return -1;
+}
+
+static void _pci_scan_bus(uint8_t bus);
+
+/* Add the function at 'function' to the device table, and scan the bus behind
+ * it if it is a bridge. */
+static void _pci_scan_function(struct pci_function *function)
+{
+	struct pci_device *device;
+	uint32_t id, class, header, i;
+
+	id = pci_read(function, PCI_VENDOR_ID);
+	class = pci_read(function, PCI_CLASS);
+	header = (pci_read(function, PCI_HEADER_TYPE) >> 16) & 0x7F;
+
+	if (device_count == PCI_MAX_DEVICES) {
+		printf("pci: device table full, ignoring %d:%d.%d\n",
+		       function->bus, function->slot, function->function);
+		return;
+	}
+
+	device = &devices[device_count++];
+	memset((uint8_t *)device, 0, sizeof(*device));
+	device->function = *function;
+	device->vendor = id & 0xFFFF;
+	device->device = id >> 16;
+	device->class = class >> 24;
+	device->subclass = (class >> 16) & 0xFF;
+	device->interface = (class >> 8) & 0xFF;
+	device->revision = class & 0xFF;
+	device->irq = pci_read(function, PCI_INTERRUPT_LINE) & 0xFF;
+
+	/* Bridges have two BARs, and other header types none we decode. */
+	if (header == PCI_HEADER_DEVICE || header == PCI_HEADER_BRIDGE) {
+		uint32_t count = header == PCI_HEADER_DEVICE ? PCI_BARS : 2;
+
+		for (i = 0; i < count; ) {
+			i += _pci_decode_bar(device, i);
+		}
+	}
+
+	pci_debug("%d:%d.%d %h:%h class %h irq %d\n", function->bus,
+		  function->slot, function->function, device->vendor,
+		  device->device, class >> 8, device->irq);
+
+	if (header == PCI_HEADER_BRIDGE && (class >> 16) == PCI_CLASS_BRIDGE) {
+		uint8_t secondary = (pci_read(function, PCI_BUS_NUMBERS) >>
+				     8) & 0xFF;
+
+		/* A secondary bus of 0 means the bridge is unconfigured. */
+		if (secondary) {
+			_pci_scan_bus(secondary);
+		}
+	}
+}
+
+static void _pci_scan_bus(uint8_t bus)
+{
+	struct pci_function function;
+	uint32_t slot, number, functions;
+
+	function.bus = bus;
+
+	for (slot = 0; slot < 32; slot++) {
+		function.slot = slot;
+		function.function = 0;
+
+		if ((pci_read(&function, PCI_VENDOR_ID) & 0xFFFF) ==
+		    PCI_NO_VENDOR) {
+			continue;
+		}
+
+		/* Functions other than 0 only exist on multi-function
+		 * devices. */
+		functions = ((pci_read(&function, PCI_HEADER_TYPE) >> 16) &
+			     PCI_HEADER_MULTIFUNCTION) ? 8 : 1;
+
+		for (number = 0; number < functions; number++) {
+			function.function = number;
+
+			if ((pci_read(&function, PCI_VENDOR_ID) & 0xFFFF) !=
+			    PCI_NO_VENDOR) {
+				_pci_scan_function(&function);
+			}
+		}
+	}
+}
+
+void init_pci()
+{
+	struct pci_function host = { 0, 0, 0 };
+	uint32_t number;
+
+	pci_debug("\n");
+
+	device_count = 0;
+	drivers = 0;
+
+	/* If the host bridge is a multi-function device, each function is the
+	 * controller of another root bus, numbered by function. */
+	if ((pci_read(&host, PCI_HEADER_TYPE) >> 16) &
+	    PCI_HEADER_MULTIFUNCTION) {
+		for (number = 0; number < 8; number++) {
+			host.function = number;
+
+			if ((pci_read(&host, PCI_VENDOR_ID) & 0xFFFF) !=
+			    PCI_NO_VENDOR) {
+				_pci_scan_bus(number);
+			}
+		}
+	} else {
+		_pci_scan_bus(0);
+	}
+
+	printf("pci: %d devices\n", device_count);
+}
+
+void pci_register_driver(struct pci_driver *driver)
+{
+	uint32_t i;
+
+	assert(driver->ids && driver->probe);
+
+	driver->next = drivers;
+	drivers = driver;
+
+	for (i = 0; i < device_count; i++) {
+		if (!devices[i].driver) {
+			_pci_probe(driver, &devices[i]);
+		}
+	}
+}
+
+struct pci_device *pci_get_device(uint32_t index)
+{
+	return index < device_count ? &devices[index] : 0;
+}
+
+void pci_enable(struct pci_device *device, uint16_t command)
+{
+	pci_write(&device->function, PCI_COMMAND,
+		  (pci_read(&device->function, PCI_COMMAND) & 0xFFFF) |
+		  command);
+}
+
+uint32_t pci_map_bar(struct pci_device *device, uint32_t index)
+{
+	struct pci_bar *bar = &device->bars[index];
+	uint32_t first, pages;
+
+	assert(index < PCI_BARS);
+
+	if (!bar->size) {
+		return 0;
+	}
+
+	if (bar->flags & PCI_BAR_IO) {
+		return bar->address;
+	}
+
+	if (!bar->virtual) {
+		first = bar->address & ALIGNMENT_MASK;
+		pages = (bar->address + bar->size - first + PAGE_SIZE - 1) /
+			PAGE_SIZE;
+
+		if ((first = kpage_map(first, pages, KPAGE_UNCACHED))) {
+			bar->virtual = first +
+				(bar->address & PAGE_OFFSET_MASK);
+		}
+	}
+
+	return bar->virtual;
+}
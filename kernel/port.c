@@ -13,6 +13,11 @@ uint8_t in_byte(port_t port)
 	return return_value;
 }
 
+void out_word(port_t port, uint16_t value)
+{
+	__asm volatile("outw %1, %0" : : "dN" (port), "a" (value));
+}
+
 uint16_t in_word(port_t port)
 {
 	uint16_t return_value;
@@ -20,3 +25,34 @@ uint16_t in_word(port_t port)
 	__asm volatile("inw %1, %0" : "=a" (return_value) : "dN" (port));
 	return return_value;
 }
+
+void out_long(port_t port, uint32_t value)
+{
+	__asm volatile("outl %1, %0" : : "dN" (port), "a" (value));
+}
+
+uint32_t in_long(port_t port)
+{
+	uint32_t return_value;
+
+	__asm volatile("inl %1, %0" : "=a" (return_value) : "dN" (port));
+	return return_value;
+}
+
+void in_words(port_t port, uint16_t *buffer, uint32_t count)
+{
+	__asm volatile("cld; rep insw"
+		       : "+D" (buffer), "+c" (count)
+		       : "d" (port)
+		       : "memory");
+}
+
+void out_words(port_t port, uint16_t *buffer, uint32_t count)
+{
+	/* The asm reads the buffer, so stores to it must not be moved past
+	 * it. */
+	__asm volatile("cld; rep outsw"
+		       : "+S" (buffer), "+c" (count)
+		       : "d" (port)
+		       : "memory");
+}
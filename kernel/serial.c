@@ -0,0 +1,249 @@
+#include <kernel/serial.h>
+
+#include <fs/devfs.h>
+#include <kernel/isr.h>
+#include <kernel/util.h>
+#include <lib/stdio.h>
+#include <lib/string.h>
+
+static struct serial_port com1;
+
+/* Move bytes from the ring into the UART's transmit FIFO, which must be
+ * empty. Call with interrupts disabled. */
+static void _serial_fill(struct serial_port *port)
+{
+	uint32_t count;
+
+	for (count = 0; count < SERIAL_FIFO_SIZE &&
+		     port->tx_tail != port->tx_head; count++) {
+		out_byte(port->io + SERIAL_DATA,
+			 port->tx[port->tx_tail++ & (SERIAL_TX_BUFFER - 1)]);
+	}
+}
+
+static void _serial_set_interrupts(struct serial_port *port,
+				   uint8_t interrupts)
+{
+	if (port->interrupts != interrupts) {
+		port->interrupts = interrupts;
+		out_byte(port->io + SERIAL_INTERRUPT, interrupts);
+	}
+}
+
+/* Start sending the ring if the UART is idle. The transmit interrupt then
+ * keeps the FIFO fed until the ring is empty. Call with interrupts
+ * disabled. */
+static void _serial_start(struct serial_port *port)
+{
+	if (port->transmitting || port->tx_tail == port->tx_head) {
+		return;
+	}
+
+	if (in_byte(port->io + SERIAL_STATUS) & SERIAL_STATUS_THRE) {
+		_serial_fill(port);
+	}
+
+	port->transmitting = 1;
+	_serial_set_interrupts(port, port->interrupts | SERIAL_INTERRUPT_TX);
+}
+
+static void _serial_receive(struct serial_port *port)
+{
+	while (in_byte(port->io + SERIAL_STATUS) & SERIAL_STATUS_DATA) {
+		uint8_t byte = in_byte(port->io + SERIAL_DATA);
+
+		if (port->rx_head - port->rx_tail == SERIAL_RX_BUFFER) {
+			port->rx_dropped++;
+			continue;
+		}
+
+		port->rx[port->rx_head++ & (SERIAL_RX_BUFFER - 1)] = byte;
+	}
+}
+
+/* We don't want GCC complaining if we don't use the registers parameter. */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+static void _serial_interrupt(struct registers registers)
+{
+	struct serial_port *port = &com1;
+	uint8_t identify;
+
+	while (!((identify = in_byte(port->io + SERIAL_IDENTIFY)) &
+		 SERIAL_IDENTIFY_NONE)) {
+		switch (identify & SERIAL_IDENTIFY_MASK) {
+		case SERIAL_IDENTIFY_TX:
+			/* The FIFO is empty. Reading the identification
+			 * register has cleared the interrupt. */
+			if (port->tx_tail == port->tx_head) {
+				port->transmitting = 0;
+				_serial_set_interrupts(port, port->interrupts &
+						       ~SERIAL_INTERRUPT_TX);
+			} else {
+				_serial_fill(port);
+			}
+			break;
+		case SERIAL_IDENTIFY_RX:
+		case SERIAL_IDENTIFY_TIMEOUT:
+			_serial_receive(port);
+			break;
+		case SERIAL_IDENTIFY_STATUS:
+			in_byte(port->io + SERIAL_STATUS);
+			break;
+		default:
+			/* Modem status, cleared by reading it. */
+			in_byte(port->io + SERIAL_MODEM_STATUS);
+			break;
+		}
+	}
+}
+
+#pragma GCC diagnostic pop /* ignored "-Wunused-parameter" */
+
+/* Queue 'length' bytes for sending. If the ring fills, which only a writer
+ * outrunning the line for a long time can do, wait for the UART to take
+ * bytes directly. */
+static void _serial_write(struct serial_port *port, const uint8_t *buffer,
+			  uint32_t length)
+{
+	uint32_t flags, i;
+
+	irq_save(flags);
+
+	for (i = 0; i < length; i++) {
+		if (port->tx_head - port->tx_tail == SERIAL_TX_BUFFER) {
+			while (!(in_byte(port->io + SERIAL_STATUS) &
+				 SERIAL_STATUS_THRE)) {
+				/* Wait for the FIFO to empty. */
+			}
+			_serial_fill(port);
+		}
+
+		port->tx[port->tx_head++ & (SERIAL_TX_BUFFER - 1)] = buffer[i];
+	}
+
+	_serial_start(port);
+
+	irq_restore(flags);
+}
+
+static void _serial_console_write(const char *text, uint32_t length)
+{
+	_serial_write(&com1, (const uint8_t *)text, length);
+}
+
+/* Free space in the ring, so that the log is not drained faster than the line
+ * can take it. */
+static uint32_t _serial_console_room(void)
+{
+	return SERIAL_TX_BUFFER - (com1.tx_head - com1.tx_tail);
+}
+
+/* Send everything in the ring by polling, for when interrupts will not be
+ * enabled again. */
+static void _serial_console_sync(void)
+{
+	struct serial_port *port = &com1;
+	uint32_t flags;
+
+	irq_save(flags);
+	while (port->tx_tail != port->tx_head) {
+		if (in_byte(port->io + SERIAL_STATUS) & SERIAL_STATUS_THRE) {
+			_serial_fill(port);
+		}
+	}
+	irq_restore(flags);
+}
+
+/* We don't want GCC complaining if we don't use the offset parameter. */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+static uint32_t _serial_read(struct fs_node *node, uint32_t offset,
+			     uint32_t size, uint8_t *buffer)
+{
+	struct serial_port *port = &com1;
+	uint32_t flags, count = 0;
+
+	irq_save(flags);
+	while (count < size && port->rx_tail != port->rx_head) {
+		buffer[count++] =
+			port->rx[port->rx_tail++ & (SERIAL_RX_BUFFER - 1)];
+	}
+	irq_restore(flags);
+
+	return count;
+}
+
+static uint32_t _serial_device_write(struct fs_node *node, uint32_t offset,
+				     uint32_t size, uint8_t *buffer)
+{
+	_serial_write(&com1, buffer, size);
+
+	return size;
+}
+
+#pragma GCC diagnostic pop /* ignored "-Wunused-parameter" */
+
+/* Returns 0 if there is a working UART at 'io', checked by sending a byte to
+ * itself in loopback mode. */
+static int _serial_probe(port_t io)
+{
+	out_byte(io + SERIAL_SCRATCH, 0x5A);
+	if (in_byte(io + SERIAL_SCRATCH) != 0x5A) {
+		return -1;
+	}
+
+	out_byte(io + SERIAL_MODEM, SERIAL_MODEM_LOOPBACK);
+	out_byte(io + SERIAL_DATA, 0xAE);
+	if (in_byte(io + SERIAL_DATA) != 0xAE) {
+		return -1;
+	}
+
+	return 0;
+}
+
+void init_serial()
+{
+	struct serial_port *port = &com1;
+	uint16_t divisor = SERIAL_BASE_BAUD / SERIAL_BAUD;
+
+	serial_debug("\n");
+
+	memset((uint8_t *)port, 0, sizeof(*port));
+	port->io = SERIAL_COM1;
+	port->irq = IRQ4;
+
+	out_byte(port->io + SERIAL_INTERRUPT, 0);
+	if (_serial_probe(port->io)) {
+		return;
+	}
+
+	out_byte(port->io + SERIAL_LINE, SERIAL_LINE_DLAB);
+	out_byte(port->io + SERIAL_DIVISOR_LOW, divisor & 0xFF);
+	out_byte(port->io + SERIAL_DIVISOR_HIGH, divisor >> 8);
+	out_byte(port->io + SERIAL_LINE, SERIAL_LINE_8N1);
+	out_byte(port->io + SERIAL_FIFO, SERIAL_FIFO_ENABLE |
+		 SERIAL_FIFO_CLEAR_RX | SERIAL_FIFO_CLEAR_TX |
+		 SERIAL_FIFO_RX_14);
+	out_byte(port->io + SERIAL_MODEM, SERIAL_MODEM_DTR | SERIAL_MODEM_RTS |
+		 SERIAL_MODEM_OUT2);
+
+	register_interrupt_handler(port->irq, (isr_t)&_serial_interrupt);
+	_serial_set_interrupts(port, SERIAL_INTERRUPT_RX);
+
+	port->console.name = "ttyS0";
+	port->console.write = &_serial_console_write;
+	port->console.room = &_serial_console_room;
+	port->console.sync = &_serial_console_sync;
+	log_register_console(&port->console);
+
+	memcpy((uint8_t *)port->node.name, (const uint8_t *)"ttyS0", 6);
+	port->node.flags = FS_CHARDEVICE;
+	port->node.read = &_serial_read;
+	port->node.write = &_serial_device_write;
+	devfs_register(&port->node);
+
+	printf("ttyS0: 16550 UART at %h, %d baud\n", port->io, SERIAL_BAUD);
+}
@@ -1,12 +1,15 @@
 #include <kernel/timer.h>
 #include <kernel/isr.h>
+#include <kernel/log.h>
 #include <kernel/port.h>
+#include <kernel/tty.h>
 #include <lib/stdio.h>
 #include <sched/task.h>
 
 #define PIT_CLOCK_FREQUENCY 1193180
 
 static uint32_t tick = 0;
+static uint32_t tick_frequency = 0;
 
 /* We don't want GCC complaining if we don't use the registers parameter. */
 #pragma GCC diagnostic push
@@ -14,6 +17,12 @@ static uint32_t tick = 0;
 
 static void _timer_callback(struct registers registers) {
 	tick++;
+
+	/* Write out new log messages, and show console output which has not
+	 * been flushed yet. */
+	log_drain();
+	tty_flush();
+
 	context_switch();
 }
 
@@ -28,6 +37,8 @@ void init_timer(uint32_t frequency)
 	/* Register our timer callback. */
 	register_interrupt_handler(IRQ0, (isr_t)&_timer_callback);
 
+	tick_frequency = frequency;
+
 	/* Get the 16-bit divisor. */
 	divisor = PIT_CLOCK_FREQUENCY / frequency;
 
@@ -38,3 +49,14 @@ void init_timer(uint32_t frequency)
 	PIT_0_DATA_OUT((uint8_t)(divisor & 0xFF));
 	PIT_0_DATA_OUT((uint8_t)((divisor>>8) & 0xFF));
 }
+
+uint32_t timer_milliseconds()
+{
+	if (!tick_frequency) {
+		return 0;
+	}
+
+	/* Split the conversion so that it needs no 64 bit division. */
+	return (tick / tick_frequency) * 1000 +
+		(tick % tick_frequency) * 1000 / tick_frequency;
+}
@@ -2,6 +2,7 @@
 #include <kernel/port.h>
 #include <tty/ascii.h>
 #include <kernel/util.h>
+#include <lib/string.h>
 
 /* The display can be thought of as a two dimension array of characters,
  * arranged into rows and columns. These values dicatate the size of each. */
@@ -11,11 +12,25 @@
 /* Memory addresses. */
 #define VGA_FRAMEBUFFER_ADDRESS 0xB8000
 
+/* Size of the text mode window onto video memory. */
+#define VGA_FRAMEBUFFER_SIZE 0x8000
+
 /* Each TTY character consists of two bytes, with bits 7:0 being an ASCII code,
  * and the higher and lower nibbles of bits 15:8 representing the background and
  * foreground colours, respectively. */
 typedef uint16_t tty_char_t;
 
+/* Rows of text which fit in video memory. The screen is a window onto this
+ * ring of rows, and scrolls by moving the display start address. */
+#define TTY_BUFFER_ROWS (VGA_FRAMEBUFFER_SIZE / sizeof(tty_char_t) / \
+			 TTY_CHAR_WIDTH)
+
+/* CRT controller registers. */
+#define CRTC_START_ADDRESS_HIGH 0x0C
+#define CRTC_START_ADDRESS_LOW  0x0D
+#define CRTC_CURSOR_HIGH        0x0E
+#define CRTC_CURSOR_LOW         0x0F
+
 /* Blank character. */
 #define TTY_CHAR_BLANK (high_byte(high_nibble(background_colour)        \
                                   | low_nibble(foreground_colour))      \
@@ -35,21 +50,69 @@ static enum tty_colour_e foreground_colour = TTY_COLOUR_WHITE;
 /* This pointer marks the start of the framebuffer memory. */
 static tty_char_t *video_memory = (tty_char_t *) VGA_FRAMEBUFFER_ADDRESS;
 
-/* Update the position of the hardware cursor. */
+/* The row of video memory shown at the top of the screen, in the range
+ * [0, TTY_BUFFER_ROWS - TTY_CHAR_HIEGHT]. */
+static uint32_t tty_top_row = 0;
+
+/* Characters are written to a copy of the screen in ordinary memory, and
+ * copied to video memory by tty_flush(). The copy is a ring of rows, of which
+ * screen row 0 is shadow_top_row. */
+static tty_char_t shadow[TTY_CHAR_HIEGHT][TTY_CHAR_WIDTH];
+static uint32_t shadow_top_row = 0;
+
+/* Bit y is set if screen row y has changed since the last flush. */
+#define TTY_ALL_ROWS ((1 << TTY_CHAR_HIEGHT) - 1)
+static uint32_t dirty_rows = 0;
+
+/* Lines scrolled since the last flush. */
+static uint32_t pending_scrolls = 0;
+
+/* The cursor location last sent to the display. */
+static uint16_t shown_cursor_location = 0;
+
+/* Return the location in the shadow screen of the character at (x, y). */
+static tty_char_t *_tty_cell(uint8_t x, uint8_t y)
+{
+	return &shadow[(shadow_top_row + y) % TTY_CHAR_HIEGHT][x];
+}
+
+/* Update the position of the hardware cursor, if it has moved. */
 static void _update_cursor_position(void)
 {
 	uint16_t cursor_location;
 
-	/* Get the location of the cursor as a flat array index. */
-	cursor_location = (tty_cursor_y * TTY_CHAR_WIDTH) + tty_cursor_x;
+	/* Get the location of the cursor as an index into video memory, which
+	 * is independent of the display start address. */
+	cursor_location = ((tty_top_row + tty_cursor_y) * TTY_CHAR_WIDTH) +
+		tty_cursor_x;
+
+	if (cursor_location == shown_cursor_location) {
+		return;
+	}
 
 	/* Send the high cursor byte. */
-	TTY_COMMAND_OUT(14);
+	TTY_COMMAND_OUT(CRTC_CURSOR_HIGH);
 	TTY_DATA_OUT(cursor_location >> 8);
 
 	/* Send the low cursor byte. */
-	TTY_COMMAND_OUT(15);
+	TTY_COMMAND_OUT(CRTC_CURSOR_LOW);
 	TTY_DATA_OUT(cursor_location);
+
+	shown_cursor_location = cursor_location;
+}
+
+/* Show the screen from the current top row of video memory. */
+static void _update_start_address(void)
+{
+	uint16_t start_address;
+
+	start_address = tty_top_row * TTY_CHAR_WIDTH;
+
+	TTY_COMMAND_OUT(CRTC_START_ADDRESS_HIGH);
+	TTY_DATA_OUT(start_address >> 8);
+
+	TTY_COMMAND_OUT(CRTC_START_ADDRESS_LOW);
+	TTY_DATA_OUT(start_address);
 }
 
 /* Initialise the TTY. */
@@ -59,48 +122,102 @@ void init_tty()
 	tty_set_colour(TTY_COLOUR_BLACK, TTY_COLOUR_WHITE);
 }
 
+/* Copy the changes to the shadow screen into video memory, and move the
+ * hardware cursor. Lines scrolled since the last flush move the display start
+ * address down the ring of rows in video memory, which leaves the rows they
+ * pushed up already in place, so only rows which have changed are copied.
+ * When the ring runs out, the display goes back to the start of video memory
+ * and every row is copied. */
+void tty_flush()
+{
+	uint32_t flags, y;
+
+	irq_save(flags);
+
+	if (pending_scrolls) {
+		if (tty_top_row + pending_scrolls + TTY_CHAR_HIEGHT <=
+		    TTY_BUFFER_ROWS) {
+			tty_top_row += pending_scrolls;
+		} else {
+			tty_top_row = 0;
+			dirty_rows = TTY_ALL_ROWS;
+		}
+
+		_update_start_address();
+		pending_scrolls = 0;
+	}
+
+	for (y = 0; dirty_rows; y++) {
+		if (dirty_rows & (1 << y)) {
+			memcpy((uint8_t *)(video_memory + (tty_top_row + y) *
+					   TTY_CHAR_WIDTH),
+			       (uint8_t *)_tty_cell(0, y), sizeof(shadow[0]));
+			dirty_rows &= ~(1 << y);
+		}
+	}
+
+	_update_cursor_position();
+
+	irq_restore(flags);
+}
+
 /* Clear the TTY display. */
 void tty_clear()
 {
-	int i;
+	uint32_t flags;
+	int x, y;
 
-	for (i = 0; i < TTY_CHAR_WIDTH * TTY_CHAR_HIEGHT; i++) {
-		video_memory[i] = TTY_CHAR_BLANK;
+	irq_save(flags);
+
+	for (y = 0; y < TTY_CHAR_HIEGHT; y++) {
+		for (x = 0; x < TTY_CHAR_WIDTH; x++) {
+			shadow[y][x] = TTY_CHAR_BLANK;
+		}
 	}
+	shadow_top_row = 0;
+	dirty_rows = TTY_ALL_ROWS;
+
+	/* Start again at the beginning of video memory. */
+	tty_top_row = 0;
+	pending_scrolls = 0;
+	_update_start_address();
 
 	/* Return hardware cursor to start. */
 	tty_cursor_x = 0;
 	tty_cursor_y = 0;
-	_update_cursor_position();
+	shown_cursor_location = (uint16_t)-1;
+
+	tty_flush();
+
+	irq_restore(flags);
 }
 
-/* Scroll the display one line. */
+/* Scroll the display one line. Only the shadow screen changes, and the scroll
+ * reaches the display at the next flush. */
 void tty_scroll_line()
 {
+	tty_char_t *line;
+	uint32_t flags;
 	int i;
-	int j;
 
-	/* Duplicate each line onto the previous one. */
-	for (i = 1; i < (TTY_CHAR_HIEGHT - 1); i++) {
-		for (j = 0; j < TTY_CHAR_WIDTH; j++) {
-			video_memory[((i - 1) * TTY_CHAR_WIDTH) + j] =
-				video_memory[(i * TTY_CHAR_WIDTH) + j];
-		}
-	}
+	irq_save(flags);
+
+	shadow_top_row = (shadow_top_row + 1) % TTY_CHAR_HIEGHT;
+	dirty_rows = (dirty_rows >> 1) | (1 << (TTY_CHAR_HIEGHT - 1));
+	pending_scrolls++;
 
-	/* Insert a blank line at the end. Fill the new line with the background
-	 * colour of the character directly above. */
+	/* The new line is the old top line, so blank it. */
+	line = _tty_cell(0, TTY_CHAR_HIEGHT - 1);
 	for (i = 0; i < TTY_CHAR_WIDTH; i++) {
-		video_memory[(TTY_CHAR_WIDTH * (TTY_CHAR_HIEGHT - 1)) + i] = \
-			low_nibble(video_memory[(TTY_CHAR_WIDTH
-						 * (TTY_CHAR_HIEGHT - 2)) + i]);
+		line[i] = TTY_CHAR_BLANK;
 	}
 
-	/* Scroll the hardware cursor. */
+	/* Scroll the cursor. */
 	if (tty_cursor_y) {
 		tty_cursor_y--;
-		_update_cursor_position();
 	}
+
+	irq_restore(flags);
 }
 
 /* Move the TTY cursor to a new position. If the cursor position is out of
@@ -115,26 +232,35 @@ void tty_move_cursor(uint8_t x, uint8_t y)
 
 	tty_cursor_x = dest_x;
 	tty_cursor_y = dest_y;
-	_update_cursor_position();
+	tty_flush();
 }
 
-/* Write the given character to the TTY display. */
+/* Write the given character to the TTY display. The character is shown at the
+ * next flush. */
 void tty_putc(char c)
 {
 	tty_char_t character;
 	uint16_t *location;
+	uint32_t flags;
 
 	/* Create our TTY character. */
 	character = high_byte(high_nibble(background_colour)        \
 			      | low_nibble(foreground_colour))     \
 		| low_byte(c);
 
+	irq_save(flags);
+
+	/* The cursor may have been moved to just below the screen. */
+	if (tty_cursor_y >= TTY_CHAR_HIEGHT) {
+		tty_scroll_line();
+	}
+
 	if (c == ASCII_BACKSPACE && tty_cursor_x) {
 		/* In case of backspace character, get the location of the last
 		 * character and mask off the low nibble. */
-		location = video_memory
-			+ (tty_cursor_y * TTY_CHAR_WIDTH + tty_cursor_x - 1);
+		location = _tty_cell(tty_cursor_x - 1, tty_cursor_y);
 		*location = *location & 0xF;
+		dirty_rows |= 1 << tty_cursor_y;
 		tty_cursor_x--;
 	} else if (c == '\t') {
 		tty_cursor_x = (tty_cursor_x + 8) & ~(8-1);
@@ -144,9 +270,9 @@ void tty_putc(char c)
 		tty_cursor_x = 0;
 		tty_cursor_y++;
 	} else if (c >= ' ') {
-		location = video_memory
-			+ (tty_cursor_y * TTY_CHAR_WIDTH + tty_cursor_x);
+		location = _tty_cell(tty_cursor_x, tty_cursor_y);
 		*location = character;
+		dirty_rows |= 1 << tty_cursor_y;
 		tty_cursor_x++;
 	}
 
@@ -161,8 +287,30 @@ void tty_putc(char c)
 		tty_scroll_line();
 	}
 
-	/* Move hardware cursor. */
-	_update_cursor_position();
+	irq_restore(flags);
+}
+
+/* As tty_write() and tty_nwrite(), but leaving the output to be shown at the
+ * next flush. */
+static void _tty_write(const char *c)
+{
+	sint32_t i;
+
+	i = 0;
+	while (c[i] != '\0') {
+		tty_putc(c[i++]);
+	}
+}
+
+static void _tty_nwrite(const char *c, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (c[i] != '\0') {
+			tty_putc(c[i]);
+		}
+	}
 }
 
 #define INT32_MAX_HEX_DIGITS 8
@@ -174,7 +322,7 @@ void tty_puth(uint32_t h)
 	static char buffer[INT32_MAX_HEX_DIGITS + 2];
 	char *pointer;
 
-	tty_nwrite("0x", sizeof("0x"));
+	_tty_nwrite("0x", sizeof("0x"));
 	pointer = buffer + INT32_MAX_HEX_DIGITS + 1;
 
 	do {
@@ -191,7 +339,7 @@ void tty_puth(uint32_t h)
 		h = h >> 4;
 	} while (h != 0);
 
-	tty_write(pointer);
+	_tty_write(pointer);
 }
 
 /* Print a binary representation of a 32-bit integer to the TTY. */
@@ -199,7 +347,7 @@ void tty_putb(uint32_t p)
 {
 	sint8_t i;
 
-	tty_nwrite("0b", sizeof("0b"));
+	_tty_nwrite("0b", sizeof("0b"));
 
 	/* Iterate over each nibble in the word. */
 	for (i = 28; i >= 0; i-=4) {
@@ -210,52 +358,52 @@ void tty_putb(uint32_t p)
 		/* Determine the correct binary representation the nibble. */
 		switch(nibble) {
 		case 0x0:
-			tty_nwrite("0000", sizeof("0000"));
+			_tty_nwrite("0000", sizeof("0000"));
 			break;
 		case 0x1:
-			tty_nwrite("0001", sizeof("0001"));
+			_tty_nwrite("0001", sizeof("0001"));
 			break;
 		case 0x2:
-			tty_nwrite("0010", sizeof("0010"));
+			_tty_nwrite("0010", sizeof("0010"));
 			break;
 		case 0x3:
-			tty_nwrite("0011", sizeof("0011"));
+			_tty_nwrite("0011", sizeof("0011"));
 			break;
 		case 0x4:
-			tty_nwrite("0100", sizeof("0100"));
+			_tty_nwrite("0100", sizeof("0100"));
 			break;
 		case 0x5:
-			tty_nwrite("0101", sizeof("0101"));
+			_tty_nwrite("0101", sizeof("0101"));
 			break;
 		case 0x6:
-			tty_nwrite("0110", sizeof("0110"));
+			_tty_nwrite("0110", sizeof("0110"));
 			break;
 		case 0x7:
-			tty_nwrite("0111", sizeof("0111"));
+			_tty_nwrite("0111", sizeof("0111"));
 			break;
 		case 0x8:
-			tty_nwrite("1000", sizeof("1000"));
+			_tty_nwrite("1000", sizeof("1000"));
 			break;
 		case 0x9:
-			tty_nwrite("1001", sizeof("1001"));
+			_tty_nwrite("1001", sizeof("1001"));
 			break;
 		case 0xA:
-			tty_nwrite("1010", sizeof("1010"));
+			_tty_nwrite("1010", sizeof("1010"));
 			break;
 		case 0xB:
-			tty_nwrite("1011", sizeof("1011"));
+			_tty_nwrite("1011", sizeof("1011"));
 			break;
 		case 0xC:
-			tty_nwrite("1100", sizeof("1100"));
+			_tty_nwrite("1100", sizeof("1100"));
 			break;
 		case 0xD:
-			tty_nwrite("1101", sizeof("1101"));
+			_tty_nwrite("1101", sizeof("1101"));
 			break;
 		case 0xE:
-			tty_nwrite("1110", sizeof("1110"));
+			_tty_nwrite("1110", sizeof("1110"));
 			break;
 		case 0xF:
-			tty_nwrite("1111", sizeof("1111"));
+			_tty_nwrite("1111", sizeof("1111"));
 			break;
 		}
 
@@ -280,7 +428,7 @@ void tty_putd(uint32_t d)
 		d /= 10;
 	} while (d != 0);
 
-	tty_write(pointer);
+	_tty_write(pointer);
 }
 
 void tty_puti(int i)
@@ -296,12 +444,8 @@ void tty_puti(int i)
 /* Write a null-terminated character string to the TTY. */
 void tty_write(const char *c)
 {
-	sint32_t i;
-
-	i = 0;
-	while (c[i] != '\0') {
-		tty_putc(c[i++]);
-	}
+	_tty_write(c);
+	tty_flush();
 }
 
 /* Write a null-terminated character string to the TTY. This is a much safer
@@ -309,13 +453,8 @@ void tty_write(const char *c)
  * buffer overflow from non-null terminated strings. */
 void tty_nwrite(const char *c, int n)
 {
-	int i;
-
-	for (i = 0; i < n; i++) {
-		if (c[i] != '\0') {
-			tty_putc(c[i]);
-		}
-	}
+	_tty_nwrite(c, n);
+	tty_flush();
 }
 
 /* Set a new drawing colour for the TTY. */
@@ -0,0 +1,396 @@
+#include <kernel/virtio-blk.h>
+
+#include <kernel/isr.h>
+#include <kernel/util.h>
+#include <lib/stdio.h>
+#include <lib/string.h>
+#include <mm/heap.h>
+#include <mm/paging.h>
+
+/* The most data descriptors one transfer can need: one per page of the
+ * largest transfer, plus one for each buffer which does not start on a page
+ * boundary. */
+#define VIRTIO_BLK_SEGMENTS						\
+	(VIRTIO_BLK_MAX_SECTORS * BLOCK_SECTOR_SIZE / PAGE_SIZE +	\
+	 BLOCK_MAX_SEGMENTS)
+
+/* The bytes of a header which the device reads. */
+#define VIRTIO_BLK_HEADER_SIZE 16
+
+#define align_up(n, a) (((n) + (a) - 1) & ~((a) - 1))
+
+/* The event index fields which follow the two rings. */
+#define used_event(vblk) ((vblk)->avail->ring[(vblk)->size])
+#define avail_event(vblk)						\
+	(*(volatile uint16_t *)((uint8_t *)(vblk)->used->ring +		\
+				(vblk)->size * sizeof(struct virtq_used_elem)))
+
+/* Stop the compiler from moving ring accesses across an index update. */
+#define barrier() __asm volatile("" : : : "memory")
+
+/* A full barrier. x86 may let a load pass an earlier store, which matters when
+ * we publish an event index and then check the device's progress. The locked
+ * instruction works on every IA-32 processor, unlike mfence. */
+#define memory_barrier() __asm volatile("lock; addl $0, (%%esp)" : : : "memory")
+
+static struct virtio_blk devices[VIRTIO_BLK_MAX];
+static uint32_t device_count;
+
+/* The handlers of other drivers on each IRQ line we use, called after ours. */
+static isr_t chained[16];
+
+static uint16_t _virtq_desc_alloc(struct virtio_blk *vblk, uint32_t address,
+				  uint32_t length, uint16_t flags)
+{
+	uint16_t i = vblk->free_head;
+	struct virtq_desc *desc = &vblk->desc[i];
+
+	vblk->free_head = desc->next;
+	vblk->free_count--;
+
+	desc->address = address;
+	desc->length = length;
+	desc->flags = flags;
+	desc->next = 0;
+
+	return i;
+}
+
+static void _virtq_chain_free(struct virtio_blk *vblk, uint16_t head)
+{
+	uint16_t i = head;
+
+	for (;;) {
+		struct virtq_desc *desc = &vblk->desc[i];
+		uint16_t next = desc->next;
+		int more = desc->flags & VIRTQ_DESC_F_NEXT;
+
+		desc->next = vblk->free_head;
+		vblk->free_head = i;
+		vblk->free_count++;
+
+		if (!more) {
+			break;
+		}
+		i = next;
+	}
+}
+
+/* Tell the device about new buffers, unless it has asked not to be told. */
+static void _virtq_notify(struct virtio_blk *vblk, uint16_t old)
+{
+	uint16_t new = vblk->avail->index;
+	int notify;
+
+	memory_barrier();
+
+	if (vblk->features & VIRTIO_RING_F_EVENT_IDX) {
+		/* Only if the device has not already seen past 'old'. */
+		notify = (uint16_t)(new - avail_event(vblk) - 1) <
+			(uint16_t)(new - old);
+	} else {
+		notify = !(vblk->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+	}
+
+	if (notify) {
+		out_word(vblk->io + VIRTIO_QUEUE_NOTIFY, 0);
+	}
+}
+
+static int _virtio_blk_transfer(struct block_device *device,
+				struct block_transfer *transfer)
+{
+	struct virtio_blk *vblk = device->driver;
+	uint32_t slot = transfer - device->transfers;
+	struct virtio_blk_header *header = &vblk->headers[slot];
+	uint32_t header_physical = vblk->headers_physical +
+		slot * sizeof(struct virtio_blk_header);
+	uint32_t addresses[VIRTIO_BLK_SEGMENTS];
+	uint32_t lengths[VIRTIO_BLK_SEGMENTS];
+	uint32_t count = 0, i;
+	uint16_t head, prev, data_flags, old;
+
+	/* Describe the buffers by physical page, joining pages which are
+	 * physically contiguous. Page cache pages are used directly. */
+	for (i = 0; i < transfer->iov_count; i++) {
+		uint32_t address = (uint32_t)transfer->iov[i].iov_base;
+		uint32_t remaining = transfer->iov[i].iov_len;
+
+		while (remaining) {
+			uint32_t physical = virtual_to_physical(address);
+			uint32_t length = min(remaining, PAGE_SIZE -
+					      (address & PAGE_OFFSET_MASK));
+
+			if (!physical) {
+				block_complete(device, transfer, -1);
+				return 0;
+			}
+
+			if (count && addresses[count - 1] + lengths[count - 1]
+			    == physical) {
+				lengths[count - 1] += length;
+			} else {
+				addresses[count] = physical;
+				lengths[count++] = length;
+			}
+
+			address += length;
+			remaining -= length;
+		}
+	}
+
+	if (count > vblk->seg_max) {
+		block_complete(device, transfer, -1);
+		return 0;
+	}
+
+	/* Wait for completions to free enough descriptors. */
+	if (count + 2 > vblk->free_count) {
+		return -1;
+	}
+
+	header->type = transfer->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+	header->reserved = 0;
+	header->sector = transfer->sector;
+	header->status = 0xFF;
+
+	head = _virtq_desc_alloc(vblk, header_physical, VIRTIO_BLK_HEADER_SIZE,
+				 VIRTQ_DESC_F_NEXT);
+	prev = head;
+
+	/* The device writes into the buffers of a read. */
+	data_flags = VIRTQ_DESC_F_NEXT |
+		(transfer->write ? 0 : VIRTQ_DESC_F_WRITE);
+
+	for (i = 0; i < count; i++) {
+		uint16_t desc = _virtq_desc_alloc(vblk, addresses[i],
+						  lengths[i], data_flags);
+
+		vblk->desc[prev].next = desc;
+		prev = desc;
+	}
+
+	vblk->desc[prev].next = _virtq_desc_alloc(vblk, header_physical +
+		VIRTIO_BLK_HEADER_SIZE, 1, VIRTQ_DESC_F_WRITE);
+
+	vblk->chains[head] = transfer;
+	vblk->in_flight++;
+
+	old = vblk->avail->index;
+	vblk->avail->ring[old % vblk->size] = head;
+	barrier();
+	vblk->avail->index = old + 1;
+
+	_virtq_notify(vblk, old);
+
+	return 0;
+}
+
+/* Complete every request the device has finished with. */
+static void _virtio_blk_drain(struct virtio_blk *vblk)
+{
+	volatile struct virtq_used *used = vblk->used;
+
+	for (;;) {
+		while (vblk->last_used != used->index) {
+			struct virtq_used_elem *elem;
+			struct block_transfer *transfer;
+			uint32_t slot;
+
+			barrier();
+			elem = &vblk->used->ring[vblk->last_used % vblk->size];
+			transfer = vblk->chains[elem->id];
+			slot = transfer - vblk->device.transfers;
+
+			_virtq_chain_free(vblk, elem->id);
+			vblk->last_used++;
+			vblk->in_flight--;
+
+			/* This may start more transfers. */
+			block_complete(&vblk->device, transfer,
+				       vblk->headers[slot].status ? -1 : 0);
+		}
+
+		if (!(vblk->features & VIRTIO_RING_F_EVENT_IDX)) {
+			break;
+		}
+
+		/* Coalesce interrupts: ask for the next one when half of the
+		 * outstanding requests have completed, or the next request if
+		 * there is only one. Then check that the device did not
+		 * finish more in the meantime. */
+		used_event(vblk) = vblk->last_used +
+			max(vblk->in_flight / 2, 1) - 1;
+		memory_barrier();
+
+		if (vblk->last_used == used->index) {
+			break;
+		}
+	}
+}
+
+static void _virtio_blk_interrupt(struct registers registers)
+{
+	uint32_t i;
+
+	/* The interrupt line may be shared, so check every device on it.
+	 * Reading the ISR register acknowledges the interrupt. */
+	for (i = 0; i < device_count; i++) {
+		struct virtio_blk *vblk = &devices[i];
+
+		if (vblk->irq == registers.interrupt_number &&
+		    (in_byte(vblk->io + VIRTIO_ISR) & VIRTIO_ISR_QUEUE)) {
+			_virtio_blk_drain(vblk);
+		}
+	}
+
+	if (chained[registers.interrupt_number - IRQ0]) {
+		chained[registers.interrupt_number - IRQ0](registers);
+	}
+}
+
+/* Negotiate features and set up the virtqueue. Returns 0, or -1 if the device
+ * cannot be used. */
+static int _virtio_blk_setup(struct virtio_blk *vblk)
+{
+	uint32_t desc_size, avail_size, used_size, ring, i;
+
+	out_byte(vblk->io + VIRTIO_STATUS, 0);
+	out_byte(vblk->io + VIRTIO_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+	out_byte(vblk->io + VIRTIO_STATUS, VIRTIO_STATUS_ACKNOWLEDGE |
+		 VIRTIO_STATUS_DRIVER);
+
+	vblk->features = in_long(vblk->io + VIRTIO_HOST_FEATURES) &
+		(VIRTIO_RING_F_EVENT_IDX | VIRTIO_BLK_F_SEG_MAX);
+	out_long(vblk->io + VIRTIO_GUEST_FEATURES, vblk->features);
+
+	out_word(vblk->io + VIRTIO_QUEUE_SELECT, 0);
+	vblk->size = in_word(vblk->io + VIRTIO_QUEUE_SIZE);
+	if (vblk->size < 3) {
+		return -1;
+	}
+
+	/* The legacy layout: descriptors, then the available ring, then the
+	 * used ring on the next page boundary. */
+	desc_size = sizeof(struct virtq_desc) * vblk->size;
+	avail_size = sizeof(struct virtq_avail) + sizeof(uint16_t) *
+		(vblk->size + 1);
+	used_size = sizeof(struct virtq_used) +
+		sizeof(struct virtq_used_elem) * vblk->size + sizeof(uint16_t);
+
+	i = (align_up(desc_size + avail_size, VIRTQ_ALIGN) +
+	     align_up(used_size, VIRTQ_ALIGN)) / PAGE_SIZE;
+
+	if (!(ring = kpage_alloc_contiguous(i))) {
+		return -1;
+	}
+
+	vblk->desc = (struct virtq_desc *)ring;
+	vblk->avail = (struct virtq_avail *)(ring + desc_size);
+	vblk->used = (struct virtq_used *)
+		(ring + align_up(desc_size + avail_size, VIRTQ_ALIGN));
+
+	for (i = 0; i < vblk->size; i++) {
+		vblk->desc[i].next = i + 1;
+	}
+	vblk->free_head = 0;
+	vblk->free_count = vblk->size;
+	vblk->last_used = 0;
+	vblk->in_flight = 0;
+
+	out_long(vblk->io + VIRTIO_QUEUE_PFN,
+		 virtual_to_physical(ring) / PAGE_SIZE);
+
+	vblk->seg_max = min(vblk->size - 2, VIRTIO_BLK_SEGMENTS);
+	if (vblk->features & VIRTIO_BLK_F_SEG_MAX) {
+		vblk->seg_max = min(vblk->seg_max,
+				    in_long(vblk->io + VIRTIO_CONFIG +
+					    VIRTIO_BLK_SEG_MAX));
+	}
+
+	vblk->headers = (struct virtio_blk_header *)kpage_alloc(1);
+	vblk->headers_physical = virtual_to_physical((uint32_t)vblk->headers);
+	vblk->chains = kcreate(struct block_transfer *, vblk->size);
+
+	out_byte(vblk->io + VIRTIO_STATUS, VIRTIO_STATUS_ACKNOWLEDGE |
+		 VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+	return 0;
+}
+
+static int _virtio_blk_probe(struct pci_device *device)
+{
+	struct virtio_blk *vblk;
+	char name[] = "vda";
+	uint32_t i;
+
+	/* The legacy interface is in I/O space. */
+	if (device_count == VIRTIO_BLK_MAX ||
+	    !(device->bars[0].flags & PCI_BAR_IO) ||
+	    device->irq == PCI_NO_IRQ) {
+		return -1;
+	}
+
+	vblk = &devices[device_count];
+	vblk->pci = device;
+	vblk->io = (port_t)pci_map_bar(device, 0);
+	vblk->irq = IRQ0 + device->irq;
+
+	pci_enable(device, PCI_COMMAND_IO | PCI_COMMAND_BUSMASTER);
+
+	if (_virtio_blk_setup(vblk)) {
+		out_byte(vblk->io + VIRTIO_STATUS, VIRTIO_STATUS_FAILED);
+		return -1;
+	}
+
+	/* Sizes beyond 32 bits of sectors are truncated. */
+	vblk->device.sector_count =
+		in_long(vblk->io + VIRTIO_CONFIG + VIRTIO_BLK_CAPACITY);
+	if (in_long(vblk->io + VIRTIO_CONFIG + VIRTIO_BLK_CAPACITY + 4)) {
+		vblk->device.sector_count = 0xFFFFFFFF;
+	}
+
+	vblk->device.max_sectors = VIRTIO_BLK_MAX_SECTORS;
+	vblk->device.depth = BLOCK_MAX_IN_FLIGHT;
+	vblk->device.transfer = &_virtio_blk_transfer;
+	vblk->device.driver = vblk;
+	device->data = vblk;
+
+	/* A PCI interrupt line may be shared with another driver, whose
+	 * handler is chained rather than replaced. The handler is installed
+	 * once per line, as it serves every device on it, and installing it
+	 * again would chain it behind whatever was installed since. */
+	for (i = 0; i < device_count; i++) {
+		if (devices[i].irq == vblk->irq) {
+			break;
+		}
+	}
+	if (i == device_count) {
+		chained[vblk->irq - IRQ0] = register_interrupt_handler(
+			vblk->irq, (isr_t)&_virtio_blk_interrupt);
+	}
+
+	name[2] = 'a' + device_count++;
+
+	virtio_debug("%s: io %h, irq %d, queue %d, features %h\n",
+		     name, vblk->io, vblk->irq - IRQ0, vblk->size,
+		     vblk->features);
+
+	block_register(&vblk->device, name);
+
+	return 0;
+}
+
+static const struct pci_id virtio_blk_ids[] = {
+	{ VIRTIO_VENDOR, VIRTIO_BLK_DEVICE, PCI_ANY_ID },
+	{ 0, 0, 0 }
+};
+
+static struct pci_driver virtio_blk_driver = {
+	"virtio-blk", virtio_blk_ids, &_virtio_blk_probe, 0
+};
+
+void init_virtio_blk()
+{
+	pci_register_driver(&virtio_blk_driver);
+}
@@ -54,6 +54,7 @@ void ordered_array_insert(struct ordered_array *array, type_t item)
 	uint32_t i = 0;
 
 	assert(array->predicate);
+	assert(array->size < array->max_size);
 
 	/* Traverse along the list while item < array->data[i]. */
 	while (i < array->size && !array->predicate(array->data[i], item)) {
@@ -89,8 +90,9 @@ type_t ordered_array_lookup_index(struct ordered_array *array,
 	if (index < array->size) {
 		return array->data[index];
 	} else {
-		ordered_array_debug("Attempt to access index %d of array[%d]\n",
-				    index, array->size);
+		ordered_array_log(LOG_WARNING,
+				  "Attempt to access index %d of array[%d]\n",
+				  index, array->size);
 		return 0;
 	}
 }
@@ -98,14 +100,15 @@ type_t ordered_array_lookup_index(struct ordered_array *array,
 void ordered_array_remove_index(struct ordered_array *array,
 				uint32_t index)
 {
-	if (index > array->size) {
-		ordered_array_debug("Attempt to remove index %d of array[%d]\n",
-				    index, array->size);
+	if (index >= array->size) {
+		ordered_array_log(LOG_WARNING,
+				  "Attempt to remove index %d of array[%d]\n",
+				  index, array->size);
 		return;
 	}
 
 	/* Bump our array elements down. */
-	while (index < array->size) {
+	while (index + 1 < array->size) {
 		array->data[index] = array->data[index+1];
 		index++;
 	}
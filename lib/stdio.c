@@ -1,15 +1,471 @@
 #include <lib/stdio.h>
 
+#include <kernel/log.h>
 #include <kernel/tty.h>
 #include <lib/string.h>
 
-/* Defined in ./tty.c */
-extern uint8_t tty_cursor_x;
-extern uint8_t tty_cursor_y;
+/* Passed for the format length to read the format up to its null byte. */
+#define STDIO_NO_LIMIT ((size_t)-1)
+
+/* Bytes of output formatted on the stack before being written to the log. */
+#define STDIO_BUFFER_SIZE 256
+
+/* Conversion flags. */
+#define STDIO_LEFT      0x01        /* '-': pad on the right.               */
+#define STDIO_ZERO      0x02        /* '0': pad numbers with zeros.         */
+#define STDIO_PLUS      0x04        /* '+': always give a sign.             */
+#define STDIO_SPACE     0x08        /* ' ': a space for positive numbers.   */
+#define STDIO_ALTERNATE 0x10        /* '#': 0 or 0x prefix.                 */
+#define STDIO_SIGNED    0x20
+#define STDIO_UPPER     0x40
+#define STDIO_POINTER   0x80        /* %h and %p: always a 0x prefix.       */
+
+/* Enough for a 64 bit number in octal. */
+#define STDIO_DIGITS_MAX 22
+
+/* Where formatted output goes. Output that does not fit in 'text' is passed
+ * to flush() if there is one, and is otherwise dropped, though it is still
+ * counted. */
+struct stdio_buffer {
+	char *text;
+	size_t size;                /* Capacity of text.                    */
+	size_t length;              /* Characters in text.                  */
+	size_t count;               /* Characters formatted in all.         */
+	int level;                  /* For _stdio_log_flush().              */
+	void (*flush)(struct stdio_buffer *buffer);
+};
+
+static void _stdio_write(struct stdio_buffer *buffer, const char *text,
+			 size_t length)
+{
+	size_t count;
+
+	buffer->count += length;
+
+	while (length) {
+		if (buffer->length == buffer->size) {
+			if (!buffer->flush) {
+				return;
+			}
+			buffer->flush(buffer);
+		}
+
+		count = min(length, buffer->size - buffer->length);
+		memcpy((uint8_t *)buffer->text + buffer->length,
+		       (const uint8_t *)text, count);
+		buffer->length += count;
+		text += count;
+		length -= count;
+	}
+}
+
+static void _stdio_pad(struct stdio_buffer *buffer, char c, size_t length)
+{
+	static const char zeros[] = "0000000000000000";
+	static const char spaces[] = "                ";
+	const char *run = c == '0' ? zeros : spaces;
+	size_t count;
+
+	while (length) {
+		count = min(length, sizeof(zeros) - 1);
+		_stdio_write(buffer, run, count);
+		length -= count;
+	}
+}
+
+/* Divide by ten with shifts and adds, as there is no 64 bit division. */
+static uint64_t _stdio_divide10(uint64_t value)
+{
+	uint64_t quotient, remainder;
+
+	quotient = (value >> 1) + (value >> 2);
+	quotient += quotient >> 4;
+	quotient += quotient >> 8;
+	quotient += quotient >> 16;
+	quotient += quotient >> 32;
+	quotient >>= 3;
+	remainder = value - ((quotient << 3) + (quotient << 1));
+
+	return quotient + (remainder > 9);
+}
+
+/* Write the digits of 'value' in 'base' (8, 10 or 16) backwards from 'end',
+ * returning the first. Zero has no digits. */
+static char *_stdio_digits(char *end, uint64_t value, uint32_t base,
+			   int upper)
+{
+	const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	uint64_t quotient;
+	uint32_t low;
+
+	while (value > 0xFFFFFFFF) {
+		if (base == 10) {
+			quotient = _stdio_divide10(value);
+			*--end = digits[value - ((quotient << 3) +
+						 (quotient << 1))];
+			value = quotient;
+		} else {
+			*--end = digits[value & (base - 1)];
+			value >>= base == 16 ? 4 : 3;
+		}
+	}
+
+	for (low = value; low; low /= base) {
+		*--end = digits[low % base];
+	}
+
+	return end;
+}
+
+/* Format an integer. 'precision' is the minimum number of digits, or -1 if
+ * none was given. */
+static void _stdio_number(struct stdio_buffer *buffer, uint64_t value,
+			  uint32_t base, uint32_t flags, int width,
+			  int precision)
+{
+	char digits[STDIO_DIGITS_MAX];
+	char *end = digits + STDIO_DIGITS_MAX, *start;
+	const char *prefix = "";
+	size_t length, zeros = 0, prefix_length, total;
+
+	if (flags & STDIO_SIGNED) {
+		if ((sint64_t)value < 0) {
+			value = -value;
+			prefix = "-";
+		} else if (flags & STDIO_PLUS) {
+			prefix = "+";
+		} else if (flags & STDIO_SPACE) {
+			prefix = " ";
+		}
+	} else if (flags & STDIO_POINTER) {
+		prefix = "0x";
+	} else if ((flags & STDIO_ALTERNATE) && base == 16 && value) {
+		prefix = flags & STDIO_UPPER ? "0X" : "0x";
+	}
+
+	start = _stdio_digits(end, value, base, flags & STDIO_UPPER);
+	length = end - start;
+
+	if (precision < 0) {
+		precision = 1;
+	} else {
+		flags &= ~STDIO_ZERO;
+	}
+
+	if ((size_t)precision > length) {
+		zeros = precision - length;
+	}
+
+	/* The alternate form of octal starts with a zero. */
+	if ((flags & STDIO_ALTERNATE) && base == 8 && !zeros &&
+	    (!length || *start != '0')) {
+		zeros = 1;
+	}
+
+	prefix_length = strlen(prefix);
+	total = prefix_length + zeros + length;
+
+	if ((flags & STDIO_ZERO) && !(flags & STDIO_LEFT) &&
+	    (size_t)width > total) {
+		zeros += width - total;
+		total = width;
+	}
+
+	if (!(flags & STDIO_LEFT) && (size_t)width > total) {
+		_stdio_pad(buffer, ' ', width - total);
+	}
+
+	_stdio_write(buffer, prefix, prefix_length);
+	_stdio_pad(buffer, '0', zeros);
+	_stdio_write(buffer, start, length);
+
+	if ((flags & STDIO_LEFT) && (size_t)width > total) {
+		_stdio_pad(buffer, ' ', width - total);
+	}
+}
+
+/* Write 'length' characters of 'text' padded to 'width'. */
+static void _stdio_field(struct stdio_buffer *buffer, const char *text,
+			 size_t length, uint32_t flags, int width)
+{
+	if (!(flags & STDIO_LEFT) && (size_t)width > length) {
+		_stdio_pad(buffer, ' ', width - length);
+	}
+
+	_stdio_write(buffer, text, length);
+
+	if ((flags & STDIO_LEFT) && (size_t)width > length) {
+		_stdio_pad(buffer, ' ', width - length);
+	}
+}
+
+/* Whether 'c', if it is before 'end', is an integer conversion. */
+static int _stdio_integer(const char *c, const char *end)
+{
+	if ((end && c >= end) || !*c) {
+		return 0;
+	}
+
+	return *c == 'd' || *c == 'i' || *c == 'o' || *c == 'u' ||
+		*c == 'x' || *c == 'X';
+}
+
+/* Format the first 'size' characters of 'format', or up to its null byte if
+ * that comes first, into 'buffer' in a single pass. Returns the number of
+ * characters formatted, whether or not they fitted. */
+static int _stdio_format(struct stdio_buffer *buffer, size_t size,
+			 const char *format, va_list ap)
+{
+	const char *end = size == STDIO_NO_LIMIT ? 0 : format + size;
+	const char *run, *specification;
+	uint32_t flags, base;
+	int width, precision, length;
+	uint64_t value;
+	size_t count;
+	char c;
+
+#define stdio_more() ((!end || format < end) && *format)
+
+	while (stdio_more()) {
+		for (run = format; stdio_more() && *format != '%'; format++) {
+			/* Find the end of the literal text. */
+		}
+		_stdio_write(buffer, run, format - run);
+
+		if (!stdio_more()) {
+			break;
+		}
+
+		specification = format++;
+		flags = 0;
+		width = 0;
+		precision = -1;
+		length = 0;
+
+		for (; stdio_more(); format++) {
+			if (*format == '-') {
+				flags |= STDIO_LEFT;
+			} else if (*format == '0') {
+				flags |= STDIO_ZERO;
+			} else if (*format == '+') {
+				flags |= STDIO_PLUS;
+			} else if (*format == ' ') {
+				flags |= STDIO_SPACE;
+			} else if (*format == '#') {
+				flags |= STDIO_ALTERNATE;
+			} else {
+				break;
+			}
+		}
+
+		if (stdio_more() && *format == '*') {
+			width = va_arg(ap, int);
+			if (width < 0) {
+				flags |= STDIO_LEFT;
+				width = -width;
+			}
+			format++;
+		} else {
+			for (; stdio_more() && *format >= '0' && *format <= '9';
+			     format++) {
+				width = width * 10 + (*format - '0');
+			}
+		}
+
+		if (stdio_more() && *format == '.') {
+			format++;
+			precision = 0;
+			if (stdio_more() && *format == '*') {
+				precision = va_arg(ap, int);
+				format++;
+			} else {
+				for (; stdio_more() && *format >= '0' &&
+					     *format <= '9'; format++) {
+					precision = precision * 10 +
+						(*format - '0');
+				}
+			}
+		}
+
+		/* Length modifiers, counted in bytes of the argument. Since
+		 * %h on its own is a hexadecimal conversion here, 'h' is only
+		 * a modifier when an integer conversion follows it. */
+		if (stdio_more()) {
+			switch (*format) {
+			case 'h':
+				if (_stdio_integer(format + 1, end)) {
+					length = 2;
+					format++;
+				} else if ((!end || format + 1 < end) &&
+					   format[1] == 'h' &&
+					   _stdio_integer(format + 2, end)) {
+					length = 1;
+					format += 2;
+				}
+				break;
+			case 'l':
+				length = 4;
+				format++;
+				if (stdio_more() && *format == 'l') {
+					length = 8;
+					format++;
+				}
+				break;
+			case 'j':
+				length = 8;
+				format++;
+				break;
+			case 'z':
+			case 't':
+				length = 4;
+				format++;
+				break;
+			}
+		}
+
+		if (!stdio_more()) {
+			/* An unfinished specification is written as it is. */
+			_stdio_write(buffer, specification,
+				     format - specification);
+			break;
+		}
+
+		base = 10;
+
+		switch (*format) {
+		case 'd':
+		case 'i':
+			flags |= STDIO_SIGNED;
+			if (length == 8) {
+				value = va_arg(ap, sint64_t);
+			} else if (length == 2) {
+				value = (sint16_t)va_arg(ap, int);
+			} else if (length == 1) {
+				value = (sint8_t)va_arg(ap, int);
+			} else {
+				value = (sint64_t)va_arg(ap, int);
+			}
+			_stdio_number(buffer, value, base, flags, width,
+				      precision);
+			break;
+		case 'X':
+			flags |= STDIO_UPPER;
+			/* Fall through. */
+		case 'x':
+			base = 16;
+			goto unsigned_number;
+		case 'o':
+			base = 8;
+			/* Fall through. */
+		case 'u':
+		unsigned_number:
+			if (length == 8) {
+				value = va_arg(ap, uint64_t);
+			} else if (length == 2) {
+				value = (uint16_t)va_arg(ap, unsigned int);
+			} else if (length == 1) {
+				value = (uint8_t)va_arg(ap, unsigned int);
+			} else {
+				value = va_arg(ap, unsigned int);
+			}
+			_stdio_number(buffer, value, base, flags, width,
+				      precision);
+			break;
+		case 'h':
+		case 'p':
+			/* Upper case hexadecimal with a 0x prefix. */
+			flags |= STDIO_POINTER | STDIO_UPPER;
+			_stdio_number(buffer, va_arg(ap, uint32_t), 16, flags,
+				      width, precision);
+			break;
+		case 'c':
+			c = (char)va_arg(ap, int);
+			_stdio_field(buffer, &c, 1, flags, width);
+			break;
+		case 's':
+			run = va_arg(ap, const char *);
+			if (!run) {
+				run = "(null)";
+			}
+			for (count = 0; (precision < 0 ||
+					 count < (size_t)precision) &&
+				     run[count]; count++) {
+				/* Find the length, up to the precision. */
+			}
+			_stdio_field(buffer, run, count, flags, width);
+			break;
+		case '%':
+			_stdio_write(buffer, "%", 1);
+			break;
+		default:
+			/* Not a conversion we know: write it as it is. */
+			_stdio_write(buffer, specification,
+				     format + 1 - specification);
+			break;
+		}
+
+		format++;
+	}
+
+#undef stdio_more
+
+	return buffer->count;
+}
+
+/* Hand what has been formatted for printf() to the kernel log. */
+static void _stdio_log_flush(struct stdio_buffer *buffer)
+{
+	log_write(buffer->level, buffer->text, buffer->length);
+	buffer->length = 0;
+}
+
+/* The TTY is a console for the kernel log. */
+static void _stdio_tty_write(const char *text, uint32_t length)
+{
+	uint32_t i;
+
+	for (i = 0; i < length; i++) {
+		tty_putc(text[i]);
+	}
+}
+
+static struct log_console tty_console = {
+	"tty", &_stdio_tty_write, &tty_flush, 0, 0, 0, 0
+};
+
+/* Format into a buffer on the stack, which is handed to the log whenever it
+ * fills and once at the end, rather than a character at a time. */
+static int _stdio_vlog(int level, size_t size, const char *format,
+		      va_list ap)
+{
+	char text[STDIO_BUFFER_SIZE];
+	struct stdio_buffer buffer;
+	int count;
+
+	if (!format) {
+		return -1;
+	}
+
+	buffer.text = text;
+	buffer.size = sizeof(text);
+	buffer.length = 0;
+	buffer.count = 0;
+	buffer.level = level;
+	buffer.flush = &_stdio_log_flush;
+
+	count = _stdio_format(&buffer, size, format, ap);
+
+	if (buffer.length) {
+		_stdio_log_flush(&buffer);
+	}
+
+	return count;
+}
 
 void init_kstream()
 {
 	init_tty();
+	log_register_console(&tty_console);
 	stdio_debug("\n");
 	tty_set_colour(TTY_COLOUR_BLACK, TTY_COLOUR_WHITE);
 }
@@ -28,7 +484,24 @@ int printf(const char *format, ...)
 
 int vprintf(const char *format, va_list ap)
 {
-	return nvprintf(strlen(format), format, ap);
+	return _stdio_vlog(LOG_INFO, STDIO_NO_LIMIT, format, ap);
+}
+
+int vklog(int level, const char *format, va_list ap)
+{
+	return _stdio_vlog(level, STDIO_NO_LIMIT, format, ap);
+}
+
+int klog(int level, const char *format, ...)
+{
+	va_list ap;
+	int vklog_return;
+
+	va_start(ap, format);
+	vklog_return = vklog(level, format, ap);
+	va_end(ap);
+
+	return vklog_return;
 }
 
 int nprintf(size_t size, const char *format, ...)
@@ -45,56 +518,43 @@ int nprintf(size_t size, const char *format, ...)
 
 int nvprintf(size_t size, const char *format, va_list ap)
 {
-	uint32_t i;
-
-	if (!format) {
-		return -1;
-	}
-
-	for (i = 0; i < size; i++) {
-		/* Detect delimiter. */
-		if (format[i] == '%') {
-			if ((i + 1) < size && format[i+1] != '%') {
-				char conv = format[i+1];
-
-				if (conv == 'd' || conv == 'i') {
-					int temp = va_arg(ap, int);
-
-					tty_puti(temp);
-					i++;
-				}
+	return _stdio_vlog(LOG_INFO, size, format, ap);
+}
 
-				if (conv == 'c') {
-					char temp = va_arg(ap, char);
+int snprintf(char *string, size_t size, const char *format, ...)
+{
+	va_list ap;
+	int vsnprintf_return;
 
-					tty_putc(temp);
-					i++;
-				}
+	va_start(ap, format);
+	vsnprintf_return = vsnprintf(string, size, format, ap);
+	va_end(ap);
 
-				if (conv == 's') {
-					char *temp = va_arg(ap, char*);
+	return vsnprintf_return;
+}
 
-					tty_write(temp);
-					i++;
-				}
+int vsnprintf(char *string, size_t size, const char *format, va_list ap)
+{
+	struct stdio_buffer buffer;
+	int count;
 
-				if (conv == 'h') {
-					int temp = va_arg(ap, int);
+	if (!format) {
+		return -1;
+	}
 
-					tty_puth(temp);
-					i++;
-				}
+	/* Keep room for the null byte. */
+	buffer.text = string;
+	buffer.size = size ? size - 1 : 0;
+	buffer.length = 0;
+	buffer.count = 0;
+	buffer.level = 0;
+	buffer.flush = 0;
 
-				if (conv == 'p') {
-					uint32_t pointer = va_arg(ap, uint32_t);
+	count = _stdio_format(&buffer, STDIO_NO_LIMIT, format, ap);
 
-					tty_puth(pointer);
-					i++;
-				}
-			}
-		} else {
-			tty_putc(format[i]);
-		}
+	if (size) {
+		string[buffer.length] = '\0';
 	}
-	return 0;
+
+	return count;
 }
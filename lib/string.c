@@ -2,29 +2,45 @@
 
 #include <lib/stdio.h>
 
-/* Return the length of a string. If passed a NULL pointer, returns -1. */
+/* Below this many bytes, memory is copied and filled a byte at a time, as
+ * starting a string instruction costs more than it saves. */
+#define STRING_WORD_THRESHOLD 64
+
+/* Whether any byte of the word 'w' is zero. */
+#define has_zero_byte(w) (((w) - 0x01010101) & ~(w) & 0x80808080)
+
+/* Return the length of a string. If passed a NULL pointer, returns -1. Once
+ * the string is word aligned it is read a word at a time, which never reads
+ * past the page holding its terminating null byte. */
 size_t strlen(const char *string)
 {
-	size_t length;
-
-	length = 0;
+	const char *end = string;
+	const uint32_t *word;
 
 	if (!string) {
 		return -1;
 	}
 
-	while (*(string+length) != '\0') {
-		length++;
+	for (; (uint32_t)end & 3; end++) {
+		if (*end == '\0') {
+			return end - string;
+		}
 	}
 
-	return length;
+	for (word = (const uint32_t *)end; !has_zero_byte(*word); word++) {
+		/* Look for a word with a zero byte. */
+	}
+
+	for (end = (const char *)word; *end != '\0'; end++) {
+		/* Find which byte it was. */
+	}
+
+	return end - string;
 }
 
 char *strcpy(char *dest, const char *src)
 {
-	do {
-		*dest++ = *src++;
-	} while (*src != '\0');
+	memcpy((uint8_t *)dest, (const uint8_t *)src, strlen(src) + 1);
 
 	return dest;
 }
@@ -33,40 +49,120 @@ int strcmp(const char *s1, const char *s2)
 {
 	int i = 0;
 
-	while (s1[i] != '\0' && s2[i] != '\0') {
-		if (s1[i] != s2[i]) {
-			return ((s1[i] < s2[2]) ? -1 : 1);
-		}
+	while (s1[i] != '\0' && s1[i] == s2[i]) {
 		i++;
 	}
 
-	return 0;
+	if (s1[i] == s2[i]) {
+		return 0;
+	}
+
+	return (((uint8_t)s1[i] < (uint8_t)s2[i]) ? -1 : 1);
+}
+
+/* FNV-1a parameters for 32-bit hashes. */
+#define FNV_OFFSET_BASIS 0x811C9DC5
+#define FNV_PRIME        0x01000193
+
+uint32_t strhash(const char *s)
+{
+	uint32_t hash = FNV_OFFSET_BASIS;
+
+	while (*s != '\0') {
+		hash ^= (uint8_t)*s++;
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
 }
 
+/* The copies below rely on the direction flag being clear, as the C calling
+ * convention requires on entry to a function. _memmove_backward() sets it for
+ * a moment, so the interrupt stubs in kernel/interrupt.s clear it before
+ * calling a handler. */
+
 uint8_t *memcpy(uint8_t *destination, const uint8_t *source, uint32_t length)
 {
-	const uint8_t *source_p;
-	uint8_t *destination_p;
+	uint8_t *d = destination;
+	const uint8_t *s = source;
+	uint32_t words;
+
+	if (length >= STRING_WORD_THRESHOLD) {
+		/* Copy bytes until the destination is word aligned, then
+		 * whole words. */
+		for (; (uint32_t)d & 3; length--) {
+			*d++ = *s++;
+		}
 
-	source_p = source;
-	destination_p = destination;
+		words = length >> 2;
+		length &= 3;
+		__asm volatile("rep movsl"
+			       : "+D" (d), "+S" (s), "+c" (words)
+			       : : "memory");
+	}
 
-	for ( ; length != 0; length--) {
-		*destination_p++ = *source_p++;
+	for (; length; length--) {
+		*d++ = *s++;
 	}
 
 	return destination;
 }
 
+/* Copy from the end of the regions towards the start, for when the
+ * destination overlaps the end of the source. */
+static void _memmove_backward(uint8_t *destination, const uint8_t *source,
+			      uint32_t length)
+{
+	uint8_t *d = destination + length - 1;
+	const uint8_t *s = source + length - 1;
+	uint32_t count = length & 3, words = length >> 2;
+
+	/* The odd bytes at the end, then whole words. */
+	__asm volatile("std\n\t"
+		       "rep movsb\n\t"
+		       "sub $3, %0\n\t"
+		       "sub $3, %1\n\t"
+		       "mov %3, %2\n\t"
+		       "rep movsl\n\t"
+		       "cld"
+		       : "+D" (d), "+S" (s), "+c" (count)
+		       : "r" (words)
+		       : "memory", "cc");
+}
+
+uint8_t *memmove(uint8_t *destination, const uint8_t *source,
+		 uint32_t length)
+{
+	if (destination <= source || destination >= source + length) {
+		return memcpy(destination, source, length);
+	}
+
+	_memmove_backward(destination, source, length);
+
+	return destination;
+}
+
 /* Write 'length' copies of 'value' to 'destination'. */
 uint8_t *memset(uint8_t *destination, uint8_t value, uint32_t length)
 {
-	uint8_t *destination_p;
+	uint8_t *d = destination;
+	uint32_t words;
+
+	if (length >= STRING_WORD_THRESHOLD) {
+		for (; (uint32_t)d & 3; length--) {
+			*d++ = value;
+		}
 
-	destination_p = destination;
+		words = length >> 2;
+		length &= 3;
+		__asm volatile("rep stosl"
+			       : "+D" (d), "+c" (words)
+			       : "a" (value * 0x01010101)
+			       : "memory");
+	}
 
-	for ( ; length != 0; length--) {
-		*destination_p++ = value;
+	for (; length; length--) {
+		*d++ = value;
 	}
 
 	return destination;
@@ -16,14 +16,6 @@
 #define FOOTER_SIZE (sizeof(struct footer))
 #define BLOCK_OVERHEAD (HEADER_SIZE + FOOTER_SIZE)
 
-/* An invalid memory access in a heap algorithm can go totally undetected, so in
- * order to provde some level of validation that a piece of memory is in fact a
- * header or footer, we will define a symbolic constant that will be embedded
- * inside of each header and footer. Note that their value is purely
- * arbritary. */
-#define HEADER_ID 0xCEC004B3
-#define FOOTER_ID 0xCEC6F0FA
-
 /* Tests that can be used to verify that a piece of memory is in fact a header
  * or footer, reliant on the _ID value. Obviously this is not a guaranteed
  * check, as it is possible that the specific piece of memory used to store the
@@ -61,8 +53,10 @@ extern struct page_directory *kernel_directory;
 /* This is defined in ./link.ld. */
 extern uint32_t end;
 
-/* These are referenced in ./paging.c. */
-uint32_t placement_address = (uint32_t)&end;
+/* These are referenced in ./paging.c. Unless kmain() moves it first,
+ * placement_address starts at the end of the kernel, set on first use so that
+ * this builds where pointers are wider than uint32_t, as in tests/. */
+uint32_t placement_address = 0;
 struct heap *kernel_heap = 0;
 
 static uint32_t _heap_kmalloc(uint32_t size, enum align_page_e align,
@@ -86,6 +80,10 @@ static uint32_t _placement_kmalloc(uint32_t size, enum align_page_e align,
 {
 	uint32_t destination_address;
 
+	if (!placement_address) {
+		placement_address = (uint32_t)&end;
+	}
+
 	/* Align the placement address if necessary. */
 	if ((align == ALIGN_PAGE) && !is_page_aligned(placement_address)) {
 		align_to_page(placement_address);
@@ -140,8 +138,9 @@ void kfree(void *block)
 	free(kernel_heap, block);
 }
 
-/* Claim extra space for the heap. */
-static void _heap_expand(struct heap *heap, uint32_t new_size)
+/* Claim extra space for the heap. Returns 0, or -1 if the heap cannot grow to
+ * 'new_size'. */
+static int _heap_expand(struct heap *heap, uint32_t new_size)
 {
 	uint32_t old_size;
 	uint32_t i;
@@ -151,20 +150,19 @@ static void _heap_expand(struct heap *heap, uint32_t new_size)
 	old_size = sizeof_heap(heap);
 	i = old_size;
 
-	assert(new_size > old_size);
-
 	/* Align to the nearest following page boundary. */
 	if (!is_page_aligned(new_size)) {
 		align_to_page(new_size);
 	}
 
-	/* Return nothing if we attempt to expand heap larger than max
-	 * address. */
-	if (heap->start_address + new_size <= heap->max_address) {
+	/* Refuse to expand the heap beyond its maximum address. A size no
+	 * larger than the old one has wrapped around. */
+	if (new_size <= old_size
+	    || new_size > heap->max_address - heap->start_address) {
 		heap_debug("Attempting to expand heap [%p] "
 			   "beyond maximum size (%h)\n",
 			   heap, new_size);
-		return;
+		return -1;
 	}
 
 	/* Allocate extra frames as necessary. */
@@ -177,6 +175,8 @@ static void _heap_expand(struct heap *heap, uint32_t new_size)
 
 	/* Set our new heap end address. */
 	heap->end_address = heap->start_address + new_size;
+
+	return 0;
 }
 
 /* Contract the heap. Returns the new size. */
@@ -185,7 +185,7 @@ static uint32_t _heap_contract(struct heap *heap, uint32_t new_size)
 	uint32_t old_size = sizeof_heap(heap);
 	uint32_t i = old_size - PAGE_SIZE;
 
-	assert(new_size < old_size);
+	assert(new_size <= old_size);
 
 	/* Align to the nearest following page boundary. */
 	if (!is_page_aligned(new_size)) {
@@ -194,9 +194,12 @@ static uint32_t _heap_contract(struct heap *heap, uint32_t new_size)
 
 	/* Prevent over-contracting. */
 	new_size = max(new_size, HEAP_MIN_SIZE);
+	if (new_size >= old_size) {
+		return old_size;
+	}
 
-	/* Free frames as necessary. */
-	while (new_size < i) {
+	/* Free the frames of every page from the new end onwards. */
+	while (new_size <= i) {
 		free_frame(get_page(heap->start_address + i, 0,
 				    kernel_directory));
 		i -= PAGE_SIZE;
@@ -208,6 +211,30 @@ static uint32_t _heap_contract(struct heap *heap, uint32_t new_size)
 	return new_size;
 }
 
+/* How far into a hole at 'location' a block must start for the memory after
+ * its header to be page aligned. Anything skipped becomes a hole of its own, so
+ * it must have room for a header and footer. */
+static uint32_t _heap_align_offset(uint32_t location)
+{
+	uint32_t offset = 0;
+
+	/* Page align the starting point of the header. Note that when a user
+	 * requests that memory be page-aligned, that request applies only to
+	 * memory that is user accessible. That means that the header address
+	 * will actually not be page-aligned. The address that we want to fall
+	 * on a boundary is the block location offset by the size of the
+	 * header. */
+	if (!is_page_aligned(location + HEADER_SIZE)) {
+		offset = PAGE_SIZE - ((location + HEADER_SIZE) % PAGE_SIZE);
+
+		if (offset < BLOCK_OVERHEAD) {
+			offset += PAGE_SIZE;
+		}
+	}
+
+	return offset;
+}
+
 /* Find the smallest hole that will fit and return its index. If none is found,
  * return -1. */
 static sint32_t _heap_find_first_fit(struct heap *heap, uint32_t size,
@@ -221,26 +248,10 @@ static sint32_t _heap_find_first_fit(struct heap *heap, uint32_t size,
 		header = (struct header *)ordered_array_lookup_index(&heap->index, i);
 
 		if (page_align) {
-			uint32_t location = (uint32_t)header;
-			sint32_t offset = 0;
-			sint32_t hole_size;
-
-			/* Page align the starting point of the header. Note
-			 * that when a user requests that memory be
-			 * page-aligned, that request applies only to memory
-			 * that is user accessible. That means that the header
-			 * address will actually not be page-aligned. The
-			 * address that we want to fall on a boundary is the
-			 * block location offset by the size of the header. */
-			if (!is_page_aligned(location + HEADER_SIZE)) {
-				offset = PAGE_SIZE
-					- ((location
-					    + HEADER_SIZE) % PAGE_SIZE);
-			}
-
-			hole_size = (sint32_t)header->size - offset;
+			uint32_t offset = _heap_align_offset((uint32_t)header);
 
-			if (hole_size >= (sint32_t)size) {
+			if (header->size > offset
+			    && header->size - offset >= size) {
 				/* Stop if hole is large enough. */
 				break;
 			}
@@ -260,6 +271,24 @@ static sint32_t _heap_find_first_fit(struct heap *heap, uint32_t size,
 	}
 }
 
+/* Take 'hole' out of the index. */
+static void _heap_remove_hole(struct heap *heap, struct header *hole)
+{
+	uint32_t i = 0;
+
+	/* Find and remove this header from the index. */
+	while ((i < heap->index.size)
+	       && (ordered_array_lookup_index(&heap->index, i)
+		   != (void*)hole)) {
+		i++;
+	}
+
+	/* Ensure that we found the correct header. */
+	assert(i < heap->index.size);
+
+	ordered_array_remove_index(&heap->index, i);
+}
+
 /* Return 1 if struct header a is larger, else return 0. Used to order a set
  * of headers by size, as opposed to the pointer address. */
 sint8_t header_predicate(void *a, void *b)
@@ -277,6 +306,7 @@ struct heap *heap_create(uint32_t start_address, uint32_t end_address,
 {
 	struct heap *heap;
 	struct header *hole;
+	struct footer *footer;
 
 	/* If we're not page aligned, then what has it all been for?? */
 	assert((start_address % PAGE_SIZE) == 0);
@@ -308,13 +338,18 @@ struct heap *heap_create(uint32_t start_address, uint32_t end_address,
 	hole->size = end_address - start_address;
 	hole->id = HEADER_ID;
 	hole->is_hole = 1;
+
+	footer = (struct footer *)(end_address - FOOTER_SIZE);
+	footer->id = FOOTER_ID;
+	footer->header = hole;
+
 	ordered_array_insert(&heap->index, (void*)hole);
 
 	return heap;
 }
 
 /* Allocate a block of size 'size' from 'heap'. Align block to page if
- * 'page_align' is nonzero. */
+ * 'page_align' is nonzero. Returns 0 if the heap cannot grow to fit it. */
 void *alloc(struct heap *heap, uint32_t size, uint8_t page_align)
 {
 	uint32_t total_size;
@@ -329,11 +364,15 @@ void *alloc(struct heap *heap, uint32_t size, uint8_t page_align)
 
 	/* We must account for the size of the header and footer. */
 	total_size = (size + BLOCK_OVERHEAD);
+	if (total_size < size) {
+		return 0;
+	}
+
 	/* Find the smallest hole that fits. */
 	i = _heap_find_first_fit(heap, total_size, page_align);
 
 	if (i == -1) {
-		struct header *header;
+		struct header *header = 0;
 		struct footer *footer;
 		uint32_t old_end_address = heap->end_address;
 		uint32_t old_length = sizeof_heap(heap);
@@ -342,7 +381,9 @@ void *alloc(struct heap *heap, uint32_t size, uint8_t page_align)
 		uint32_t value = 0;
 
 		/* We must allocate some more space. */
-		_heap_expand(heap, old_length + total_size);
+		if (_heap_expand(heap, old_length + total_size)) {
+			return 0;
+		}
 		new_length = heap->end_address - heap->start_address;
 
 		/* Find the endmost header. N.B. this is the endmost in location, not in
@@ -361,78 +402,74 @@ void *alloc(struct heap *heap, uint32_t size, uint8_t page_align)
 			i++;
 		}
 
-		if (index == (uint32_t)-1) {
-			/* If we didn't find any headers, we must add one. */
+		if (index != (uint32_t)-1) {
+			header = ordered_array_lookup_index(&heap->index, index);
+		}
+
+		if (header && (uint32_t)header + header->size == old_end_address) {
+			/* The last hole reaches the old end, so it grows. It
+			 * goes back into the index at its new size. */
+			ordered_array_remove_index(&heap->index, index);
+			header->size += new_length - old_length;
+		} else {
+			/* If the heap ends in a block, we must add a hole. */
 			header = (struct header *)old_end_address;
 			header->id = HEADER_ID;
 			header->size = new_length - old_length;
 			header->is_hole = 1;
+		}
 
-			footer = (struct footer *)(old_end_address
-						   + header->size
-						   - FOOTER_SIZE);
-			footer->id = FOOTER_ID;
-			footer->header = header;
-
-			ordered_array_insert((void*)header, &heap->index);
-		} else {
-			/* The last header needs adjusting. */
-			header = ordered_array_lookup_index(&heap->index, index);
-			header->size += new_length - old_length;
+		/* Re-write the footer. */
+		footer = (struct footer *)((uint32_t)header
+					    + header->size
+					    - FOOTER_SIZE);
+		footer->id = FOOTER_ID;
+		footer->header = header;
 
-			/* Re-write the footer. */
-			footer = (struct footer *)((uint32_t)header
-						    + header->size
-						    - FOOTER_SIZE);
-			footer->id = FOOTER_ID;
-			footer->header = header;
-		}
+		ordered_array_insert(&heap->index, (void*)header);
 
 		/* We now have enough space, so can recurse. */
-		alloc(heap, size, page_align);
+		return alloc(heap, size, page_align);
 	}
 
-	/* We must now decide whether to split the hole we found into two
-	 * parts. Is the original hole size minus requested hole size less than
-	 * the overhead for adding a new hole? */
 	original_hole_header = (struct header *)ordered_array_lookup_index(&heap->index, i);
 	original_hole_position = (uint32_t)original_hole_header;
 	original_hole_size = original_hole_header->size;
 
-	if ((original_hole_size - total_size) < BLOCK_OVERHEAD) {
-		/* Increae the requested size to the size of the hole we
-		 * found. */
-		size += original_hole_size - total_size;
-		total_size = original_hole_size;
-	}
+	/* We don't need this hole anymore, so remove it from the index. What is
+	 * left of it either side of the block goes back in as new holes. */
+	ordered_array_remove_index(&heap->index, i);
 
 	/* If we need to page-align the data, do it now and make a new hole in
 	 * front of our block. */
-	if (page_align && (!is_page_aligned(original_hole_position))) {
-		uint32_t new_location;
+	if (page_align && _heap_align_offset(original_hole_position)) {
+		uint32_t offset = _heap_align_offset(original_hole_position);
 		struct header *hole_header;
 		struct footer *hole_footer;
 
-		new_location = (original_hole_position + PAGE_SIZE
-				- HEADER_SIZE
-				- (original_hole_position & 0xFFF));
-
 		hole_header = (struct header *)original_hole_position;
-		hole_header->size = (PAGE_SIZE
-				     - (original_hole_position & 0xFFF)
-				     - HEADER_SIZE);
+		hole_header->size = offset;
 		hole_header->id = HEADER_ID;
 		hole_header->is_hole = 1;
 
-		hole_footer = (struct footer *)((uint32_t)new_location - FOOTER_SIZE);
+		hole_footer = (struct footer *)(original_hole_position + offset
+						 - FOOTER_SIZE);
 		hole_footer->id = FOOTER_ID;
 		hole_footer->header = hole_header;
-		original_hole_position = new_location;
-		original_hole_size = original_hole_size - hole_header->size;
-	} else {
-		/* We don't need this hole anymore, so remove it from the
-		 * index. */
-		ordered_array_remove_index(&heap->index, i);
+
+		ordered_array_insert(&heap->index, (void*)hole_header);
+
+		original_hole_position += offset;
+		original_hole_size -= offset;
+	}
+
+	/* We must now decide whether to split the hole we found into two
+	 * parts. Is the original hole size minus requested hole size less than
+	 * the overhead for adding a new hole? */
+	if ((original_hole_size - total_size) < BLOCK_OVERHEAD) {
+		/* Increase the requested size to the size of the hole we
+		 * found. */
+		total_size = original_hole_size;
 	}
 
 	/* Overwrite the original header. */
@@ -443,30 +480,27 @@ void *alloc(struct heap *heap, uint32_t size, uint8_t page_align)
 
 	/* Overwrite the original footer. */
 	block_footer = (struct footer *)(original_hole_position
-					  + HEADER_SIZE + size);
+					  + total_size - FOOTER_SIZE);
 	block_footer->id = FOOTER_ID;
 	block_footer->header = block_header;
 
 	/* We may need to write a new hole after the allocated block. We do this only
 	 * if the new hole would have a positive size (size > 0). */
-	if ((original_hole_size - total_size) > 0) {
+	if (original_hole_size > total_size) {
 		struct header *hole_header;
 		struct footer *hole_footer;
 
-		hole_header = (struct header *)(original_hole_position + size
-						 + BLOCK_OVERHEAD);
+		hole_header = (struct header *)(original_hole_position
+						 + total_size);
 		hole_header->id = HEADER_ID;
 		hole_header->is_hole = 1;
 		hole_header->size = original_hole_size - total_size;
 
-		hole_footer = (struct footer *)((uint32_t)hole_header
-						 - total_size
+		hole_footer = (struct footer *)(original_hole_position
 						 + original_hole_size
 						 - FOOTER_SIZE);
-		if ((uint32_t)hole_footer < heap->end_address) {
-			hole_footer->id = FOOTER_ID;
-			hole_footer->header = hole_header;
-		}
+		hole_footer->id = FOOTER_ID;
+		hole_footer->header = hole_header;
 
 		/* Put the new hole in the index. */
 		ordered_array_insert(&heap->index, (void*)hole_header);
@@ -481,7 +515,6 @@ void free(struct heap *heap, void *block)
 	struct footer *footer;
 	struct header *test_header;
 	struct footer *test_footer;
-	char do_add = 1;
 
 	/* Exit gracefully for a null pointer. */
 	if (!block) {
@@ -505,87 +538,55 @@ void free(struct heap *heap, void *block)
 	 * hole. */
 	test_footer = (struct footer *)((uint32_t)header - FOOTER_SIZE);
 
-	/* If the memory immediately to the left of this block is a footer then
-	 * we can merge left. */
-	if (is_footer(test_footer) && is_hole(test_footer->header)) {
+	/* If the memory immediately to the left of this block is the footer of
+	 * a hole then we can merge left. */
+	if ((uint32_t)header > heap->start_address
+	    && is_footer(test_footer) && is_hole(test_footer->header)) {
 		uint32_t cache_size = header->size;
 
 		/* Cache our current size, and proceed to re-write the current
 		 * header with the new one, re-write the footer to point to the
-		 * new header, update the header size, and set the flag so that
-		 * we don't add to index again. */
+		 * new header, and update the header size. The hole leaves the
+		 * index, to go back in at its new size. */
 		header = test_footer->header;
 		footer->header = header;
 		header->size += cache_size;
-		do_add = 0;
+		_heap_remove_hole(heap, header);
 	}
 
-	/* If the memory immediately to the right of this block is a footer then
-	 * we can merge right. */
+	/* If the memory immediately to the right of this block is the header of
+	 * a hole then we can merge right. There is nothing to the right of the
+	 * last block. */
 	test_header = (struct header *)((uint32_t)footer + FOOTER_SIZE);
-	if (test_header->id == HEADER_ID
-	    && test_header->is_hole == 1) {
-		uint32_t i = 0;
-
+	if ((uint32_t)test_header < heap->end_address
+	    && is_header(test_header) && is_hole(test_header)) {
 		/* Increase the size the current header, and re-write the footer
 		 * of the test block to point to the current header. */
 		header->size += test_header->size;
-		test_footer = (struct footer *)((uint32_t)test_header
-						 + test_header->size
-						 - FOOTER_SIZE);
-		footer = test_footer;
-
-		/* Find and remove this header from the index. */
-		while ((i < heap->index.size)
-		       && (ordered_array_lookup_index(&heap->index, i)
-			   != (void*)test_header)) {
-			i++;
-		}
-
-		/* Ensure that we found the correct header. */
-		assert(i < heap->index.size);
+		footer = (struct footer *)((uint32_t)test_header
+					   + test_header->size
+					   - FOOTER_SIZE);
+		footer->header = header;
 
-		/* Remove header from index. */
-		ordered_array_remove_index(&heap->index, i);
+		_heap_remove_hole(heap, test_header);
 	}
 
-	/* If the location of the footer is the end address, we can contract. */
+	/* If the location of the footer is the end address, we can contract,
+	 * leaving enough of the hole for its header and footer. */
 	if ((uint32_t)footer + FOOTER_SIZE == heap->end_address) {
 		uint32_t old_length = (heap->end_address - heap->start_address);
 		uint32_t new_length = _heap_contract(heap, (uint32_t)header
-						     - heap->start_address);
-
-		/* Check how big the block will be after resizing. */
-		if (header->size - (old_length - new_length) > 0) {
-			/* The block will still exist, so resize. */
-			header->size -= (old_length - new_length);
-
-			footer = (struct footer *)((uint32_t)header
-						    + header->size
-						    - FOOTER_SIZE);
-			footer->id = FOOTER_ID;
-			footer->header = header;
-		} else {
-			uint32_t i = 0;
-
-			/* The block will no longer exist, so RIP block, and
-			 * remove from index. */
-			while ((i < heap->index.size)
-			       && (ordered_array_lookup_index(&heap->index, i)
-				   != (void*)test_header)) {
-				i++;
-			}
+						     - heap->start_address
+						     + BLOCK_OVERHEAD);
 
-			/* If we didn't find the block, there is nothing to
-			 * remove. */
-			if (i < heap->index.size) {
-				ordered_array_remove_index(&heap->index, i);
-			}
-		}
-	}
+		header->size -= (old_length - new_length);
 
-	/* If required, add this block to the index. */
-	if (do_add == 1) {
-		ordered_array_insert(&heap->index, (void*)header);
+		footer = (struct footer *)((uint32_t)header
+					    + header->size
+					    - FOOTER_SIZE);
+		footer->id = FOOTER_ID;
+		footer->header = header;
 	}
+
+	ordered_array_insert(&heap->index, (void*)header);
 }
@@ -0,0 +1,375 @@
+#include <mm/page-cache.h>
+
+#include <kernel/assert.h>
+#include <kernel/timer.h>
+#include <kernel/util.h>
+#include <lib/stdio.h>
+#include <lib/string.h>
+#include <mm/paging.h>
+
+/* Defined in ./paging.c. */
+extern struct page_directory *kernel_directory;
+
+#define page_address(page)						\
+	((uint8_t *)(PAGE_CACHE_START + ((page) - pages) * PAGE_SIZE))
+#define page_hash(node, index)						\
+	((((uint32_t)(node) >> 4) ^ ((index) * 0x9E3779B1))		\
+	 % PAGE_CACHE_BUCKETS)
+
+static struct cached_page pages[PAGE_CACHE_PAGES];
+static struct cached_page *buckets[PAGE_CACHE_BUCKETS];
+
+/* The clock hand, the next slot to consider for eviction. */
+static uint32_t hand;
+
+/* When page_cache_writeback() last wrote dirty pages back. */
+static uint32_t last_writeback;
+
+static struct cached_page *_page_find(struct fs_node *node, uint32_t index)
+{
+	struct cached_page *page;
+
+	for (page = buckets[page_hash(node, index)]; page;
+	     page = page->hash_next) {
+		if (page->node == node && page->index == index) {
+			return page;
+		}
+	}
+
+	return 0;
+}
+
+/* Remove a page from its hash bucket and mark the slot unused. */
+static void _page_remove(struct cached_page *page)
+{
+	struct cached_page **link = &buckets[page_hash(page->node,
+						       page->index)];
+
+	while (*link && *link != page) {
+		link = &(*link)->hash_next;
+	}
+
+	if (*link) {
+		*link = page->hash_next;
+	}
+
+	page->node = 0;
+	page->dirty = 0;
+	page->referenced = 0;
+	page->hash_next = 0;
+}
+
+static void _page_writeback(struct cached_page *page)
+{
+	struct fs_node *node = page->node;
+
+	if (!page->dirty) {
+		return;
+	}
+
+	if (node->write) {
+		node->write(node, page->index * PAGE_SIZE, page->length,
+			    page_address(page));
+	} else {
+		page_cache_log(LOG_WARNING,
+			       "dropping dirty page %d of read-only '%s'\n",
+			       page->index, node->name);
+	}
+
+	page->dirty = 0;
+}
+
+/* Find a free slot, or evict a page using the clock algorithm. Pages which
+ * have been referenced since the hand last passed them are given a second
+ * chance, so this finds a victim within two sweeps. Pages being filled are
+ * passed over, as a driver may read through the cache while filling one. */
+static struct cached_page *_page_evict(void)
+{
+	for (;;) {
+		struct cached_page *page = &pages[hand];
+
+		hand = (hand + 1) % PAGE_CACHE_PAGES;
+
+		if (!page->node) {
+			return page;
+		}
+
+		if (page->busy) {
+			continue;
+		}
+
+		if (page->referenced) {
+			page->referenced = 0;
+			continue;
+		}
+
+		_page_writeback(page);
+		_page_remove(page);
+
+		return page;
+	}
+}
+
+/* Return the cached page 'index' of 'node', creating it if necessary. A new
+ * page is filled from the driver if 'fill' is set, and is otherwise empty. */
+static struct cached_page *_page_get(struct fs_node *node, uint32_t index,
+				     int fill)
+{
+	struct cached_page *page = _page_find(node, index);
+	uint32_t bucket;
+	uint8_t *address;
+
+	if (page) {
+		page->referenced = 1;
+		return page;
+	}
+
+	page = _page_evict();
+	address = page_address(page);
+
+	if (!page->mapped) {
+		alloc_frame(get_page((uint32_t)address, NO_CREATE,
+				     kernel_directory), 1, 1);
+		page->mapped = 1;
+	}
+
+	page->node = node;
+	page->index = index;
+	page->length = 0;
+	page->dirty = 0;
+	page->referenced = 1;
+
+	bucket = page_hash(node, index);
+	page->hash_next = buckets[bucket];
+	buckets[bucket] = page;
+
+	if (fill && node->read) {
+		page->busy = 1;
+		page->length = node->read(node, index * PAGE_SIZE, PAGE_SIZE,
+					  address);
+		page->busy = 0;
+	}
+
+	/* Zero the rest of the page, so that holes read as zeros. */
+	memset(address + page->length, 0x0, PAGE_SIZE - page->length);
+
+	return page;
+}
+
+/* Read ahead the pages following a sequential access. Pages read ahead are not
+ * marked as referenced, so they are the first to go if never used. If the
+ * driver supports readv, the run of missing pages is filled with one call, so
+ * that a block device can read them in a single transfer straight into the
+ * cache pages. */
+static void _page_readahead(struct fs_node *node, uint32_t index)
+{
+	struct cached_page *batch[PAGE_CACHE_READAHEAD];
+	struct iovec iov[PAGE_CACHE_READAHEAD];
+	uint32_t count = 0, first = index;
+	uint32_t i, done;
+
+	for (i = index; i < index + PAGE_CACHE_READAHEAD; i++) {
+		struct cached_page *page;
+
+		if (i * PAGE_SIZE >= node->size) {
+			break;
+		}
+
+		if (_page_find(node, i)) {
+			/* Only a contiguous run can be read at once. */
+			if (count) {
+				break;
+			}
+			first = i + 1;
+			continue;
+		}
+
+		/* Pages stay busy until the batch is filled, so that neither
+		 * the clock nor page_cache_shrink() can take one for the
+		 * next. */
+		page = _page_get(node, i, !node->readv);
+		if (!node->readv) {
+			page->referenced = 0;
+			continue;
+		}
+
+		page->busy = 1;
+		batch[count] = page;
+		iov[count].iov_base = page_address(page);
+		iov[count].iov_len = PAGE_SIZE;
+		count++;
+	}
+
+	if (!count) {
+		return;
+	}
+
+	done = node->readv(node, first * PAGE_SIZE, iov, count);
+
+	for (i = 0; i < count; i++) {
+		batch[i]->length = min(done, PAGE_SIZE);
+		batch[i]->referenced = 0;
+		batch[i]->busy = 0;
+		done -= batch[i]->length;
+	}
+}
+
+void init_page_cache()
+{
+	memset((uint8_t *)pages, 0x0, sizeof(pages));
+	memset((uint8_t *)buckets, 0x0, sizeof(buckets));
+	hand = 0;
+	last_writeback = 0;
+}
+
+uint32_t page_cache_read(struct fs_node *node, uint32_t offset,
+			 uint32_t size, uint8_t *buffer)
+{
+	uint32_t done = 0;
+
+	if (offset >= node->size) {
+		return 0;
+	}
+
+	size = min(size, node->size - offset);
+
+	while (done < size) {
+		uint32_t index = (offset + done) / PAGE_SIZE;
+		uint32_t page_offset = (offset + done) % PAGE_SIZE;
+		uint32_t length;
+		struct cached_page *page = _page_find(node, index);
+		int sequential = 0;
+
+		if (page) {
+			page->referenced = 1;
+		} else {
+			sequential = index && _page_find(node, index - 1);
+			page = _page_get(node, index, 1);
+		}
+
+		/* Stop on a short read from the driver. */
+		if (page_offset >= page->length) {
+			break;
+		}
+
+		length = min(PAGE_SIZE - page_offset, size - done);
+		length = min(length, page->length - page_offset);
+		memcpy(buffer + done, page_address(page) + page_offset, length);
+		done += length;
+
+		if (sequential) {
+			_page_readahead(node, index + 1);
+		}
+	}
+
+	return done;
+}
+
+uint32_t page_cache_write(struct fs_node *node, uint32_t offset,
+			  uint32_t size, uint8_t *buffer)
+{
+	uint32_t done = 0;
+
+	while (done < size) {
+		uint32_t index = (offset + done) / PAGE_SIZE;
+		uint32_t page_offset = (offset + done) % PAGE_SIZE;
+		uint32_t length = min(PAGE_SIZE - page_offset, size - done);
+		struct cached_page *page;
+		int partial;
+
+		/* A page which is only partly overwritten must first be read,
+		 * unless it lies entirely beyond the end of the file. */
+		partial = (page_offset || length < PAGE_SIZE)
+			&& index * PAGE_SIZE < node->size;
+		page = _page_get(node, index, partial);
+
+		memcpy(page_address(page) + page_offset, buffer + done, length);
+		page->length = max(page->length, page_offset + length);
+		page->dirty = 1;
+		done += length;
+	}
+
+	if (offset + size > node->size) {
+		node->size = offset + size;
+	}
+
+	return done;
+}
+
+void page_cache_sync(struct fs_node *node)
+{
+	uint32_t i;
+
+	for (i = 0; i < PAGE_CACHE_PAGES; i++) {
+		struct cached_page *page = &pages[i];
+
+		if (page->node && (!node || page->node == node)) {
+			_page_writeback(page);
+		}
+	}
+}
+
+void page_cache_writeback()
+{
+	uint32_t now = timer_milliseconds();
+
+	if (now - last_writeback < PAGE_CACHE_WRITEBACK_MS) {
+		return;
+	}
+
+	last_writeback = now;
+	page_cache_sync(0);
+}
+
+void page_cache_invalidate(struct fs_node *node, uint32_t offset)
+{
+	uint32_t i;
+
+	for (i = 0; i < PAGE_CACHE_PAGES; i++) {
+		struct cached_page *page = &pages[i];
+		uint32_t start = page->index * PAGE_SIZE;
+
+		if (page->node != node) {
+			continue;
+		}
+
+		if (start >= offset) {
+			_page_remove(page);
+		} else if (start + page->length > offset) {
+			/* Truncate the page which straddles the offset. */
+			memset(page_address(page) + (offset - start), 0x0,
+			       page->length - (offset - start));
+			page->length = offset - start;
+		}
+	}
+}
+
+uint32_t page_cache_shrink(uint32_t count)
+{
+	uint32_t released = 0;
+	uint32_t i;
+
+	for (i = 0; i < PAGE_CACHE_PAGES && released < count; i++) {
+		struct cached_page *page = &pages[i];
+
+		if (!page->mapped || page->busy ||
+		    (page->node && page->dirty)) {
+			continue;
+		}
+
+		if (page->node) {
+			_page_remove(page);
+		}
+
+		free_frame(get_page((uint32_t)page_address(page), NO_CREATE,
+				    kernel_directory));
+		page->mapped = 0;
+		released++;
+	}
+
+	if (released) {
+		flush_tlb();
+	}
+
+	return released;
+}
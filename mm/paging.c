@@ -1,11 +1,11 @@
 #include <mm/paging.h>
 
 #include <kernel/panic.h>
-#include <kernel/tty.h>
 #include <kernel/util.h>
 #include <lib/stdio.h>
 #include <lib/string.h>
 #include <mm/heap.h>
+#include <mm/page-cache.h>
 
 /* Macros used in the bitset algorithms. */
 #define INDEX_FROM_BIT(a) (a / (8 * 4))
@@ -25,6 +25,12 @@ uint32_t frames_count;
 extern uint32_t placement_address;
 extern struct heap *kernel_heap;
 
+/* A bitset of pages in use in the kpage window. */
+static uint32_t kpages[KPAGE_PAGES / 32];
+
+#define kpage_used(i) (kpages[INDEX_FROM_BIT(i)] & (0x1 << OFFSET_FROM_BIT(i)))
+#define kpage_address(i) (KPAGE_START + (i) * PAGE_SIZE)
+
 /* Set a bit in a frame's bitset. */
 static void _set_frame(uint32_t frame_address)
 {
@@ -64,7 +70,7 @@ static uint32_t _first_frame(void)
 		}
 	}
 
-	return 0;
+	return (uint32_t)-1;
 }
 
 static struct page_table *_clone_table(struct page_table *src,
@@ -126,6 +132,20 @@ void init_paging()
 		get_page(i, 1, kernel_directory);
 	}
 
+	/* Likewise create the page tables for the page cache window. Its frames
+	 * are allocated on demand, but the tables must exist before the kernel
+	 * directory is cloned so that every directory shares them. */
+	for (i = PAGE_CACHE_START;
+	     i < PAGE_CACHE_START + PAGE_CACHE_PAGES * PAGE_SIZE;
+	     i += PAGE_SIZE) {
+		get_page(i, 1, kernel_directory);
+	}
+
+	for (i = KPAGE_START; i < KPAGE_START + KPAGE_PAGES * PAGE_SIZE;
+	     i += PAGE_SIZE) {
+		get_page(i, 1, kernel_directory);
+	}
+
 	/* We need to identity map (physical_address = virtual address) from 0x0 to
 	 * the end of the used memory, so that we can access this transparently, as if
 	 * paging weren't enabled. An extra page is allocated so that the kernel heap
@@ -163,6 +183,14 @@ void alloc_frame(struct page *p, int is_kernel, int is_writeable)
 		uint32_t index;
 
 		index = _first_frame();
+
+		/* Clean pages of file data can be read again, so take frames
+		 * back from the page cache before giving up. */
+		if (index == (uint32_t)-1 &&
+		    page_cache_shrink(PAGE_CACHE_SHRINK_BATCH)) {
+			index = _first_frame();
+		}
+
 		if (index == (uint32_t)-1) {
 			printf("Unable to allocate a frame for page %p\n", p);
 			panic("Out of Memory");
@@ -182,9 +210,216 @@ void free_frame(struct page *p)
 	uint32_t frame;
 
 	if ((frame = p->frame)) {
-		_clear_frame(frame);
+		_clear_frame(frame * PAGE_SIZE);
 		p->frame = 0x0;
+		p->present = 0;
+	}
+}
+
+void map_frame(struct page *p, uint32_t frame_address,
+	       int is_kernel, int is_writeable)
+{
+	p->present = 1;
+	p->rw = (is_writeable) ? 1 : 0;
+	p->user = (is_kernel) ? 0 : 1;
+	p->frame = frame_address / PAGE_SIZE;
+}
+
+/* Returns 1 if pages [first, first + count) of the kpage window are free. */
+static int _kpage_range_free(uint32_t first, uint32_t count)
+{
+	uint32_t i;
+
+	if (first + count > KPAGE_PAGES) {
+		return 0;
+	}
+
+	for (i = first; i < first + count; i++) {
+		if (kpage_used(i)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static uint32_t _kpage_claim(uint32_t first, uint32_t count)
+{
+	uint32_t i;
+
+	for (i = first; i < first + count; i++) {
+		kpages[INDEX_FROM_BIT(i)] |= (0x1 << OFFSET_FROM_BIT(i));
+		alloc_frame(get_page(kpage_address(i), NO_CREATE,
+				     kernel_directory), 1, 1);
+	}
+
+	/* The pages may previously have been mapped to other frames. */
+	flush_tlb();
+	memset((uint8_t *)kpage_address(first), 0x0, count * PAGE_SIZE);
+
+	return kpage_address(first);
+}
+
+uint32_t kpage_alloc(uint32_t count)
+{
+	uint32_t i;
+
+	for (i = 0; i + count <= KPAGE_PAGES; i++) {
+		if (_kpage_range_free(i, count)) {
+			return _kpage_claim(i, count);
+		}
+	}
+
+	return 0;
+}
+
+uint32_t kpage_alloc_at(uint32_t address, uint32_t count)
+{
+	uint32_t first;
+
+	if (address < KPAGE_START) {
+		return 0;
+	}
+
+	first = (address - KPAGE_START) / PAGE_SIZE;
+	if (!_kpage_range_free(first, count)) {
+		return 0;
+	}
+
+	return _kpage_claim(first, count);
+}
+
+/* Return the first of 'count' consecutive free frames, or -1 if there is no
+ * such run. */
+static uint32_t _first_frames(uint32_t count)
+{
+	uint32_t frame, run = 0;
+
+	for (frame = 0; frame < frames_count; frame++) {
+		if (frames[INDEX_FROM_BIT(frame)] &
+		    (0x1 << OFFSET_FROM_BIT(frame))) {
+			run = 0;
+		} else if (++run == count) {
+			return frame + 1 - count;
+		}
 	}
+
+	return (uint32_t)-1;
+}
+
+uint32_t kpage_alloc_contiguous(uint32_t count)
+{
+	uint32_t first, frame, i;
+
+	for (first = 0; first + count <= KPAGE_PAGES; first++) {
+		if (_kpage_range_free(first, count)) {
+			break;
+		}
+	}
+
+	if (first + count > KPAGE_PAGES ||
+	    (frame = _first_frames(count)) == (uint32_t)-1) {
+		return 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		kpages[INDEX_FROM_BIT(first + i)] |=
+			(0x1 << OFFSET_FROM_BIT(first + i));
+		_set_frame((frame + i) * PAGE_SIZE);
+		map_frame(get_page(kpage_address(first + i), NO_CREATE,
+				   kernel_directory),
+			  (frame + i) * PAGE_SIZE, 1, 1);
+	}
+
+	flush_tlb();
+	memset((uint8_t *)kpage_address(first), 0x0, count * PAGE_SIZE);
+
+	return kpage_address(first);
+}
+
+void kpage_free(uint32_t address, uint32_t count)
+{
+	uint32_t first = (address - KPAGE_START) / PAGE_SIZE;
+	uint32_t i;
+
+	for (i = first; i < first + count; i++) {
+		kpages[INDEX_FROM_BIT(i)] &= ~(0x1 << OFFSET_FROM_BIT(i));
+		free_frame(get_page(kpage_address(i), NO_CREATE,
+				    kernel_directory));
+	}
+
+	flush_tlb();
+}
+
+uint32_t kpage_map(uint32_t physical, uint32_t count, uint32_t flags)
+{
+	uint32_t first, i;
+
+	for (first = 0; first + count <= KPAGE_PAGES; first++) {
+		if (_kpage_range_free(first, count)) {
+			break;
+		}
+	}
+
+	if (first + count > KPAGE_PAGES) {
+		return 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		struct page *page = get_page(kpage_address(first + i),
+					     NO_CREATE, kernel_directory);
+
+		kpages[INDEX_FROM_BIT(first + i)] |=
+			(0x1 << OFFSET_FROM_BIT(first + i));
+		map_frame(page, physical + i * PAGE_SIZE, 1, 1);
+
+		/* PCD and PWT together make the page uncacheable whatever
+		 * the MTRRs say. */
+		page->pcd = (flags & KPAGE_UNCACHED) ? 1 : 0;
+		page->pwt = (flags & KPAGE_UNCACHED) ? 1 : 0;
+	}
+
+	flush_tlb();
+
+	return kpage_address(first);
+}
+
+void kpage_unmap(uint32_t address, uint32_t count)
+{
+	uint32_t first = (address - KPAGE_START) / PAGE_SIZE;
+	uint32_t i;
+
+	for (i = first; i < first + count; i++) {
+		struct page *page = get_page(kpage_address(i), NO_CREATE,
+					     kernel_directory);
+
+		kpages[INDEX_FROM_BIT(i)] &= ~(0x1 << OFFSET_FROM_BIT(i));
+		page->frame = 0x0;
+		page->present = 0;
+		page->pcd = 0;
+		page->pwt = 0;
+	}
+
+	flush_tlb();
+}
+
+uint32_t virtual_to_physical(uint32_t address)
+{
+	struct page *page = get_page(address, NO_CREATE, current_directory);
+
+	if (!page || !page->present) {
+		return 0;
+	}
+
+	return (page->frame * PAGE_SIZE) + (address & PAGE_OFFSET_MASK);
+}
+
+void flush_tlb()
+{
+	uint32_t pd_address;
+
+	__asm volatile("mov %%cr3, %0" : "=r" (pd_address));
+	__asm volatile("mov %0, %%cr3" : : "r" (pd_address) : "memory");
 }
 
 void switch_page_directory(struct page_directory *d)
@@ -193,10 +428,10 @@ void switch_page_directory(struct page_directory *d)
 
 	paging_debug("%h -> %h\n", current_directory, d);
 	current_directory = d;
-	__asm volatile("mov %0, %%cr3":: "r"(d->directory_address));
+	__asm volatile("mov %0, %%cr3":: "r"(d->directory_address) : "memory");
 	__asm volatile("mov %%cr0, %0": "=r"(cr0));
 	cr0 |= 0x80000000; /* Enable paging. */
-	__asm volatile("mov %0, %%cr0":: "r"(cr0));
+	__asm volatile("mov %0, %%cr0":: "r"(cr0) : "memory");
 }
 
 struct page *get_page(uint32_t address, enum create_page_e make,
@@ -235,10 +470,9 @@ struct page_directory *clone_directory(struct page_directory *src)
 	uint32_t offset;
 	int i;
 
-	paging_debug("dest_address: %h\n", dest_address);
-
 	/* Make and zero a page directory and obtain its physical address. */
 	dest = kcreate_ap(struct page_directory, 1, &dest_address);
+	paging_debug("dest_address: %h\n", dest_address);
 	memset((uint8_t*)dest, 0x0, sizeof(struct page_directory));
 
 	/* Get the offset of physical_tables from the start of the struct
@@ -296,23 +530,23 @@ void page_fault(struct registers registers)
 	printf("PAGE FAULT: %h ", faulting_address);
 
 	if (present) {
-		tty_write("PRESENT ");
+		printf("PRESENT ");
 	}
 
 	if (rw) {
-		tty_write("READ-ONLY ");
+		printf("READ-ONLY ");
 	}
 
 	if (us) {
-		tty_write("USER-MODE ");
+		printf("USER-MODE ");
 	} else {
-		tty_write("KERNEL-MODE ");
+		printf("KERNEL-MODE ");
 	}
 
 	if (reserved) {
-		tty_write("RESERVED ");
+		printf("RESERVED ");
 	}
 
-	tty_write("\n");
+	printf("\n");
 	panic("Page fault");
 }
@@ -1,5 +1,6 @@
 #include <sched/task.h>
 
+#include <kernel/util.h>
 #include <lib/string.h>
 #include <mm/paging.h>
 #include <mm/heap.h>
@@ -43,6 +44,10 @@ void init_tasking ()
 	current_task->ebp = 0;
 	current_task->eip = 0;
 	current_task->pde = current_directory;
+	memset((uint8_t *)current_task->files, 0x0,
+	       sizeof(current_task->files));
+	current_task->state = TASK_RUNNING;
+	current_task->wait = 0;
 	current_task->next = 0;
 
 	/* Initialise our task queue. */
@@ -53,6 +58,7 @@ void init_tasking ()
 
 void context_switch()
 {
+	volatile struct task *next;
 	uint32_t esp, ebp, eip;
 
 	if (!current_task) {
@@ -79,13 +85,19 @@ void context_switch()
 	current_task->esp = esp;
 	current_task->ebp = ebp;
 
-	current_task = current_task->next;
+	/* Pick the next runnable task. The last task in our ready queue always
+	 * contains a null pointer, so if that is the case, start at the
+	 * beginning of the list again. If every other task is asleep, we come
+	 * back around to the current one. */
+	next = current_task;
+	do {
+		next = next->next;
+		if (!next) {
+			next = ready_queue;
+		}
+	} while (next->state != TASK_RUNNING && next != current_task);
 
-	/* The last task in our ready queue always contains a null pointer, so
-	 * if that is the case, start at the beginning of the list again. */
-	if (!current_task) {
-		current_task = ready_queue;
-	}
+	current_task = next;
 
 	eip = current_task->eip;
 	esp = current_task->esp;
@@ -119,6 +131,7 @@ int fork()
 	struct task *parent_task, *new_task, *queued_task;
 	struct page_directory *pde;
 	uint32_t eip;
+	int fd;
 
 	__asm volatile("cli");
 
@@ -136,8 +149,18 @@ int fork()
 	new_task->ebp = 0;
 	new_task->eip = 0;
 	new_task->pde = pde;
+	new_task->state = TASK_RUNNING;
+	new_task->wait = 0;
 	new_task->next = 0;
 
+	/* The child shares the parent's open files. */
+	for (fd = 0; fd < TASK_MAX_FILES; fd++) {
+		new_task->files[fd] = parent_task->files[fd];
+		if (new_task->files[fd]) {
+			file_get(new_task->files[fd]);
+		}
+	}
+
 	/* Add the newly created task to the end of the ready queue. */
 	queued_task = (struct task *)ready_queue;
 	while (queued_task->next) {
@@ -190,7 +213,7 @@ void stack_mv(void *dst, size_t size)
 	 * mapping has changed. Flush the TLB by reading and writing the PD
 	 * address again.  */
 	__asm volatile("mov %%cr3, %0" : "=r" (pd_address));
-	__asm volatile("mov %0, %%cr3" : : "r" (pd_address));
+	__asm volatile("mov %0, %%cr3" : : "r" (pd_address) : "memory");
 
 	/* Read old ESP and EBP from registers. */
 	__asm volatile("mov %%esp, %0" : "=r" (old_esp));
@@ -234,3 +257,41 @@ int getpid()
 {
 	return current_task->pid;
 }
+
+void sleep_on(struct wait_queue *queue)
+{
+	struct task *task = (struct task *)current_task;
+
+	__asm volatile("cli");
+
+	task->state = TASK_WAITING;
+	task->wait = queue->head;
+	queue->head = task;
+
+	/* Enabling interrupts and halting is atomic on x86, so a wake_up() from
+	 * an interrupt handler cannot be lost between the test and the hlt. The
+	 * timer interrupt schedules other tasks while we are asleep. */
+	while (task->state == TASK_WAITING) {
+		__asm volatile("sti; hlt; cli");
+	}
+
+	__asm volatile("sti");
+}
+
+void wake_up(struct wait_queue *queue)
+{
+	struct task *task;
+	uint32_t eflags;
+
+	/* We may be called with interrupts already disabled, from an interrupt
+	 * handler, so restore the previous state rather than enabling them. */
+	irq_save(eflags);
+
+	while ((task = queue->head)) {
+		queue->head = task->wait;
+		task->wait = 0;
+		task->state = TASK_RUNNING;
+	}
+
+	irq_restore(eflags);
+}
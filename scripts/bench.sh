@@ -0,0 +1,101 @@
+#!/bin/bash
+# bench.sh - run with ' --help' for usage information.
+
+KERNEL=floppy/kernel
+INPUT_DIR=initrd
+INITRDGEN=./tools/initrd-gen
+OUTPUT=bench.json
+PROFILE=release
+TIMEOUT=120
+
+# The file read by the fs_read_initrd benchmark, see kernel/bench.c.
+BENCH_FILE=bench.dat
+BENCH_FILE_KIB=1024
+
+# The disks read by the block_read_* and aio_read_* benchmarks, on the
+# primary IDE channel and on virtio-blk.
+BENCH_DISK_MB=8
+
+# isa-debug-exit at the port in include/ports/debug-exit.h. The kernel writes
+# DEBUG_EXIT_SUCCESS to it once the results are out, which QEMU exits with as
+# (0x10 << 1) | 1.
+DEBUG_EXIT="isa-debug-exit,iobase=0xf4,iosize=0x04"
+DEBUG_EXIT_SUCCESS=33
+
+usage () {
+    echo "Usage: $(basename $0) [--help] [profile]"
+    echo ""
+    echo "Builds the kernel in the given profile (default: $PROFILE) and boots"
+    echo "it headless in QEMU with 'bench' on its command line, so that it runs"
+    echo "the benchmarks in kernel/bench.c and exits. The initrd holds the"
+    echo "files in '$INPUT_DIR/' and a $BENCH_FILE_KIB KiB '$BENCH_FILE' to read."
+    echo "Blank $BENCH_DISK_MB MB disks are attached on IDE and virtio-blk, so"
+    echo "that the two drivers can be compared."
+    echo ""
+    echo "The results are printed and written to '$OUTPUT' as JSON, with the"
+    echo "profile, commit and date of the run. Each benchmark has its name,"
+    echo "iterations, total cycles, cycles_per_op and ns_per_op, and the file"
+    echo "reads also have bytes and kib_per_s. Fails, printing the serial log,"
+    echo "if QEMU does not exit as the kernel asks within $TIMEOUT seconds."
+}
+
+set -e
+
+# Enable debugging if needed.
+test -n "$DEBUG" && set -x
+
+# Parse --help argument first.
+for arg in $@; do
+    if [ $arg = "--help" ]; then
+        usage
+        exit 0
+    fi
+done
+
+test $# -gt 0 && PROFILE=$1
+
+make -s tools
+make -s PROFILE=$PROFILE kernel
+
+WORK=$(mktemp -d)
+trap "rm -rf $WORK" EXIT
+
+# Build an initrd like scripts/mkinitrd.sh, without needing root, plus the
+# file to read.
+head -c $(( BENCH_FILE_KIB * 1024 )) /dev/urandom > "$WORK/$BENCH_FILE"
+input_files="$WORK/$BENCH_FILE $BENCH_FILE"
+for f in $(find $INPUT_DIR -type f); do
+    file="$(basename $f)"
+    if [ "$file" != ".gitignore" ] && [ "$file" != "Makefile" ]; then
+        input_files+=" $f ${f#$INPUT_DIR/}"
+    fi
+done
+$INITRDGEN "$WORK/initrd" $input_files >/dev/null
+
+for disk in hda vda; do
+    dd if=/dev/zero of="$WORK/$disk.img" bs=1M count=$BENCH_DISK_MB 2>/dev/null
+done
+
+status=0
+timeout $TIMEOUT qemu-system-i386 -kernel "$KERNEL" -initrd "$WORK/initrd" \
+    -append bench -display none -serial file:"$WORK/serial.log" \
+    -drive file="$WORK/hda.img",if=ide,index=0,media=disk,format=raw \
+    -drive file="$WORK/vda.img",if=virtio,format=raw \
+    -device $DEBUG_EXIT -no-reboot || status=$?
+
+results=$(sed -n '/^bench: begin$/,/^bench: end$/{//!p}' "$WORK/serial.log")
+
+if [ $status -ne $DEBUG_EXIT_SUCCESS ] || [ -z "$results" ]; then
+    echo "$(basename $0): $PROFILE kernel did not finish the benchmarks" \
+         "(QEMU exit status $status); serial log:" >&2
+    cat "$WORK/serial.log" >&2
+    exit 1
+fi
+
+commit=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+cat > "$OUTPUT" <<EOF
+{"profile":"$PROFILE","commit":"$commit","date":"$(date -u +%Y-%m-%dT%H:%M:%SZ)",
+"results":$results}
+EOF
+
+cat "$OUTPUT"
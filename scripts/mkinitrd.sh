@@ -5,6 +5,7 @@ INITRD=initrd
 OUTPUT_DIR=floppy
 INPUT_DIR=initrd
 INITRDGEN=./tools/initrd-gen
+INITRDGEN_FLAGS=${INITRDGEN_FLAGS:-}
 
 usage () {
     echo "Usage: $(basename $0) [--help]"
@@ -14,6 +15,8 @@ usage () {
     echo ""
     echo "    Input directory: '$INPUT_DIR/'"
     echo "    Image:           '$OUTPUT_DIR/$INITRD'"
+    echo ""
+    echo "Set INITRDGEN_FLAGS=--lz4 to compress the files in the image."
 }
 
 set -e
@@ -49,7 +52,7 @@ rm -f .mkinitrd_tmp
 for f in $input_files; do
     file="$(basename $f)"
     if [ "$file" != ".gitignore" ] && [ "$file" != "Makefile" ]; then
-        echo -n "$f $(basename $f) " >> .mkinitrd_tmp
+        echo -n "$f ${f#$INPUT_DIR/} " >> .mkinitrd_tmp
     fi
 done
 
@@ -57,7 +60,7 @@ input_files="$(cat .mkinitrd_tmp)"
 rm -f .mkinitrd_tmp
 
 echo ""
-sudo $INITRDGEN $OUTPUT_DIR/$INITRD $input_files
+sudo $INITRDGEN $INITRDGEN_FLAGS $OUTPUT_DIR/$INITRD $input_files
 
 sudo chown root $OUTPUT_DIR/$INITRD
 sudo chgrp root $OUTPUT_DIR/$INITRD
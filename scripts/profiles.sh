@@ -0,0 +1,136 @@
+#!/bin/bash
+# profiles.sh - run with ' --help' for usage information.
+
+KERNEL=floppy/kernel
+INPUT_DIR=initrd
+INITRDGEN=./tools/initrd-gen
+PROFILES="debug release profile"
+INITRDS="raw lz4"
+BOOT_MESSAGE="Boot complete"
+TIMEOUT=60
+
+usage () {
+    echo "Usage: $(basename $0) [--help] [profile ...]"
+    echo ""
+    echo "Builds the kernel in each profile (default: $PROFILES), boots it"
+    echo "headless in QEMU with each initrd ($INITRDS), and compares the"
+    echo "results. Both initrds hold the files in '$INPUT_DIR/', and the lz4"
+    echo "one is compressed as by 'make LZ4=1 initrd'. A boot passes once the"
+    echo "kernel logs '$BOOT_MESSAGE' on the serial port, within $TIMEOUT"
+    echo "seconds. For each boot, the report gives:"
+    echo ""
+    echo "    text, data, bss  section sizes of '$KERNEL', in bytes"
+    echo "    file             size of '$KERNEL' on disk, in bytes"
+    echo "    initrd           the initrd booted, and its size in bytes"
+    echo "    kernel ms        boot time measured by the kernel's timer"
+    echo "    wall ms          time from starting QEMU to the message"
+    echo ""
+    echo "The kernel is left built in the last profile given."
+}
+
+set -e
+
+# Enable debugging if needed.
+test -n "$DEBUG" && set -x
+
+# Parse --help argument first.
+for arg in $@; do
+    if [ $arg = "--help" ]; then
+        usage
+        exit 0
+    fi
+done
+
+test $# -gt 0 && PROFILES="$@"
+
+# A profile is only verified by booting it, so refuse to report sizes alone.
+for tool in nasm qemu-system-i386; do
+    if ! command -v $tool >/dev/null; then
+        echo "$(basename $0): '$tool' not found; the profiles cannot be" \
+             "built and booted" >&2
+        exit 1
+    fi
+done
+
+# Milliseconds since the epoch.
+now () {
+    echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# Boot the kernel with the initrd $2, waiting for the boot message in the
+# serial log $1. Prints the wall clock time taken, or nothing if it never came.
+boot () {
+    local log=$1 initrd=$2 start pid
+
+    start=$(now)
+    qemu-system-i386 -kernel "$KERNEL" -initrd "$initrd" \
+        -display none -serial file:"$log" -no-reboot &
+    pid=$!
+
+    while ! grep -q "$BOOT_MESSAGE" "$log" 2>/dev/null; do
+        if ! kill -0 $pid 2>/dev/null \
+            || [ $(( $(now) - start )) -gt $(( TIMEOUT * 1000 )) ]; then
+            kill $pid 2>/dev/null || true
+            wait $pid 2>/dev/null || true
+            return
+        fi
+        sleep 0.05
+    done
+
+    echo $(( $(now) - start ))
+    kill $pid
+    wait $pid 2>/dev/null || true
+}
+
+WORK=$(mktemp -d)
+trap "rm -rf $WORK" EXIT
+LOG="$WORK/serial.log"
+
+# Build each initrd like scripts/mkinitrd.sh, without needing root.
+make -s tools
+input_files=
+for f in $(find $INPUT_DIR -type f); do
+    file="$(basename $f)"
+    if [ "$file" != ".gitignore" ] && [ "$file" != "Makefile" ]; then
+        input_files+=" $f ${f#$INPUT_DIR/}"
+    fi
+done
+$INITRDGEN "$WORK/raw" $input_files >/dev/null
+$INITRDGEN --lz4 "$WORK/lz4" $input_files >/dev/null
+
+REPORT=$(printf "%-8s %8s %8s %8s %8s %-6s %8s %10s %8s  %s\n" \
+    profile text data bss file initrd size "kernel ms" "wall ms" result)
+FAILED=
+
+for profile in $PROFILES; do
+    make -s PROFILE=$profile kernel
+
+    read text data bss rest <<< $(size "$KERNEL" | awk 'NR == 2')
+    file=$(stat -c %s "$KERNEL")
+
+    for initrd in $INITRDS; do
+        : > "$LOG"
+        wall=$(boot "$LOG" "$WORK/$initrd")
+        kernel=$(sed -n "s/.*$BOOT_MESSAGE in \([0-9]*\) ms.*/\1/p" \
+            "$LOG")
+
+        if [ -n "$wall" ]; then
+            result=ok
+        else
+            result=FAILED
+            FAILED=1
+            echo "$(basename $0): $profile kernel did not boot with the" \
+                 "$initrd initrd; serial log:" >&2
+            cat "$LOG" >&2
+        fi
+
+        REPORT+=$'\n'$(printf "%-8s %8s %8s %8s %8s %-6s %8s %10s %8s  %s" \
+            $profile $text $data $bss $file $initrd \
+            $(stat -c %s "$WORK/$initrd") "${kernel:--}" "${wall:--}" \
+            $result)
+    done
+done
+
+echo "$REPORT"
+
+test -z "$FAILED"
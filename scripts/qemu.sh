@@ -0,0 +1,81 @@
+#!/bin/bash
+# qemu.sh - run with ' --help' for usage information.
+
+IMAGE=floppy.img
+DISK=disk.img
+VIRTIO_DISK=disk-virtio.img
+DISK_SIZE_MB=32
+FAT_DIR=initrd
+
+usage () {
+    echo "Usage: $(basename $0) [--help] [qemu options]"
+    echo ""
+    echo "Begins a QEMU IA-32 session, booting from the floppy image with one"
+    echo "hard disk image attached to the primary IDE channel, and another"
+    echo "attached as a virtio-blk device:"
+    echo ""
+    echo "    image:   '$IMAGE'"
+    echo "    ide:     '$DISK' (${DISK_SIZE_MB} MB, created if missing)"
+    echo "    virtio:  '$VIRTIO_DISK' (${DISK_SIZE_MB} MB, created if missing)"
+    echo ""
+    echo "A new IDE disk is formatted as FAT16 if mkfs.fat is installed, and the"
+    echo "contents of '$FAT_DIR/' are copied onto it if mtools is installed. A new"
+    echo "virtio disk is formatted as ext2, holding a copy of '$FAT_DIR/', if"
+    echo "mke2fs is installed. The kernel mounts each on /mnt/<disk>."
+    echo ""
+    echo "The kernel log is also written to the first serial port, which is"
+    echo "connected to standard output."
+    echo ""
+    echo "Any further options are passed to qemu-system-i386."
+}
+
+set -e
+
+NEW_DISK=
+NEW_VIRTIO_DISK=
+
+# Enable debugging if needed.
+test -n "$DEBUG" && set -x
+
+# Parse --help argument first.
+for arg in $@; do
+    if [ $arg = "--help" ]; then
+        usage
+        exit 0
+    fi
+done
+
+if [ ! -f "$IMAGE" ]; then
+    echo "$(basename $0): file does not exist '$IMAGE'" >&2
+    exit 1
+fi
+
+for disk in "$DISK" "$VIRTIO_DISK"; do
+    if [ ! -f "$disk" ]; then
+        dd if=/dev/zero of="$disk" bs=1M count=$DISK_SIZE_MB 2>/dev/null
+        echo "$(basename $0): created '$disk'"
+        test "$disk" = "$DISK" && NEW_DISK=1
+        test "$disk" = "$VIRTIO_DISK" && NEW_VIRTIO_DISK=1
+    fi
+done
+
+# Format a fresh IDE disk, with no partition table, so the kernel can mount it.
+if [ -n "$NEW_DISK" ] && command -v mkfs.fat >/dev/null; then
+    mkfs.fat -F 16 "$DISK" >/dev/null
+    if command -v mcopy >/dev/null; then
+        mcopy -s -i "$DISK" "$FAT_DIR"/* ::/
+    fi
+    echo "$(basename $0): formatted '$DISK' as FAT16"
+fi
+
+if [ -n "$NEW_VIRTIO_DISK" ] && command -v mke2fs >/dev/null; then
+    mke2fs -q -F -t ext2 -b 1024 -d "$FAT_DIR" "$VIRTIO_DISK"
+    echo "$(basename $0): formatted '$VIRTIO_DISK' as ext2"
+fi
+
+exec qemu-system-i386 \
+    -drive file="$IMAGE",if=floppy,format=raw \
+    -drive file="$DISK",if=ide,index=0,media=disk,format=raw \
+    -drive file="$VIRTIO_DISK",if=virtio,format=raw \
+    -serial stdio \
+    -boot a "$@"
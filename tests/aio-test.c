@@ -0,0 +1,425 @@
+#include "test.h"
+
+#include "stubs.h"
+#include <fs/aio.h>
+#include <lib/string.h>
+#include <mm/page-cache.h>
+#include <mm/paging.h>
+
+#define DISK_SECTORS 128
+#define DISK_SIZE    (DISK_SECTORS * BLOCK_SECTOR_SIZE)
+#define FILE_SIZE    350
+
+/* A disk whose driver completes requests only when _test_interrupt() is
+ * called, and a file served by fs_readv() and fs_writev(), standing in for the
+ * VFS and the block layer. */
+static struct block_device disk;
+static struct fs_node file;
+static uint8_t disk_data[DISK_SIZE];
+static uint8_t file_data[FILE_SIZE];
+
+/* Requests queued on the disk and not yet completed, oldest first. */
+static struct block_request *queued[AIO_RING_SIZE + 1];
+static uint32_t queued_count;
+
+static int disk_status;
+static uint32_t readv_calls, writev_calls, sync_calls, wake_ups;
+static uint32_t invalidated;
+
+static uint8_t buffers[AIO_RING_SIZE][BLOCK_SECTOR_SIZE * 2]
+	__attribute__((aligned(4)));
+
+/* Whether 'length' bytes at 'a' and 'b' are the same. */
+static int _test_equal(const uint8_t *a, const uint8_t *b, uint32_t length)
+{
+	while (length--) {
+		if (*a++ != *b++) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static uint8_t *_test_data(struct fs_node *node, uint32_t *size)
+{
+	*size = (node == &disk.node) ? DISK_SIZE : FILE_SIZE;
+	return (node == &disk.node) ? disk_data : file_data;
+}
+
+static uint32_t _test_transfer(struct fs_node *node, uint32_t offset,
+			       struct iovec *iov, uint32_t count, int write)
+{
+	uint32_t size, done = 0, i;
+	uint8_t *data = _test_data(node, &size);
+
+	for (i = 0; i < count && offset + done < size; i++) {
+		uint32_t length = min(iov[i].iov_len, size - (offset + done));
+
+		if (write) {
+			memcpy(data + offset + done, iov[i].iov_base, length);
+		} else {
+			memcpy(iov[i].iov_base, data + offset + done, length);
+		}
+		done += length;
+	}
+
+	return done;
+}
+
+uint32_t fs_readv(struct fs_node *node, uint32_t offset,
+		  struct iovec *iov, uint32_t count)
+{
+	readv_calls++;
+	return _test_transfer(node, offset, iov, count, 0);
+}
+
+uint32_t fs_writev(struct fs_node *node, uint32_t offset,
+		   struct iovec *iov, uint32_t count)
+{
+	writev_calls++;
+	return _test_transfer(node, offset, iov, count, 1);
+}
+
+/* We don't want GCC complaining about unused parameters. */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+void page_cache_sync(struct fs_node *node)
+{
+	sync_calls++;
+}
+
+void page_cache_invalidate(struct fs_node *node, uint32_t offset)
+{
+	invalidated = offset;
+}
+
+void wake_up(struct wait_queue *queue)
+{
+	wake_ups++;
+}
+
+void block_submit(struct block_device *device, struct block_request *request)
+{
+	check(device == &disk);
+	check(queued_count < AIO_RING_SIZE);
+
+	request->status = BLOCK_PENDING;
+	queued[queued_count++] = request;
+}
+
+#pragma GCC diagnostic pop /* ignored "-Wunused-parameter" */
+
+/* Complete the oldest request queued on the disk, as its interrupt would. */
+static void _test_interrupt(void)
+{
+	struct block_request *request = queued[0];
+	uint8_t *sectors = disk_data + request->sector * BLOCK_SECTOR_SIZE;
+	uint32_t length = request->count * BLOCK_SECTOR_SIZE;
+
+	memmove((uint8_t *)queued, (uint8_t *)(queued + 1),
+		--queued_count * sizeof(*queued));
+
+	if (!disk_status) {
+		if (request->write) {
+			memcpy(sectors, request->buffer, length);
+		} else {
+			memcpy(request->buffer, sectors, length);
+		}
+	}
+
+	request->status = disk_status ? BLOCK_ERROR : BLOCK_DONE;
+	if (request->done) {
+		request->done(request);
+	}
+}
+
+/* The task sleeps until the next interrupt. */
+void sleep_on(struct wait_queue *queue)
+{
+	(void)queue;
+
+	check(queued_count);
+	if (queued_count) {
+		_test_interrupt();
+	}
+}
+
+static struct aio_ring *_test_setup(void)
+{
+	uint32_t i;
+
+	arena_heap_create(HEAP_MIN_SIZE, HEAP_MIN_SIZE);
+
+	memset((uint8_t *)&disk, 0, sizeof(disk));
+	disk.node.flags = FS_BLOCKDEVICE | FS_PAGECACHE;
+	disk.node.size = DISK_SIZE;
+	disk.sector_count = DISK_SECTORS;
+	disk.max_sectors = 8;
+
+	memset((uint8_t *)&file, 0, sizeof(file));
+	file.flags = FS_FILE;
+	file.size = FILE_SIZE;
+
+	for (i = 0; i < DISK_SIZE; i++) {
+		disk_data[i] = (uint8_t)(i * 7 + i / BLOCK_SECTOR_SIZE);
+	}
+	for (i = 0; i < FILE_SIZE; i++) {
+		file_data[i] = (uint8_t)(i * 13);
+	}
+
+	queued_count = 0;
+	disk_status = 0;
+	readv_calls = writev_calls = sync_calls = wake_ups = 0;
+	invalidated = 0xffffffff;
+
+	return aio_create();
+}
+
+static void _test_read(struct aio_ring *ring, struct fs_node *node,
+		       uint32_t offset, uint32_t size, uint32_t user_data)
+{
+	struct aio_request *request = aio_get_request(ring);
+
+	check(request != 0);
+	if (request) {
+		request->opcode = AIO_READ;
+		request->node = node;
+		request->offset = offset;
+		request->buffer = buffers[user_data];
+		request->size = size;
+		request->user_data = user_data;
+	}
+}
+
+/* Consume the next completion, checking it is for 'user_data' with 'result'. */
+static void _test_completion(struct aio_ring *ring, uint32_t user_data,
+			     sint32_t result)
+{
+	struct aio_completion *completion = aio_get_completion(ring);
+
+	check(completion != 0);
+	if (completion) {
+		check(completion->user_data == user_data);
+		check(completion->result == result);
+		aio_completion_seen(ring);
+	}
+}
+
+static void _test_nop(void)
+{
+	struct aio_ring *ring = _test_setup();
+	struct aio_request *request;
+
+	check(aio_get_completion(ring) == 0);
+
+	request = aio_get_request(ring);
+	request->opcode = AIO_NOP;
+	request->user_data = 7;
+
+	/* Nothing is seen until it is submitted. */
+	check(aio_run(ring) == 0);
+	check(aio_submit(ring) == 1);
+	check(aio_wait(ring, 1) == 1);
+
+	_test_completion(ring, 7, 0);
+	check(aio_get_completion(ring) == 0);
+	check(wake_ups == 1);
+
+	aio_destroy(ring);
+}
+
+/* Contiguous reads of a file are one transfer, shared out in order. */
+static void _test_merge(void)
+{
+	struct aio_ring *ring = _test_setup();
+	uint32_t i;
+
+	for (i = 0; i < 4; i++) {
+		_test_read(ring, &file, i * 100, 100, i);
+	}
+
+	check(aio_submit(ring) == 4);
+	check(aio_wait(ring, 4) == 4);
+	check(readv_calls == 1);
+
+	_test_completion(ring, 0, 100);
+	_test_completion(ring, 1, 100);
+	_test_completion(ring, 2, 100);
+	_test_completion(ring, 3, 50);
+	check(_test_equal(buffers[3], file_data + 300, 50));
+
+	aio_destroy(ring);
+}
+
+/* A direct read is started by aio_submit(), which returns before it is done,
+ * and completes from the interrupt. */
+static void _test_direct(void)
+{
+	struct aio_ring *ring = _test_setup();
+
+	_test_read(ring, &disk.node, 4 * BLOCK_SECTOR_SIZE,
+		   2 * BLOCK_SECTOR_SIZE, 1);
+
+	check(aio_submit(ring) == 1);
+	check(queued_count == 1);
+	check(ring->in_flight == 1);
+	check(aio_get_completion(ring) == 0);
+	check(sync_calls == 1);
+	check(readv_calls == 0);
+
+	_test_interrupt();
+
+	check(ring->in_flight == 0);
+	check(wake_ups == 1);
+	_test_completion(ring, 1, 2 * BLOCK_SECTOR_SIZE);
+	check(_test_equal(buffers[1], disk_data + 4 * BLOCK_SECTOR_SIZE,
+			  2 * BLOCK_SECTOR_SIZE));
+
+	aio_destroy(ring);
+}
+
+/* Direct requests queued behind another request are started in order, once
+ * the worker has run it. */
+static void _test_order(void)
+{
+	struct aio_ring *ring = _test_setup();
+
+	_test_read(ring, &disk.node, 0, BLOCK_SECTOR_SIZE, 0);
+	_test_read(ring, &disk.node, 10, 100, 1);
+	_test_read(ring, &disk.node, BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE, 2);
+
+	check(aio_submit(ring) == 3);
+	check(queued_count == 1);
+
+	check(aio_wait(ring, 3) == 3);
+	check(readv_calls == 1);
+	check(queued_count == 0);
+
+	_test_completion(ring, 1, 100);
+	_test_completion(ring, 0, BLOCK_SECTOR_SIZE);
+	_test_completion(ring, 2, BLOCK_SECTOR_SIZE);
+	check(_test_equal(buffers[1], disk_data + 10, 100));
+	check(_test_equal(buffers[2], disk_data + BLOCK_SECTOR_SIZE,
+			  BLOCK_SECTOR_SIZE));
+
+	aio_destroy(ring);
+}
+
+/* A direct write drops the cached pages it may make stale. */
+static void _test_write(void)
+{
+	struct aio_ring *ring = _test_setup();
+	struct aio_request *request;
+	uint32_t offset = PAGE_SIZE + 3 * BLOCK_SECTOR_SIZE;
+
+	memset(buffers[0], 0xa5, BLOCK_SECTOR_SIZE);
+
+	request = aio_get_request(ring);
+	request->opcode = AIO_WRITE;
+	request->node = &disk.node;
+	request->offset = offset;
+	request->buffer = buffers[0];
+	request->size = BLOCK_SECTOR_SIZE;
+
+	check(aio_submit(ring) == 1);
+	check(sync_calls == 1);
+	check(invalidated == PAGE_SIZE);
+
+	check(aio_wait(ring, 1) == 1);
+	_test_completion(ring, 0, BLOCK_SECTOR_SIZE);
+	check(_test_equal(disk_data + offset, buffers[0], BLOCK_SECTOR_SIZE));
+	check(writev_calls == 0);
+
+	aio_destroy(ring);
+}
+
+static void _test_errors(void)
+{
+	struct aio_ring *ring = _test_setup();
+	struct aio_request *request;
+
+	/* No file. */
+	_test_read(ring, 0, 0, 100, 0);
+
+	/* Unknown opcode. */
+	request = aio_get_request(ring);
+	request->opcode = 0x99;
+	request->node = &file;
+	request->user_data = 1;
+
+	/* A disk error. */
+	_test_read(ring, &disk.node, 0, BLOCK_SECTOR_SIZE, 2);
+
+	/* Past the end of the disk, so not direct, and short. */
+	_test_read(ring, &disk.node, DISK_SIZE - BLOCK_SECTOR_SIZE,
+		   2 * BLOCK_SECTOR_SIZE, 3);
+
+	disk_status = -1;
+	check(aio_submit(ring) == 4);
+	check(aio_wait(ring, 4) == 4);
+
+	_test_completion(ring, 0, -1);
+	_test_completion(ring, 1, -1);
+	_test_completion(ring, 3, BLOCK_SECTOR_SIZE);
+	_test_completion(ring, 2, -1);
+
+	/* Nothing more can arrive, so there is no waiting for it. */
+	check(aio_wait(ring, 1) == 0);
+
+	aio_destroy(ring);
+}
+
+/* Requests in flight hold their place on the completion queue, so no more are
+ * started until completions are consumed. */
+static void _test_full(void)
+{
+	struct aio_ring *ring = _test_setup();
+	uint32_t i;
+
+	for (i = 0; i < AIO_RING_SIZE; i++) {
+		_test_read(ring, &disk.node, i * BLOCK_SECTOR_SIZE,
+			   BLOCK_SECTOR_SIZE, i);
+	}
+	check(aio_get_request(ring) == 0);
+
+	check(aio_submit(ring) == AIO_RING_SIZE);
+	check(ring->in_flight == AIO_RING_SIZE);
+
+	_test_read(ring, &disk.node, 0, BLOCK_SECTOR_SIZE, 0);
+	check(aio_submit(ring) == 1);
+	check(queued_count == AIO_RING_SIZE);
+
+	/* The completion takes the room the request freed. */
+	_test_interrupt();
+	check(queued_count == AIO_RING_SIZE - 1);
+	check(aio_run(ring) == 0);
+	check(queued_count == AIO_RING_SIZE - 1);
+
+	_test_completion(ring, 0, BLOCK_SECTOR_SIZE);
+	check(aio_run(ring) == 0);
+	check(queued_count == AIO_RING_SIZE);
+
+	check(aio_wait(ring, AIO_RING_SIZE) == AIO_RING_SIZE);
+	for (i = 1; i < AIO_RING_SIZE; i++) {
+		_test_completion(ring, i, BLOCK_SECTOR_SIZE);
+	}
+
+	check(aio_wait(ring, 1) == 1);
+	_test_completion(ring, 0, BLOCK_SECTOR_SIZE);
+	check(ring->in_flight == 0);
+
+	aio_destroy(ring);
+}
+
+const struct test aio_tests[] = {
+	{ "aio/nop",    &_test_nop },
+	{ "aio/merge",  &_test_merge },
+	{ "aio/direct", &_test_direct },
+	{ "aio/order",  &_test_order },
+	{ "aio/write",  &_test_write },
+	{ "aio/errors", &_test_errors },
+	{ "aio/full",   &_test_full },
+	{ 0,            0 }
+};
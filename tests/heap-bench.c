@@ -0,0 +1,204 @@
+/* heap-bench - time the kernel heap on the host, and watch it fragment.
+ *
+ * Each trace picks one of a fixed number of slots at random, freeing the block
+ * in it if there is one and allocating a new one otherwise, so that about half
+ * of the slots are in use once it has warmed up. Traces differ in the sizes
+ * they ask for. For each, the report gives the time per operation and the
+ * state of the heap at the end, then the mixed trace is run again, sampling
+ * the heap as it goes.
+ *
+ * Usage: heap-bench [operations per trace] [seed]
+ */
+
+#include "heap-check.h"
+#include "host.h"
+#include "stubs.h"
+#include <lib/stdio.h>
+#include <mm/paging.h>
+
+#define SLOTS   4096
+#define SAMPLES 20
+
+/* The largest heap the arena can hold, after its index. */
+#define HEAP_MAX_SIZE							\
+	(ARENA_SIZE - PAGE_SIZE - sizeof(type_t) * HEAP_INDEX_SIZE)
+
+struct trace {
+	const char *name;
+	const char *description;
+	uint32_t (*size)(uint32_t random);
+	uint32_t page_align; /* One in how many requests is page aligned. */
+};
+
+static void *slots[SLOTS];
+static uint32_t sizes[SLOTS];
+
+/* Blocks in use, and the bytes asked for them. */
+static uint32_t live, requested;
+
+static uint32_t _small(uint32_t random)
+{
+	return 8 + random % 121;
+}
+
+static uint32_t _mixed(uint32_t random)
+{
+	uint32_t kind = random % 100;
+
+	random /= 100;
+	if (kind < 90) {
+		return 16 + random % 241;
+	} else if (kind < 99) {
+		return 256 + random % 3841;
+	} else {
+		return 4096 + random % 61441;
+	}
+}
+
+static uint32_t _large(uint32_t random)
+{
+	return 1024 + random % 31745;
+}
+
+static const struct trace traces[] = {
+	{ "small", "8-128 bytes",             &_small, 0 },
+	{ "mixed", "90% <256, 9% <4K, 1% <64K", &_mixed, 0 },
+	{ "large", "1-32K bytes",             &_large, 0 },
+	{ "align", "mixed, 1 in 8 aligned",   &_mixed, 8 },
+	{ 0,       0,                         0,       0 }
+};
+
+/* Run 'operations' steps of 'trace' on 'heap'. */
+static void _bench_run(struct heap *heap, const struct trace *trace,
+		       uint32_t operations)
+{
+	uint32_t i;
+
+	for (i = 0; i < operations; i++) {
+		uint32_t slot = host_random() % SLOTS;
+
+		if (slots[slot]) {
+			free(heap, slots[slot]);
+			slots[slot] = 0;
+			requested -= sizes[slot];
+			live--;
+		} else {
+			uint32_t random = host_random();
+			uint8_t align = trace->page_align &&
+				random % trace->page_align == 0;
+
+			sizes[slot] = trace->size(random >> 3);
+			slots[slot] = alloc(heap, sizes[slot], align);
+			if (!slots[slot]) {
+				printf("%s: out of memory after %u "
+				       "operations\n", trace->name, i);
+				host_exit(1);
+			}
+
+			requested += sizes[slot];
+			live++;
+		}
+	}
+}
+
+static struct heap *_bench_reset(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < SLOTS; i++) {
+		slots[i] = 0;
+	}
+	live = 0;
+	requested = 0;
+
+	return arena_heap_create(HEAP_MIN_SIZE, HEAP_MAX_SIZE);
+}
+
+/* Percentage of the free bytes outside of the largest hole. */
+static double _bench_fragmentation(struct heap_stats *stats)
+{
+	if (!stats->free) {
+		return 0;
+	}
+
+	return 100.0 * (stats->free - stats->largest_hole) / stats->free;
+}
+
+static void _bench_check(struct heap *heap, struct heap_stats *stats)
+{
+	if (heap_check(heap, stats)) {
+		host_exit(1);
+	}
+}
+
+static void _bench_throughput(uint32_t operations, uint32_t seed)
+{
+	const struct trace *trace;
+
+	printf("%-6s %-26s %9s %8s %8s %6s %7s\n", "trace", "sizes",
+	       "ns/op", "heap KB", "used KB", "holes", "frag %");
+
+	for (trace = traces; trace->name; trace++) {
+		struct heap *heap = _bench_reset();
+		struct heap_stats stats;
+		double start;
+
+		host_set_context(trace->name);
+		host_random_seed(seed);
+
+		start = host_seconds();
+		_bench_run(heap, trace, operations);
+		start = host_seconds() - start;
+
+		_bench_check(heap, &stats);
+		printf("%-6s %-26s %9.1f %8u %8u %6u %7.1f\n", trace->name,
+		       trace->description, start * 1e9 / operations,
+		       (heap->end_address - heap->start_address) / 1024,
+		       stats.used / 1024, stats.holes,
+		       _bench_fragmentation(&stats));
+	}
+}
+
+static void _bench_fragmentation_over_time(uint32_t operations, uint32_t seed)
+{
+	const struct trace *trace = &traces[1];
+	struct heap *heap = _bench_reset();
+	uint32_t i;
+
+	printf("\nFragmentation over time, %s trace:\n", trace->name);
+	printf("%10s %6s %8s %8s %8s %6s %8s %7s %7s\n", "operations", "live",
+	       "req KB", "heap KB", "free KB", "holes", "max hole", "frag %",
+	       "util %");
+
+	host_set_context("fragmentation");
+	host_random_seed(seed);
+
+	for (i = 1; i <= SAMPLES; i++) {
+		struct heap_stats stats;
+		uint32_t size;
+
+		_bench_run(heap, trace, operations / SAMPLES);
+		_bench_check(heap, &stats);
+		size = heap->end_address - heap->start_address;
+
+		printf("%10u %6u %8u %8u %8u %6u %8u %7.1f %7.1f\n",
+		       i * (operations / SAMPLES), live, requested / 1024,
+		       size / 1024, stats.free / 1024, stats.holes,
+		       stats.largest_hole, _bench_fragmentation(&stats),
+		       100.0 * requested / size);
+	}
+
+	printf("\n(frag %%: free bytes outside the largest hole;"
+	       " util %%: requested bytes over heap size)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t operations = argc > 1 ? host_atoi(argv[1]) : 200000;
+	uint32_t seed = argc > 2 ? host_atoi(argv[2]) : 1;
+
+	_bench_throughput(operations, seed);
+	_bench_fragmentation_over_time(operations, seed);
+
+	return 0;
+}
@@ -0,0 +1,86 @@
+#include "heap-check.h"
+
+#include <lib/stdio.h>
+
+static int _heap_check_fail(const char *problem, uint32_t address)
+{
+	printf("\nheap_check: %s at %x\n", problem, address);
+	return -1;
+}
+
+int heap_check(struct heap *heap, struct heap_stats *stats)
+{
+	struct heap_stats found = { 0, 0, 0, 0, 0 };
+	uint32_t address = heap->start_address;
+	uint32_t i, previous_hole = 0;
+
+	while (address < heap->end_address) {
+		struct header *header = (struct header *)address;
+		struct footer *footer;
+
+		if (header->id != HEADER_ID) {
+			return _heap_check_fail("bad header", address);
+		}
+
+		if (header->size < sizeof(struct header) + sizeof(struct footer)
+		    || header->size > heap->end_address - address) {
+			return _heap_check_fail("bad size", address);
+		}
+
+		footer = (struct footer *)(address + header->size
+					   - sizeof(struct footer));
+		if (footer->id != FOOTER_ID || footer->header != header) {
+			return _heap_check_fail("bad footer", address);
+		}
+
+		if (header->is_hole) {
+			if (previous_hole) {
+				return _heap_check_fail("adjacent holes",
+							address);
+			}
+
+			found.holes++;
+			found.free += header->size;
+			found.largest_hole = max(found.largest_hole,
+						 header->size);
+		} else {
+			found.blocks++;
+			found.used += header->size;
+		}
+
+		previous_hole = header->is_hole;
+		address += header->size;
+	}
+
+	if (address != heap->end_address) {
+		return _heap_check_fail("blocks overrun the end", address);
+	}
+
+	if (heap->index.size != found.holes) {
+		return _heap_check_fail("index size differs from holes",
+					heap->index.size);
+	}
+
+	for (i = 0; i < heap->index.size; i++) {
+		struct header *hole = (struct header *)heap->index.data[i];
+
+		if ((uint32_t)hole < heap->start_address
+		    || (uint32_t)hole >= heap->end_address
+		    || hole->id != HEADER_ID || !hole->is_hole) {
+			return _heap_check_fail("index entry is not a hole",
+						(uint32_t)hole);
+		}
+
+		if (i > 0 && ((struct header *)heap->index.data[i - 1])->size
+		    > hole->size) {
+			return _heap_check_fail("index out of order",
+						(uint32_t)hole);
+		}
+	}
+
+	if (stats) {
+		*stats = found;
+	}
+
+	return 0;
+}
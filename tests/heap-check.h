@@ -0,0 +1,23 @@
+#ifndef _HEAP_CHECK_H
+#define _HEAP_CHECK_H
+
+#include <kernel/types.h>
+#include <mm/heap.h>
+
+/* What a walk over a heap's blocks found. */
+struct heap_stats {
+	uint32_t blocks;       /* Blocks in use.                    */
+	uint32_t holes;        /* Free blocks.                      */
+	uint32_t used;         /* Bytes in blocks, with overheads.  */
+	uint32_t free;         /* Bytes in holes, with overheads.   */
+	uint32_t largest_hole; /* Size of the largest hole.         */
+};
+
+/* Walk every block of 'heap', checking that headers and footers are intact and
+ * agree, that they tile the heap exactly, that no two holes are adjacent, and
+ * that the index holds exactly the holes, smallest first. Returns 0 if so,
+ * filling in 'stats' if it is not null, or prints the first problem found and
+ * returns -1. */
+int heap_check(struct heap *heap, struct heap_stats *stats);
+
+#endif /* _HEAP_CHECK_H */
@@ -0,0 +1,344 @@
+#include "test.h"
+
+#include "heap-check.h"
+#include "host.h"
+#include "stubs.h"
+#include <mm/paging.h>
+
+#define OVERHEAD (sizeof(struct header) + sizeof(struct footer))
+#define MAX_BLOCKS 1024
+
+struct block {
+	uint8_t *address;
+	uint32_t size;
+	uint8_t pattern;
+};
+
+static struct block blocks[MAX_BLOCKS];
+
+/* Allocate block 'i', filled with a pattern of its own. */
+static int _test_alloc(struct heap *heap, uint32_t i, uint32_t size,
+		       uint8_t page_align)
+{
+	uint32_t j;
+
+	blocks[i].address = alloc(heap, size, page_align);
+	blocks[i].size = size;
+	blocks[i].pattern = (uint8_t)(i * 31 + size);
+
+	if (!blocks[i].address) {
+		return -1;
+	}
+
+	for (j = 0; j < size; j++) {
+		blocks[i].address[j] = blocks[i].pattern;
+	}
+
+	return 0;
+}
+
+/* Whether block 'i' still holds its pattern. */
+static int _test_intact(uint32_t i)
+{
+	uint32_t j;
+
+	for (j = 0; j < blocks[i].size; j++) {
+		if (blocks[i].address[j] != blocks[i].pattern) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void _test_free(struct heap *heap, uint32_t i)
+{
+	check(_test_intact(i));
+	free(heap, blocks[i].address);
+	blocks[i].address = 0;
+}
+
+/* Whether the heap is a single hole again, and holds its initial frames. */
+static int _test_empty(struct heap *heap, uint32_t size)
+{
+	struct heap_stats stats;
+
+	return heap_check(heap, &stats) == 0 && stats.blocks == 0
+		&& stats.holes == 1 && stats.free == size
+		&& heap->end_address - heap->start_address == size;
+}
+
+static void _test_create(void)
+{
+	struct heap *heap = arena_heap_create(HEAP_MIN_SIZE, HEAP_MIN_SIZE);
+
+	check(heap->end_address - heap->start_address == HEAP_MIN_SIZE);
+	check(_test_empty(heap, HEAP_MIN_SIZE));
+}
+
+static void _test_basic(void)
+{
+	struct heap *heap = arena_heap_create(HEAP_MIN_SIZE, HEAP_MIN_SIZE);
+	struct heap_stats stats;
+	uint32_t i;
+
+	for (i = 0; i < 3; i++) {
+		check(_test_alloc(heap, i, 100, 0) == 0);
+		check((uint32_t)blocks[i].address >= heap->start_address);
+		check((uint32_t)blocks[i].address + 100 <= heap->end_address);
+	}
+
+	check(heap_check(heap, &stats) == 0);
+	check(stats.blocks == 3 && stats.holes == 1);
+
+	for (i = 0; i < 3; i++) {
+		check(_test_intact(i));
+	}
+
+	/* Freeing a null pointer does nothing. */
+	free(heap, 0);
+	check(heap_check(heap, 0) == 0);
+
+	for (i = 0; i < 3; i++) {
+		_test_free(heap, i);
+	}
+
+	check(_test_empty(heap, HEAP_MIN_SIZE));
+}
+
+/* Blocks freed in every order must merge back into one hole. */
+static void _test_coalesce(void)
+{
+	static const uint32_t orders[][3] = {
+		{ 0, 1, 2 }, { 0, 2, 1 }, { 1, 0, 2 },
+		{ 1, 2, 0 }, { 2, 0, 1 }, { 2, 1, 0 }
+	};
+	struct heap *heap = arena_heap_create(HEAP_MIN_SIZE, HEAP_MIN_SIZE);
+	uint32_t i, j;
+
+	for (i = 0; i < sizeof(orders) / sizeof(orders[0]); i++) {
+		/* A fourth block keeps the others away from the heap's end. */
+		for (j = 0; j < 4; j++) {
+			check(_test_alloc(heap, j, 64 + j * 8, 0) == 0);
+		}
+
+		for (j = 0; j < 3; j++) {
+			_test_free(heap, orders[i][j]);
+			check(heap_check(heap, 0) == 0);
+		}
+
+		_test_free(heap, 3);
+		check(_test_empty(heap, HEAP_MIN_SIZE));
+	}
+}
+
+/* A freed block's hole is reused, and the smallest hole that fits is
+ * chosen. */
+static void _test_best_fit(void)
+{
+	static const uint32_t sizes[] = { 512, 64, 256, 64 };
+	struct heap *heap = arena_heap_create(HEAP_MIN_SIZE, HEAP_MIN_SIZE);
+	uint8_t *large, *small;
+	uint32_t i;
+
+	for (i = 0; i < 4; i++) {
+		check(_test_alloc(heap, i, sizes[i], 0) == 0);
+	}
+
+	large = blocks[0].address;
+	small = blocks[2].address;
+	_test_free(heap, 0);
+	_test_free(heap, 2);
+
+	check(_test_alloc(heap, 2, 200, 0) == 0);
+	check(blocks[2].address == small);
+	check(_test_alloc(heap, 0, 500, 0) == 0);
+	check(blocks[0].address == large);
+	check(heap_check(heap, 0) == 0);
+
+	for (i = 0; i < 4; i++) {
+		_test_free(heap, i);
+	}
+
+	check(_test_empty(heap, HEAP_MIN_SIZE));
+}
+
+/* A hole only just too big to split is handed out whole. */
+static void _test_exact_fit(void)
+{
+	struct heap *heap = arena_heap_create(HEAP_MIN_SIZE, HEAP_MIN_SIZE);
+	uint32_t extra;
+
+	for (extra = 0; extra < OVERHEAD + 8; extra++) {
+		check(_test_alloc(heap, 0, 256, 0) == 0);
+		check(_test_alloc(heap, 1, 16, 0) == 0);
+		_test_free(heap, 0);
+
+		check(_test_alloc(heap, 0, 256 - extra, 0) == 0);
+		check(heap_check(heap, 0) == 0);
+
+		_test_free(heap, 0);
+		_test_free(heap, 1);
+		check(_test_empty(heap, HEAP_MIN_SIZE));
+	}
+}
+
+/* Page aligned blocks after every offset into a page. */
+static void _test_page_align(void)
+{
+	struct heap *heap = arena_heap_create(HEAP_MIN_SIZE, HEAP_MIN_SIZE);
+	uint32_t offset;
+
+	for (offset = 0; offset < PAGE_SIZE + 64; offset += 4) {
+		check(_test_alloc(heap, 0, offset, 0) == 0);
+		check(_test_alloc(heap, 1, 100 + offset % 3, 1) == 0);
+		check(((uint32_t)blocks[1].address & PAGE_OFFSET_MASK) == 0);
+		check(_test_alloc(heap, 2, 8, 0) == 0);
+		check(heap_check(heap, 0) == 0);
+
+		_test_free(heap, 1);
+		_test_free(heap, 0);
+		_test_free(heap, 2);
+		check(_test_empty(heap, HEAP_MIN_SIZE));
+	}
+}
+
+/* Allocations past the end of the heap grow it, and freeing them shrinks it
+ * again, giving back the frames. */
+static void _test_expand(void)
+{
+	struct heap *heap = arena_heap_create(HEAP_MIN_SIZE,
+					      HEAP_MIN_SIZE * 8);
+	uint32_t frames = arena_frames;
+	uint32_t i;
+
+	for (i = 0; i < 16; i++) {
+		check(_test_alloc(heap, i, HEAP_MIN_SIZE / 4, 0) == 0);
+		check(heap_check(heap, 0) == 0);
+	}
+
+	check(heap->end_address - heap->start_address > HEAP_MIN_SIZE * 3);
+	check(arena_frames > frames);
+
+	for (i = 0; i < 16; i++) {
+		check(_test_intact(i));
+	}
+
+	for (i = 16; i > 0; i--) {
+		_test_free(heap, i - 1);
+		check(heap_check(heap, 0) == 0);
+	}
+
+	check(_test_empty(heap, HEAP_MIN_SIZE));
+	check(arena_frames == frames);
+}
+
+/* Growth when the block at the end of the heap is in use, rather than a hole
+ * that can be extended. */
+static void _test_expand_full(void)
+{
+	struct heap *heap = arena_heap_create(HEAP_MIN_SIZE,
+					      HEAP_MIN_SIZE * 4);
+
+	check(_test_alloc(heap, 0, HEAP_MIN_SIZE - OVERHEAD, 0) == 0);
+	check(heap_check(heap, 0) == 0);
+	check(_test_alloc(heap, 1, 1000, 0) == 0);
+	check(_test_alloc(heap, 2, 1000, 1) == 0);
+	check(((uint32_t)blocks[2].address & PAGE_OFFSET_MASK) == 0);
+	check(heap_check(heap, 0) == 0);
+
+	_test_free(heap, 0);
+	_test_free(heap, 2);
+	_test_free(heap, 1);
+	check(_test_empty(heap, HEAP_MIN_SIZE));
+}
+
+/* A request the heap cannot grow to fit fails, leaving the heap as it was. */
+static void _test_exhausted(void)
+{
+	struct heap *heap = arena_heap_create(HEAP_MIN_SIZE,
+					      HEAP_MIN_SIZE * 2);
+
+	check(_test_alloc(heap, 0, 1000, 0) == 0);
+	check(alloc(heap, HEAP_MIN_SIZE * 2, 0) == 0);
+	check(alloc(heap, 0xFFFFFFF0, 0) == 0);
+	check(heap_check(heap, 0) == 0);
+
+	_test_free(heap, 0);
+	check(_test_empty(heap, HEAP_MIN_SIZE));
+}
+
+static void _test_kmalloc(void)
+{
+	struct heap *heap = arena_heap_create(HEAP_MIN_SIZE, HEAP_MIN_SIZE);
+	uint32_t a, b, physical;
+
+	a = kmalloc(40);
+	b = kmalloc_ap(40, &physical);
+
+	check(a && b);
+	check((b & PAGE_OFFSET_MASK) == 0);
+	check(physical / PAGE_SIZE == get_page(b, NO_CREATE, 0)->frame);
+	check(heap_check(heap, 0) == 0);
+
+	kfree((void *)a);
+	kfree((void *)b);
+	check(_test_empty(heap, HEAP_MIN_SIZE));
+}
+
+/* Random allocations and frees, checking the whole heap and every block's
+ * contents as it goes. */
+static void _test_random(void)
+{
+	struct heap *heap = arena_heap_create(HEAP_MIN_SIZE,
+					      HEAP_MIN_SIZE * 16);
+	uint32_t step, i;
+
+	host_random_seed(49);
+	for (i = 0; i < MAX_BLOCKS; i++) {
+		blocks[i].address = 0;
+	}
+
+	for (step = 0; step < 20000; step++) {
+		i = host_random() % MAX_BLOCKS;
+
+		if (blocks[i].address) {
+			_test_free(heap, i);
+		} else {
+			uint32_t r = host_random();
+			uint32_t size = (r % 8 == 0) ? r % 16384 : r % 256;
+
+			check(_test_alloc(heap, i, size, r % 32 == 0) == 0);
+		}
+
+		if (step % 500 == 0) {
+			check(heap_check(heap, 0) == 0);
+			for (i = 0; i < MAX_BLOCKS; i++) {
+				check(!blocks[i].address || _test_intact(i));
+			}
+		}
+	}
+
+	for (i = 0; i < MAX_BLOCKS; i++) {
+		if (blocks[i].address) {
+			_test_free(heap, i);
+		}
+	}
+
+	check(_test_empty(heap, HEAP_MIN_SIZE));
+}
+
+const struct test heap_tests[] = {
+	{ "heap/create",      &_test_create },
+	{ "heap/basic",       &_test_basic },
+	{ "heap/coalesce",    &_test_coalesce },
+	{ "heap/best-fit",    &_test_best_fit },
+	{ "heap/exact-fit",   &_test_exact_fit },
+	{ "heap/page-align",  &_test_page_align },
+	{ "heap/expand",      &_test_expand },
+	{ "heap/expand-full", &_test_expand_full },
+	{ "heap/exhausted",   &_test_exhausted },
+	{ "heap/kmalloc",     &_test_kmalloc },
+	{ "heap/random",      &_test_random },
+	{ 0,                  0 }
+};
@@ -0,0 +1,109 @@
+/* The C library side of the tests. Everything else is built against the
+ * kernel's headers, so reaches the host only through the functions declared in
+ * host.h. */
+
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *context = "";
+static uint32_t random_state = 1;
+
+/* A fault is a heap touching memory it has not been given a frame for, or has
+ * given back, just as it would be in the kernel. */
+static void fault(int signal, siginfo_t *info, void *unused)
+{
+	(void)signal;
+	(void)unused;
+
+	fflush(stdout);
+	fprintf(stderr, "\nFAULT at %p in %s\n", info->si_addr, context);
+	_exit(2);
+}
+
+uint32_t host_map(uint32_t size)
+{
+	static int handling;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	void *address;
+
+#ifdef MAP_32BIT
+	if (sizeof(void *) > sizeof(uint32_t)) {
+		flags |= MAP_32BIT;
+	}
+#endif
+
+	address = mmap(0, size, PROT_NONE, flags, -1, 0);
+	if (address == MAP_FAILED || (uintptr_t)address + size > UINT32_MAX) {
+		fprintf(stderr, "unable to map %u bytes below 4GiB\n", size);
+		exit(1);
+	}
+
+	if (!handling) {
+		struct sigaction action;
+
+		memset(&action, 0, sizeof(action));
+		action.sa_sigaction = &fault;
+		action.sa_flags = SA_SIGINFO;
+		sigaction(SIGSEGV, &action, 0);
+		sigaction(SIGBUS, &action, 0);
+		handling = 1;
+	}
+
+	return (uint32_t)(uintptr_t)address;
+}
+
+void host_protect(uint32_t address, uint32_t size, int accessible)
+{
+	if (mprotect((void *)(uintptr_t)address, size,
+		     accessible ? PROT_READ | PROT_WRITE : PROT_NONE)) {
+		perror("mprotect");
+		exit(1);
+	}
+}
+
+double host_seconds(void)
+{
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/* xorshift32, so that traces are the same on every C library. */
+uint32_t host_random(void)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+
+	return random_state;
+}
+
+void host_random_seed(uint32_t seed)
+{
+	random_state = seed ? seed : 1;
+}
+
+uint32_t host_atoi(const char *string)
+{
+	return (uint32_t)strtoul(string, 0, 10);
+}
+
+void host_set_context(const char *name)
+{
+	context = name;
+}
+
+void host_exit(int status)
+{
+	fflush(stdout);
+	exit(status);
+}
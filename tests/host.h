@@ -0,0 +1,35 @@
+#ifndef _HOST_H
+#define _HOST_H
+
+#include <kernel/types.h>
+
+/* The C library, as seen from code built against the kernel's headers, which
+ * clash with the library's own. Implemented in host.c. printf() is the C
+ * library's, declared by <lib/stdio.h>. */
+
+/* Map 'size' bytes of inaccessible memory below 4GiB, so that addresses fit
+ * the kernel's uint32_t, and return its address. 'size' must be a multiple of
+ * PAGE_SIZE. Exits if the memory cannot be mapped. */
+uint32_t host_map(uint32_t size);
+
+/* Make the pages from 'address' for 'size' bytes readable and writable if
+ * 'accessible' is set, or fault on any access if not. */
+void host_protect(uint32_t address, uint32_t size, int accessible);
+
+/* Seconds since an arbitrary point, for timing. */
+double host_seconds(void);
+
+/* A pseudo-random number, repeatable from the seed given to
+ * host_random_seed(). */
+uint32_t host_random(void);
+void host_random_seed(uint32_t seed);
+
+/* The decimal number at the start of 'string'. */
+uint32_t host_atoi(const char *string);
+
+/* Name what is running, to be reported if it faults. */
+void host_set_context(const char *context);
+
+void host_exit(int status) __attribute__((noreturn));
+
+#endif /* _HOST_H */
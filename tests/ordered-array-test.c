@@ -0,0 +1,213 @@
+#include "test.h"
+
+#include "host.h"
+#include "stubs.h"
+#include <lib/ordered-array.h>
+
+#define ARRAY_SIZE 512
+
+static sint8_t _descending(type_t a, type_t b)
+{
+	return (a < b) ? 1 : 0;
+}
+
+/* Whether every element is ordered after the one before it. */
+static int _sorted(struct ordered_array *array)
+{
+	uint32_t i;
+
+	for (i = 1; i < array->size; i++) {
+		if (array->predicate(array->data[i - 1], array->data[i])) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void _test_insert(void)
+{
+	struct ordered_array array;
+	uint32_t i;
+
+	arena_heap_create(HEAP_MIN_SIZE, HEAP_MIN_SIZE);
+	array = ordered_array_new(ARRAY_SIZE, &default_predicate);
+	check(array.size == 0);
+
+	host_random_seed(1);
+	for (i = 0; i < ARRAY_SIZE; i++) {
+		ordered_array_insert(&array,
+				     (type_t)(host_random() % 1000 + 1));
+	}
+
+	check(array.size == ARRAY_SIZE);
+	check(_sorted(&array));
+
+	ordered_array_destroy(&array);
+}
+
+static void _test_duplicates(void)
+{
+	struct ordered_array array;
+	uint32_t i;
+
+	arena_heap_create(HEAP_MIN_SIZE, HEAP_MIN_SIZE);
+	array = ordered_array_new(16, &default_predicate);
+
+	for (i = 0; i < 16; i++) {
+		ordered_array_insert(&array, (type_t)(i % 2 + 1));
+	}
+
+	check(array.size == 16);
+	check(_sorted(&array));
+	check(ordered_array_lookup_index(&array, 7) == (type_t)1);
+	check(ordered_array_lookup_index(&array, 8) == (type_t)2);
+
+	ordered_array_destroy(&array);
+}
+
+static void _test_predicate(void)
+{
+	struct ordered_array array;
+	uint32_t i;
+
+	arena_heap_create(HEAP_MIN_SIZE, HEAP_MIN_SIZE);
+	array = ordered_array_new(ARRAY_SIZE, &_descending);
+
+	for (i = 1; i <= 100; i++) {
+		ordered_array_insert(&array, (type_t)i);
+	}
+
+	check(_sorted(&array));
+	check(ordered_array_lookup_index(&array, 0) == (type_t)100);
+	check(ordered_array_lookup_index(&array, 99) == (type_t)1);
+
+	ordered_array_destroy(&array);
+}
+
+static void _test_lookup(void)
+{
+	struct ordered_array array;
+
+	arena_heap_create(HEAP_MIN_SIZE, HEAP_MIN_SIZE);
+	array = ordered_array_new(4, &default_predicate);
+
+	check(ordered_array_lookup_index(&array, 0) == 0);
+
+	ordered_array_insert(&array, (type_t)3);
+	ordered_array_insert(&array, (type_t)1);
+	ordered_array_insert(&array, (type_t)2);
+
+	check(ordered_array_lookup_index(&array, 0) == (type_t)1);
+	check(ordered_array_lookup_index(&array, 1) == (type_t)2);
+	check(ordered_array_lookup_index(&array, 2) == (type_t)3);
+	check(ordered_array_lookup_index(&array, 3) == 0);
+
+	ordered_array_destroy(&array);
+}
+
+static void _test_remove(void)
+{
+	struct ordered_array array;
+	uint32_t i;
+
+	arena_heap_create(HEAP_MIN_SIZE, HEAP_MIN_SIZE);
+	array = ordered_array_new(8, &default_predicate);
+
+	for (i = 1; i <= 8; i++) {
+		ordered_array_insert(&array, (type_t)i);
+	}
+
+	/* Last, first, then middle. */
+	ordered_array_remove_index(&array, 7);
+	check(array.size == 7);
+	check(ordered_array_lookup_index(&array, 6) == (type_t)7);
+
+	ordered_array_remove_index(&array, 0);
+	check(array.size == 6);
+	check(ordered_array_lookup_index(&array, 0) == (type_t)2);
+
+	ordered_array_remove_index(&array, 2);
+	check(array.size == 5);
+	check(ordered_array_lookup_index(&array, 1) == (type_t)3);
+	check(ordered_array_lookup_index(&array, 2) == (type_t)5);
+	check(_sorted(&array));
+
+	/* Out of range is refused. */
+	ordered_array_remove_index(&array, 5);
+	check(array.size == 5);
+
+	while (array.size) {
+		ordered_array_remove_index(&array, 0);
+	}
+	ordered_array_remove_index(&array, 0);
+	check(array.size == 0);
+
+	ordered_array_destroy(&array);
+}
+
+/* Filling the array to its maximum must not write past it. */
+static void _test_full(void)
+{
+	struct ordered_array array;
+	type_t *guard;
+	uint32_t i;
+
+	arena_heap_create(HEAP_MIN_SIZE, HEAP_MIN_SIZE);
+	array = ordered_array_new(32, &default_predicate);
+	guard = kcreate(type_t, 1);
+	*guard = (type_t)0x5A5A5A5A;
+
+	for (i = 32; i > 0; i--) {
+		ordered_array_insert(&array, (type_t)i);
+	}
+
+	check(array.size == 32);
+	check(_sorted(&array));
+
+	for (i = 0; i < 32; i++) {
+		ordered_array_remove_index(&array, 0);
+	}
+
+	check(array.size == 0);
+	check(*guard == (type_t)0x5A5A5A5A);
+
+	ordered_array_destroy(&array);
+}
+
+static void _test_place(void)
+{
+	type_t *data;
+	struct ordered_array array;
+	uint32_t i;
+
+	arena_heap_create(HEAP_MIN_SIZE, HEAP_MIN_SIZE);
+	data = kcreate(type_t, 64);
+	for (i = 0; i < 64; i++) {
+		data[i] = (type_t)0xFF;
+	}
+
+	array = ordered_array_place(data, 64, &default_predicate);
+	check(array.data == data);
+	check(array.max_size == 64);
+
+	for (i = 0; i < 64; i++) {
+		check(data[i] == 0);
+	}
+
+	ordered_array_insert(&array, (type_t)2);
+	ordered_array_insert(&array, (type_t)1);
+	check(data[0] == (type_t)1);
+	check(data[1] == (type_t)2);
+}
+
+const struct test ordered_array_tests[] = {
+	{ "ordered-array/insert",     &_test_insert },
+	{ "ordered-array/duplicates", &_test_duplicates },
+	{ "ordered-array/predicate",  &_test_predicate },
+	{ "ordered-array/lookup",     &_test_lookup },
+	{ "ordered-array/remove",     &_test_remove },
+	{ "ordered-array/full",       &_test_full },
+	{ "ordered-array/place",      &_test_place },
+	{ 0,                          0 }
+};
@@ -0,0 +1,120 @@
+/* Stand-ins for the parts of the kernel that mm/heap.c, lib/ordered-array.c
+ * and lib/string.c need, so that they can run on the host. */
+
+#include "stubs.h"
+
+#include "host.h"
+#include <kernel/debug.h>
+#include <lib/stdio.h>
+#include <mm/paging.h>
+
+#define ARENA_PAGES (ARENA_SIZE / PAGE_SIZE)
+#define INDEX_BYTES (sizeof(type_t) * HEAP_INDEX_SIZE)
+
+/* These are defined in mm/heap.c. */
+extern uint32_t placement_address;
+extern struct heap *kernel_heap;
+
+struct page_directory *kernel_directory = 0;
+uint32_t debug_mask = 0;
+uint32_t arena_frames = 0;
+
+static uint32_t arena = 0;
+static struct page pages[ARENA_PAGES];
+
+void panic_assert(const char *file, uint32_t line, const char *expression)
+{
+	printf("\nASSERTION FAILED: %s at %s:%u\n", expression, file, line);
+	host_exit(1);
+}
+
+void panic_halt(const char *message, const char *file, uint32_t line)
+{
+	printf("\nPANIC: %s at %s:%u\n", message, file, line);
+	host_exit(1);
+}
+
+/* We don't want GCC complaining about unused parameters. */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+void debug_printf(int level, const char *file, int line, const char *function,
+		  const char *format, ...)
+{
+	/* debug_mask is zero, so nothing is logged. */
+}
+
+struct page *get_page(uint32_t address, enum create_page_e make,
+		      struct page_directory *page_directory)
+{
+	if (address < arena || address - arena >= ARENA_SIZE) {
+		printf("\nget_page(%x): outside of the arena\n", address);
+		host_exit(1);
+	}
+
+	return &pages[(address - arena) / PAGE_SIZE];
+}
+
+void alloc_frame(struct page *page, int is_kernel, int is_writeable)
+{
+	if (page->frame == 0) {
+		uint32_t index = page - pages;
+
+		host_protect(arena + index * PAGE_SIZE, PAGE_SIZE, 1);
+		page->present = 1;
+		page->rw = (is_writeable) ? 1 : 0;
+		page->user = (is_kernel) ? 0 : 1;
+		page->frame = index + 1;
+		arena_frames++;
+	}
+}
+
+#pragma GCC diagnostic pop /* ignored "-Wunused-parameter" */
+
+void free_frame(struct page *page)
+{
+	if (page->frame) {
+		host_protect(arena + (page->frame - 1) * PAGE_SIZE, PAGE_SIZE, 0);
+		page->frame = 0;
+		page->present = 0;
+		arena_frames--;
+	}
+}
+
+/* The arena starts with a page for placement allocations, the heap's own
+ * structure among them, followed by the heap's index and then its blocks. */
+struct heap *arena_heap_create(uint32_t size, uint32_t max_size)
+{
+	uint32_t start, i;
+	struct heap *heap;
+
+	if (!arena) {
+		arena = host_map(ARENA_SIZE);
+	}
+
+	if (PAGE_SIZE + INDEX_BYTES + max_size > ARENA_SIZE) {
+		printf("\nA heap of %u bytes does not fit the arena\n",
+		       max_size);
+		host_exit(1);
+	}
+
+	for (i = 0; i < ARENA_PAGES; i++) {
+		free_frame(&pages[i]);
+	}
+
+	kernel_heap = 0;
+	placement_address = arena;
+	start = arena + PAGE_SIZE;
+
+	/* The heap expects its initial pages to be present already, as
+	 * init_paging() arranges for the kernel heap. */
+	for (i = arena; i < start + INDEX_BYTES + size; i += PAGE_SIZE) {
+		alloc_frame(get_page(i, CREATE_PAGE, kernel_directory), 1, 1);
+	}
+
+	heap = heap_create(start, start + INDEX_BYTES + size,
+			   start + INDEX_BYTES + max_size, 0, 0);
+	kernel_heap = heap;
+
+	return heap;
+}
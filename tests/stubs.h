@@ -0,0 +1,22 @@
+#ifndef _STUBS_H
+#define _STUBS_H
+
+#include <kernel/types.h>
+#include <mm/heap.h>
+
+/* Paging for heaps on the host. The pages a heap claims come from an arena of
+ * host memory, which faults wherever the heap has not been given a frame, just
+ * as unmapped memory does in the kernel. */
+
+/* The most memory a heap can be given, including its index. */
+#define ARENA_SIZE 0x4000000
+
+/* Frames given out by alloc_frame() and not yet freed. */
+extern uint32_t arena_frames;
+
+/* Throw away the arena's heap, if there is one, and create a new one of 'size'
+ * bytes that can grow to 'max_size' bytes, neither counting its index. It also
+ * becomes kernel_heap, for kmalloc(). */
+struct heap *arena_heap_create(uint32_t size, uint32_t max_size);
+
+#endif /* _STUBS_H */
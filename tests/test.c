@@ -0,0 +1,90 @@
+/* test - run the kernel's heap, ordered array and AIO tests on the host.
+ *
+ * Usage: test [name ...]
+ *
+ * Runs every test, or only those whose names begin with one of the given
+ * names, and exits non-zero if any failed.
+ */
+
+#include "test.h"
+
+#include "host.h"
+#include <lib/stdio.h>
+
+static const struct test *suites[] = {
+	ordered_array_tests,
+	heap_tests,
+	aio_tests,
+	0
+};
+
+static uint32_t failures;
+
+void test_failed(const char *file, uint32_t line, const char *expression)
+{
+	printf("\n    %s:%u: check failed: %s", file, line, expression);
+	failures++;
+}
+
+/* Whether 'name' begins with 'prefix'. */
+static int _test_match(const char *name, const char *prefix)
+{
+	while (*prefix) {
+		if (*name++ != *prefix++) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int _test_selected(const char *name, int argc, char *argv[])
+{
+	int i;
+
+	if (argc < 2) {
+		return 1;
+	}
+
+	for (i = 1; i < argc; i++) {
+		if (_test_match(name, argv[i])) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct test **suite, *test;
+	uint32_t run = 0, failed = 0;
+	double start = host_seconds();
+
+	for (suite = suites; *suite; suite++) {
+		for (test = *suite; test->name; test++) {
+			uint32_t before = failures;
+
+			if (!_test_selected(test->name, argc, argv)) {
+				continue;
+			}
+
+			printf("  %-40s", test->name);
+			host_set_context(test->name);
+			test->run();
+			run++;
+
+			if (failures == before) {
+				printf("ok\n");
+			} else {
+				printf("\n  %-40sFAILED\n", test->name);
+				failed++;
+			}
+		}
+	}
+
+	printf("%u tests, %u failed, %.2f s\n", run, failed,
+	       host_seconds() - start);
+
+	return failed != 0;
+}
@@ -0,0 +1,23 @@
+#ifndef _TEST_H
+#define _TEST_H
+
+#include <kernel/types.h>
+
+/* A test is a function that check()s what it expects. A failed check is
+ * reported and counted against the test, which carries on. */
+struct test {
+	const char *name;
+	void (*run)(void);
+};
+
+/* The tests of each file, ending with a null name. */
+extern const struct test heap_tests[];
+extern const struct test ordered_array_tests[];
+extern const struct test aio_tests[];
+
+#define check(expression) ((expression) ?				\
+			   (void)0 : test_failed(__FILE__, __LINE__, #expression))
+
+void test_failed(const char *file, uint32_t line, const char *expression);
+
+#endif /* _TEST_H */
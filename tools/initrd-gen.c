@@ -1,43 +1,283 @@
+/* For strdup(). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <malloc.h>
-
-/* Kernel source prototypes. */
-#define HEADER_ID    0xCC
-#define HEADER_COUNT 64
-#define FILENAME_LEN 128
-
-struct initrd_file_header {
-  char          name[FILENAME_LEN];
-  unsigned char id;
-  unsigned int  offset;
-  unsigned int  size;
+
+/* Kernel source prototypes, see include/fs/initrd.h. */
+#define INITRD_MAGIC      0x44524E49
+#define INITRD_VERSION    2
+#define INITRD_DATA_ALIGN 0x1000
+#define INITRD_FILE       0x01
+#define INITRD_DIRECTORY  0x02
+#define INITRD_LZ4        0x10
+#define FILENAME_LEN      254
+
+struct initrd_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t entry_count;
+  uint32_t entries_offset;
+  uint32_t strings_offset;
+  uint32_t strings_size;
+  uint32_t data_offset;
+  uint32_t reserved;
+} __attribute__((packed));
+
+struct initrd_entry {
+  uint64_t offset;
+  uint64_t size;
+  uint32_t name;
+  uint32_t name_hash;
+  uint32_t parent;
+  uint32_t first_child;
+  uint32_t child_count;
+  uint32_t flags;
+  uint32_t checksum;
+  uint32_t stored_size;
+} __attribute__((packed));
+
+/* A node in the in-memory tree built from the command line. */
+struct node {
+  char          *name;
+  char          *path;     /* Local file path, or NULL for directories. */
+  int           is_dir;
+  struct node   *parent;
+  struct node   **children;
+  int           child_count;
+  uint32_t      index;     /* Position in the entry table. */
 };
 
+#define align(n, a) (((n) + (a) - 1) & ~((uint64_t)(a) - 1))
+
 static void usage(FILE *stream)
 {
-  fprintf(stream, "Usage: intrd-gen: <image> [<path name> ...]\n");
+  fprintf(stream, "Usage: intrd-gen: [--lz4] <image> [<path name> ...]\n");
   fprintf(stream, "\n");
   fprintf(stream, "Generate an init ramdisk <image> containing a list of files from arguments\n");
   fprintf(stream, "passed as as <path name> couplets, where <path> is the local file path, and\n");
-  fprintf(stream, "<name> specifies the name of the file in the initrd. For example:\n");
+  fprintf(stream, "<name> specifies the name of the file in the initrd. Names may contain '/'\n");
+  fprintf(stream, "separators, in which case the parent directories are created. For example:\n");
   fprintf(stream, "\n");
-  fprintf(stream, "  $ initrd-gen initrd.img ~/foo foo ~/bar bar\n");
+  fprintf(stream, "  $ initrd-gen initrd.img ~/foo foo ~/bar etc/bar\n");
   fprintf(stream, "\n");
   fprintf(stream, "This generates a file initrd.img which is a ramdisk containing the files\n");
-  fprintf(stream, "~/foo and ~/bar, with the respective filenames 'foo' and 'bar'.\n");
+  fprintf(stream, "~/foo and ~/bar, with the respective paths '/foo' and '/etc/bar'. Empty\n");
+  fprintf(stream, "'/dev', '/tmp' and '/mnt' directories are always created.\n");
+  fprintf(stream, "\n");
+  fprintf(stream, "With --lz4, each file is stored as an LZ4 block if that makes it smaller.\n");
   fprintf(stream, "\n");
   fprintf(stream, "It is possible to generate an initrd with no input files.\n");
 }
 
+/* Must match strhash() in lib/string.c. */
+static uint32_t strhash(const char *s)
+{
+  uint32_t hash = 0x811C9DC5;
+
+  while (*s) {
+    hash ^= (unsigned char)*s++;
+    hash *= 0x01000193;
+  }
+
+  return hash;
+}
+
+static uint32_t adler32(const unsigned char *data, size_t length)
+{
+  uint32_t a = 1, b = 0;
+  size_t i;
+
+  for (i = 0; i < length; i++) {
+    a = (a + data[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+
+  return (b << 16) | a;
+}
+
+/* LZ4 block format parameters, see fs/lz4.c. */
+#define LZ4_MIN_MATCH  4
+#define LZ4_MFLIMIT    12   /* A match may not start in the last 12 bytes. */
+#define LZ4_LASTLITERALS 5  /* The last 5 bytes are always literals. */
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS  16
+
+#define lz4_bound(n) ((n) + ((n) / 255) + 16)
+
+static uint32_t read32(const unsigned char *p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static unsigned char *lz4_write_length(unsigned char *op, size_t length)
+{
+  while (length >= 255) {
+    *op++ = 255;
+    length -= 255;
+  }
+  *op++ = (unsigned char)length;
+
+  return op;
+}
+
+/* Emit one sequence. A match_length of zero emits only literals. */
+static unsigned char *lz4_sequence(unsigned char *op, const unsigned char *literals,
+                                   size_t literal_length, size_t offset,
+                                   size_t match_length)
+{
+  unsigned char *token = op++;
+
+  *token = (literal_length >= 15 ? 15 : literal_length) << 4;
+  if (literal_length >= 15) {
+    op = lz4_write_length(op, literal_length - 15);
+  }
+
+  memcpy(op, literals, literal_length);
+  op += literal_length;
+
+  if (match_length) {
+    match_length -= LZ4_MIN_MATCH;
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+    *token |= (match_length >= 15 ? 15 : match_length);
+    if (match_length >= 15) {
+      op = lz4_write_length(op, match_length - 15);
+    }
+  }
+
+  return op;
+}
+
+/* Greedy single-pass LZ4 block compressor. 'dst' must hold lz4_bound(n) bytes.
+ * Returns the compressed size. */
+static size_t lz4_compress(const unsigned char *src, size_t n, unsigned char *dst)
+{
+  static int64_t table[1 << LZ4_HASH_BITS];
+  unsigned char *op = dst;
+  size_t ip = 0, anchor = 0;
+
+  memset(table, 0xFF, sizeof(table));
+
+  while (n >= LZ4_MFLIMIT + 1 && ip + LZ4_MFLIMIT < n) {
+    uint32_t sequence = read32(src + ip);
+    uint32_t hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+    int64_t ref = table[hash];
+
+    table[hash] = ip;
+
+    if (ref >= 0 && ip - ref <= LZ4_MAX_OFFSET && read32(src + ref) == sequence) {
+      size_t length = LZ4_MIN_MATCH;
+
+      while (ip + length < n - LZ4_LASTLITERALS && src[ref + length] == src[ip + length]) {
+        length++;
+      }
+
+      op = lz4_sequence(op, src + anchor, ip - anchor, ip - ref, length);
+      ip += length;
+      anchor = ip;
+    } else {
+      ip++;
+    }
+  }
+
+  op = lz4_sequence(op, src + anchor, n - anchor, 0, 0);
+
+  return op - dst;
+}
+
+static struct node *node_new(const char *name, struct node *parent, int is_dir)
+{
+  struct node *node = calloc(1, sizeof(struct node));
+
+  node->name = strdup(name);
+  node->is_dir = is_dir;
+  node->parent = parent;
+
+  if (parent) {
+    parent->children = realloc(parent->children,
+                               sizeof(struct node *) * (parent->child_count + 1));
+    parent->children[parent->child_count++] = node;
+  }
+
+  return node;
+}
+
+static struct node *node_child(struct node *dir, const char *name)
+{
+  int i;
+
+  for (i = 0; i < dir->child_count; i++) {
+    if (!strcmp(dir->children[i]->name, name)) {
+      return dir->children[i];
+    }
+  }
+
+  return NULL;
+}
+
+/* Insert the file at 'path' into the tree under 'name', creating parent
+ * directories as required. Returns nonzero on error. */
+static int node_insert(struct node *root, char *path, const char *name)
+{
+  char *copy = strdup(name);
+  char *component = strtok(copy, "/");
+  struct node *dir = root;
+
+  while (component) {
+    char *next = strtok(NULL, "/");
+    struct node *child = node_child(dir, component);
+
+    if (strlen(component) > FILENAME_LEN) {
+      fprintf(stderr, "initrd-gen: file name exceeds initrd max file length, %d.\n", FILENAME_LEN);
+      return 1;
+    }
+
+    if (next) {
+      if (!child) {
+        child = node_new(component, dir, 1);
+      } else if (!child->is_dir) {
+        fprintf(stderr, "initrd-gen: '%s' is not a directory: '%s'\n", component, name);
+        return 1;
+      }
+      dir = child;
+    } else if (child) {
+      fprintf(stderr, "initrd-gen: duplicate file name: '%s'\n", name);
+      return 1;
+    } else {
+      node_new(component, dir, 0)->path = path;
+    }
+
+    component = next;
+  }
+
+  free(copy);
+  return 0;
+}
+
+static int node_compare(const void *a, const void *b)
+{
+  return strcmp((*(struct node **)a)->name, (*(struct node **)b)->name);
+}
+
 int main(int argc, char **argv)
 {
-  struct initrd_file_header headers[HEADER_COUNT];
-  int headers_count;
+  struct initrd_header header;
+  struct initrd_entry *entries;
+  struct node **order;
+  struct node *root;
   char *output_file;
-  unsigned int offset;
+  char *strings;
+  unsigned char **data;
+  uint32_t entry_count, strings_size, head, tail;
+  uint64_t offset;
   FILE *write_stream;
-  unsigned char *data;
+  int compress = 0;
   int i;
 
   for (i = 1; i < argc; i++) {
@@ -47,48 +287,137 @@ int main(int argc, char **argv)
     }
   }
 
-  if (argc < 2) {
-    usage(stderr);
-  } else if ((argc % 2) || (argc > (2 * HEADER_COUNT) + 2)) {
-    /* Arg count doesn't match <path name> couplet, or is a greater number than
-     * the number of file headers in ramdisk. */
+  if (argc > 1 && !strcmp(argv[1], "--lz4")) {
+    compress = 1;
+    argv++;
+    argc--;
+  }
+
+  if (argc < 2 || (argc % 2)) {
+    /* Arg count doesn't match <path name> couplet. */
     usage(stderr);
+    return 1;
   }
 
   output_file = argv[1];
-  headers_count = (argc - 2) / 2;
-
   printf("INITRD-GEN  %s\n", output_file);
-  offset = sizeof(struct initrd_file_header) * HEADER_COUNT + sizeof(int);
 
-  for(i = 0; i < headers_count; i++) {
-    char *path = argv[(2 * i) + 2];
-    char *name = argv[(2 * i) + 3];
-    struct initrd_file_header *header = &headers[i];
-    FILE *stream;
+  /* Build the directory tree. */
+  root = node_new("", NULL, 1);
+  node_new("dev", root, 1);
+  node_new("tmp", root, 1);
+  node_new("mnt", root, 1);
 
-    if (strlen(path) > FILENAME_LEN) {
-      fprintf(stderr, "initrd-gen: file name exceeds initrd max file length, %d.\n", FILENAME_LEN);
+  for (i = 2; i < argc; i += 2) {
+    if (node_insert(root, argv[i], argv[i + 1])) {
       return 1;
     }
+  }
 
-    strcpy(header->name, name);
-    header->offset = offset;
+  /* Lay out the entries breadth first, so that the children of each directory
+   * are contiguous, and sort each set of children by name. */
+  order = malloc(sizeof(struct node *));
+  order[0] = root;
+  strings_size = 1; /* The root's empty name. */
+  for (head = 0, tail = 1; head < tail; head++) {
+    struct node *dir = order[head];
 
-    stream = fopen(path, "r");
-    if(!stream) {
-      fprintf(stderr, "initrd-gen: file not found: '%s'\n", path);
-      return 1;
+    dir->index = head;
+    if (!dir->is_dir) {
+      continue;
     }
 
-    fseek(stream, 0, SEEK_END);
-    header->size = ftell(stream);
+    qsort(dir->children, dir->child_count, sizeof(struct node *), node_compare);
+    order = realloc(order, sizeof(struct node *) * (tail + dir->child_count));
 
-    offset += header->size;
-    fclose(stream);
-    header->id = HEADER_ID;
+    for (i = 0; i < dir->child_count; i++) {
+      order[tail++] = dir->children[i];
+      strings_size += strlen(dir->children[i]->name) + 1;
+    }
+  }
+  entry_count = tail;
+
+  /* Build the entry and string tables. */
+  entries = calloc(entry_count, sizeof(struct initrd_entry));
+  data = calloc(entry_count, sizeof(unsigned char *));
+  strings = calloc(1, strings_size);
+
+  memset(&header, 0, sizeof(header));
+  header.magic = INITRD_MAGIC;
+  header.version = INITRD_VERSION;
+  header.entry_count = entry_count;
+  header.entries_offset = sizeof(struct initrd_header);
+  header.strings_offset = header.entries_offset + entry_count * sizeof(struct initrd_entry);
+  header.strings_size = strings_size;
+  header.data_offset = align(header.strings_offset + strings_size, INITRD_DATA_ALIGN);
+
+  offset = header.data_offset;
+  strings_size = 1;
+
+  for (head = 0; head < entry_count; head++) {
+    struct node *node = order[head];
+    struct initrd_entry *entry = &entries[head];
+
+    if (head) {
+      entry->name = strings_size;
+      strcpy(&strings[strings_size], node->name);
+      strings_size += strlen(node->name) + 1;
+    }
 
-    printf("\t0x%x\t%s\t%d\t%s\n", offset, name, header->size, path);
+    entry->name_hash = strhash(node->name);
+    entry->parent = node->parent ? node->parent->index : 0;
+
+    if (node->is_dir) {
+      entry->flags = INITRD_DIRECTORY;
+      entry->first_child = node->child_count ? node->children[0]->index : 0;
+      entry->child_count = node->child_count;
+    } else {
+      FILE *stream = fopen(node->path, "r");
+      unsigned char *packed;
+      size_t packed_size;
+
+      if (!stream) {
+        fprintf(stderr, "initrd-gen: file not found: '%s'\n", node->path);
+        return 1;
+      }
+
+      fseek(stream, 0, SEEK_END);
+      entry->flags = INITRD_FILE;
+      entry->size = ftell(stream);
+      entry->offset = offset;
+      fseek(stream, 0, SEEK_SET);
+
+      data[head] = malloc(entry->size + 1);
+      if (fread(data[head], 1, entry->size, stream) != entry->size) {
+        fprintf(stderr, "initrd-gen: unable to read file: '%s'.\n", node->path);
+        return 1;
+      }
+      fclose(stream);
+
+      entry->checksum = adler32(data[head], entry->size);
+      entry->stored_size = entry->size;
+
+      /* Keep the compressed data only if it is smaller. Files which are
+       * already compressed are stored raw. */
+      if (compress && entry->size) {
+        packed = malloc(lz4_bound(entry->size));
+        packed_size = lz4_compress(data[head], entry->size, packed);
+
+        if (packed_size < entry->size) {
+          free(data[head]);
+          data[head] = packed;
+          entry->stored_size = packed_size;
+          entry->flags |= INITRD_LZ4;
+        } else {
+          free(packed);
+        }
+      }
+
+      printf("\t0x%llx\t%s\t%llu\t%u\t%s\n", (unsigned long long)offset, node->name,
+             (unsigned long long)entry->size, entry->stored_size, node->path);
+
+      offset = align(offset + entry->stored_size, INITRD_DATA_ALIGN);
+    }
   }
 
   write_stream = fopen(output_file, "w");
@@ -97,32 +426,34 @@ int main(int argc, char **argv)
     return 1;
   }
 
-  data = (unsigned char *)malloc(offset);
-  fwrite(&headers_count, sizeof(int), 1, write_stream);
-  fwrite(headers, sizeof(struct initrd_file_header), HEADER_COUNT, write_stream);
-
-  for(i = 0; i < headers_count; i++) {
-    char *path = argv[(2 * i) + 2];
-    unsigned char *buffer = (unsigned char *)malloc(headers[i].size);
-    FILE *stream = fopen(path, "r");
+  for (head = 0; head < entry_count; head++) {
+    struct initrd_entry *entry = &entries[head];
 
-    if(!stream) {
-      fprintf(stderr, "initrd-gen: unable to read file: '%s'.\n", path);
-      return 1;
+    if ((entry->flags & 0x0F) != INITRD_FILE) {
+      continue;
     }
 
-    fread(buffer, 1, headers[i].size, stream);
-    fwrite(buffer, 1, headers[i].size, write_stream);
-    fclose(stream);
-    free(buffer);
+    /* Each file begins on a page boundary, and the gaps are zero filled. */
+    fseek(write_stream, entry->offset, SEEK_SET);
+    fwrite(data[head], 1, entry->stored_size, write_stream);
+    free(data[head]);
   }
 
+  fseek(write_stream, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, write_stream);
+  fwrite(entries, sizeof(struct initrd_entry), entry_count, write_stream);
+  fwrite(strings, 1, header.strings_size, write_stream);
+
+  /* Pad the image to a whole number of pages. */
+  fseek(write_stream, offset - 1, SEEK_SET);
+  fputc(0, write_stream);
+
   fclose(write_stream);
-  free(data);
 
   printf("\n\t/ ");
-  for (i = 0; i < headers_count; i++) {
-    printf("/%s ", argv[(2 * i) + 3]);
+  for (head = 1; head < entry_count; head++) {
+    printf("%s%s ", strings + entries[head].name,
+           (entries[head].flags == INITRD_DIRECTORY) ? "/" : "");
   }
   printf("\n");
 
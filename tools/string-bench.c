@@ -0,0 +1,215 @@
+/* string-bench - check and time the kernel's memory routines on the host.
+ *
+ * lib/string.c is compiled with its functions renamed to kernel_*(), and
+ * linked against this file. memcpy(), memmove(), memset() and strlen() are
+ * first checked at every size up to 256 bytes and every alignment of source
+ * and destination, then the first three are timed against byte at a time
+ * loops across a range of sizes and alignments.
+ *
+ * Usage: string-bench [megabytes per measurement]
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+unsigned char *kernel_memcpy(unsigned char *destination,
+			     const unsigned char *source, unsigned int length);
+unsigned char *kernel_memmove(unsigned char *destination,
+			      const unsigned char *source, unsigned int length);
+unsigned char *kernel_memset(unsigned char *destination, unsigned char value,
+			     unsigned int length);
+unsigned int kernel_strlen(const char *string);
+
+#define BUFFER_SIZE  (1024 * 1024 + 64)
+#define CHECK_SIZE   256
+#define ALIGNMENTS   4
+
+static unsigned char *source, *destination, *expected;
+
+/* The byte loops the kernel used before. */
+static unsigned char *byte_memcpy(unsigned char *destination,
+				  const unsigned char *source,
+				  unsigned int length)
+{
+	unsigned char *d = destination;
+
+	while (length--) {
+		*d++ = *source++;
+	}
+
+	return destination;
+}
+
+static unsigned char *byte_memset(unsigned char *destination,
+				  unsigned char value, unsigned int length)
+{
+	unsigned char *d = destination;
+
+	while (length--) {
+		*d++ = value;
+	}
+
+	return destination;
+}
+
+static void fill(unsigned char *buffer, unsigned int length, unsigned int seed)
+{
+	unsigned int i;
+
+	for (i = 0; i < length; i++) {
+		buffer[i] = (unsigned char)(i * 7 + seed);
+	}
+}
+
+static int check(void)
+{
+	unsigned int length, s, d, failures = 0;
+	int shift;
+
+	for (length = 0; length <= CHECK_SIZE; length++) {
+		for (s = 0; s < ALIGNMENTS; s++) {
+			for (d = 0; d < ALIGNMENTS; d++) {
+				fill(source, CHECK_SIZE + 16, length);
+				fill(destination, CHECK_SIZE + 16, ~length);
+				memcpy(expected, destination, CHECK_SIZE + 16);
+				memcpy(expected + d, source + s, length);
+				kernel_memcpy(destination + d, source + s,
+					      length);
+				if (memcmp(destination, expected,
+					   CHECK_SIZE + 16)) {
+					printf("memcpy: length %u, source +%u,"
+					       " destination +%u\n", length,
+					       s, d);
+					failures++;
+				}
+
+				fill(destination, CHECK_SIZE + 16, length);
+				memcpy(expected, destination, CHECK_SIZE + 16);
+				memset(expected + d, 0xA5 ^ s, length);
+				kernel_memset(destination + d, 0xA5 ^ s,
+					      length);
+				if (memcmp(destination, expected,
+					   CHECK_SIZE + 16)) {
+					printf("memset: length %u, value %u,"
+					       " destination +%u\n", length,
+					       0xA5 ^ s, d);
+					failures++;
+				}
+			}
+		}
+
+		/* Overlapping moves in both directions. */
+		for (shift = -9; shift <= 9; shift++) {
+			unsigned char *base = destination + 32;
+
+			fill(destination, CHECK_SIZE + 64, length);
+			memcpy(expected, destination, CHECK_SIZE + 64);
+			memmove(expected + 32 + shift, expected + 32, length);
+			kernel_memmove(base + shift, base, length);
+			if (memcmp(destination, expected, CHECK_SIZE + 64)) {
+				printf("memmove: length %u, shift %d\n",
+				       length, shift);
+				failures++;
+			}
+		}
+
+		for (s = 0; s < ALIGNMENTS; s++) {
+			memset(source, 'x', CHECK_SIZE + 16);
+			source[s + length] = '\0';
+			if (kernel_strlen((char *)source + s) != length) {
+				printf("strlen: length %u, +%u\n", length, s);
+				failures++;
+			}
+		}
+	}
+
+	return failures;
+}
+
+static double now(void)
+{
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/* Megabytes per second copying 'length' bytes repeatedly until 'total' bytes
+ * have been moved. */
+static double rate(int function, unsigned int length, unsigned int s,
+		   unsigned int d, double total)
+{
+	unsigned int i, rounds = total / length;
+	double start = now();
+
+	for (i = 0; i < rounds; i++) {
+		switch (function) {
+		case 0:
+			byte_memcpy(destination + d, source + s, length);
+			break;
+		case 1:
+			kernel_memcpy(destination + d, source + s, length);
+			break;
+		case 2:
+			byte_memset(destination + d, (unsigned char)i, length);
+			break;
+		case 3:
+			kernel_memset(destination + d, (unsigned char)i,
+				      length);
+			break;
+		case 4:
+			kernel_memmove(destination + d, destination + d + 1,
+				       length);
+			break;
+		}
+	}
+
+	return (double)rounds * length / (now() - start) / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+	static const unsigned int sizes[] = {
+		8, 16, 64, 256, 1024, 4096, 65536, 1024 * 1024
+	};
+	static const unsigned int offsets[][2] = {
+		{ 0, 0 }, { 1, 0 }, { 0, 3 }, { 1, 2 }
+	};
+	double total = (argc > 1 ? atof(argv[1]) : 256) * 1e6;
+	unsigned int i, j, failures;
+
+	source = malloc(BUFFER_SIZE);
+	destination = malloc(BUFFER_SIZE);
+	expected = malloc(BUFFER_SIZE);
+	if (!source || !destination || !expected) {
+		return 1;
+	}
+
+	failures = check();
+	printf("check: %u failures\n\n", failures);
+
+	fill(source, BUFFER_SIZE, 0);
+	printf("%8s %9s %12s %12s %12s %12s %12s\n", "size", "src/dst",
+	       "byte memcpy", "memcpy", "byte memset", "memset",
+	       "memmove");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for (j = 0; j < sizeof(offsets) / sizeof(offsets[0]); j++) {
+			unsigned int s = offsets[j][0], d = offsets[j][1];
+
+			printf("%8u %5u/%-3u %12.0f %12.0f %12.0f %12.0f "
+			       "%12.0f\n", sizes[i], s, d,
+			       rate(0, sizes[i], s, d, total),
+			       rate(1, sizes[i], s, d, total),
+			       rate(2, sizes[i], s, d, total),
+			       rate(3, sizes[i], s, d, total),
+			       rate(4, sizes[i], s, d, total));
+		}
+	}
+	printf("\n(MB/s)\n");
+
+	return failures != 0;
+}